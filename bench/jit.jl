@@ -0,0 +1,88 @@
+#| bench/jit.jl -- timing compiled code with and without native code
+
+   Run from the top of the build tree with:
+
+	./test --batch bench/jit.jl
+
+   Each benchmark is run three times with the byte-code interpreter and
+   then three times with hot functions translated to native code (see
+   set-bytecode-jit), printing the best time of each in milliseconds. |#
+
+(define-structure bench.jit ()
+
+    (open rep
+	  rep.system
+	  rep.vm.compiler
+	  rep.vm.interpreter)
+
+  (define (sum-multiples n)
+    (let loop ((i 0) (acc 0))
+      (if (>= i n)
+	  acc
+	(loop (1+ i) (+ acc (* i 3))))))
+
+  (define (vector-fill v)
+    (let ((n (length v)))
+      (do ((i 0 (1+ i)))
+	  ((= i n) v)
+	(aset v i (- n i)))))
+
+  (define (vector-sum v)
+    (let ((n (length v)))
+      (let loop ((i 0) (acc 0))
+	(if (= i n)
+	    acc
+	  (loop (1+ i) (+ acc (aref v i)))))))
+
+  (define (list-sum l)
+    (let loop ((l l) (acc 0))
+      (if (consp l)
+	  (loop (cdr l) (+ acc (car l)))
+	acc)))
+
+  (define (fib n)
+    (if (< n 2)
+	n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+  (define vec (make-vector 100000 1))
+  (define lst (make-list 100000 2))
+
+  (define benchmarks
+    (list (cons "sum-multiples" (lambda () (sum-multiples 5000000)))
+	  (cons "vector-fill+sum"
+		(lambda ()
+		  (do ((i 0 (1+ i))
+		       (s 0 (+ s (vector-sum (vector-fill vec)))))
+		      ((= i 50) s))))
+	  (cons "list-sum"
+		(lambda ()
+		  (do ((i 0 (1+ i))
+		       (s 0 (+ s (list-sum lst))))
+		      ((= i 50) s))))
+	  (cons "fib" (lambda () (fib 25)))))
+
+  (define (best-time thunk)
+    (let loop ((i 0) (best nil))
+      (if (= i 3)
+	  best
+	(let ((start (current-utime)))
+	  (thunk)
+	  (let ((elapsed (quotient (- (current-utime) start) 1000)))
+	    (loop (1+ i) (if (or (null best) (< elapsed best))
+			     elapsed
+			   best)))))))
+
+  (mapc compile-function (list sum-multiples vector-fill vector-sum
+			       list-sum fib best-time))
+
+  (format standard-output "%-20s %8s %8s\n" "" "interp" "native")
+  (mapc (lambda (b)
+	  (let (interp native)
+	    (set-bytecode-jit nil)
+	    (setq interp (best-time (cdr b)))
+	    (set-bytecode-jit t)
+	    (setq native (best-time (cdr b)))
+	    (set-bytecode-jit nil)
+	    (format standard-output "%-20s %8d %8d\n" (car b) interp native)))
+	benchmarks))
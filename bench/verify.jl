@@ -0,0 +1,97 @@
+#| bench/verify.jl -- timing verified code against checked code
+
+   Run from the top of the build tree with:
+
+	./test --batch bench/verify.jl
+
+   Each benchmark is a compiled function that refers to a variable of
+   the closure it was made in, on a path that's never taken. As that
+   closure it verifies and runs unchecked; as a closure of the same
+   code made in an empty environment it runs checked, since the
+   environment is shorter than the code needs (see verify.c). Each is
+   run three times both ways with quickening disabled, then again with
+   it enabled, printing the best time of each in milliseconds. |#
+
+(define-structure bench.verify ()
+
+    (open rep
+	  rep.system
+	  rep.vm.compiler
+	  rep.vm.interpreter)
+
+  (define (make-benchmarks)
+    (let ((never 'never))
+      (setq never 'still-never)
+      (list (cons "sum-multiples"
+		  (lambda (n)
+		    (if (eq n 'never)
+			never
+		      (let ((i 0) (acc 0))
+			(while (< i n)
+			  (setq acc (+ acc (* i 3)))
+			  (setq i (1+ i)))
+			acc))))
+	    (cons "vector-fill+sum"
+		  (lambda (n)
+		    (if (eq n 'never)
+			never
+		      (let ((v (make-vector 1000))
+			    (acc 0))
+			(do ((k 0 (1+ k)))
+			    ((= k n) acc)
+			  (do ((i 0 (1+ i)))
+			      ((= i 1000))
+			    (aset v i i))
+			  (do ((i 0 (1+ i)))
+			      ((= i 1000))
+			    (setq acc (+ acc (aref v i)))))))))
+	    (cons "list-walk"
+		  (lambda (n)
+		    (if (eq n 'never)
+			never
+		      (let ((l (make-list 1000 1))
+			    (acc 0))
+			(do ((k 0 (1+ k)))
+			    ((= k n) acc)
+			  (do ((rest l (cdr rest)))
+			      ((null rest))
+			    (setq acc (+ acc (car rest))))))))))))
+
+  ;; compiled, this runs with the empty environment of the top level
+  (define (in-empty-environment fun)
+    (make-closure fun))
+
+  (define (best-time fun arg)
+    (let loop ((i 0) (best nil))
+      (if (= i 3)
+	  best
+	(let ((start (current-utime)))
+	  (fun arg)
+	  (let ((elapsed (quotient (- (current-utime) start) 1000)))
+	    (loop (1+ i) (if (or (null best) (< elapsed best))
+			     elapsed
+			   best)))))))
+
+  (define arguments '(("sum-multiples" . 3000000)
+		      ("vector-fill+sum" . 1000)
+		      ("list-walk" . 2000)))
+
+  (mapc compile-function (list make-benchmarks in-empty-environment
+			       best-time))
+
+  (format standard-output "%-20s %10s %10s %10s %10s\n" ""
+	  "unchecked" "checked" "quick" "quick+chk")
+  (mapc (lambda (b)
+	  (let* ((verified (cdr b))
+		 (checked (in-empty-environment (closure-function verified)))
+		 (arg (cdr (assoc (car b) arguments)))
+		 (quickening (set-bytecode-quickening nil))
+		 (times (list (best-time verified arg)
+			      (best-time checked arg))))
+	    (set-bytecode-quickening t)
+	    (setq times (nconc times (list (best-time verified arg)
+					   (best-time checked arg))))
+	    (set-bytecode-quickening quickening)
+	    (apply format standard-output "%-20s %10d %10d %10d %10d\n"
+		   (car b) times)))
+	(make-benchmarks)))
@@ -35,6 +35,7 @@
 	    doc-file-param-key
 	    doc-file-ref
 	    doc-file-set
+	    merge-documentation-file
 	    documentation
 	    document-variable
 	    add-documentation
@@ -137,6 +138,23 @@ NAME is true, then it should be the symbol that is associated with VALUE."
 	    (gdbm-store db key value 'replace)
 	  (gdbm-close db)))))
 
+  (defun merge-documentation-file (file)
+    "Copy all doc strings from the documentation database FILE to the
+one called `documentation-file'."
+    (require 'rep.io.db.gdbm)
+    (let ((from (gdbm-open file 'read nil '(no-lock))))
+      (when from
+	(unwind-protect
+	    (let ((db (gdbm-open documentation-file 'append nil '(no-lock))))
+	      (when db
+		(unwind-protect
+		    (gdbm-walk (lambda (key)
+				 (gdbm-store db key (gdbm-fetch from key)
+					     'replace))
+			       from)
+		  (gdbm-close db))))
+	  (gdbm-close from)))))
+
 
 ;;; Accessing doc strings
 
@@ -26,11 +26,16 @@
 
     (export call-in-profiler
 	    print-profile
-	    profile-interval)
+	    profile-interval
+	    call-in-allocation-profiler
+	    allocation-profile-by-function
+	    print-allocation-profile
+	    print-collapsed-stacks)
 
     (open rep
 	  rep.lang.record-profile
-	  rep.data.symbol-table)
+	  rep.data.symbol-table
+	  rep.test.framework)
 
   (define (call-in-profiler thunk)
     (start-profiler)
@@ -61,4 +66,97 @@
 			  (symbol-name name) local
 			  (round (* (/ local total-samples) 100)) total
 			  (round (* (/ total total-samples) 100))))))
-	    profile))))
+	    profile)))
+
+;;; allocation profiles
+
+  (define (call-in-allocation-profiler thunk #!optional interval)
+    (start-allocation-profiler interval)
+    (unwind-protect
+	(thunk)
+      (stop-allocation-profiler)))
+
+  (define (allocation-profile-by-function)
+    "Return a list `((NAME SELF . TOTAL) ...)' summarising the current
+allocation profile, sorted by SELF. SELF is the estimated number of
+bytes allocated while NAME was the innermost function called, TOTAL
+the number allocated while it was anywhere on the stack."
+    (let ((table (make-symbol-table))
+	  (out '()))
+      (mapc (lambda (sample)
+	      (let ((stack (car sample))
+		    (bytes (cadr sample))
+		    (seen '()))
+		(mapc (lambda (name)
+			(unless (memq name seen)
+			  (setq seen (cons name seen))
+			  (let ((cell (symbol-table-ref table name)))
+			    (unless cell
+			      (setq cell (cons 0 0))
+			      (symbol-table-set table name cell))
+			    (rplacd cell (+ (cdr cell) bytes)))))
+		      stack)
+		(when stack
+		  (let ((cell (symbol-table-ref table (last stack))))
+		    (rplaca cell (+ (car cell) bytes))))))
+	    (fetch-allocation-profile))
+      (symbol-table-walk (lambda (name cell)
+		    (setq out (cons (cons name cell) out))) table)
+      (sort out (lambda (x y)
+		  (> (cadr x) (cadr y))))))
+
+  (define (print-allocation-profile #!optional stream)
+    (let ((profile (allocation-profile-by-function))
+	  (total 0))
+      (mapc (lambda (sample)
+	      (setq total (+ total (cadr sample))))
+	    (fetch-allocation-profile))
+      (format (or stream standard-output)
+	      "%-32s       %10s       %10s\n\n"
+	      "Function Name" "Self" "Total")
+      (mapc (lambda (cell)
+	      (let ((name (car cell))
+		    (self (cadr cell))
+		    (all (cddr cell)))
+		(when (> self 0)
+		  (format (or stream standard-output)
+			  "%-32s %10d (%02.2d%%) %10d (%02.2d%%)\n"
+			  (symbol-name name) self
+			  (round (* (/ self total) 100)) all
+			  (round (* (/ all total) 100))))))
+	    profile)))
+
+  (define (print-collapsed-stacks #!optional stream)
+    "Print the current allocation profile to STREAM in the collapsed
+stack format read by flame graph tools: a line `OUTER;...;INNER BYTES'
+for each stack sampled."
+    (mapc (lambda (sample)
+	    (let ((stack (car sample)))
+	      (format (or stream standard-output) "%s %d\n"
+		      (if stack
+			  (mapconcat symbol-name stack ";")
+			"[toplevel]")
+		      (cadr sample))))
+	  (fetch-allocation-profile)))
+
+
+;;; tests
+
+  ;;###autoload
+  (define-self-test 'rep.lang.profiler
+    (lambda ()
+      (call-in-allocation-profiler
+       (lambda ()
+	 (do ((i 0 (1+ i)))
+	     ((= i 100))
+	   (make-vector 1000)))
+       1024)
+      (let ((profile (allocation-profile-by-function))
+	    (total 0))
+	(mapc (lambda (sample)
+		(setq total (+ total (cadr sample))))
+	      (fetch-allocation-profile))
+	(test (>= total (* 100 1000 4)))
+	(test (assq 'make-vector profile))
+	(test (>= (cadr (assq 'make-vector profile)) (* 50 1000 4)))
+	(test (not (allocation-profiling-p)))))))
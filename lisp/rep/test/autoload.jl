@@ -35,6 +35,12 @@ Jade, select this file, then evaluate:
 ;;; ::autoload-start::
 (autoload-self-test 'rep.data.queues 'rep.data.queues)
 (autoload-self-test 'rep.data 'rep.test.data)
+(autoload-self-test 'rep.data.gc 'rep.test.gc)
+(autoload-self-test 'rep.structures 'rep.test.structures)
+(autoload-self-test 'rep.io.files 'rep.test.files)
+(autoload-self-test 'rep.vm.interpreter 'rep.test.interpreter)
+(autoload-self-test 'rep.lang.profiler 'rep.lang.profiler)
+(autoload-self-test 'rep.vm.compiler 'rep.vm.compiler)
 (autoload-self-test 'rep.www.quote-url 'rep.www.quote-url)
 (autoload-self-test 'rep.www.cgi-get 'rep.www.cgi-get)
 ;;; ::autoload-end::
@@ -26,6 +26,9 @@
 
     (open rep
 	  rep.data.records
+	  rep.data.tables
+	  rep.regexp
+	  rep.util.md5
 	  rep.test.framework)
 
 ;;; equality function tests
@@ -71,6 +74,69 @@
     (test (equal 2 2))
     (test (equal (make-vector 5 'a) (make-vector 5 'a))))
 
+;;; float tests
+
+  (define (float-self-test)
+    ;; on 64-bit hosts floats between 2^-127 and 2^129 in magnitude
+    ;; (and 0.0) are immediate values, so equal ones are eq
+    (let* ((immediate (eq (/ 3.0 2) (/ 3.0 2)))
+	   (lo (expt 2.0 -127))
+	   (hi (expt 2.0 129))
+	   (inf (* 1e308 10))
+	   (nan (- inf inf))
+	   (-zero (- 0.0))
+	   (floats (list 0.0 -zero 1.5 -1.5 lo (- lo) (* lo 1.5) (* hi 0.75)
+			 (- (* hi 0.75)) hi 1e-300 1e300 inf (- inf)))
+	   (copy (lambda (x) (* x 1))))
+
+      (when immediate
+	(test (eq 1.5 (/ 3.0 2)))
+	(test (eq (* lo 1.5) (copy (* lo 1.5))))
+	(test (eq (- (* hi 0.75)) (copy (- (* hi 0.75)))))
+	(test (eq 0.0 (copy 0.0)))
+	(test (eq (exact->inexact 3/2) 1.5))
+	(test (eq (string->number "1.5") 1.5)))
+      ;; the limits themselves, and -0.0, are boxed
+      (test (not (eq lo (copy lo))))
+      (test (not (eq hi (copy hi))))
+      (test (not (eq -zero (copy -zero))))
+      (test (not (eq 1e300 (copy 1e300))))
+
+      ;; boxed or not, the values are the same
+      (mapc (lambda (x)
+	      (test (eql x (copy x)))
+	      (test (= x (copy x)))
+	      (test (equal (list x) (list (copy x))))
+	      (test (= (equal-hash x) (equal-hash (copy x))))
+	      (test (not (eql x 'x)))) floats)
+      (mapc (lambda (x)
+	      (test (eql (read-from-string (prin1-to-string x)) x)))
+	    (list 0.0 -zero 1.5 lo (- lo) (* lo 1.5) (* hi 0.75) hi 1e300))
+      (test (not (eql 1.5 (+ 1.5 (expt 2.0 -52)))))
+      (test (not (eql lo (* lo 1.5))))
+      (test (not (eql 1 1.0)))
+      (test (not (equal 1.0 1)))
+
+      ;; the sign of zero is kept
+      (test (= -zero 0.0))
+      (test (< (atan -zero -1) 0))
+      (test (> (atan 0.0 -1) 0))
+      (test (string= (prin1-to-string -zero) "-0."))
+      (test (> inf 1e308))
+      (test (= (- inf) (* inf -1)))
+      (test (string= (prin1-to-string (- inf)) "-inf."))
+      (test (not (eq nan (copy nan))))
+      (test (= (/ (* hi 0.75) (* hi 0.375)) 2))
+      (test (= (* (* lo 1.5) 2) (* lo 3)))
+
+      (let ((tab (make-table equal-hash equal)))
+	(mapc (lambda (x)
+		(table-set tab x (list x))) floats)
+	(test (let loop ((rest floats))
+		(cond ((null rest) t)
+		      ((equal (table-ref tab (copy (car rest))) (list (car rest)))
+		       (loop (cdr rest)))))))))
+
 ;;; cons and list tests
 
   ;; adapted from guile's test.scm
@@ -189,11 +255,152 @@
     (test (string= (mapconcat string-upcase '("foo" "bar" "baz") " ")
 		   "FOO BAR BAZ")))
 
+;;; large string tests
+
+  (define (large-string-self-test)
+    (let* ((text (lambda ()
+		   (concat (make-string 1000 ?x) "y" (make-string 1000 ?x))))
+	   ;; made before the threshold is lowered
+	   (plain (text))
+	   (threshold (large-string-threshold 100)))
+      (unwind-protect
+	  ;; everything longer than 100 bytes made from here on is large
+	  (let ((big (text))
+		(out (make-string-output-stream)))
+	    (test (= (length big) 2001))
+	    (test (string= big plain))
+	    (test (equal big plain))
+	    (test (= (aref big 1000) ?y))
+	    (test (string= (substring big 990 1010) "xxxxxxxxxxyxxxxxxxxx"))
+	    (test (= (length (substring big 500)) 1501))
+	    (test (string= (substring (concat big big) 2001) plain))
+	    (test (string-match "x+y" big))
+	    (test (= (match-start) 0))
+	    (test (= (match-end) 1001))
+	    (test (string-match "yx*" big 500))
+	    (test (= (match-start) 1000))
+	    (test (= (match-end) 2001))
+	    (test (string= (expand-last-match "\\0") (substring plain 1000)))
+	    (test (equal (md5-string big) (md5-string plain)))
+	    (test (string= (string-upcase big) (string-upcase plain)))
+	    (test (string= (format nil "%s-%s" big big)
+			   (concat plain "-" plain)))
+	    ;; streams grow their strings with rep_set_string_len
+	    (let loop ((i 0))
+	      (when (< i 2001)
+		(write out (aref big i))
+		(loop (1+ i))))
+	    (write out big)
+	    (test (string= (get-output-stream-string out) (concat plain plain)))
+	    (let ((in (make-string-input-stream big)))
+	      (test (string= (read-chars in 1500) (substring plain 0 1500)))
+	      (test (string= (read-chars in 1500) (substring plain 1500))))
+	    (test (string= (bytevector->string (string->bytevector big)) plain))
+	    (garbage-collect)
+	    (test (string= big plain)))
+	(large-string-threshold threshold))))
+
+;;; string arena tests
+
+  ;; compacting the string arena moves the contents of small strings,
+  ;; but not what they hold or the match data pointing into them
+  (define (string-arena-self-test)
+    (let* ((compaction (string-arena-compaction 100))
+	   (kept (let loop ((i 0) (l '()))
+		   (if (= i 20000)
+		       l
+		     (let ((s (format nil "string %d" i)))
+		       (loop (1+ i) (if (= (mod i 50) 0) (cons s l) l))))))
+	   (s (car kept)))
+      (test (string-match "[0-9]+" s))
+      (garbage-collect)
+      (garbage-collect)
+      (string-arena-compaction compaction)
+      (test (string= (expand-last-match "\\0") "19950"))
+      (test (let loop ((i 19950) (l kept))
+	      (cond ((null l) (= i -50))
+		    ((string= (car l) (format nil "string %d" i))
+		     (loop (- i 50) (cdr l))))))))
+
+;;; numeric vector tests
+
+  (define (numeric-vector-self-test)
+    (let ((v (make-numeric-vector 'f64 4 1.5)))
+      (test (numeric-vector-p v))
+      (test (eq (numeric-vector-type v) 'f64))
+      (test (= (length v) 4))
+      (test (= (aref v 3) 1.5))
+      (aset v 0 -2)
+      (test (= (numeric-vector-sum v) 2.5))
+      (test (= (numeric-vector-min v) -2))
+      (test (= (numeric-vector-max v) 1.5))
+      (test (equal (numeric-vector-copy v 1 3)
+		   (numeric-vector 'f64 1.5 1.5))))
+
+    (let ((v (numeric-vector 'u8 1 2 3 255)))
+      (test (eql (numeric-vector-sum v) 261))
+      (test (condition-case nil (progn (aset v 0 256) nil) (error t)))
+      (numeric-vector-fill v 7 1 3)
+      (test (equal v (numeric-vector 'u8 1 7 7 255)))
+      (numeric-vector-replace v 1 v 0 3)
+      (test (equal v (numeric-vector 'u8 1 1 7 7))))
+
+    (test (eql (aref (numeric-vector 'u32 4294967295) 0) 4294967295))
+    (test (eql (aref (numeric-vector 's32 -2147483648) 0) -2147483648))
+    (test (= (numeric-vector-dot (numeric-vector 'f32 1 2 3)
+				 (numeric-vector 's32 4 5 6)) 32)))
+
+  (define (bytevector-self-test)
+    (let* ((b (make-bytevector 8))
+	   (s (bytevector-slice b 2 6)))
+      (test (bytevectorp s))
+      (test (bytevector-shared-p s))
+      (test (= (length s) 4))
+      (bytevector-set s 'u32 0 #x01020304 'big)
+      (test (equal (bytevector-copy b 1 7) (bytevector 0 1 2 3 4 0)))
+      (test (eql (bytevector-ref b 'u16 3 'little) #x0302))
+      (test (eql (bytevector-ref s 's32 0 'little) #x04030201))
+      (aset s 3 255)
+      (test (eql (bytevector-ref b 's8 5) -1))
+      (bytevector-set b 'f64 0 1.25)
+      (test (= (bytevector-ref b 'f64 0) 1.25))
+      (test (condition-case nil (bytevector-ref s 'u32 1) (error t)))
+      (test (condition-case nil (progn (bytevector-set s 'u16 0 65536) nil)
+	      (error t))))
+
+    (let* ((str (copy-sequence "hello"))
+	   (b (string->bytevector str 1 4)))
+      (aset b 0 ?a)
+      (test (string= str "hallo"))
+      (test (string= (bytevector->string b) "all"))
+      (test (eq (bytevector->string (string->bytevector str)) str)))
+
+    (let ((b (bytevector 120 121)))
+      (test (string= (bytevector->string b) "xy"))
+      (aset b 0 ?z)
+      (test (string= (bytevector->string b) "zy")))
+
+    (let* ((str (copy-sequence "abcdefg"))
+	   (in (make-string-input-stream str))
+	   (b (make-bytevector 3)))
+      (test (eql (read-into-bytevector in b) 3))
+      (test (equal b (bytevector ?a ?b ?c)))
+      (test (eql (read-char in) ?d))
+      ;; reading a string into a window on itself
+      (test (eql (read-into-bytevector in (string->bytevector str 1)) 3))
+      (test (string= str "aefgefg"))
+      (test (null (read-into-bytevector in b)))))
+
   (define (self-test)
     (equality-self-test)
+    (float-self-test)
     (cons-self-test)
     (record-self-test)
-    (string-util-self-test))
+    (string-util-self-test)
+    (large-string-self-test)
+    (string-arena-self-test)
+    (numeric-vector-self-test)
+    (bytevector-self-test))
 
   ;;###autoload
   (define-self-test 'rep.data self-test))
@@ -0,0 +1,93 @@
+#| rep.test.files -- checks for rep.io.files module
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+(define-structure rep.test.files ()
+
+    (open rep
+	  rep.io.files
+	  rep.vm.interpreter
+	  rep.test.framework)
+
+  (define (compiled-file-self-test)
+    (let ((file (make-temp-name))
+	  (data (list "string" 'symbol '#:keyword -3 1.5 12345678901234
+		      (/ 1 3) [vector (dotted . pair)] '(#!optional #!rest)
+		      #t #f (make-byte-code-subr "\x49\x76" [] 1))))
+      (unwind-protect
+	  (progn
+	    (test (write-compiled-file file (list (list 'quote data))))
+	    (test (equal (load-file file) data))
+	    ;; strings from the file may be modified
+	    (aset (car (load-file file)) 0 ?S)
+	    (test (string= (car (load-file file)) "string"))
+	    (test (null ((make-closure (last (load-file file))))))
+	    ;; nor does changing the file once it's loaded
+	    (let ((loaded (load-file file))
+		  (stream (open-file file 'write)))
+	      (write stream "x")
+	      (close-file stream)
+	      (garbage-collect)
+	      (test (equal loaded data)))
+	    ;; closures can't be written
+	    (test (not (write-compiled-file file (list (lambda () nil)))))
+	    (test (not (file-exists-p file))))
+	(when (file-exists-p file)
+	  (delete-file file))))
+
+    ;; the file's words are little-endian on every host, and load uses
+    ;; the source when the compiled file's format isn't this one
+    (let* ((base (make-temp-name))
+	   (source (concat base ".jl"))
+	   (compiled (concat base ".jlc")))
+      (define (contents file)
+	(let* ((stream (open-file file 'read))
+	       (text (read-chars stream 100000)))
+	  (close-file stream)
+	  text))
+      (define (set-contents file text)
+	(let ((stream (open-file file 'write)))
+	  (write stream text)
+	  (close-file stream)))
+      (unwind-protect
+	  (progn
+	    (set-contents source "'source\n")
+	    (test (write-compiled-file compiled '('compiled)))
+	    (test (string= (substring (contents compiled) 0 16)
+			   "rep-jlc\000\001\000\000\000\004\003\002\001"))
+	    (test (eq (load base nil t) 'compiled))
+	    (let ((text (contents compiled)))
+	      (aset text 8 2)
+	      (set-contents compiled text))
+	    (test (eq (load base nil t) 'source))
+	    (test (eq (car (condition-case data
+			       (load-file compiled)
+			     (bytecode-error data)))
+		      'bytecode-error)))
+	(mapc (lambda (file)
+		(when (file-exists-p file)
+		  (delete-file file)))
+	      (list source compiled)))))
+
+  (define (self-test)
+    (compiled-file-self-test))
+
+  ;;###autoload
+  (define-self-test 'rep.io.files self-test))
@@ -0,0 +1,293 @@
+#| rep.test.gc -- checks for the garbage collector
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+(define-structure rep.test.gc ()
+
+    (open rep
+	  rep.data.tables
+	  rep.io.files
+	  rep.test.framework)
+
+  (define (heap-census-self-test)
+    (let* ((v (make-vector 100000))
+	   (census (heap-census))
+	   (largest (heap-largest-objects 1 '(vector))))
+      (test (>= (nth 1 (assoc "vector" census)) 1))
+      (test (>= (nth 2 (assoc "vector" census)) (* 100000 4)))
+      (test (eq (cdr (car largest)) v))
+      (test (null (heap-largest-objects 0))))
+
+    (let ((cell (list (make-string 100))))
+      (test (= (car (heap-retained-size cell)) 2))
+      (test (> (cadr (heap-retained-size cell)) 100)))
+
+    (let ((file (make-temp-name)))
+      (unwind-protect
+	  (progn
+	    (dump-heap file)
+	    (let ((fh (open-file file 'read)))
+	      (test (string= (read-chars fh 12) "{\"snapshot\":"))
+	      (close-file fh)))
+	(when (file-exists-p file)
+	  (delete-file file)))))
+
+  (define (gc-self-test)
+    (define (mark-stack-overflows)
+      (nth 2 (assq 'mark-stack (gc-pause-statistics))))
+    (define (fill-vector v)
+      (let loop ((i 0))
+	(when (< i (length v))
+	  (aset v i (list i))
+	  (loop (1+ i))))
+      v)
+    (define (intact-p v)
+      (let loop ((i 0))
+	(cond ((= i (length v)) t)
+	      ((equal (aref v i) (list i)) (loop (1+ i))))))
+    (define (collections kind)
+      (nth 1 (assq kind (gc-pause-statistics))))
+    ;; call (FUN I) for I = 0, 1, ... while allocating, until a whole
+    ;; incremental collection has been done in small steps and I has
+    ;; reached 1000 (with a small heap, the collection can finish first)
+    (define (collect-incrementally fun)
+      (let ((threshold (garbage-threshold 20000))
+	    (pause (gc-max-pause 1))
+	    (generational (set-generational-gc nil))
+	    (majors (collections 'major))
+	    (steps (collections 'step)))
+	(unwind-protect
+	    (let loop ((i 0))
+	      (fun i)
+	      (make-string 1000)
+	      (when (or (< i 1000)
+			(< (collections 'major) (+ majors 2))
+			(< (collections 'step) (+ steps 10)))
+		(loop (1+ i))))
+	  (garbage-threshold threshold)
+	  (gc-max-pause pause)
+	  (set-generational-gc generational))))
+    ;; a vector with more slots than the mark stack can hold is
+    ;; marked a slice at a time, without overflowing it
+    (let ((threshold (garbage-threshold 64000000))
+	  (v (fill-vector (make-vector (* 1100 1024))))
+	  overflows)
+      (garbage-threshold threshold)
+      (garbage-collect)
+      (setq overflows (mark-stack-overflows))
+      (garbage-collect)
+      (test (eql (mark-stack-overflows) overflows))
+      (test (intact-p v))
+      ;; as it is when several threads mark it, where they can (the
+      ;; heap is large enough for them to be used)
+      (let ((threads (gc-mark-threads 4))
+	    (parallel (collections 'parallel)))
+	(garbage-collect)
+	(when (eql (gc-mark-threads threads) 4)
+	  (test (> (collections 'parallel) parallel)))
+	(test (intact-p v))))
+    ;; with generational collection, what's stored in cells and other
+    ;; objects that survived a collection outlives the minor
+    ;; collections that follow
+    (let ((generational (set-generational-gc t))
+	  (threshold (garbage-threshold 20000))
+	  (l (list 1 2 3))
+	  (r (list 1 2 3))
+	  (v (make-vector 3))
+	  (tab (make-table equal-hash equal))
+	  (minors (collections 'minor)))
+      (unwind-protect
+	  (progn
+	    (garbage-collect)
+	    (rplaca l (list 'car))
+	    (rplacd (cddr l) (list 'cdr))
+	    (nconc l (list 'nconc))
+	    (setq r (nreverse r))
+	    (aset v 0 (list 'aset))
+	    (table-set tab 'key (list 'value))
+	    (let loop ((i 0))
+	      (make-string 100)
+	      (when (< (collections 'minor) (+ minors 4))
+		(loop (1+ (car (list i))))))
+	    (test (equal l '((car) 2 3 cdr nconc)))
+	    (test (equal r '(3 2 1)))
+	    (test (equal (aref v 0) '(aset)))
+	    (test (equal (table-ref tab 'key) '(value))))
+	(garbage-threshold threshold)
+	(set-generational-gc generational)))
+    ;; objects stored while marking is in progress, in ones that may
+    ;; already have been marked, survive
+    (let ((v (make-vector 1000))
+	  (tab (make-table equal-hash equal))
+	  (ob (make-obarray 31))
+	  (fun (make-closure nil)))
+      (collect-incrementally
+       (lambda (i)
+	 (aset v (mod i 1000) (list (mod i 1000)))
+	 (table-set tab (mod i 1000) (list (mod i 1000)))
+	 (set-closure-function fun (list i))
+	 (intern (format nil "s%d" (mod i 1000)) ob)))
+      (garbage-collect)
+      (test (intact-p v))
+      (test (let loop ((i 0))
+	      (cond ((= i 1000) t)
+		    ((and (equal (table-ref tab i) (list i))
+			  (find-symbol (format nil "s%d" i) ob))
+		     (loop (1+ i))))))
+      (test (consp (closure-function fun))))
+    ;; and so do those only found by scanning the heap once the mark
+    ;; stack has overflowed (each car of the list is pushed)
+    (let* ((threshold (garbage-threshold 64000000))
+	   (l (let loop ((i 0) (l '()))
+		(if (= i (* 1100 1024))
+		    (nreverse l)
+		  (loop (1+ i) (cons (list i) l)))))
+	   (overflows (mark-stack-overflows)))
+      (garbage-threshold threshold)
+      (collect-incrementally (lambda (i) i))
+      (test (> (mark-stack-overflows) overflows))
+      (test (let loop ((i 0) (l l))
+	      (cond ((null l) (= i (* 1100 1024)))
+		    ((equal (car l) (list i)) (loop (1+ i) (cdr l)))))))
+    ;; cells freed by a full collection are reused while the sweep is
+    ;; still pending, and the cells, strings and numbers allocated
+    ;; from the swept blocks survive the next collection
+    (let ((threshold (garbage-threshold 64000000))
+	  (item (lambda (i)
+		  (list i (format nil "%d" i) (* i 1000000000000 1.5))))
+	  blocks kept)
+      (let loop ((i 0))
+	(when (< i 400000)
+	  (cons i i)
+	  (loop (1+ i))))
+      (garbage-collect)
+      (setq blocks (nth 2 (gc-heap-statistics)))
+      (setq kept (let loop ((i 0) (l '()))
+		   (if (= i 40000)
+		       l
+		     (loop (1+ i) (cons (item i) l)))))
+      (test (<= (nth 2 (gc-heap-statistics)) blocks))
+      (garbage-collect)
+      (garbage-threshold threshold)
+      (test (let loop ((i 39999) (l kept))
+	      (cond ((null l) (= i -1))
+		    ((equal (car l) (item i)) (loop (1- i) (cdr l)))))))
+    ;; the blocks emptied by a full collection are given back, all but
+    ;; enough of them to allocate garbage-threshold bytes
+    (let ((threshold (garbage-threshold 200000))
+	  (huge-pages (set-gc-huge-pages nil))
+	  (heap (lambda ()
+		  (let ((l (make-list 2000000)))
+		    (garbage-collect)
+		    (when (= (length l) 2000000)
+		      (gc-heap-statistics)))))
+	  before after)
+      (define (returned-p before after)
+	(and (< (nth 2 after) (/ (nth 2 before) 4))
+	     (<= (nth 2 after) (nth 1 after) (nth 0 after))
+	     (<= (nth 3 after) (nth 3 before))))
+      (setq before (heap))
+      (garbage-collect)
+      (setq after (gc-heap-statistics))
+      (test (> (nth 2 before) 1900))
+      (test (returned-p before after))
+      (test (< (nth 1 after) (/ (nth 1 before) 4)))
+      ;; huge pages are only given back with their whole arena
+      (set-gc-huge-pages t)
+      (setq before (heap))
+      (garbage-collect)
+      (setq after (gc-heap-statistics))
+      (set-gc-huge-pages huge-pages)
+      (garbage-threshold threshold)
+      (test (returned-p before after))
+      (test (or (= (nth 3 before) 0) (< (nth 3 after) (nth 3 before)))))
+    ;; gc-statistics counts the collections and their pauses, the
+    ;; objects allocated since the last one, and those it found live
+    (let ((threshold (garbage-threshold 64000000))
+	  (type (lambda (name)
+		  (cdr (assoc name (cdr (assq 'types (gc-statistics)))))))
+	  before after kept)
+      (garbage-collect)
+      (setq before (gc-statistics))
+      (setq kept (let loop ((i 0) (l '()))
+		   (if (= i 1000)
+		       l
+		     (loop (1+ i) (cons (make-vector 10) l)))))
+      (test (>= (nth 0 (type "vector")) 1000))
+      (test (>= (nth 1 (type "vector")) (* 1000 10 4)))
+      (test (>= (nth 0 (type "cons")) 1000))
+      (garbage-collect)
+      (setq after (gc-statistics))
+      (garbage-threshold threshold)
+      (test (= (nth 1 (assq 'collections after))
+	       (1+ (nth 1 (assq 'collections before)))))
+      (test (> (nth 2 (assq 'collections after))
+	       (nth 2 (assq 'collections before))))
+      (test (<= (nth 3 (assq 'collections after))
+		(nth 2 (assq 'collections after))))
+      ;; every pause is in the histogram, the minor and major
+      ;; collections and the incremental steps
+      (test (= (apply + (mapcar cdr (cdr (assq 'pauses after))))
+	       (apply + (mapcar (lambda (kind)
+				  (nth 1 (assq kind (gc-pause-statistics))))
+				'(minor major step)))))
+      (test (null (car (last (cdr (assq 'pauses after))))))
+      (test (< (nth 0 (type "vector")) 1000))
+      (test (>= (nth 2 (type "vector")) (length kept)))
+      (test (>= (nth 2 (type "cons")) 1000)))
+    ;; with garbage-threshold-growth set, each full collection sets the
+    ;; threshold from the size of the live data, within the bounds
+    (let ((threshold (garbage-threshold))
+	  (growth (garbage-threshold-growth 200))
+	  (min-threshold (min-garbage-threshold 100000))
+	  (max-threshold (max-garbage-threshold 256000000))
+	  (big (make-list 1000000))
+	  small)
+      (garbage-collect)
+      ;; a million cells take 16 megabytes
+      (test (>= (garbage-threshold) (* 2 16000000)))
+      (max-garbage-threshold 1000000)
+      (garbage-collect)
+      (test (= (garbage-threshold) 1000000))
+      (max-garbage-threshold 256000000)
+      (setq big (length big))
+      (garbage-collect)
+      (setq small (garbage-threshold))
+      (test (< small (* 2 16000000)))
+      (min-garbage-threshold (* 2 small))
+      (garbage-collect)
+      (test (= (garbage-threshold) (* 2 small)))
+      ;; but otherwise it's left alone
+      (garbage-threshold-growth 0)
+      (garbage-threshold 123456)
+      (garbage-collect)
+      (test (= (garbage-threshold) 123456))
+      (garbage-threshold-growth growth)
+      (min-garbage-threshold min-threshold)
+      (max-garbage-threshold max-threshold)
+      (garbage-threshold threshold)
+      (test (= big 1000000))))
+
+  (define (self-test)
+    (heap-census-self-test)
+    (gc-self-test))
+
+  ;;###autoload
+  (define-self-test 'rep.data.gc self-test))
@@ -0,0 +1,175 @@
+#| rep.test.interpreter -- checks for rep.vm.interpreter module
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+(define-structure rep.test.interpreter ()
+
+    (open rep
+	  rep.structures
+	  rep.vm.compiler
+	  rep.vm.interpreter
+	  rep.test.framework)
+
+  (define (inline-cache-self-test)
+    ;; compiled references to global variables cache the binding they
+    ;; found, these must see every change to where it would be found
+    (eval '(define-structure inline-cache-lib (export cached-var)
+	     (open rep)
+	     (define cached-var 'lib)))
+    (eval '(define-structure inline-cache-lib2 (export cached-var)
+	     (open rep)
+	     (define cached-var 'lib2)))
+    (eval '(define-structure inline-cache-user (export)
+	     (open rep rep.structures inline-cache-lib)
+	     (define (cached-ref) cached-var)))
+    (let* ((user (get-structure 'inline-cache-user))
+	   (ref (compile-function (%structure-ref user 'cached-ref))))
+      (test (bytecodep (closure-function ref)))
+      (test (eq (ref) 'lib))
+      (test (eq (ref) 'lib))
+      ;; the binding's value changes
+      (structure-set (get-structure 'inline-cache-lib) 'cached-var 'set)
+      (test (eq (ref) 'set))
+      ;; the structure it's imported from is redefined
+      (eval '(define-structure inline-cache-lib (export cached-var)
+	       (open rep)
+	       (define cached-var 'redefined)))
+      (test (eq (ref) 'redefined))
+      ;; a local binding shadows the import, until it's removed
+      (structure-define user 'cached-var 'local)
+      (test (eq (ref) 'local))
+      (eval '(makunbound 'cached-var) user)
+      (test (eq (ref) 'redefined))
+      ;; another structure that exports it is opened
+      (eval '(open-structures '(inline-cache-lib2)) user)
+      (test (eq (ref) 'lib2))))
+
+  (define (quickening-self-test)
+    (define (add a b) (+ a b))
+    (define (mul a b) (* a b))
+    (define (less a b) (< a b))
+    (define (first x) (car x))
+    (define (ref v i) (aref v i))
+    (do ((i 0 (1+ i)))
+	((= i 100))
+      (add i i)
+      (mul i i)
+      (less i 1)
+      (first (list i))
+      (ref (vector i) 0))
+
+    ;; the quickened forms must fall back when their guards fail
+    (test (eql (add 1 2) 3))
+    (test (= (add 1.5 2) 3.5))
+    (test (eql (add 1 2) 3))
+    (test (= (mul 1000000000 1000000000) 1e18))
+    (test (less 1.5 2))
+    (test (not (less 2 1.5)))
+    (test (null (first nil)))
+    (test (eql (first '(1)) 1))
+    (test (eql (ref "abc" 1) ?b))
+    (test (eql (ref (vector 'a 'b) 1) 'b)))
+
+  (define (native-code-self-test)
+    (define (sum v)
+      (let loop ((i 0) (acc 0))
+	(if (= i (length v))
+	    acc
+	  (loop (1+ i) (+ acc (aref v i))))))
+    (define (count l)
+      (do ((l l (cdr l))
+	   (n 0 (1+ n)))
+	  ((not (consp l)) n)))
+    (let ((old (set-bytecode-jit t))
+	  (v (make-vector 2000 3)))
+      (unwind-protect
+	  (progn
+	    (test (eql (sum v) 6000))
+	    (test (eql (count (make-list 2000)) 2000))
+	    ;; native code returns to the interpreter when its guards fail
+	    (aset v 1999 1.5)
+	    (test (= (sum v) 5998.5))
+	    (test (eq (car (condition-case data
+			       (sum (vector 1 'a))
+			     (error data)))
+		      'bad-arg))
+	    (test (eql (count '(a b . c)) 2)))
+	(set-bytecode-jit old))))
+
+  (define (tail-call-self-test)
+    ;; none of these should run out of lisp depth
+    (define (state-a n)
+      (case (mod n 3)
+	((0) (if (= n 0) 'done (state-b (1- n))))
+	(t (state-c (1- n)))))
+    (define (state-b n) (state-a n))
+    (define (state-c n)
+      ;; needs a bigger frame than state-a and state-b
+      (let* ((a (list n)) (b (cons n a)) (c (vector a b)))
+	(state-a (car (aref c 0)))))
+    (define (spread n . rest)
+      (if (= n 0) (length rest) (apply spread (1- n) rest)))
+    (test (eq (state-a 100000) 'done))
+    (test (eql (spread 100000 1 2 3) 3)))
+
+  (define (verifier-self-test)
+    (define (bytecode code stack)
+      (make-byte-code-subr code [] stack))
+    (define (error-of thunk)
+      (condition-case data
+	  (progn (thunk) nil)
+	(bytecode-error (cadr data))))
+    ;; nil; return
+    (test (eq (verify-byte-code (bytecode "\x49\x76" 1)) t))
+    (test (null ((make-closure (bytecode "\x49\x76" 1)))))
+    ;; nil; slot-set 69; slot-ref 69; return
+    (test (eq (verify-byte-code
+	       (bytecode "\x49\x36\x45\x06\x45\x76" (+ 1 (ash 70 20))))
+	      t))
+    ;; these don't verify, so run with checks instead of crashing
+    (mapc (lambda (fun)
+	    (test (stringp (error-of (lambda () (verify-byte-code fun)))))
+	    (test (stringp (error-of (make-closure fun)))))
+	  (list (bytecode "\x48\x48\x76" 1)		;stack underflow
+		(bytecode "\x49\x49\x76" 1)		;stack overflow
+		(bytecode "\x10\x76" 1)		;no such constant
+		(bytecode "\x00\x76" (+ 1 (ash 1 20)))	;unset slot
+		(bytecode "\xfb\x10\x00" 1)		;jump outside the code
+		(bytecode "\x49\xfc\xff\xff\x49\x76" 2) ;and from jn
+		(bytecode "\x49\x76" -1)		;negative slot count
+		(bytecode "\xa1\x7f\xff\x75\x9b\x4c\x76" 2) ;bad handler
+		(bytecode "\x45\x45\x76" 1)))	;binding stack underflow
+    ;; these verify, but still mustn't crash: refn 32767 has no
+    ;; environment to refer to, ejmp can't rethrow a fixnum
+    (mapc (lambda (fun)
+	    (test (eq (verify-byte-code fun) t))
+	    (test (stringp (error-of (make-closure fun)))))
+	  (list (bytecode "\x3f\x7f\xff\x76" 1)
+		(bytecode "\x9a\xf8\x00\x00" 1))))
+
+  (define (self-test)
+    (inline-cache-self-test)
+    (quickening-self-test)
+    (native-code-self-test)
+    (tail-call-self-test)
+    (verifier-self-test))
+
+  ;;###autoload
+  (define-self-test 'rep.vm.interpreter self-test))
@@ -0,0 +1,45 @@
+#| rep.test.structures -- checks for rep.structures module
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+(define-structure rep.test.structures ()
+
+    (open rep
+	  rep.structures
+	  rep.test.framework)
+
+  (define (structure-walk-self-test)
+    ;; structure-walk passes the same values as looking the variables
+    ;; up, including those of bindings not yet rebuilt from an image
+    (let ((seen '()))
+      (let walk ((name 'rep))
+	(let ((s (get-structure name)))
+	  (when (and s (not (memq name seen)))
+	    (setq seen (cons name seen))
+	    (structure-walk (lambda (var value)
+			      (test (eq value (%structure-ref s var)))) s)
+	    (mapc walk (structure-imports s)))))
+      (test (memq 'rep.data seen))))
+
+  (define (self-test)
+    (structure-walk-self-test))
+
+  ;;###autoload
+  (define-self-test 'rep.structures self-test))
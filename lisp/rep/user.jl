@@ -52,6 +52,10 @@
 	      (setq arg (car command-line-args))
 	      (setq command-line-args (cdr command-line-args))
 	      (do-load arg))
+	     ((string= arg "--save-image")
+	      (setq arg (car command-line-args))
+	      (setq command-line-args (cdr command-line-args))
+	      (save-image arg))
 	     ((string= arg "--check")
 	      (require 'rep.test.framework)
 	      (run-self-tests-and-exit))
@@ -66,6 +70,7 @@ where OPTIONS are any of:
     --batch		batch mode: process options and exit
     --interp		interpreted mode: don't load compiled Lisp files
     --debug		start in the debugger (implies --interp)
+    --jit		translate hot compiled functions to native code
 
     --call FUNCTION	call the Lisp function FUNCTION
     --f FUNCTION
@@ -73,6 +78,9 @@ where OPTIONS are any of:
     --load FILE		load the Lisp file FILE
     -l FILE
 
+    --save-image FILE	save the state of the Lisp system to FILE
+    --image FILE	start from the state saved in FILE
+
     --check		run self tests and exit
 
     --version		print version details
@@ -327,6 +327,35 @@
 	       (car (nth 4 stats)) (+ (car (nth 4 stats))
 				      (cdr (nth 4 stats)))))))
 
+  (define-repl-command
+   'heap
+   (lambda (#!optional count)
+     (format standard-output "%10s %12s  %s\n" "Objects" "Bytes" "Type")
+     (mapc (lambda (x)
+	     (format standard-output "%10d %12d  %s\n"
+		     (nth 1 x) (nth 2 x) (nth 0 x)))
+	   (heap-census))
+     (format standard-output "\nLargest objects:\n")
+     (mapc (lambda (x)
+	     (let ((desc (if (vectorp (cdr x))
+			     (format nil "<vector of %d elements>"
+				     (length (cdr x)))
+			   (format nil "%S" (cdr x)))))
+	       (format standard-output "%12d  %s\n" (car x)
+		       (if (> (length desc) 60)
+			   (concat (substring desc 0 60) "...")
+			 desc))))
+	   (heap-largest-objects (or count 10))))
+   "[COUNT]")
+
+  (define-repl-command
+   'retained
+   (lambda (form)
+     (let ((size (heap-retained-size (repl-eval form))))
+       (format standard-output "%d objects, %d bytes\n"
+	       (car size) (cadr size))))
+   "FORM")
+
   (define-repl-command
    'disassemble
    (lambda (arg)
@@ -461,6 +490,15 @@ commands may be abbreviated to their unique leading characters.\n\n")
      (print-profile))
    "FORM")
 
+  (define-repl-command
+   'allocations
+   (lambda (form)
+     (require 'rep.lang.profiler)
+     (format standard-output "%S\n\n" (call-in-allocation-profiler
+				       (lambda () (repl-eval form)) 4096))
+     (print-allocation-profile))
+   "FORM")
+
   (define-repl-command
    'check
    (lambda (#!optional module)
@@ -69,7 +69,10 @@
 	      l)))
 
       (define (get-const-id value)
-	(or (cdr (assoc value constants))
+	;; 0.0 and -0.0 are equal, but mustn't share a constant
+	(or (cdr (if (and (numberp value) (not (exactp value)) (zerop value))
+		     (assq value constants)
+		   (assoc value constants)))
 	    (prog1 next-const-id
 	      (setq constants (cons (cons value next-const-id) constants))
 	      (setq next-const-id (1+ next-const-id)))))
@@ -41,7 +41,12 @@
 	  rep.structures
 	  rep.system
 	  rep.io.files
+	  rep.io.processes
 	  rep.regexp
+	  rep.lang.doc
+	  rep.data.tables
+	  rep.util.md5
+	  rep.test.framework
 	  rep.vm.compiler.basic
 	  rep.vm.compiler.bindings
 	  rep.vm.compiler.modules
@@ -67,6 +72,10 @@
   ;; regexp matching library files not to compile
   (define lib-exclude-re "\\bautoload\\.jl$|^CVS$")
 
+  ;; the most workers compile-lisp-lib uses when REP_COMPILE_JOBS
+  ;; doesn't say how many
+  (define lib-max-jobs 8)
+
   ;; map languages to compiler modules
   (put 'rep 'compiler-module 'rep.vm.compiler.rep)
   (put 'no-lang 'compiler-module 'rep.vm.compiler.no-lang)
@@ -213,6 +222,273 @@ we would like. This is due to the view of folded functions as
 ;; so I need to do all those funky lexical scope optimisation now..
 
 
+;;; Compilation cache
+
+(defvar *compiler-cache-directory* (getenv "REP_COMPILE_CACHE")
+  "When non-nil, the name of a directory in which compile-file keeps a
+copy of each file it compiles, named by a digest of the source file,
+the compiler, and the structures that the file imports. A source file
+whose digest is found there isn't compiled again, the copy is used.")
+
+;; digests of library source files, by structure name
+(define source-digests (make-table symbol-hash eq))
+
+(define (source-digest struct)
+  (let ((digest (table-ref source-digests struct)))
+    (unless digest
+      (let* ((stem (concat (structure-file struct) ".jl"))
+	     (file (catch 'out
+		     (mapc (lambda (dir)
+			     (let ((file (expand-file-name stem dir)))
+			       (when (file-regular-p file)
+				 (throw 'out (local-file-name file)))))
+			   load-path)
+		     nil)))
+	(setq digest (if file (md5-local-file file) 'none))
+	(table-set source-digests struct digest)))
+    digest))
+
+;; Returns (DEFINED . IMPORTS), the names of the structures defined at
+;; the top level of FILE-NAME, and of those that it opens or accesses,
+;; or requires
+(define (scan-source-file file-name)
+  (let ((file (open-file file-name 'read))
+	(defined '())
+	(imports '()))
+    (unwind-protect
+	(condition-case nil
+	    (while t
+	      (let ((form (read file)))
+		(case (car form)
+		  ((define-structure structure)
+		   (let ((config (if (eq (car form) 'structure)
+				     (nth 2 form)
+				   (setq defined (cons (nth 1 form) defined))
+				   (nth 3 form))))
+		     (unless (listp (car config))
+		       (setq config (list config)))
+		     (mapc (lambda (clause)
+			     (when (memq (car clause) '(open access))
+			       (setq imports (append (cdr clause) imports))))
+			   config)))
+		  ((require)
+		   (when (eq (car (nth 1 form)) 'quote)
+		     (setq imports (cons (nth 1 (nth 1 form)) imports)))))))
+	  (end-of-stream))
+      (close-file file))
+    (cons defined imports)))
+
+;; signatures of imported structures, by name
+(define import-signatures (make-table symbol-hash eq))
+
+;; Digests the interface and source of the structure called STRUCT, so
+;; that changing either of them changes the key of files importing it
+(define (import-signature struct)
+  (let ((signature (table-ref import-signatures struct)))
+    (unless signature
+      (let ((tem (condition-case nil
+		     (intern-structure struct)
+		   (file-error nil))))
+	(setq signature
+	      (md5-string
+	       (format nil "%S %S"
+		       (and tem (sort (mapcar symbol-name
+					      (structure-interface tem))))
+		       (source-digest struct))))
+	(table-set import-signatures struct signature)))
+    (cons struct signature)))
+
+;; Return the name of the file in the cache that FILE-NAME compiles
+;; to, or false if the cache isn't being used
+(define (cached-file-name file-name)
+  (let ((local (and *compiler-cache-directory*
+		    ;; doc strings are written as a side effect
+		    (not *compiler-write-docs*)
+		    (local-file-name file-name))))
+    (when local
+      (condition-case nil
+	  (let ((key (list rep-version bytecode-major bytecode-minor
+			   *compiler-no-low-level-optimisations*
+			   *compiler-debug*
+			   (mapcar source-digest
+				   (append assembler-sources compiler-sources))
+			   (md5-local-file local)
+			   (mapcar import-signature
+				   (cdr (scan-source-file local))))))
+	    (expand-file-name (concat (number->string
+				       (md5-string (format nil "%S" key)) 16)
+				      ".jlc")
+			      *compiler-cache-directory*))
+	;; let the compiler report errors in the file
+	(error nil)))))
+
+(define (compiled-file-name file-name)
+  (concat file-name (if (string-match "\\.jl$" file-name) ?c ".jlc")))
+
+
+;;; Compiling in parallel
+
+(defvar *compiler-jobs* (let ((jobs (getenv "REP_COMPILE_JOBS")))
+			  (or (and jobs (string->number jobs)) 1))
+  "The number of files that compile-directory compiles at once, each in
+a separate copy of the Lisp process. Initially the value of the
+REP_COMPILE_JOBS environment variable, or one.")
+
+;; Run in a worker process, with standard input and output connected
+;; to the process that forked it. Compiles each file name read, then
+;; prints a `compiled' form with the name and any error, until
+;; something other than a string is read. Doc strings are written to
+;; DOC-FILE, the parent merges them
+(define (compile-worker doc-file)
+  (let ((in (stdin-file))
+	(out (stdout-file))
+	file)
+    (when *compiler-write-docs*
+      (setq documentation-file doc-file))
+    (while (stringp (setq file (condition-case nil
+				   (read in)
+				 (end-of-stream nil))))
+      (let ((error-info (condition-case data
+			    (progn
+			      (compile-file file)
+			      nil)
+			  (error data))))
+	(format out "(compiled %S %S)\n"
+		file (and error-info (format nil "%S" error-info)))
+	(flush-file out)))))
+
+;; Returns an alist mapping each of FILES to the list of the others
+;; defining structures that it imports
+(define (file-dependencies files)
+  (let ((scanned (mapcar (lambda (file)
+			   (cons file (condition-case nil
+					  (scan-source-file file)
+					(error nil))))
+			 files))
+	(defined-by (make-table symbol-hash eq)))
+    (mapc (lambda (cell)
+	    (mapc (lambda (name)
+		    (table-set defined-by name (car cell)))
+		  (cadr cell)))
+	  scanned)
+    (mapcar (lambda (cell)
+	      (let ((deps '()))
+		(mapc (lambda (name)
+			(let ((file (table-ref defined-by name)))
+			  (when (and file (not (equal file (car cell)))
+				     (not (member file deps)))
+			    (setq deps (cons file deps)))))
+		      (cddr cell))
+		(cons (car cell) deps)))
+	    scanned)))
+
+;; Compile FILES using up to JOBS forked worker processes. A file isn't
+;; started until the files defining the structures it imports have
+;; been compiled, unless they import each other. Errors are collected,
+;; and signalled once all the files have been tried
+(define (compile-files-in-parallel files jobs)
+  (let ((deps (file-dependencies files))
+	(pending files)
+	(finished '())
+	(failed '())
+	(idle '())
+	(busy '())			;((PROCESS . FILE) ...)
+	(doc-files '())
+	(n-workers 0))
+
+    (define (ready-p file)
+      (let loop ((rest (cdr (assoc file deps))))
+	(cond ((null rest) t)
+	      ((member (car rest) finished) (loop (cdr rest)))
+	      (t nil))))
+
+    (define (finish proc file error-info)
+      (setq busy (delq (assq proc busy) busy))
+      (setq finished (cons file finished))
+      (when error-info
+	(format (stderr-file) "%s: %s\n" file error-info)
+	(setq failed (cons file failed))))
+
+    (define (start-worker)
+      (let ((pending-output "")
+	    (doc-file (make-temp-name))
+	    proc)
+	(setq proc (make-process
+		    (lambda (text)
+		      (setq pending-output (concat pending-output text))
+		      (let loop ()
+			(when (string-match "\n" pending-output)
+			  (let ((line (substring pending-output
+						 0 (match-end))))
+			    (setq pending-output
+				  (substring pending-output (match-end)))
+			    (if (string-match "^\\(compiled " line)
+				(let ((form (read-from-string line)))
+				  (finish proc (nth 1 form) (nth 2 form))
+				  (setq idle (cons proc idle)))
+			      (write (stdout-file) line))
+			    (loop)))))
+		    (lambda (proc)
+		      (unless (process-in-use-p proc)
+			(let ((cell (assq proc busy)))
+			  (setq idle (delq proc idle))
+			  (setq n-workers (1- n-workers))
+			  (when cell
+			    ;; it died while compiling a file
+			    (finish proc (cdr cell)
+				    (format nil "worker exited with status %d"
+					    (process-exit-value proc)))))))))
+	(set-process-error-stream proc (stderr-file))
+	(setq doc-files (cons doc-file doc-files))
+	(setq n-workers (1+ n-workers))
+	(start-process proc compile-worker doc-file)))
+
+    (define (dispatch file)
+      (let ((proc (if idle
+		      (prog1 (car idle)
+			(setq idle (cdr idle)))
+		    (start-worker))))
+	(setq pending (delete file pending))
+	(setq busy (cons (cons proc file) busy))
+	(report-progress file)
+	(format proc "%S\n" file)))
+
+    (unwind-protect
+	(while (or pending busy)
+	  (let loop ((rest pending))
+	    (when (and rest (or idle (< n-workers jobs)))
+	      (let ((next (cdr rest)))
+		(when (ready-p (car rest))
+		  (dispatch (car rest)))
+		(loop next))))
+	  (when (and pending (null busy))
+	    ;; what's left imports itself
+	    (dispatch (car pending)))
+	  (when busy
+	    (accept-process-output 1)))
+      ;; tell idle workers to exit, kill any that are still busy after
+      ;; a non-local exit, then wait for them
+      (mapc (lambda (proc)
+	      (format proc "()\n"))
+	    idle)
+      (mapc (lambda (cell)
+	      (kill-process (car cell)))
+	    busy)
+      (while (> n-workers 0)
+	(accept-process-output 1)))
+
+    (when *compiler-write-docs*
+      (mapc (lambda (doc-file)
+	      (when (file-exists-p doc-file)
+		(merge-documentation-file doc-file)
+		(delete-file doc-file)))
+	    doc-files))
+
+    (when failed
+      (signal 'compile-error
+	      (cons "Some files failed to compile" (nreverse failed))))))
+
+
 ;;; Top level entrypoints
 
 (define (report-progress filename)
@@ -220,8 +496,35 @@ we would like. This is due to the view of folded functions as
 
 (defun compile-file (file-name)
   "Compiles the file of jade-lisp code FILE-NAME into a new file called
-`(concat FILE-NAME ?c)' (ie, `foo.jl' => `foo.jlc')."
+`(concat FILE-NAME ?c)' (ie, `foo.jl' => `foo.jlc').
+
+If `*compiler-cache-directory*' is set and the file has been compiled
+before, from the same source and with the same compiler and imported
+structures, the compiled file is copied from there instead."
   (interactive "fLisp file to compile:")
+  (let ((cached (cached-file-name file-name)))
+    (if (and cached (file-regular-p cached))
+	(let ((real-name (compiled-file-name file-name)))
+	  (copy-file cached real-name)
+	  (set-file-modes real-name (file-modes file-name))
+	  t)
+      (when (compile-file-1 file-name)
+	(when cached
+	  ;; rename into place, other compilers may share the cache
+	  (let ((temp-file (concat cached (file-name-nondirectory
+					   (make-temp-name)))))
+	    (condition-case nil
+		(progn
+		  (unless (file-directory-p *compiler-cache-directory*)
+		    (make-directory *compiler-cache-directory*))
+		  (copy-file (compiled-file-name file-name) temp-file)
+		  (rename-file temp-file cached))
+	      (file-error
+	       (when (file-exists-p temp-file)
+		 (delete-file temp-file))))))
+	t))))
+
+(define (compile-file-1 file-name)
   (let ((temp-file (make-temp-name))
 	src-file dst-file body header)
     (let-fluids ((current-file file-name)
@@ -260,10 +563,19 @@ we would like. This is due to the view of folded functions as
 			  (end-of-stream))))
 		   (close-file src-file))
 		 (setq body (compile-module-body (nreverse body) t t))
-		 (when (setq dst-file (open-file temp-file 'write))
+		 ;; Use the binary form that load-file maps, unless this
+		 ;; is a script, or something in it can only be printed
+		 (when (or (and (not header)
+				(write-compiled-file
+				 temp-file
+				 (cons (list 'validate-byte-code
+					     bytecode-major bytecode-minor)
+				       (delq nil body))
+				 file-name))
+			   (setq dst-file (open-file temp-file 'write)))
 		   (condition-case error-info
 		       (unwind-protect
-			   (progn
+			   (when dst-file
 			     ;; write out the results
 			     (when header
 			       (write dst-file header))
@@ -273,7 +585,8 @@ we would like. This is due to the view of folded functions as
 				     (when form
 				       (print form dst-file))) body)
 			     (write dst-file ?\n))
-			 (close-file dst-file))
+			 (when dst-file
+			   (close-file dst-file)))
 		     (error
 		      ;; Be sure to remove any partially written dst-file.
 		      ;; Also, signal the error again so that the user sees it.
@@ -283,47 +596,67 @@ we would like. This is due to the view of folded functions as
 		      (throw 'error error-info)))
 		   ;; Copy the file to its correct location, and copy
 		   ;; permissions from source file
-		   (let ((real-name (concat file-name (if (string-match
-							   "\\.jl$" file-name)
-							  ?c ".jlc"))))
+		   (let ((real-name (compiled-file-name file-name)))
 		     (copy-file temp-file real-name)
 		     (set-file-modes real-name (file-modes file-name)))
 		   t)))
 	   (when (file-exists-p temp-file)
 	     (delete-file temp-file))))))))
 
-(defun compile-directory (dir-name #!optional force-p exclude-re)
+(define (files-to-compile dir-name force-p exclude-re)
+  (apply append
+	 (mapcar (lambda (file)
+		   (let ((abs-file (expand-file-name file dir-name)))
+		     (cond ((or (and exclude-re (string-match exclude-re file))
+				(eq (aref file 0) #\.))
+			    '())
+			   ((file-directory-p abs-file)
+			    (files-to-compile abs-file force-p exclude-re))
+			   ((and (string-match "\\.jl$" file)
+				 (let ((c-name (concat abs-file ?c)))
+				   (or force-p (not (file-exists-p c-name))
+				       (file-newer-than-file-p abs-file c-name))))
+			    (list abs-file))
+			   (t '()))))
+		 (sort (directory-files dir-name) <))))
+
+(defun compile-directory (dir-name #!optional force-p exclude-re jobs)
   "Compiles all Lisp files in the directory DIRECTORY-NAME whose object
 files are either older than their source file or don't exist. If
 FORCE-P is true every lisp file is recompiled. Any subdirectories of
 DIR-NAME are recursed into.
 
-EXCLUDE-RE may be a regexp matching files which shouldn't be compiled."
+EXCLUDE-RE may be a regexp matching files which shouldn't be compiled.
+
+JOBS is the number of files to compile at once, by default the value of
+`*compiler-jobs*'. When it's more than one, files are compiled by that
+many copies of this process, each after the files defining the
+structures that it imports."
   (interactive "DDirectory of Lisp files to compile:\nP")
-  (mapc (lambda (file)
-	  (unless (or (and exclude-re (string-match exclude-re file))
-		      (eq (aref file 0) #\.))
-	    (let ((abs-file (expand-file-name file dir-name)))
-	      (cond ((file-directory-p abs-file)
-		     (compile-directory abs-file force-p exclude-re))
-		    ((string-match "\\.jl$" file)
-		     (let* ((c-name (concat abs-file ?c)))
-		       (when (or force-p (not (file-exists-p c-name))
-				 (file-newer-than-file-p abs-file c-name))
-			 (report-progress abs-file)
-			 (compile-file abs-file))))))))
-	(sort (directory-files dir-name) <))
+  (let ((files (files-to-compile dir-name force-p exclude-re)))
+    (if (and (> (or jobs *compiler-jobs*) 1) (cdr files))
+	(compile-files-in-parallel files (or jobs *compiler-jobs*))
+      (mapc (lambda (file)
+	      (report-progress file)
+	      (compile-file file))
+	    files)))
   t)
 
 (defun compile-lisp-lib (#!optional directory force-p)
   "Recompile all out of date files in the lisp library directory. If FORCE-P
 is true it's as though all files were out of date.
 This makes sure that all doc strings are written to their special file and
-that files which shouldn't be compiled aren't."
+that files which shouldn't be compiled aren't.
+
+The files are compiled by one worker process per processor, up to eight,
+unless the REP_COMPILE_JOBS environment variable gives the number."
   (interactive "\nP")
   (let ((*compiler-write-docs* t))
     (compile-directory (or directory lisp-lib-directory)
-		       force-p lib-exclude-re)))
+		       force-p lib-exclude-re
+		       (if (getenv "REP_COMPILE_JOBS")
+			   *compiler-jobs*
+			 (min (processor-count) lib-max-jobs)))))
 
 ;; Call like `rep --batch -l compiler -f compile-lib-batch [--force] DIR'
 (defun compile-lib-batch ()
@@ -357,4 +690,163 @@ that files which shouldn't be compiled aren't."
 ;; Used when bootstrapping from the Makefile, recompiles compiler.jl if
 ;; it's out of date
 (defun compile-compiler () (bootstrap compiler-sources))
-(defun compile-assembler () (bootstrap assembler-sources)))
+(defun compile-assembler () (bootstrap assembler-sources))
+
+
+;;; tests
+
+;;###autoload
+(define-self-test 'rep.vm.compiler
+  (lambda ()
+    ;; closures made in a loop see the value each binding had, those
+    ;; made after a binding is modified see the new value
+    (define (adder n) (lambda (x) (+ x n)))
+    (define (counters k)
+      (let loop ((i 0) (out '()))
+	(if (= i k)
+	    (mapcar (lambda (f) (f)) out)
+	  (loop (1+ i) (cons (lambda () i) out)))))
+    (define (nested a b)
+      (let ((c (+ a b)))
+	(lambda (x)
+	  (list a c ((lambda () (list b x)))))))
+
+    ;; the value of the case form is popped once after each iteration
+    (define (count-as lst)
+      (let ((n 0))
+	(unwind-protect
+	    (condition-case nil
+		(while t
+		  (let ((x (if lst
+			       (prog1 (car lst) (setq lst (cdr lst)))
+			     (error "End of list"))))
+		    (case x
+		      ((a) (setq n (1+ n))))))
+	      (error))
+	  (setq lst nil))
+	n))
+
+    (test (equal (mapcar (adder 3) '(1 2 3)) '(4 5 6)))
+    (test (equal (counters 3) '(2 1 0)))
+    (test (equal ((nested 1 2) 4) '(1 3 (2 4))))
+    (let* ((v 1)
+	   (f (lambda () v)))
+      (setq v 2)
+      (test (eql (f) 2)))
+    (letrec ((count (lambda (n) (if (= n 0) 'done (count (1- n))))))
+      (test (eq (count 10) 'done)))
+    (test (eql (count-as '(a b a c a)) 3))
+
+    (let ((file (concat (make-temp-name) ".jl"))
+	  (cache (make-temp-name)))
+      (define (write-source text)
+	(let ((out (open-file file 'write)))
+	  (write out text)
+	  (close-file out)))
+      (define (cached-files)
+	(mapcar (lambda (f) (expand-file-name f cache))
+		(delete-if-not (lambda (f) (string-match "\\.jlc$" f))
+			       (directory-files cache))))
+      (let ((*compiler-cache-directory* cache))
+	(unwind-protect
+	    (progn
+	      (write-source "(list 1)\n")
+	      (test (compile-file file))
+	      (test (equal (load-file (concat file ?c)) '(1)))
+	      (test (= (length (cached-files)) 1))
+	      ;; the cached file is used, the source isn't compiled
+	      (write-compiled-file (car (cached-files)) '((list 2)))
+	      (delete-file (concat file ?c))
+	      (test (compile-file file))
+	      (test (equal (load-file (concat file ?c)) '(2)))
+	      ;; a changed source file is compiled again
+	      (write-source "(list 3)\n")
+	      (test (compile-file file))
+	      (test (equal (load-file (concat file ?c)) '(3)))
+	      (test (= (length (cached-files)) 2)))
+	  (mapc delete-file (list* file (concat file ?c) (cached-files)))
+	  (delete-directory cache))))
+
+    ;; compiling directories with worker processes. Calls FUN with a
+    ;; function mapping a file name to its path in a new directory
+    ;; holding SOURCES, an alist of file names and contents
+    (define (call-with-sources sources fun)
+      (let ((dir (make-temp-name)))
+	(define (in-dir name) (expand-file-name name dir))
+	(make-directory dir)
+	(unwind-protect
+	    (progn
+	      (mapc (lambda (cell)
+		      (let ((out (open-file (in-dir (car cell)) 'write)))
+			(write out (cdr cell))
+			(close-file out)))
+		    sources)
+	      (fun dir in-dir))
+	  (mapc (lambda (f)
+		  (delete-file (in-dir f)))
+		(delete "." (delete ".." (directory-files dir))))
+	  (delete-directory dir))))
+
+    ;; errors are collected, the other files are still compiled
+    (call-with-sources
+     '(("a.jl" . "(list \"a.jl\")\n")
+       ("b.jl" . "(list \"b.jl\")\n")
+       ("c.jl" . "(list 3\n"))
+     (lambda (dir in-dir)
+       (test (equal (condition-case data
+			(compile-directory dir t nil 2)
+		      (compile-error (cdr data)))
+		    (list "Some files failed to compile" (in-dir "c.jl"))))
+       (test (equal (load-file (in-dir "a.jlc")) (list "a.jl")))
+       (test (equal (load-file (in-dir "b.jlc")) (list "b.jl")))
+       (test (not (file-exists-p (in-dir "c.jlc"))))))
+
+    ;; a file isn't given to a worker until the file defining the
+    ;; structure it opens has been compiled, even when a worker is free.
+    ;; Each writes to LOG as it's compiled, from an anonymous structure
+    ;; since compile-time forms are evaluated in the compiler's own;
+    ;; were test-a compiled first, test-z would be loaded from source,
+    ;; writing nothing
+    (let ((log (make-temp-name)))
+      (define (log-form text)
+	(format nil "(eval-when-compile
+    (structure () (open rep rep.io.files)
+      (let ((out (open-file %S 'append)))
+        (write out %S)
+        (close-file out))))\n"
+		log text))
+      (unwind-protect
+	  (call-with-sources
+	   (list (cons "a.jl" (concat "(define-structure test-a (export)
+  (open rep test-z)\n  "
+				      (log-form "a") ")\n"))
+		 (cons "z.jl" (concat "(define-structure test-z (export)
+  (open rep)\n  "
+				      (log-form "<")
+				      "  (eval-when-compile
+    (structure () (open rep rep.system) (sleep-for 0 300)))\n  "
+				      (log-form ">") ")\n")))
+	   (lambda (dir in-dir)
+	     (declare (unused in-dir))
+	     (let ((load-path (cons dir load-path)))
+	       (test (compile-directory dir t nil 2))
+	       (test (equal (let ((in (open-file log 'read)))
+			      (prog1 (read-line in)
+				(close-file in)))
+			    "<>a")))))
+	(when (file-exists-p log)
+	  (delete-file log))))
+
+    ;; a worker that dies fails the file it was compiling
+    (call-with-sources
+     '(("a.jl" . "(list \"a.jl\")\n")
+       ("b.jl" . "(eval-when-compile (throw 'quit 3))\n(list \"b.jl\")\n")
+       ("c.jl" . "(list \"c.jl\")\n"))
+     (lambda (dir in-dir)
+       (test (equal (condition-case data
+			(compile-directory dir t nil 2)
+		      (compile-error (cdr data)))
+		    (list "Some files failed to compile" (in-dir "b.jl"))))
+       (test (equal (load-file (in-dir "a.jlc")) (list "a.jl")))
+       (test (not (file-exists-p (in-dir "b.jlc"))))
+       (test (equal (load-file (in-dir "c.jlc")) (list "c.jl"))))))))
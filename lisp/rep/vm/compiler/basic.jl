@@ -39,6 +39,7 @@
 	    call-with-lambda-record
 	    assembly-code assembly-code-set
 	    assembly-slots assembly-slots-set
+	    assembly-max-b-stack assembly-max-b-stack-set
 	    compile-constant compile-form-1 compile-body
 	    compile-lambda compile-lambda-constant
 	    compile-form
@@ -183,7 +183,8 @@
 	   (decrement-stack))
 	  ((lexically-bound-p sym)
 	    ;; The lexical address is known. Use it to avoid scanning
-	   (emit-insn `(lex-set ,sym ,(fluid lex-bindings))))
+	   (emit-insn `(lex-set ,sym ,(fluid lex-bindings)))
+	   (tag-binding sym 'reassigned))
 	  (t
 	   ;; No lexical binding, but not special either. Just
 	   ;; update the global value
@@ -214,16 +215,30 @@
 	;; used to tag bindings unconditionally on the heap
 	(cell-tagged-p 'heap-allocated cell)))
 
-  ;; heap addresses count up from the _most_ recent binding
-  (define (heap-address var bindings)
-    (let loop ((rest bindings)
-	       (i 0))
-      (cond ((null rest) (error "No heap address for %s" var))
-	    ((or (not (heap-binding-p (car rest)))
-		 (cell-tagged-p 'no-location (car rest)))
-	     (loop (cdr rest) i))
-	    ((eq (caar rest) var) i)
-	    (t (loop (cdr rest) (1+ i))))))
+;; heap addresses count up from the _most_ recent binding. COPIES is
+  ;; an alist (BASE . CELLS): the bindings copied into the environment
+  ;; of each closure whose own bindings end at BASE, most recent first.
+  ;; These come between the closure's own bindings and those of the
+  ;; environment it was made in
+  (define (heap-address var bindings #!optional copies)
+    (let ((cell (assq var bindings)))
+      (let loop ((rest bindings)
+		 (i 0))
+	(let ((copied (cdr (assq rest copies))))
+	  (cond ((memq cell copied)
+		 (+ i (- (length copied) (length (memq cell copied)))))
+		((null rest) (error "No heap address for %s" var))
+		(t
+		 (setq i (+ i (length copied)))
+		 (cond ((or (not (heap-binding-p (car rest)))
+			    (cell-tagged-p 'no-location (car rest)))
+			(loop (cdr rest) i))
+		       ((eq (caar rest) var) i)
+		       (t (loop (cdr rest) (1+ i))))))))))
+
+  (define (copied-binding-p cell copies)
+    (let loop ((rest copies))
+      (and rest (or (memq cell (cdar rest)) (loop (cdr rest))))))
 
   ;; slot addresses count up from the _least_ recent binding
   (define (slot-address var bindings base)
@@ -239,22 +254,52 @@
 		     (t (loop-2 (cdr rest) (1+ i))))))
 	    (t (loop (cdr rest))))))
 
-  (define (identify-captured-bindings asm lex-env)
+  ;; Tag the bindings outside ASM (i.e. in LEX-ENV) that it references.
+  ;; A binding that's never assigned to, and is only referenced from
+  ;; closures made by the function that binds it (i.e. isn't in
+  ;; OUTER-ENV), is tagged `copied': it can stay in a slot register,
+  ;; with its value copied into the environment of each closure as
+  ;; it's made. Other bindings are shared with the closure, so they're
+  ;; tagged `captured' and allocated on the heap
+  (define (identify-captured-bindings asm lex-env outer-env)
     (mapc (lambda (insn)
 	    (case (car insn)
 	      ((lex-ref lex-set)
-	       (let ((cell (assq (nth 1 insn) lex-env)))
-		 (when cell
-		   (tag-cell 'captured cell))))
+	       (let ((cell (assq (nth 1 insn) (nth 2 insn))))
+		 (when (memq cell lex-env)
+		   (tag-cell (if (or (memq cell outer-env)
+				     (cell-tagged-p 'reassigned cell)
+				     (cell-tagged-p 'heap-allocated cell))
+				 'captured
+			       'copied) cell))))
 	      ((push-bytecode)
-	       (identify-captured-bindings (nth 1 insn) (nth 2 insn)))))
+	       (identify-captured-bindings (nth 1 insn) (nth 2 insn) lex-env))))
 	  (assembly-code asm)))
 
+  ;; Return the bindings to copy into the environment of closure ASM,
+  ;; made where the bindings are ENV, most recent first. BASE is the
+  ;; environment of the function making the closure
+  (define (closure-copies asm env base)
+    (let ((copies '()))
+      (mapc (lambda (insn)
+	      (when (eq (car insn) 'lex-ref)
+		(let ((cell (assq (nth 1 insn) (nth 2 insn))))
+		  (when (and (cell-tagged-p 'copied cell)
+			     (not (heap-binding-p cell))
+			     (memq cell env)
+			     (not (memq cell base))
+			     (not (memq cell copies)))
+		    (setq copies (cons cell copies))))))
+	    (assembly-code asm))
+      copies))
+
   ;; Extra pass over the output pseudo-assembly code; converts
   ;; pseudo-instructions accessing lexical bindings into real
-  ;; instructions accessing either the heap or the slot registers
-  (define (allocate-bindings-1 asm base-env)
-    (let ((max-slot 0))
+  ;; instructions accessing either the heap or the slot registers.
+  ;; COPIES is as for heap-address
+  (define (allocate-bindings-1 asm base-env #!optional copies)
+    (let ((max-slot 0)
+	  (copying nil))
       (let loop ((rest (assembly-code asm)))
 	(when rest
 	  (case (caar rest)
@@ -262,13 +307,13 @@
 	     (let* ((var (nth 1 (car rest)))
 		    (bindings (nth 2 (car rest)))
 		    (cell (assq var bindings)))
-	       (if (heap-binding-p cell)
+	       (if (or (heap-binding-p cell) (copied-binding-p cell copies))
 		   (rplaca rest (case (caar rest)
 				  ((lex-bind) (list 'bind))
 				  ((lex-ref)
-				   (list 'refn (heap-address var bindings)))
+				   (list 'refn (heap-address var bindings copies)))
 				  ((lex-set)
-				   (list 'setn (heap-address var bindings)))))
+				   (list 'setn (heap-address var bindings copies)))))
 		 (let ((slot (slot-address var bindings base-env)))
 		   (setq max-slot (max max-slot (1+ slot)))
 		   (rplaca rest (case (caar rest)
@@ -277,19 +322,49 @@
 				  ((lex-ref)
 				   (list 'slot-ref slot))))))))
 	    ((push-bytecode)
-	     (let ((asm (nth 1 (car rest)))
-		   (env (nth 2 (car rest)))
-		   (doc (nth 3 (car rest)))
-		   (interactive (nth 4 (car rest))))
-	       (allocate-bindings-1 asm env)
-	       (rplaca rest (list 'push (assemble-assembly-to-subr
-					 asm doc interactive))))))
+	     (let* ((asm (nth 1 (car rest)))
+		    (env (nth 2 (car rest)))
+		    (doc (nth 3 (car rest)))
+		    (interactive (nth 4 (car rest)))
+		    (inner-copies (closure-copies asm env base-env))
+		    (insn (list 'push (progn
+					(allocate-bindings-1
+					 asm env (if inner-copies
+						     (cons (cons env inner-copies)
+							   copies)
+						   copies))
+					(assemble-assembly-to-subr
+					 asm doc interactive)))))
+	       (if (null inner-copies)
+		   (rplaca rest insn)
+		 ;; bind the copies around the following `enclose':
+		 ;;	init-bind
+		 ;;	slot-ref #N; bind	[for each copy]
+		 ;;	push CODE
+		 ;;	enclose
+		 ;;	unbind
+		 (let ((enclose (cdr rest))
+		       (out '()))
+		   (unless (eq (caar enclose) 'enclose)
+		     (error "No enclose after pushed bytecode: %S" enclose))
+		   (mapc (lambda (cell)
+			   (let ((slot (slot-address (car cell) env base-env)))
+			     (setq max-slot (max max-slot (1+ slot)))
+			     (setq out (list* (list 'slot-ref slot)
+					      (list 'bind) out))))
+			 inner-copies)
+		   (rplaca rest (list 'init-bind))
+		   (rplacd rest (nconc out (list insn) enclose))
+		   (rplacd enclose (cons (list 'unbind) (cdr enclose)))
+		   (setq copying t))))))
 	  (loop (cdr rest))))
       (assembly-slots-set asm max-slot)
+      (when copying
+	(assembly-max-b-stack-set asm (1+ (assembly-max-b-stack asm))))
       asm))
 
   (define (allocate-bindings asm)
-    (identify-captured-bindings asm (fluid lex-bindings))
+    (identify-captured-bindings asm (fluid lex-bindings) (fluid lex-bindings))
     (allocate-bindings-1 asm (fluid lex-bindings)))
 
 
@@ -667,7 +667,8 @@
       (increment-stack)
       (fix-label end-label)
       (emit-insn '(swap))
-      (emit-insn '(pop))))
+      (emit-insn '(pop))
+      (decrement-stack)))
   (put 'case 'rep-compile-fun compile-case)
 
   (defun compile-catch (form)
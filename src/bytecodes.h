@@ -44,6 +44,10 @@
    first opcode is the high bits, the second the low bits. */
 #define OP_ARG_2BYTE 7
 
+/* The most slots a frame may have, slot numbers having at most two
+   opcodes. Larger sizes in a function's stack word are rejected. */
+#define BYTECODE_MAX_SLOTS 0x10000
+
 
 /* Opcodes which have an argument encoded in them */
 
@@ -270,6 +274,27 @@
 #define OP_OPTIONAL_ARG_ 0xce
 #define OP_KEYWORD_ARG_ 0xcf
 
+/* Quickened instructions. These never appear in compiled code, the VM
+   rewrites the generic instructions in its private copies of hot
+   functions to them after seeing the types of their operands. Each
+   checks that its operands are still of those types, if not it
+   rewrites itself back to the generic instruction. */
+
+#define OP_ADD_FIX 0xd0			/* add, fixnums */
+#define OP_SUB_FIX 0xd1			/* sub, fixnums */
+#define OP_MUL_FIX 0xd2			/* mul, fixnums */
+#define OP_INC_FIX 0xd3			/* inc, fixnum */
+#define OP_DEC_FIX 0xd4			/* dec, fixnum */
+#define OP_NUM_EQ_FIX 0xd5		/* num-eq, fixnums */
+#define OP_LT_FIX 0xd6			/* lt, fixnums */
+#define OP_GT_FIX 0xd7			/* gt, fixnums */
+#define OP_LE_FIX 0xd8			/* le, fixnums */
+#define OP_GE_FIX 0xd9			/* ge, fixnums */
+#define OP_CAR_CONS 0xda		/* car, cons */
+#define OP_CDR_CONS 0xdb		/* cdr, cons */
+#define OP_AREF_VECT 0xdc		/* aref, vector and fixnum */
+#define OP_ASET_VECT 0xdd		/* aset, vector and fixnum */
+
 
 /* Jump opcodes */
 
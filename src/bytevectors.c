@@ -0,0 +1,780 @@
+/* bytevectors.c -- vectors of bytes, which may share their contents
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
+
+/* A bytevector either owns a block of memory, or is a window on the
+   contents of another bytevector or of a string, its base. Windows
+   refer to their base as a Lisp object, keeping it alive, and find
+   their contents through it each time since string contents can move
+   (see compact_string_arena in values.c).
+
+   The base of a window is always a string or a bytevector owning its
+   memory, so that finding the contents never takes more than two
+   steps. A bytevector that owns its memory can later hand it over to
+   a string (see bytevector->string), then it becomes a window on
+   that string. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include <string.h>
+#include <stdint.h>
+
+typedef struct bytevector_struct {
+    repv car;
+    struct bytevector_struct *next;
+
+    /* nil if this owns DATA, otherwise the string or bytevector whose
+       contents this is a window on, from byte OFFSET */
+    repv base;
+    char *data;
+    long offset;
+    long len;
+} bytevector;
+
+#define BYTEVECTOR(v)	((bytevector *) rep_PTR (v))
+
+int rep_bytevector_type;
+
+static bytevector *bytevector_chain;
+
+/* Element types of bytevector-ref and bytevector-set */
+enum { BV_U8, BV_S8, BV_U16, BV_S16, BV_U32, BV_S32,
+       BV_U64, BV_S64, BV_F32, BV_F64, BV_KINDS };
+
+/* u8, u32, s32, f32 and f64 are shared with numeric-vectors.c */
+DEFSYM(s8, "s8");
+DEFSYM(u16, "u16");
+DEFSYM(s16, "s16");
+DEFSYM(u64, "u64");
+DEFSYM(s64, "s64");
+DEFSYM(big, "big");
+DEFSYM(little, "little");
+
+static repv *kind_names[BV_KINDS] = {
+    &Qu8, &Qs8, &Qu16, &Qs16, &Qu32, &Qs32, &Qu64, &Qs64, &Qf32, &Qf64
+};
+
+static const int kind_sizes[BV_KINDS] = { 1, 1, 2, 2, 4, 4, 8, 8, 4, 8 };
+
+static int
+symbol_kind (repv sym)
+{
+    int k;
+    for (k = 0; k < BV_KINDS; k++)
+    {
+	if (sym == *kind_names[k])
+	    return k;
+    }
+    return -1;
+}
+
+static inline char *
+bytevector_bytes (bytevector *b)
+{
+    if (b->base == Qnil)
+	return b->data;
+    else if (rep_STRINGP (b->base))
+	return rep_STR (b->base) + b->offset;
+    else
+	return bytevector_bytes (BYTEVECTOR (b->base)) + b->offset;
+}
+
+/* Return the string whose contents B shares, or nil */
+static repv
+bytevector_string (bytevector *b)
+{
+    while (b->base != Qnil)
+    {
+	if (rep_STRINGP (b->base))
+	    return b->base;
+	b = BYTEVECTOR (b->base);
+    }
+    return Qnil;
+}
+
+static repv
+alloc_bytevector (repv base, char *data, long offset, long len)
+{
+    bytevector *b = rep_ALLOC_CELL (sizeof (bytevector));
+    if (b == 0)
+	return rep_mem_error ();
+    b->car = rep_bytevector_type;
+    b->base = base;
+    b->data = data;
+    b->offset = offset;
+    b->len = len;
+    b->next = bytevector_chain;
+    bytevector_chain = b;
+    rep_NOTE_ALLOC (rep_bytevector_type, sizeof (bytevector)
+		    + (data != 0 ? len : 0));
+    return rep_VAL (b);
+}
+
+/* Return a new bytevector owning LEN bytes of memory. They're followed
+   by a zero byte, so that they can be given to a string. */
+static repv
+make_bytevector (long len)
+{
+    repv bv;
+    char *data = rep_alloc (len + 1);
+    if (data == 0)
+	return rep_mem_error ();
+    data[len] = 0;
+    bv = alloc_bytevector (Qnil, data, 0, len);
+    if (bv == rep_NULL)
+	rep_free (data);
+    return bv;
+}
+
+/* Return a window on LEN bytes of bytevector or string BASE from
+   byte OFFSET */
+static repv
+make_window (repv base, long offset, long len)
+{
+    if (rep_BYTEVECTORP (base) && BYTEVECTOR (base)->base != Qnil)
+    {
+	offset += BYTEVECTOR (base)->offset;
+	base = BYTEVECTOR (base)->base;
+    }
+    return alloc_bytevector (base, 0, offset, len);
+}
+
+/* Called after changing the contents of B */
+static void
+bytevector_modified (bytevector *b)
+{
+    repv str = bytevector_string (b);
+    if (str != Qnil)
+	rep_string_modified (str);
+}
+
+/* Check the optional START and END arguments (numbers ARGN and ARGN+1)
+   against LEN, storing the range they denote */
+static rep_bool
+get_range (long len, repv start, repv end, int argn, long *s, long *e)
+{
+    *s = 0;
+    *e = len;
+    if (start != Qnil)
+    {
+	if (!rep_INTP (start) || rep_INT (start) < 0 || rep_INT (start) > len)
+	{
+	    rep_signal_arg_error (start, argn);
+	    return rep_FALSE;
+	}
+	*s = rep_INT (start);
+    }
+    if (end != Qnil)
+    {
+	if (!rep_INTP (end) || rep_INT (end) < *s || rep_INT (end) > len)
+	{
+	    rep_signal_arg_error (end, argn + 1);
+	    return rep_FALSE;
+	}
+	*e = rep_INT (end);
+    }
+    return rep_TRUE;
+}
+
+/* Decode the ENDIAN argument (number ARGN), storing true in *SWAP if
+   values have to be byte-swapped */
+static rep_bool
+get_swap (repv endian, int argn, rep_bool *swap)
+{
+    static const union { uint16_t s; unsigned char b[2]; } probe = { 1 };
+    rep_bool native_big = (probe.b[0] == 0);
+    if (endian == Qnil)
+	*swap = rep_FALSE;
+    else if (endian == Qbig)
+	*swap = !native_big;
+    else if (endian == Qlittle)
+	*swap = native_big;
+    else
+    {
+	rep_signal_arg_error (endian, argn);
+	return rep_FALSE;
+    }
+    return rep_TRUE;
+}
+
+static inline void
+swap_bytes (unsigned char *p, int n)
+{
+    int i;
+    for (i = 0; i < n / 2; i++)
+    {
+	unsigned char tem = p[i];
+	p[i] = p[n - 1 - i];
+	p[n - 1 - i] = tem;
+    }
+}
+
+/* Make an unsigned 64-bit integer */
+static repv
+make_u64 (uint64_t x)
+{
+    if (x <= INT64_MAX)
+	return rep_make_longlong_int ((rep_long_long) x);
+#if SIZEOF_LONG >= 8
+    return rep_make_long_uint ((unsigned long) x);
+#else
+    return rep_number_add (Fash (rep_make_long_uint (x >> 32),
+				 rep_MAKE_INT (32)),
+			   rep_make_long_uint (x & 0xffffffff));
+#endif
+}
+
+/* Convert X to the integer *OUT, returning false unless it's exact
+   and lies between MIN and MAX. MAX is unsigned, for u64. */
+static rep_bool
+get_integer (repv x, rep_long_long min, uint64_t max, uint64_t *out)
+{
+    rep_long_long n;
+    if (!rep_INTEGERP (x))
+	return rep_FALSE;
+    n = rep_get_longlong_int (x);
+    if (!rep_INTP (x) && rep_compare_numbers (x, rep_make_longlong_int (n)))
+    {
+	/* too large for a long long, may still be a u64 */
+	if (max <= INT64_MAX || rep_compare_numbers (x, make_u64 (max)) > 0
+	    || rep_compare_numbers (x, rep_MAKE_INT (0)) < 0)
+	{
+	    return rep_FALSE;
+	}
+#if SIZEOF_LONG >= 8
+	*out = rep_get_long_uint (x);
+#else
+	*out = ((uint64_t) rep_get_long_uint
+		(Fash (x, rep_MAKE_INT (-32))) << 32)
+	       | rep_get_long_uint (rep_number_logand
+				    (x, rep_make_long_uint (0xffffffff)));
+#endif
+	return rep_TRUE;
+    }
+    if (n < min || (n > 0 && (uint64_t) n > max))
+	return rep_FALSE;
+    *out = (uint64_t) n;
+    return rep_TRUE;
+}
+
+
+/* Entry points for other modules */
+
+char *
+rep_bytevector_data (repv bv)
+{
+    return bytevector_bytes (BYTEVECTOR (bv));
+}
+
+long
+rep_bytevector_length (repv bv)
+{
+    return BYTEVECTOR (bv)->len;
+}
+
+/* Called after writing directly into the memory returned by
+   rep_bytevector_data */
+void
+rep_bytevector_modified (repv bv)
+{
+    bytevector_modified (BYTEVECTOR (bv));
+}
+
+repv
+rep_bytevector_ref (repv bv, long i)
+{
+    return rep_MAKE_INT (((unsigned char *) rep_bytevector_data (bv))[i]);
+}
+
+repv
+rep_bytevector_set (repv bv, long i, repv x)
+{
+    if (!rep_INTP (x) || rep_INT (x) < 0 || rep_INT (x) > 255)
+	return rep_signal_arg_error (x, 3);
+    rep_bytevector_data (bv)[i] = rep_INT (x);
+    bytevector_modified (BYTEVECTOR (bv));
+    return x;
+}
+
+repv
+rep_bytevector_copy (repv bv, long start, long end)
+{
+    repv new = make_bytevector (end - start);
+    if (new != rep_NULL)
+    {
+	memcpy (BYTEVECTOR (new)->data,
+		rep_bytevector_data (bv) + start, end - start);
+    }
+    return new;
+}
+
+
+/* Lisp functions */
+
+DEFUN("make-bytevector", Fmake_bytevector, Smake_bytevector,
+      (repv len, repv init), rep_Subr2) /*
+::doc:rep.data#make-bytevector::
+make-bytevector LENGTH [INITIAL-VALUE]
+
+Return a new bytevector of LENGTH bytes, each set to INITIAL-VALUE, an
+integer between 0 and 255, or zero.
+::end:: */
+{
+    repv bv;
+    rep_DECLARE1 (len, rep_INTP);
+    if (rep_INT (len) < 0)
+	return rep_signal_arg_error (len, 1);
+    if (init == Qnil)
+	init = rep_MAKE_INT (0);
+    else if (!rep_INTP (init) || rep_INT (init) < 0 || rep_INT (init) > 255)
+	return rep_signal_arg_error (init, 2);
+    bv = make_bytevector (rep_INT (len));
+    if (bv != rep_NULL)
+	memset (BYTEVECTOR (bv)->data, rep_INT (init), rep_INT (len));
+    return bv;
+}
+
+DEFUN("bytevector", Fbytevector, Sbytevector,
+      (int argc, repv *argv), rep_SubrV) /*
+::doc:rep.data#bytevector::
+bytevector BYTES...
+
+Return a new bytevector containing the integers BYTES.
+::end:: */
+{
+    repv bv = make_bytevector (argc);
+    int i;
+    for (i = 0; bv != rep_NULL && i < argc; i++)
+    {
+	if (!rep_INTP (argv[i]) || rep_INT (argv[i]) < 0
+	    || rep_INT (argv[i]) > 255)
+	{
+	    return rep_signal_arg_error (argv[i], i + 1);
+	}
+	BYTEVECTOR (bv)->data[i] = rep_INT (argv[i]);
+    }
+    return bv;
+}
+
+DEFUN("bytevectorp", Fbytevectorp, Sbytevectorp, (repv arg), rep_Subr1) /*
+::doc:rep.data#bytevectorp::
+bytevectorp ARG
+
+Returns t when ARG is a bytevector.
+::end:: */
+{
+    return rep_BYTEVECTORP (arg) ? Qt : Qnil;
+}
+
+DEFUN("bytevector-slice", Fbytevector_slice, Sbytevector_slice,
+      (repv bv, repv start, repv end), rep_Subr3) /*
+::doc:rep.data#bytevector-slice::
+bytevector-slice BYTEVECTOR START [END]
+
+Return a bytevector sharing the bytes of BYTEVECTOR from index START up
+to END (or its end), without copying them. Changes to either are seen
+by the other.
+::end:: */
+{
+    long s, e;
+    rep_DECLARE1 (bv, rep_BYTEVECTORP);
+    rep_DECLARE2 (start, rep_INTP);
+    if (!get_range (BYTEVECTOR (bv)->len, start, end, 2, &s, &e))
+	return rep_NULL;
+    return make_window (bv, s, e - s);
+}
+
+DEFUN("bytevector-copy", Fbytevector_copy, Sbytevector_copy,
+      (repv bv, repv start, repv end), rep_Subr3) /*
+::doc:rep.data#bytevector-copy::
+bytevector-copy BYTEVECTOR [START [END]]
+
+Return a new bytevector containing a copy of the bytes of BYTEVECTOR
+from index START (or zero) up to END (or its end).
+::end:: */
+{
+    long s, e;
+    rep_DECLARE1 (bv, rep_BYTEVECTORP);
+    if (!get_range (BYTEVECTOR (bv)->len, start, end, 2, &s, &e))
+	return rep_NULL;
+    return rep_bytevector_copy (bv, s, e);
+}
+
+DEFUN("bytevector-replace", Fbytevector_replace, Sbytevector_replace,
+      (repv dst, repv dst_start, repv src, repv start, repv end),
+      rep_Subr5) /*
+::doc:rep.data#bytevector-replace::
+bytevector-replace DEST DEST-START SOURCE [START [END]]
+
+Copy the bytes of bytevector SOURCE from index START (or zero) up to
+END (or its end) into bytevector DEST, starting at index DEST-START.
+The two may overlap. Returns DEST.
+::end:: */
+{
+    long s, e, ds;
+    rep_DECLARE1 (dst, rep_BYTEVECTORP);
+    rep_DECLARE2 (dst_start, rep_INTP);
+    rep_DECLARE3 (src, rep_BYTEVECTORP);
+    if (!get_range (BYTEVECTOR (src)->len, start, end, 4, &s, &e))
+	return rep_NULL;
+    ds = rep_INT (dst_start);
+    if (ds < 0 || ds + (e - s) > BYTEVECTOR (dst)->len)
+	return rep_signal_arg_error (dst_start, 2);
+    memmove (rep_bytevector_data (dst) + ds,
+	     rep_bytevector_data (src) + s, e - s);
+    bytevector_modified (BYTEVECTOR (dst));
+    return dst;
+}
+
+DEFUN("bytevector-fill", Fbytevector_fill, Sbytevector_fill,
+      (repv bv, repv x, repv start, repv end), rep_Subr4) /*
+::doc:rep.data#bytevector-fill::
+bytevector-fill BYTEVECTOR VALUE [START [END]]
+
+Set the bytes of BYTEVECTOR from index START (or zero) up to END (or
+its end) to the integer VALUE. Returns BYTEVECTOR.
+::end:: */
+{
+    long s, e;
+    rep_DECLARE1 (bv, rep_BYTEVECTORP);
+    if (!rep_INTP (x) || rep_INT (x) < 0 || rep_INT (x) > 255)
+	return rep_signal_arg_error (x, 2);
+    if (!get_range (BYTEVECTOR (bv)->len, start, end, 3, &s, &e))
+	return rep_NULL;
+    memset (rep_bytevector_data (bv) + s, rep_INT (x), e - s);
+    bytevector_modified (BYTEVECTOR (bv));
+    return bv;
+}
+
+DEFUN("bytevector-ref", Fbytevector_ref, Sbytevector_ref,
+      (repv bv, repv type, repv index, repv endian), rep_Subr4) /*
+::doc:rep.data#bytevector-ref::
+bytevector-ref BYTEVECTOR TYPE INDEX [ENDIAN]
+
+Return the number of type TYPE stored in BYTEVECTOR starting at byte
+INDEX, which needn't be aligned. TYPE is one of the symbols `u8', `s8',
+`u16', `s16', `u32', `s32', `u64', `s64' (unsigned and signed integers
+of that many bits), `f32' or `f64' (single and double precision
+floats). ENDIAN is `big' or `little', or nil for the byte order of the
+host.
+::end:: */
+{
+    int kind = symbol_kind (type);
+    rep_bool swap;
+    union {
+	unsigned char b[8];
+	uint8_t u8; int8_t s8; uint16_t u16; int16_t s16;
+	uint32_t u32; int32_t s32; uint64_t u64; int64_t s64;
+	float f32; double f64;
+    } u;
+
+    rep_DECLARE1 (bv, rep_BYTEVECTORP);
+    if (kind < 0)
+	return rep_signal_arg_error (type, 2);
+    rep_DECLARE3 (index, rep_INTP);
+    if (rep_INT (index) < 0
+	|| rep_INT (index) + kind_sizes[kind] > BYTEVECTOR (bv)->len)
+    {
+	return rep_signal_arg_error (index, 3);
+    }
+    if (!get_swap (endian, 4, &swap))
+	return rep_NULL;
+
+    memcpy (u.b, rep_bytevector_data (bv) + rep_INT (index),
+	    kind_sizes[kind]);
+    if (swap)
+	swap_bytes (u.b, kind_sizes[kind]);
+
+    switch (kind)
+    {
+    case BV_U8: return rep_MAKE_INT (u.u8);
+    case BV_S8: return rep_MAKE_INT (u.s8);
+    case BV_U16: return rep_MAKE_INT (u.u16);
+    case BV_S16: return rep_MAKE_INT (u.s16);
+    case BV_U32: return rep_make_long_uint (u.u32);
+    case BV_S32: return rep_make_long_int (u.s32);
+    case BV_U64: return make_u64 (u.u64);
+    case BV_S64: return rep_make_longlong_int (u.s64);
+    case BV_F32: return rep_make_float (u.f32, rep_TRUE);
+    case BV_F64: return rep_make_float (u.f64, rep_TRUE);
+    }
+    abort ();
+}
+
+DEFUN("bytevector-set", Fbytevector_set, Sbytevector_set,
+      (repv bv, repv type, repv index, repv x, repv endian), rep_Subr5) /*
+::doc:rep.data#bytevector-set::
+bytevector-set BYTEVECTOR TYPE INDEX VALUE [ENDIAN]
+
+Store the number VALUE as type TYPE in BYTEVECTOR starting at byte
+INDEX (see `bytevector-ref'). Integers must be exact and fit the type.
+Returns VALUE.
+::end:: */
+{
+    int kind = symbol_kind (type);
+    rep_bool swap, ok = rep_TRUE;
+    uint64_t n = 0;
+    union {
+	unsigned char b[8];
+	uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+	float f32; double f64;
+    } u;
+
+    rep_DECLARE1 (bv, rep_BYTEVECTORP);
+    if (kind < 0)
+	return rep_signal_arg_error (type, 2);
+    rep_DECLARE3 (index, rep_INTP);
+    if (rep_INT (index) < 0
+	|| rep_INT (index) + kind_sizes[kind] > BYTEVECTOR (bv)->len)
+    {
+	return rep_signal_arg_error (index, 3);
+    }
+    if (!get_swap (endian, 5, &swap))
+	return rep_NULL;
+
+    switch (kind)
+    {
+    case BV_U8: ok = get_integer (x, 0, UINT8_MAX, &n); break;
+    case BV_S8: ok = get_integer (x, INT8_MIN, INT8_MAX, &n); break;
+    case BV_U16: ok = get_integer (x, 0, UINT16_MAX, &n); break;
+    case BV_S16: ok = get_integer (x, INT16_MIN, INT16_MAX, &n); break;
+    case BV_U32: ok = get_integer (x, 0, UINT32_MAX, &n); break;
+    case BV_S32: ok = get_integer (x, INT32_MIN, INT32_MAX, &n); break;
+    case BV_U64: ok = get_integer (x, 0, UINT64_MAX, &n); break;
+    case BV_S64: ok = get_integer (x, INT64_MIN, INT64_MAX, &n); break;
+    case BV_F32: case BV_F64: ok = rep_NUMERICP (x); break;
+    }
+    if (!ok)
+	return rep_signal_arg_error (x, 4);
+
+    switch (kind_sizes[kind])
+    {
+    case 1: u.u8 = (uint8_t) n; break;
+    case 2: u.u16 = (uint16_t) n; break;
+    case 4:
+	if (kind == BV_F32)
+	    u.f32 = (float) rep_get_float (x);
+	else
+	    u.u32 = (uint32_t) n;
+	break;
+    case 8:
+	if (kind == BV_F64)
+	    u.f64 = rep_get_float (x);
+	else
+	    u.u64 = n;
+	break;
+    }
+    if (swap)
+	swap_bytes (u.b, kind_sizes[kind]);
+    memcpy (rep_bytevector_data (bv) + rep_INT (index),
+	    u.b, kind_sizes[kind]);
+    bytevector_modified (BYTEVECTOR (bv));
+    return x;
+}
+
+DEFUN("string->bytevector", Fstring_to_bytevector, Sstring_to_bytevector,
+      (repv string, repv start, repv end), rep_Subr3) /*
+::doc:rep.data#string->bytevector::
+string->bytevector STRING [START [END]]
+
+Return a bytevector holding the bytes of STRING from index START (or
+zero) up to END (or its end). Unless STRING is a constant, the
+bytevector shares them with STRING instead of copying them, so changes
+to either are seen by the other.
+::end:: */
+{
+    long s, e;
+    repv bv;
+    rep_DECLARE1 (string, rep_STRINGP);
+    if (!get_range (rep_STRING_LEN (string), start, end, 2, &s, &e))
+	return rep_NULL;
+    if (rep_STRING_WRITABLE_P (string))
+	return make_window (string, s, e - s);
+    bv = make_bytevector (e - s);
+    if (bv != rep_NULL)
+	memcpy (BYTEVECTOR (bv)->data, rep_STR (string) + s, e - s);
+    return bv;
+}
+
+DEFUN("bytevector->string", Fbytevector_to_string, Sbytevector_to_string,
+      (repv bv), rep_Subr1) /*
+::doc:rep.data#bytevector->string::
+bytevector->string BYTEVECTOR
+
+Return a string containing the bytes of BYTEVECTOR. When BYTEVECTOR
+owns its bytes (i.e. it isn't a slice) or shares all of a string's
+bytes, the string shares them too instead of copying them.
+::end:: */
+{
+    bytevector *b;
+    repv str;
+    rep_DECLARE1 (bv, rep_BYTEVECTORP);
+    b = BYTEVECTOR (bv);
+
+    if (b->base == Qnil && b->len <= rep_max_short_string)
+    {
+	/* give the memory to a new string, then look at it through
+	   the string from now on */
+	str = rep_box_string (b->data, b->len);
+	if (str != rep_NULL)
+	{
+	    b->base = str;
+	    b->data = 0;
+	    b->offset = 0;
+	}
+	return str;
+    }
+
+    str = bytevector_string (b);
+    if (str != Qnil && rep_STR (str) == bytevector_bytes (b)
+	&& rep_STRING_LEN (str) == b->len)
+    {
+	return str;
+    }
+
+    str = rep_make_string (b->len + 1);
+    if (str != rep_NULL)
+    {
+	memcpy (rep_STR (str), bytevector_bytes (b), b->len);
+	rep_STR (str)[b->len] = 0;
+    }
+    return str;
+}
+
+DEFUN("bytevector-shared-p", Fbytevector_shared_p, Sbytevector_shared_p,
+      (repv bv), rep_Subr1) /*
+::doc:rep.data#bytevector-shared-p::
+bytevector-shared-p BYTEVECTOR
+
+Returns t when BYTEVECTOR shares the bytes of another bytevector or a
+string, i.e. when changing them may change something else.
+::end:: */
+{
+    rep_DECLARE1 (bv, rep_BYTEVECTORP);
+    return BYTEVECTOR (bv)->base != Qnil ? Qt : Qnil;
+}
+
+
+/* Type hooks */
+
+static int
+bytevector_cmp (repv v1, repv v2)
+{
+    bytevector *a, *b;
+    long len;
+    int tem;
+
+    if (rep_TYPE (v1) != rep_TYPE (v2))
+	return 1;
+    a = BYTEVECTOR (v1);
+    b = BYTEVECTOR (v2);
+    len = MIN (a->len, b->len);
+    tem = memcmp (bytevector_bytes (a), bytevector_bytes (b), len);
+    if (tem != 0)
+	return tem;
+    return (a->len == b->len) ? 0 : (a->len < b->len) ? -1 : 1;
+}
+
+static void
+bytevector_print (repv stream, repv bv)
+{
+    char buf[64];
+#ifdef HAVE_SNPRINTF
+    snprintf (buf, sizeof (buf), "#<bytevector %ld>", BYTEVECTOR (bv)->len);
+#else
+    sprintf (buf, "#<bytevector %ld>", BYTEVECTOR (bv)->len);
+#endif
+    rep_stream_puts (stream, buf, -1, rep_FALSE);
+}
+
+static void
+bytevector_mark (repv bv)
+{
+    rep_MARKVAL (BYTEVECTOR (bv)->base);
+}
+
+static unsigned long
+bytevector_size (repv bv)
+{
+    return sizeof (bytevector) + (BYTEVECTOR (bv)->data != 0
+				  ? BYTEVECTOR (bv)->len : 0);
+}
+
+static void
+bytevector_sweep (void)
+{
+    bytevector *b = bytevector_chain;
+    bytevector_chain = 0;
+    while (b != 0)
+    {
+	bytevector *next = b->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (b)))
+	{
+	    if (b->data != 0)
+		rep_free (b->data);
+	    rep_FREE_CELL (b);
+	}
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL (b));
+	    b->next = bytevector_chain;
+	    bytevector_chain = b;
+	}
+	b = next;
+    }
+}
+
+void
+rep_bytevectors_init (void)
+{
+    repv tem;
+
+    rep_bytevector_type = rep_register_new_type ("bytevector",
+						 bytevector_cmp,
+						 bytevector_print,
+						 bytevector_print,
+						 bytevector_sweep,
+						 bytevector_mark, 0,
+						 0, 0, 0, 0, 0, 0);
+    rep_set_parallel_mark (rep_bytevector_type, bytevector_mark);
+    rep_set_type_size (rep_bytevector_type, bytevector_size);
+    rep_INTERN (s8);
+    rep_INTERN (u16);
+    rep_INTERN (s16);
+    rep_INTERN (u64);
+    rep_INTERN (s64);
+    rep_INTERN (big);
+    rep_INTERN (little);
+
+    tem = rep_push_structure ("rep.data");
+    rep_ADD_SUBR (Smake_bytevector);
+    rep_ADD_SUBR (Sbytevector);
+    rep_ADD_SUBR (Sbytevectorp);
+    rep_ADD_SUBR (Sbytevector_slice);
+    rep_ADD_SUBR (Sbytevector_copy);
+    rep_ADD_SUBR (Sbytevector_replace);
+    rep_ADD_SUBR (Sbytevector_fill);
+    rep_ADD_SUBR (Sbytevector_ref);
+    rep_ADD_SUBR (Sbytevector_set);
+    rep_ADD_SUBR (Sstring_to_bytevector);
+    rep_ADD_SUBR (Sbytevector_to_string);
+    rep_ADD_SUBR (Sbytevector_shared_p);
+    rep_pop_structure (tem);
+}
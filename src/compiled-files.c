@@ -0,0 +1,835 @@
+/* compiled-files.c -- compiled Lisp files in binary form
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
+
+/* The compiler writes .jlc files in a binary form that load-file can
+   use without running the Lisp reader over them. Each file holds a list
+   of top-level forms, which are evaluated in turn, as though they'd been
+   read from a file of Lisp code.
+
+   The file is a header, then the offsets of the symbol records, the
+   offsets of the other records and the top-level forms, followed by
+   the records themselves. Everything is a sequence of 32-bit words,
+   least significant byte first whatever the host. A word referring to a Lisp
+   value is either a fixnum shifted left one bit, or the number of a
+   symbol or other record shifted left two bits with the low bits set
+   to 01 or 11 respectively.
+
+   Symbols are only written once per file, so each is interned once
+   when the file is loaded. The file is read into a region of memory
+   set aside for them (see rep_read_file_data), and the strings built
+   from it -- bytecode, docstrings and other constants -- use the
+   characters there instead of copying them. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include "serialize.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+typedef unsigned int cf_word;
+
+#define CF_MAGIC	"rep-jlc"
+#define CF_VERSION	1
+#define CF_BYTE_ORDER	0x01020304
+
+#define WORD_SIZE	sizeof (cf_word)
+#define WORDS(bytes)	(((bytes) + WORD_SIZE - 1) / WORD_SIZE)
+
+typedef struct {
+    char magic[8];
+    cf_word version;
+    cf_word byte_order;
+    cf_word n_symbols;		/* symbol record offsets follow */
+    cf_word n_records;		/* then the other record offsets */
+    cf_word n_forms;		/* then the top-level forms */
+    cf_word source;		/* name of the source file, or nil */
+} cf_header;
+
+/* References to values */
+#define FIXNUM_REF_P(w)		(((w) & 1) == 0)
+#define SYMBOL_REF_P(w)		(((w) & 3) == 1)
+#define REF_FIXNUM(w)		((long) ((int) (w) >> 1))
+#define REF_INDEX(w)		((w) >> 2)
+#define MAKE_FIXNUM_REF(n)	((cf_word) (n) << 1)
+#define MAKE_SYMBOL_REF(i)	((((cf_word) (i)) << 2) | 1)
+#define MAKE_RECORD_REF(i)	((((cf_word) (i)) << 2) | 3)
+
+/* The fixnums that fit in a reference */
+#define MIN_FIXNUM_REF		(-(1L << 30))
+#define MAX_FIXNUM_REF		((1L << 30) - 1)
+
+/* The first word of each record is its kind, plus KIND_BITS of extra
+   information */
+enum cf_record {
+    REC_STRING = 1, REC_LIST, REC_VECTOR, REC_COMPILED,
+    REC_FLOAT, REC_NUMBER, REC_SPECIAL
+};
+
+#define KIND_BITS	REP_SERIAL_KIND_BITS
+#define REC_KIND(w)	((w) & ((1 << KIND_BITS) - 1))
+#define REC_AUX(w)	((w) >> KIND_BITS)
+
+/* Where symbols are interned */
+enum { SYM_OBARRAY, SYM_KEYWORD };
+
+/* REC_SPECIAL records, objects with their own read syntax */
+enum {
+    SPECIAL_NIL, SPECIAL_OPTIONAL, SPECIAL_REST, SPECIAL_KEY,
+    SPECIAL_TRUE, SPECIAL_FALSE, SPECIAL_UNDEFINED
+};
+
+DEFSTRING(malformed, "Malformed compiled Lisp file");
+DEFSTRING(recompile, "File needs recompiling for this version of rep");
+
+
+/* Writing */
+
+typedef struct {
+    /* Records for everything but symbols */
+    rep_serializer s;
+
+    /* Symbols, which are written after the records */
+    rep_value_set symbols;
+} cf_out;
+
+#define CF_OUT(s) ((cf_out *) (s))
+
+static rep_serial_word
+ref_word (rep_serializer *out, repv v)
+{
+    if (rep_INTP (v) && rep_INT (v) >= MIN_FIXNUM_REF
+	&& rep_INT (v) <= MAX_FIXNUM_REF)
+    {
+	return MAKE_FIXNUM_REF (rep_INT (v));
+    }
+    else if (rep_SYMBOLP (v) && !rep_SYMBOL_LITERAL_P (v))
+    {
+	return MAKE_SYMBOL_REF (rep_value_number (&CF_OUT (out)->symbols,
+						  v, rep_TRUE));
+    }
+    else
+	return MAKE_RECORD_REF (rep_value_number (&out->records, v, rep_TRUE));
+}
+
+static void
+put_special (rep_serializer *out, int code)
+{
+    rep_serial_put_word (out, REC_SPECIAL | (code << KIND_BITS));
+}
+
+/* Write the list starting with the cons V, as far as the end of the
+   list or the first cons that has a record of its own */
+static void
+write_list (rep_serializer *out, repv v)
+{
+    repv tail = v, slow = v;
+    long n = 0;
+    do {
+	tail = rep_CDR (tail);
+	if (++n % 2 == 0)
+	{
+	    slow = rep_CDR (slow);
+	    if (slow == tail)
+	    {
+		/* circular */
+		out->error = v;
+		return;
+	    }
+	}
+    } while (rep_CONSP (tail)
+	     && rep_value_number (&out->records, tail, rep_FALSE) < 0);
+
+    rep_serial_put_word (out, REC_LIST);
+    rep_serial_put_word (out, n);
+    for (tail = v; n-- > 0; tail = rep_CDR (tail))
+	rep_serial_put_ref (out, rep_CAR (tail));
+    rep_serial_put_ref (out, tail);
+}
+
+static void
+write_record (rep_serializer *out, repv v)
+{
+    if (v == Qnil)
+	put_special (out, SPECIAL_NIL);
+    else if (v == rep_lambda_list_marker ('o'))
+	put_special (out, SPECIAL_OPTIONAL);
+    else if (v == rep_lambda_list_marker ('r'))
+	put_special (out, SPECIAL_REST);
+    else if (v == rep_lambda_list_marker ('k'))
+	put_special (out, SPECIAL_KEY);
+    else if (v == rep_scm_t)
+	put_special (out, SPECIAL_TRUE);
+    else if (v == rep_scm_f)
+	put_special (out, SPECIAL_FALSE);
+    else if (v == rep_undefined_value)
+	put_special (out, SPECIAL_UNDEFINED);
+    else if (rep_CONSP (v))
+	write_list (out, v);
+    else if (rep_STRINGP (v))
+	rep_serial_put_string (out, REC_STRING, v);
+    else if (rep_VECTORP (v) || rep_COMPILEDP (v))
+    {
+	rep_serial_put_vector (out, rep_VECTORP (v)
+			       ? REC_VECTOR : REC_COMPILED, v);
+    }
+    else if (rep_NUMBERP (v) && rep_NUMBER_FLOAT_P (v))
+	rep_serial_put_float (out, REC_FLOAT, v);
+    else if (rep_NUMERICP (v))
+	rep_serial_put_number (out, REC_NUMBER, v);
+    else
+	out->error = v;
+}
+
+/* Symbols are written as their name, they're interned when loaded
+   whether or not they were interned when written, as when printed */
+static void
+write_symbol (rep_serializer *out, repv v)
+{
+    repv name = rep_SYM (v)->name;
+    rep_serial_put_word (out, (rep_SYM (v)->car & rep_SF_KEYWORD)
+			 ? SYM_KEYWORD : SYM_OBARRAY);
+    rep_serial_put_word (out, rep_STRING_LEN (name));
+    rep_serial_put_bytes (out, rep_STR (name), rep_STRING_LEN (name));
+}
+
+static rep_bool
+write_file (cf_out *cf, repv forms, repv source, FILE *fh)
+{
+    rep_serializer *out = &cf->s;
+    cf_word *refs, source_ref, base, n_symbols;
+    size_t *symbol_offsets;
+    long i, n_forms = rep_list_length (forms);
+    rep_bool ok;
+
+    if (n_forms < 0)
+	return rep_FALSE;
+    refs = rep_alloc (sizeof (cf_word) * (n_forms + 1));
+    for (i = 0; i < n_forms; i++, forms = rep_CDR (forms))
+	refs[i] = ref_word (out, rep_CAR (forms));
+    source_ref = ref_word (out, source);
+
+    if (!rep_serial_write_records (out))
+    {
+	rep_free (refs);
+	return rep_FALSE;
+    }
+    n_symbols = cf->symbols.n_values;
+    symbol_offsets = rep_alloc (sizeof (size_t) * (n_symbols + 1));
+    for (i = 0; i < (long) n_symbols; i++)
+    {
+	symbol_offsets[i] = out->len;
+	write_symbol (out, cf->symbols.values[i]);
+    }
+
+    /* The header's words are written in the file's byte order too */
+    base = (sizeof (cf_header)
+	    + (n_symbols + out->records.n_values + n_forms) * WORD_SIZE);
+    ok = (fwrite (CF_MAGIC, sizeof (CF_MAGIC), 1, fh) == 1
+	  && rep_serial_fwrite_word (out, CF_VERSION, fh)
+	  && rep_serial_fwrite_word (out, CF_BYTE_ORDER, fh)
+	  && rep_serial_fwrite_word (out, n_symbols, fh)
+	  && rep_serial_fwrite_word (out, out->records.n_values, fh)
+	  && rep_serial_fwrite_word (out, n_forms, fh)
+	  && rep_serial_fwrite_word (out, source_ref, fh));
+    for (i = 0; ok && i < (long) n_symbols; i++)
+	ok = rep_serial_fwrite_word (out, base + symbol_offsets[i], fh);
+    for (i = 0; ok && i < out->records.n_values; i++)
+	ok = rep_serial_fwrite_word (out, base + out->offsets[i], fh);
+    for (i = 0; ok && i < n_forms; i++)
+	ok = rep_serial_fwrite_word (out, refs[i], fh);
+    rep_free (refs);
+    rep_free (symbol_offsets);
+    return ok && fwrite (out->buf, 1, out->len, fh) == out->len;
+}
+
+DEFUN("write-compiled-file", Fwrite_compiled_file, Swrite_compiled_file,
+      (repv file, repv forms, repv source), rep_Subr3) /*
+::doc:rep.io.files#write-compiled-file::
+write-compiled-file FILE-NAME FORMS [SOURCE-NAME]
+
+Write the list of top-level forms FORMS to the file called FILE-NAME,
+as a compiled Lisp file in binary form. Loading the file evaluates each
+form in turn, as if they'd been read from a file of Lisp code, without
+needing to parse them. SOURCE-NAME is recorded as the name of the file
+the forms were compiled from.
+
+FORMS may contain symbols, strings, numbers, lists, vectors and
+byte-code subroutines. If there's anything else, FILE-NAME isn't
+written and false is returned, otherwise true.
+::end:: */
+{
+    cf_out out;
+    repv local;
+    FILE *fh;
+    rep_bool ok;
+
+    rep_DECLARE1 (file, rep_STRINGP);
+    rep_DECLARE2 (forms, rep_LISTP);
+
+    local = Flocal_file_name (file);
+    if (local == rep_NULL)
+	return rep_NULL;
+    if (!rep_STRINGP (local))
+	return rep_signal_file_error (file);
+
+    rep_serial_init (&out.s, WORD_SIZE, rep_TRUE);
+    out.s.ref_word = ref_word;
+    out.s.write_record = write_record;
+    memset (&out.symbols, 0, sizeof (out.symbols));
+
+    fh = fopen (rep_STR (local), "wb");
+    if (fh != 0)
+    {
+	ok = write_file (&out, forms, source, fh);
+	if (fclose (fh) != 0)
+	    ok = rep_FALSE;
+	if (!ok)
+	    unlink (rep_STR (local));
+    }
+    else
+	ok = rep_FALSE;
+
+    rep_free_value_set (&out.symbols);
+    rep_serial_free (&out.s);
+
+    if (out.s.error != rep_NULL)
+	return Qnil;
+    else if (!ok)
+	return rep_signal_file_error (file);
+    else
+	return Qt;
+}
+
+
+/* Loading */
+
+/* The word I words after P, in the host's byte order */
+#ifdef WORDS_BIGENDIAN
+# define WORD_AT(p, i) (get_le_word ((p) + (i)))
+
+static inline cf_word
+get_le_word (const cf_word *p)
+{
+    const unsigned char *b = (const unsigned char *) p;
+    return (b[0] | (b[1] << 8) | (b[2] << 16) | ((cf_word) b[3] << 24));
+}
+#else
+# define WORD_AT(p, i) ((p)[i])
+#endif
+
+/* Copy the double stored least significant byte first at P to *D */
+static void
+get_le_double (const void *p, double *d)
+{
+#ifdef WORDS_BIGENDIAN
+    const unsigned char *b = p;
+    unsigned char *to = (unsigned char *) d;
+    int i;
+    for (i = 0; i < (int) sizeof (double); i++)
+	to[i] = b[sizeof (double) - 1 - i];
+#else
+    memcpy (d, p, sizeof (double));
+#endif
+}
+
+typedef struct {
+    char *data;
+    size_t size;
+
+    cf_word *symbols, *records, *forms;
+    cf_word n_symbols, n_records, n_forms;
+
+    /* The symbols then records built so far, or zero */
+    repv objects;
+} cf_file;
+
+static repv build_record (cf_file *f, cf_word i);
+
+static repv
+malformed_file (void)
+{
+    return Fsignal (Qerror, rep_list_2 (rep_VAL (&malformed),
+					Fsymbol_value (Qload_filename, Qt)));
+}
+
+/* Return a pointer to the record at OFFSET, if it has at least WORDS
+   words before the end of the file, otherwise null */
+static inline cf_word *
+record_at (cf_file *f, cf_word offset, size_t words)
+{
+    if (offset % WORD_SIZE != 0 || offset > f->size
+	|| (f->size - offset) / WORD_SIZE < words)
+    {
+	return 0;
+    }
+    return (cf_word *) (f->data + offset);
+}
+
+/* Return the LEN bytes following the two words at W, if they fit in
+   the file with a null after them, otherwise null */
+static inline char *
+record_bytes (cf_file *f, cf_word *w, cf_word len)
+{
+    char *text = (char *) (w + 2);
+    if ((size_t) (f->data + f->size - text) <= len || text[len] != 0)
+	return 0;
+    return text;
+}
+
+static repv
+build_symbol (cf_file *f, cf_word i)
+{
+    cf_word *w = record_at (f, WORD_AT (f->symbols, i), 2);
+    cf_word len = w ? WORD_AT (w, 1) : 0;
+    char *text = w ? record_bytes (f, w, len) : 0;
+    repv v;
+
+    if (text == 0 || WORD_AT (w, 0) > SYM_KEYWORD)
+	return malformed_file ();
+    v = rep_box_mapped_string (text, len);
+    if (v == rep_NULL)
+	return rep_NULL;
+    if (WORD_AT (w, 0) == SYM_KEYWORD)
+    {
+	v = Fintern (v, rep_keyword_obarray);
+	if (v != rep_NULL)
+	    rep_SYM (v)->car |= rep_SF_KEYWORD;
+    }
+    else
+	v = Fintern (v, rep_obarray);
+    if (v != rep_NULL)
+	rep_VECTI (f->objects, i) = v;
+    return v;
+}
+
+static repv
+build_value (cf_file *f, cf_word w)
+{
+    repv v;
+    if (FIXNUM_REF_P (w))
+	return rep_MAKE_INT (REF_FIXNUM (w));
+    else if (SYMBOL_REF_P (w))
+    {
+	if (REF_INDEX (w) >= f->n_symbols)
+	    return malformed_file ();
+	v = rep_VECTI (f->objects, REF_INDEX (w));
+	return v != 0 ? v : build_symbol (f, REF_INDEX (w));
+    }
+    else
+    {
+	if (REF_INDEX (w) >= f->n_records)
+	    return malformed_file ();
+	v = rep_VECTI (f->objects, f->n_symbols + REF_INDEX (w));
+	if (v == 0)
+	{
+	    v = build_record (f, REF_INDEX (w));
+	    /* everything built is reachable from the record, and
+	       evaluating earlier forms may have marked the vector */
+	    rep_OBJECT_BARRIER (f->objects, v);
+	}
+	return v;
+    }
+}
+
+static repv
+build_record (cf_file *f, cf_word i)
+{
+    cf_word offset = WORD_AT (f->records, i);
+    cf_word *w = record_at (f, offset, 1);
+    repv *slot = rep_VECT (f->objects)->array + f->n_symbols + i;
+    repv v = rep_NULL, tem;
+    cf_word kind, len;
+    char *text;
+    long j;
+
+    if (w == 0)
+	return malformed_file ();
+    kind = WORD_AT (w, 0);
+    /* the length, for the records that have one */
+    len = record_at (f, offset, 2) ? WORD_AT (w, 1) : 0;
+
+    switch (REC_KIND (kind))
+    {
+	double d;
+	int sign;
+
+    case REC_LIST:
+	if (record_at (f, offset, 2) == 0
+	    || record_at (f, offset, (size_t) len + 3) == 0
+	    || len == 0)
+	{
+	    break;
+	}
+	/* make the conses first, so cycles through them work. Building
+	   doesn't call Lisp, so no collection can happen before they're
+	   filled in, and storing into them needs no barrier */
+	v = Qnil;
+	for (j = 0; j < (long) len; j++)
+	    v = Fcons (Qnil, v);
+	*slot = v;
+	for (j = 0, tem = v; j < (long) len; j++, tem = rep_CDR (tem))
+	{
+	    repv elt = build_value (f, WORD_AT (w, 2 + j));
+	    if (elt == rep_NULL)
+		return rep_NULL;
+	    rep_CAR (tem) = elt;
+	    if (j == (long) len - 1)
+	    {
+		repv tail = build_value (f, WORD_AT (w, 3 + j));
+		if (tail == rep_NULL)
+		    return rep_NULL;
+		rep_CDR (tem) = tail;
+		break;
+	    }
+	}
+	return v;
+
+    case REC_STRING:
+	if (record_at (f, offset, 2) == 0
+	    || (text = record_bytes (f, w, len)) == 0)
+	{
+	    break;
+	}
+	v = rep_box_mapped_string (text, len);
+	if (v != rep_NULL)
+	    *slot = v;
+	return v;
+
+    case REC_VECTOR:
+	if (record_at (f, offset, 2) == 0
+	    || record_at (f, offset, (size_t) len + 2) == 0)
+	{
+	    break;
+	}
+	v = rep_make_vector (len);
+	if (v == rep_NULL)
+	    return rep_NULL;
+	for (j = 0; j < (long) len; j++)
+	    rep_VECTI (v, j) = Qnil;
+	*slot = v;
+	for (j = 0; j < (long) len; j++)
+	{
+	    tem = build_value (f, WORD_AT (w, 2 + j));
+	    if (tem == rep_NULL)
+		return rep_NULL;
+	    rep_VECTI (v, j) = tem;
+	}
+	return v;
+
+    case REC_COMPILED:
+	{
+	    /* check it's a byte-code subr, as the reader does */
+	    cf_word *consts = 0;
+	    if (record_at (f, offset, 2) != 0
+		&& len >= rep_COMPILED_MIN_SLOTS
+		&& record_at (f, offset, (size_t) len + 2) != 0)
+	    {
+		cf_word ref = WORD_AT (w, 3);
+		if (!FIXNUM_REF_P (ref) && !SYMBOL_REF_P (ref)
+		    && REF_INDEX (ref) < f->n_records)
+		{
+		    consts = record_at (f, WORD_AT (f->records,
+						    REF_INDEX (ref)), 2);
+		}
+	    }
+	    if (consts == 0
+		|| REC_KIND (WORD_AT (consts, 0)) != REC_VECTOR
+		|| !FIXNUM_REF_P (WORD_AT (w, 4)))
+	    {
+		break;
+	    }
+	    v = rep_make_compiled (len, WORD_AT (consts, 1));
+	    if (v == rep_NULL)
+		return rep_NULL;
+	    for (j = 0; j < (long) len; j++)
+		rep_VECTI (v, j) = Qnil;
+	    *slot = v;
+	    for (j = 0; j < (long) len; j++)
+	    {
+		tem = build_value (f, WORD_AT (w, 2 + j));
+		if (tem == rep_NULL)
+		    return rep_NULL;
+		rep_VECTI (v, j) = tem;
+	    }
+	    if (!rep_STRINGP (rep_COMPILED_CODE (v)))
+	    {
+		v = rep_NULL;
+		break;
+	    }
+	    /* it's verified when first run, many never are */
+	    return v;
+	}
+
+    case REC_FLOAT:
+	if (record_at (f, offset, 1 + WORDS (sizeof (d))) == 0)
+	    break;
+	get_le_double (w + 1, &d);
+	v = rep_make_float (d, rep_TRUE);
+	if (v != rep_NULL)
+	    *slot = v;
+	return v;
+
+    case REC_NUMBER:
+	if (record_at (f, offset, 2) == 0
+	    || (text = record_bytes (f, w, len)) == 0)
+	{
+	    break;
+	}
+	sign = 1;
+	if (*text == '-')
+	{
+	    sign = -1;
+	    text++;
+	}
+	v = rep_parse_number (text, strlen (text), 10, sign,
+			      (REC_AUX (kind) == rep_NUMBER_RATIONAL)
+			      ? rep_NUMBER_RATIONAL : 0);
+	if (v != rep_NULL)
+	    *slot = v;
+	break;
+
+    case REC_SPECIAL:
+	switch (REC_AUX (kind))
+	{
+	case SPECIAL_NIL: v = Qnil; break;
+	case SPECIAL_OPTIONAL: v = rep_lambda_list_marker ('o'); break;
+	case SPECIAL_REST: v = rep_lambda_list_marker ('r'); break;
+	case SPECIAL_KEY: v = rep_lambda_list_marker ('k'); break;
+	case SPECIAL_TRUE: v = rep_scm_t; break;
+	case SPECIAL_FALSE: v = rep_scm_f; break;
+	case SPECIAL_UNDEFINED: v = rep_undefined_value; break;
+	}
+	if (v != rep_NULL)
+	    *slot = v;
+	break;
+    }
+
+    return v != rep_NULL ? v : malformed_file ();
+}
+
+/* Read the header of the file open on FD into H, with its words in
+   the host's byte order, returning true if it's a compiled file in
+   binary form */
+static rep_bool
+read_header (int fd, cf_header *h)
+{
+    size_t done = 0;
+    while (done < sizeof (*h))
+    {
+	ssize_t this = read (fd, (char *) h + done, sizeof (*h) - done);
+	if (this <= 0)
+	    return rep_FALSE;
+	done += this;
+    }
+    h->version = WORD_AT (&h->version, 0);
+    h->byte_order = WORD_AT (&h->byte_order, 0);
+    h->n_symbols = WORD_AT (&h->n_symbols, 0);
+    h->n_records = WORD_AT (&h->n_records, 0);
+    h->n_forms = WORD_AT (&h->n_forms, 0);
+    h->source = WORD_AT (&h->source, 0);
+    return memcmp (h->magic, CF_MAGIC, sizeof (h->magic)) == 0;
+}
+
+/* Return true if FILE is a compiled Lisp file in binary form that was
+   written in a format this rep can't load, so that `load' uses its
+   source instead */
+rep_bool
+rep_compiled_file_stale_p (repv file)
+{
+    repv local = Flocal_file_name (file);
+    cf_header h;
+    rep_bool stale = rep_FALSE;
+    int fd;
+
+    if (local == rep_NULL || !rep_STRINGP (local))
+    {
+	rep_throw_value = rep_NULL;
+	return rep_FALSE;
+    }
+    fd = open (rep_STR (local), O_RDONLY);
+    if (fd < 0)
+	return rep_FALSE;
+    if (read_header (fd, &h))
+	stale = (h.version != CF_VERSION || h.byte_order != CF_BYTE_ORDER);
+    close (fd);
+    return stale;
+}
+
+/* If FILE is a compiled Lisp file in binary form, load it into
+   STRUCTURE as load-file does, store the value of its last form (or
+   null if an error was signalled) in *RESULT, and return true.
+   Otherwise return false, so it can be read as text. */
+rep_bool
+rep_load_compiled_file (repv file, repv structure, repv *result)
+{
+    repv local, bindings, value = Qnil;
+    cf_file f;
+    cf_header h;
+    struct stat st;
+    struct rep_Call lc;
+    rep_GC_root gc_bindings, gc_objects;
+    rep_bool in_region;
+    int fd;
+    cf_word i;
+
+    local = Flocal_file_name (file);
+    if (local == rep_NULL || !rep_STRINGP (local))
+    {
+	/* let load-file report it */
+	rep_throw_value = rep_NULL;
+	return rep_FALSE;
+    }
+    fd = open (rep_STR (local), O_RDONLY);
+    if (fd < 0)
+	return rep_FALSE;
+    if (fstat (fd, &st) != 0 || !read_header (fd, &h))
+    {
+	close (fd);
+	return rep_FALSE;
+    }
+
+    bindings = rep_bind_symbol (Qnil, Qload_filename, file);
+    rep_PUSHGC (gc_bindings, bindings);
+    f.objects = Qnil;
+    rep_PUSHGC (gc_objects, f.objects);
+    f.data = 0;
+    in_region = rep_FALSE;
+
+    if (h.version != CF_VERSION || h.byte_order != CF_BYTE_ORDER)
+    {
+	close (fd);
+	value = Fsignal (Qbytecode_error, rep_list_2 (rep_VAL (&recompile),
+						      file));
+	goto out;
+    }
+
+    f.size = st.st_size;
+    f.data = rep_read_file_data (fd, &f.size);
+    if (f.data != 0)
+	in_region = rep_TRUE;
+    else
+    {
+	size_t done = 0;
+	f.data = rep_alloc (f.size + 1);
+	lseek (fd, 0, SEEK_SET);
+	while (f.data != 0 && done < f.size)
+	{
+	    ssize_t this = read (fd, f.data + done, f.size - done);
+	    if (this <= 0)
+		break;
+	    done += this;
+	}
+	f.size = done;
+    }
+    close (fd);
+    if (f.data == 0)
+    {
+	value = rep_mem_error ();
+	goto out;
+    }
+
+    f.n_symbols = h.n_symbols;
+    f.n_records = h.n_records;
+    f.n_forms = h.n_forms;
+    if (f.n_symbols >= f.size || f.n_records >= f.size
+	|| f.n_forms >= f.size
+	|| ((f.size - sizeof (h)) / WORD_SIZE
+	    < (size_t) f.n_symbols + f.n_records + f.n_forms))
+    {
+	value = malformed_file ();
+	goto out;
+    }
+    f.symbols = (cf_word *) (f.data + sizeof (h));
+    f.records = f.symbols + f.n_symbols;
+    f.forms = f.records + f.n_records;
+
+    f.objects = rep_make_vector (f.n_symbols + f.n_records);
+    if (f.objects == rep_NULL)
+    {
+	value = rep_NULL;
+	goto out;
+    }
+    for (i = 0; i < f.n_symbols + f.n_records; i++)
+	rep_VECTI (f.objects, i) = 0;
+
+    /* Intern the symbols first, then evaluate the forms in order,
+       building each as it's needed */
+    for (i = 0; i < f.n_symbols; i++)
+    {
+	if (build_symbol (&f, i) == rep_NULL)
+	{
+	    value = rep_NULL;
+	    goto out;
+	}
+    }
+
+    /* Create the lexical environment for the file. */
+    lc.fun = Qnil;
+    lc.args = Qnil;
+    rep_PUSH_CALL (lc);
+    rep_env = Qnil;
+    rep_structure = structure;
+
+    for (i = 0; i < f.n_forms; i++)
+    {
+	repv form = build_value (&f, WORD_AT (f.forms, i));
+	rep_TEST_INT;
+	if (form == rep_NULL || rep_INTERRUPTP
+	    || !(value = rep_eval (form, Qnil)))
+	{
+	    value = rep_NULL;
+	    break;
+	}
+    }
+    rep_POP_CALL (lc);
+
+out:
+    if (f.data != 0 && !in_region)
+	rep_free (f.data);
+    else if (f.data != 0)
+	/* the strings using it keep it now */
+	rep_release_file_data (f.data);
+    rep_POPGC; rep_POPGC;
+    rep_PUSHGC (gc_objects, value);
+    rep_unbind_symbols (bindings);
+    rep_POPGC;
+    *result = value;
+    return rep_TRUE;
+}
+
+
+/* dl hooks */
+
+void
+rep_compiled_files_init (void)
+{
+    repv tem = rep_push_structure ("rep.io.files");
+    rep_ADD_SUBR (Swrite_compiled_file);
+    rep_pop_structure (tem);
+}
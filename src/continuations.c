@@ -486,7 +486,7 @@ save_stack (rep_continuation *c)
     {
 	c->stack_size = size;
 	c->stack_copy = rep_alloc (size);
-	rep_data_after_gc += size;
+	rep_NOTE_ALLOC_BYTES (continuation_type (), size);
     }
 
     c->real_size = size;
@@ -653,7 +653,7 @@ primitive_call_cc (repv (*callback)(rep_continuation *, void *), void *data,
     if (c == 0)
     {
 	c = rep_ALLOC_CELL (sizeof (rep_continuation));
-	rep_data_after_gc += sizeof (rep_continuation);
+	rep_NOTE_ALLOC (continuation_type (), sizeof (rep_continuation));
 	c->next = continuations;
 	continuations = c;
 	c->stack_copy = 0;
@@ -934,6 +934,7 @@ again:
 	    root_barrier->active = 0;
 	    assert (rep_throw_value != exit_barrier_cell);
 	    rep_CDR (exit_barrier_cell) = rep_throw_value;
+	    rep_CONS_BARRIER (exit_barrier_cell);
 	    rep_throw_value = exit_barrier_cell;
 	    DB (("no more threads, throwing to root..\n"));
 	    return;
@@ -993,7 +994,7 @@ static rep_thread *
 new_thread (repv name)
 {
     rep_thread *t = rep_ALLOC_CELL (sizeof (rep_thread));
-    rep_data_after_gc += sizeof (rep_thread);
+    rep_NOTE_ALLOC (thread_type (), sizeof (rep_thread));
     memset (t, 0, sizeof (rep_thread));
     t->car = thread_type ();
     t->name = name;
@@ -1057,6 +1058,7 @@ make_thread (repv thunk, repv name, rep_bool suspended)
 	{
 	    /* exited with a throw, throw out of the dynamic root */
 	    rep_CDR (exit_barrier_cell) = rep_throw_value;
+	    rep_CONS_BARRIER (exit_barrier_cell);
 	    rep_throw_value = exit_barrier_cell;
 	}
 	return 0;
@@ -1215,6 +1217,7 @@ mark_cont (repv obj)
     {
 	repv *ptr = FIXUP(rep_GC_root *, c, roots)->ptr;
 	rep_MARKVAL (*FIXUP(repv *, c, ptr));
+	rep_pin_string_data (*FIXUP(repv *, c, ptr));
     }
     for (nroots = c->gc_n_roots;
 	 nroots != 0 && !SP_OLDER_P ((char *) roots, c->stack_bottom);
@@ -106,7 +106,10 @@ arguments, the datum and the stream to print to.
 {
     repv cell = Fassq (id, printer_alist);
     if (cell && rep_CONSP (cell))
+    {
 	rep_CDR (cell) = printer;
+	rep_CONS_BARRIER (cell);
+    }
     else
 	printer_alist = Fcons (Fcons (id, printer), printer_alist);
     return printer;
@@ -151,6 +154,21 @@ created using the `make-datum' function).
 }
 
 
+/* heap image support (see images.c) */
+
+rep_bool
+rep_datump (repv arg)
+{
+    return DATUMP (arg);
+}
+
+repv
+rep_datum_printers (void)
+{
+    return printer_alist;
+}
+
+
 /* dl hooks */
 
 void
@@ -160,6 +178,7 @@ rep_pre_datums_init (void)
 					datum_print, datum_print,
 					0, rep_mark_tuple,
 					0, 0, 0, 0, 0, 0, 0);
+    rep_set_parallel_mark (datum_type, rep_mark_tuple);
 
     /* Including CELL_MARK_BIT means we don't have to worry about
        GC; the cell will never get remarked, and it's not on any
@@ -352,7 +352,12 @@ rep_ffi_marshal (unsigned int type_id, repv value, char *ptr)
 	    return ptr + sizeof (int64_t);
 
 	case FFI_TYPE_POINTER:
-	    *(void **)ptr = (rep_STRINGP(value)) ? rep_STR (value) : rep_get_pointer (value);
+	    if (rep_STRINGP (value))
+		*(void **)ptr = rep_STR (value);
+	    else if (rep_BYTEVECTORP (value))
+		*(void **)ptr = rep_bytevector_data (value);
+	    else
+		*(void **)ptr = rep_get_pointer (value);
 	    return ptr + sizeof (void *);
 
 	case FFI_TYPE_STRUCT:		/* FIXME: */
@@ -669,7 +669,7 @@ make_file(void)
     repv file = rep_VAL(rep_ALLOC_CELL(sizeof(rep_file)));
     if(file == rep_NULL)
 	return rep_mem_error();
-    rep_data_after_gc += sizeof (rep_file);
+    rep_NOTE_ALLOC (rep_file_type, sizeof (rep_file));
     rep_FILE(file)->car = rep_file_type | rep_LFF_BOGUS_LINE_NUMBER;
     rep_FILE(file)->name = Qnil;
     rep_FILE(file)->handler = Qnil;
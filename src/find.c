@@ -227,6 +227,36 @@ rep_mark_regexp_data(void)
     }
 }
 
+static void
+rebase_string_matches (rep_regsubs *matches, char *old, char *new)
+{
+    int i;
+    for(i = 0; i < rep_NSUBEXP; i++)
+    {
+	if(matches->string.startp[i] != NULL)
+	    matches->string.startp[i] = new + (matches->string.startp[i] - old);
+	if(matches->string.endp[i] != NULL)
+	    matches->string.endp[i] = new + (matches->string.endp[i] - old);
+    }
+}
+
+/* Called by GC when the contents of the string STR have been moved
+   from OLD, so that match data pointing into them can follow */
+void
+rep_regexp_string_moved(repv str, char *old)
+{
+    struct rep_saved_regexp_data *sd;
+
+    if(last_match_type == rep_reg_string && last_match_data == str)
+	rebase_string_matches(&last_matches, old, rep_STR(str));
+
+    for(sd = rep_saved_matches; sd != 0; sd = sd->next)
+    {
+	if(sd->type == rep_reg_string && sd->data == str)
+	    rebase_string_matches(&sd->matches, old, rep_STR(str));
+    }
+}
+
 /* Fix the match buffers to reflect matching a string from START to END. */
 void
 rep_set_string_match(repv obj, repv start, repv end)
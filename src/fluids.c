@@ -99,9 +99,15 @@ variable object FLUID to VALUE.
 
     tem = search_special_bindings (f);
     if (tem != Qnil)
+    {
 	rep_CDR (tem) = v;
+	rep_CONS_BARRIER (tem);
+    }
     else
+    {
 	FLUID_GLOBAL_VALUE (f) = v;
+	rep_CONS_BARRIER (f);
+    }
     return v;
 }
 
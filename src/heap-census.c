@@ -0,0 +1,782 @@
+/* heap-census.c -- finding out what the Lisp heap is made of
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
+
+/* Each function here walks the graph of objects reachable from the
+   garbage collector's roots, breadth first. Objects are found through
+   the same code that marks them (see rep_visit_children), so every type
+   registered with rep_register_type is followed, and the memory each
+   object takes is found by the size function of its type.
+
+   A walk starts with a full collection, after which nothing is left
+   marked (see rep_prepare_heap_walk). The walk itself only uses malloc'd
+   memory, so no Lisp object can move or be freed while it's in progress;
+   the results are only consed once it's finished. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct {
+    long to;			/* index of the object referred to */
+    long position;		/* among the values of the referrer */
+} walk_edge;
+
+typedef struct heap_walk_struct heap_walk;
+struct heap_walk_struct {
+    /* Objects found, in the order they were found. When walking from
+       the roots, the first entry is rep_NULL, standing for them. */
+    repv *objects;
+    long n_objects, allocated_objects;
+
+    /* The next object whose children are to be found */
+    long next;
+
+    /* Open hash table of the indices of OBJECTS plus one, or zero */
+    long *table;
+    long table_size;
+
+    /* When RECORD_EDGES is true, the references between the objects
+       found; those of object I start at FIRST_EDGE[I] */
+    rep_bool record_edges;
+    walk_edge *edges;
+    long n_edges, allocated_edges;
+    long *first_edge;
+
+    /* Position of the next value of the current object */
+    long position;
+
+    /* If non-null, an object that isn't entered */
+    repv blocked;
+
+    /* If non-null, a walk whose objects aren't entered */
+    heap_walk *exclude;
+
+    /* True if memory ran out */
+    rep_bool failed;
+};
+
+/* The longest string or symbol name written to a snapshot */
+#define SNAPSHOT_NAME_MAX 80
+
+
+/* Walking */
+
+static inline unsigned long
+hash_object (repv v, long size)
+{
+    return ((v >> 3) * 2654435761UL) & (size - 1);
+}
+
+/* Return the index of V in W, or -1 */
+static long
+find_object (heap_walk *w, repv v)
+{
+    unsigned long h;
+    if (w->table_size == 0)
+	return -1;
+    for (h = hash_object (v, w->table_size); w->table[h] != 0;
+	 h = (h + 1) & (w->table_size - 1))
+    {
+	if (w->objects[w->table[h] - 1] == v)
+	    return w->table[h] - 1;
+    }
+    return -1;
+}
+
+static rep_bool
+grow_table (heap_walk *w)
+{
+    long new_size = w->table_size ? w->table_size * 2 : 4096;
+    long *new = rep_alloc (new_size * sizeof (long));
+    long i;
+    if (new == 0)
+	return rep_FALSE;
+    memset (new, 0, new_size * sizeof (long));
+    for (i = 0; i < w->n_objects; i++)
+    {
+	unsigned long h;
+	if (w->objects[i] == rep_NULL)
+	    continue;
+	for (h = hash_object (w->objects[i], new_size); new[h] != 0;
+	     h = (h + 1) & (new_size - 1))
+	    ;
+	new[h] = i + 1;
+    }
+    if (w->table != 0)
+	rep_free (w->table);
+    w->table = new;
+    w->table_size = new_size;
+    return rep_TRUE;
+}
+
+/* Append V to the objects of W, returning its index, or -1 if there's
+   no memory. V is only entered in the hash table if HASHED is true. */
+static long
+append_object (heap_walk *w, repv v, rep_bool hashed)
+{
+    if (w->n_objects == w->allocated_objects)
+    {
+	long new_size = w->allocated_objects ? w->allocated_objects * 2 : 4096;
+	repv *objects = (w->objects != 0
+			 ? rep_realloc (w->objects, new_size * sizeof (repv))
+			 : rep_alloc (new_size * sizeof (repv)));
+	if (objects == 0)
+	    return -1;
+	w->objects = objects;
+	if (w->record_edges)
+	{
+	    long *first = (w->first_edge != 0
+			   ? rep_realloc (w->first_edge,
+					  new_size * sizeof (long))
+			   : rep_alloc (new_size * sizeof (long)));
+	    if (first == 0)
+		return -1;
+	    w->first_edge = first;
+	}
+	w->allocated_objects = new_size;
+    }
+    if (hashed && (w->n_objects + 1) * 2 > w->table_size && !grow_table (w))
+	return -1;
+    w->objects[w->n_objects] = v;
+    if (hashed)
+    {
+	unsigned long h;
+	for (h = hash_object (v, w->table_size); w->table[h] != 0;
+	     h = (h + 1) & (w->table_size - 1))
+	    ;
+	w->table[h] = w->n_objects + 1;
+    }
+    return w->n_objects++;
+}
+
+static void
+add_edge (heap_walk *w, long to)
+{
+    if (w->n_edges == w->allocated_edges)
+    {
+	long new_size = w->allocated_edges ? w->allocated_edges * 2 : 8192;
+	walk_edge *edges = (w->edges != 0
+			    ? rep_realloc (w->edges,
+					   new_size * sizeof (walk_edge))
+			    : rep_alloc (new_size * sizeof (walk_edge)));
+	if (edges == 0)
+	{
+	    w->failed = rep_TRUE;
+	    return;
+	}
+	w->edges = edges;
+	w->allocated_edges = new_size;
+    }
+    w->edges[w->n_edges].to = to;
+    w->edges[w->n_edges].position = w->position;
+    w->n_edges++;
+}
+
+/* Called for each value the object being walked refers to */
+static void
+walk_value (repv v, void *data)
+{
+    heap_walk *w = data;
+    if (v != 0 && rep_CELLP(v) && v != w->blocked && !w->failed
+	&& (w->exclude == 0 || find_object (w->exclude, v) < 0))
+    {
+	long i = find_object (w, v);
+	if (i < 0)
+	{
+	    i = append_object (w, v, rep_TRUE);
+	    if (i < 0)
+		w->failed = rep_TRUE;
+	}
+	if (i >= 0 && w->record_edges)
+	    add_edge (w, i);
+    }
+    w->position++;
+}
+
+/* Find everything reachable from the objects of W */
+static void
+walk_heap (heap_walk *w)
+{
+    for (; w->next < w->n_objects && !w->failed; w->next++)
+    {
+	repv v = w->objects[w->next];
+	if (w->record_edges)
+	    w->first_edge[w->next] = w->n_edges;
+	w->position = 0;
+	if (v == rep_NULL)
+	    rep_visit_roots (walk_value, w);
+	else
+	    rep_visit_children (v, walk_value, w);
+    }
+}
+
+static void
+init_walk (heap_walk *w, rep_bool record_edges)
+{
+    memset (w, 0, sizeof (*w));
+    w->record_edges = record_edges;
+}
+
+/* Find everything reachable from the garbage collector's roots, or
+   from START if it's non-null. Returns false if memory ran out. */
+static rep_bool
+walk_from (heap_walk *w, repv start)
+{
+    if (append_object (w, start, start != rep_NULL) < 0)
+	return rep_FALSE;
+    walk_heap (w);
+    return !w->failed;
+}
+
+static void
+free_walk (heap_walk *w)
+{
+    if (w->objects != 0)
+	rep_free (w->objects);
+    if (w->table != 0)
+	rep_free (w->table);
+    if (w->edges != 0)
+	rep_free (w->edges);
+    if (w->first_edge != 0)
+	rep_free (w->first_edge);
+}
+
+/* Return the number of bytes of memory cell V takes */
+unsigned long
+rep_object_size (repv v)
+{
+    rep_type *t = rep_get_data_type (rep_CELL_TYPE(v));
+    return t->size != 0 ? t->size (v) : sizeof (rep_tuple);
+}
+
+
+/* Census */
+
+struct census_entry {
+    rep_type *type;
+    unsigned long count, bytes;
+};
+
+static int
+census_cmp (const void *a, const void *b)
+{
+    const struct census_entry *x = a, *y = b;
+    return (x->bytes < y->bytes) ? 1 : (x->bytes > y->bytes) ? -1 : 0;
+}
+
+DEFUN("heap-census", Fheap_census, Sheap_census, (void), rep_Subr0) /*
+::doc:rep.data#heap-census::
+heap-census
+
+Collect garbage, then return a list `((NAME COUNT BYTES) ...)'
+describing the objects still in use, with an entry for each type of
+object. NAME is the name of the type, COUNT the number of reachable
+objects of that type and BYTES the memory they take. The list is sorted
+by BYTES, largest first.
+::end:: */
+{
+    static struct census_entry entries[rep_TYPE_SLOTS];
+    heap_walk w;
+    repv out = Qnil;
+    rep_bool ok;
+    long i;
+
+    if (!rep_prepare_heap_walk ())
+	return rep_mem_error ();
+    init_walk (&w, rep_FALSE);
+    ok = walk_from (&w, rep_NULL);
+    rep_finish_heap_walk ();
+    if (!ok)
+    {
+	free_walk (&w);
+	return rep_mem_error ();
+    }
+    memset (entries, 0, sizeof (entries));
+    for (i = 1; i < w.n_objects; i++)
+    {
+	repv v = w.objects[i];
+	unsigned int code = rep_CELL_TYPE(v);
+	struct census_entry *e = &entries[rep_TYPE_SLOT(code)];
+	if (e->type == 0)
+	    e->type = rep_get_data_type (code);
+	e->count++;
+	e->bytes += rep_object_size (v);
+    }
+    free_walk (&w);
+
+    qsort (entries, rep_TYPE_SLOTS, sizeof (entries[0]), census_cmp);
+    for (i = rep_TYPE_SLOTS - 1; i >= 0; i--)
+    {
+	if (entries[i].count == 0)
+	    continue;
+	out = Fcons (rep_list_3 (rep_string_dup (entries[i].type->name),
+				 rep_make_long_uint (entries[i].count),
+				 rep_make_long_uint (entries[i].bytes)), out);
+    }
+    return out;
+}
+
+
+/* Largest objects */
+
+struct sized_object {
+    repv obj;
+    unsigned long bytes;
+};
+
+/* Move entry I of the min-heap HEAP of N entries down to its place */
+static void
+sift_down (struct sized_object *heap, long n, long i)
+{
+    for (;;)
+    {
+	long smallest = i, l = 2 * i + 1, r = l + 1;
+	struct sized_object tem;
+	if (l < n && heap[l].bytes < heap[smallest].bytes)
+	    smallest = l;
+	if (r < n && heap[r].bytes < heap[smallest].bytes)
+	    smallest = r;
+	if (smallest == i)
+	    return;
+	tem = heap[i];
+	heap[i] = heap[smallest];
+	heap[smallest] = tem;
+	i = smallest;
+    }
+}
+
+static int
+sized_object_cmp (const void *a, const void *b)
+{
+    const struct sized_object *x = a, *y = b;
+    return (x->bytes < y->bytes) ? 1 : (x->bytes > y->bytes) ? -1 : 0;
+}
+
+/* True if the type of V is named by one of the strings in TYPES */
+static rep_bool
+type_selected (repv v, repv types)
+{
+    const char *name = rep_get_data_type (rep_CELL_TYPE(v))->name;
+    for (; rep_CONSP(types); types = rep_CDR(types))
+    {
+	repv tem = rep_CAR(types);
+	if (rep_SYMBOLP(tem))
+	    tem = rep_SYM(tem)->name;
+	if (rep_STRINGP(tem) && strcmp (rep_STR(tem), name) == 0)
+	    return rep_TRUE;
+    }
+    return rep_FALSE;
+}
+
+DEFUN("heap-largest-objects", Fheap_largest_objects,
+      Sheap_largest_objects, (repv count, repv types), rep_Subr2) /*
+::doc:rep.data#heap-largest-objects::
+heap-largest-objects COUNT [TYPES]
+
+Collect garbage, then return a list `((BYTES . OBJECT) ...)' of the
+COUNT largest objects still in use, largest first. BYTES is the memory
+taken by OBJECT itself, not counting the objects it refers to.
+
+When TYPES is given it's a list of type names, strings or symbols as
+returned by `heap-census', and only objects of those types are
+considered. Otherwise all objects except cons cells are.
+::end:: */
+{
+    struct sized_object *heap;
+    heap_walk w;
+    long n = 0, max, i;
+    repv out = Qnil;
+    rep_bool ok;
+
+    rep_DECLARE1(count, rep_INTP);
+    rep_DECLARE2_OPT(types, rep_LISTP);
+    max = rep_INT(count);
+    if (max <= 0)
+	return Qnil;
+    heap = rep_alloc (max * sizeof (struct sized_object));
+    if (heap == 0)
+	return rep_mem_error ();
+
+    if (!rep_prepare_heap_walk ())
+    {
+	rep_free (heap);
+	return rep_mem_error ();
+    }
+    init_walk (&w, rep_FALSE);
+    ok = walk_from (&w, rep_NULL);
+    rep_finish_heap_walk ();
+    if (!ok)
+    {
+	free_walk (&w);
+	rep_free (heap);
+	return rep_mem_error ();
+    }
+    for (i = 1; i < w.n_objects; i++)
+    {
+	repv v = w.objects[i];
+	unsigned long bytes;
+	if (types != Qnil ? !type_selected (v, types) : rep_CONSP(v))
+	    continue;
+	bytes = rep_object_size (v);
+	if (n < max)
+	{
+	    long j;
+	    heap[n].obj = v;
+	    heap[n].bytes = bytes;
+	    n++;
+	    if (n == max)
+	    {
+		for (j = n / 2 - 1; j >= 0; j--)
+		    sift_down (heap, n, j);
+	    }
+	}
+	else if (bytes > heap[0].bytes)
+	{
+	    heap[0].obj = v;
+	    heap[0].bytes = bytes;
+	    sift_down (heap, n, 0);
+	}
+    }
+    free_walk (&w);
+
+    qsort (heap, n, sizeof (heap[0]), sized_object_cmp);
+    for (i = n - 1; i >= 0; i--)
+	out = Fcons (Fcons (rep_make_long_uint (heap[i].bytes), heap[i].obj), out);
+    rep_free (heap);
+    return out;
+}
+
+
+/* Retained size */
+
+DEFUN("heap-retained-size", Fheap_retained_size, Sheap_retained_size,
+      (repv obj), rep_Subr1) /*
+::doc:rep.data#heap-retained-size::
+heap-retained-size OBJECT
+
+Collect garbage, then return a list `(COUNT BYTES)' describing the
+objects that are only reachable through OBJECT, including OBJECT itself:
+those that would be freed if OBJECT was. COUNT is the number of those
+objects, and BYTES the memory they take.
+::end:: */
+{
+    heap_walk outside, inside;
+    unsigned long count = 0, bytes = 0;
+    rep_bool ok;
+    long i;
+
+    if (!rep_CELLP(obj))
+	return rep_list_2 (rep_MAKE_INT (0), rep_MAKE_INT (0));
+
+    /* OBJECT is still referred to by this call, so first find
+       everything that can be reached without passing through it,
+       then everything else that can be reached from it */
+    if (!rep_prepare_heap_walk ())
+	return rep_mem_error ();
+    init_walk (&outside, rep_FALSE);
+    outside.blocked = obj;
+    init_walk (&inside, rep_FALSE);
+    inside.exclude = &outside;
+    ok = walk_from (&outside, rep_NULL) && walk_from (&inside, obj);
+    rep_finish_heap_walk ();
+    if (!ok)
+    {
+	free_walk (&inside);
+	free_walk (&outside);
+	return rep_mem_error ();
+    }
+    for (i = 0; i < inside.n_objects; i++)
+    {
+	count++;
+	bytes += rep_object_size (inside.objects[i]);
+    }
+    free_walk (&inside);
+    free_walk (&outside);
+    return rep_list_2 (rep_make_long_uint (count), rep_make_long_uint (bytes));
+}
+
+
+/* Heap snapshots */
+
+/* Snapshots use the JSON format of V8's heap profiler, which Chrome's
+   developer tools (and various other heap analysers) can load. Each
+   node is an object, each edge a reference; the first node stands for
+   the garbage collector's roots. */
+
+#define NODE_FIELDS 6
+
+/* Node types, as listed in write_snapshot */
+enum { NODE_HIDDEN, NODE_ARRAY, NODE_STRING, NODE_OBJECT, NODE_CODE,
+       NODE_CLOSURE, NODE_REGEXP, NODE_NUMBER, NODE_NATIVE, NODE_SYNTHETIC,
+       NODE_CONCATENATED, NODE_SLICED, NODE_SYMBOL };
+
+/* Edge types */
+enum { EDGE_CONTEXT, EDGE_ELEMENT, EDGE_PROPERTY, EDGE_INTERNAL };
+
+/* The strings every snapshot starts with, type names follow */
+enum { STR_ROOTS, STR_CAR, STR_CDR, STR_ANONYMOUS, N_FIXED_STRINGS };
+
+static const char *fixed_strings[N_FIXED_STRINGS] = {
+    "(GC roots)", "car", "cdr", "lambda"
+};
+
+static int
+node_type (repv v)
+{
+    if (v == rep_NULL)
+	return NODE_SYNTHETIC;
+    switch (rep_CELL_TYPE(v))
+    {
+    case rep_String:
+	return NODE_STRING;
+    case rep_Symbol:
+	return NODE_SYMBOL;
+    case rep_Number:
+	return NODE_NUMBER;
+    case rep_Compiled:
+	return NODE_CODE;
+    case rep_Funarg:
+	return NODE_CLOSURE;
+    case rep_Vector:
+	return NODE_ARRAY;
+    default:
+	return NODE_OBJECT;
+    }
+}
+
+/* The Lisp string naming node V, or rep_NULL if it's named by its type */
+static repv
+node_name (repv v)
+{
+    if (v == rep_NULL)
+	return rep_NULL;
+    else if (rep_STRINGP(v))
+	return v;
+    else if (rep_SYMBOLP(v))
+	return rep_SYM(v)->name;
+    else if (rep_FUNARGP(v))
+    {
+	repv name = rep_FUNARG(v)->name;
+	return (rep_SYMBOLP(name) ? rep_SYM(name)->name
+		: rep_STRINGP(name) ? name : rep_NULL);
+    }
+    else if (rep_STRUCTUREP(v) && rep_SYMBOLP(rep_STRUCTURE(v)->name))
+	return rep_SYM(rep_STRUCTURE(v)->name)->name;
+    else
+	return rep_NULL;
+}
+
+/* The index in the string table of the name of node V, when the
+   strings naming nodes so far end at *NEXT */
+static long
+node_name_index (repv v, long *next)
+{
+    if (v == rep_NULL)
+	return STR_ROOTS;
+    else if (node_name (v) != rep_NULL)
+	return (*next)++;
+    else if (rep_FUNARGP(v))
+	return STR_ANONYMOUS;
+    else
+	return N_FIXED_STRINGS + rep_TYPE_SLOT(rep_CELL_TYPE(v));
+}
+
+static void
+put_json_string (FILE *fh, const char *s, long len)
+{
+    long i;
+    putc ('"', fh);
+    for (i = 0; i < len; i++)
+    {
+	unsigned char c = s[i];
+	if (c == '"' || c == '\\')
+	    fprintf (fh, "\\%c", c);
+	else if (c < 32 || c >= 127)
+	    /* other bytes are treated as latin-1, so that the file is
+	       valid even if the string isn't utf-8 */
+	    fprintf (fh, "\\u%04x", c);
+	else
+	    putc (c, fh);
+    }
+    putc ('"', fh);
+}
+
+static rep_bool
+write_snapshot (heap_walk *w, FILE *fh)
+{
+    static rep_type *types[rep_TYPE_SLOTS];
+    long i, e, next_name;
+    rep_bool first;
+
+    memset (types, 0, sizeof (types));
+    for (i = 1; i < w->n_objects; i++)
+    {
+	unsigned int code = rep_CELL_TYPE(w->objects[i]);
+	if (types[rep_TYPE_SLOT(code)] == 0)
+	    types[rep_TYPE_SLOT(code)] = rep_get_data_type (code);
+    }
+
+    fputs ("{\"snapshot\":{\"meta\":{"
+	   "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\","
+	   "\"edge_count\",\"trace_node_id\"],"
+	   "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\","
+	   "\"code\",\"closure\",\"regexp\",\"number\",\"native\","
+	   "\"synthetic\",\"concatenated string\",\"sliced string\","
+	   "\"symbol\"],\"string\",\"number\",\"number\",\"number\","
+	   "\"number\"],"
+	   "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],"
+	   "\"edge_types\":[[\"context\",\"element\",\"property\","
+	   "\"internal\",\"hidden\",\"shortcut\",\"weak\"],"
+	   "\"string_or_number\",\"node\"],"
+	   "\"trace_function_info_fields\":[],\"trace_node_fields\":[],"
+	   "\"sample_fields\":[],\"location_fields\":[]},", fh);
+    fprintf (fh, "\"node_count\":%ld,\"edge_count\":%ld,"
+	     "\"trace_function_count\":0},\n", w->n_objects, w->n_edges);
+
+    fputs ("\"nodes\":[", fh);
+    next_name = N_FIXED_STRINGS + rep_TYPE_SLOTS;
+    for (i = 0; i < w->n_objects; i++)
+    {
+	repv v = w->objects[i];
+	long end = (i + 1 < w->n_objects) ? w->first_edge[i + 1] : w->n_edges;
+	fprintf (fh, "%s%d,%ld,%ld,%lu,%ld,0\n", i > 0 ? "," : "",
+		 node_type (v), node_name_index (v, &next_name), 2 * i + 1,
+		 v != rep_NULL ? rep_object_size (v) : 0UL,
+		 end - w->first_edge[i]);
+    }
+
+    fputs ("],\n\"edges\":[", fh);
+    first = rep_TRUE;
+    for (i = 0; i < w->n_objects; i++)
+    {
+	repv v = w->objects[i];
+	long end = (i + 1 < w->n_objects) ? w->first_edge[i + 1] : w->n_edges;
+	for (e = w->first_edge[i]; e < end; e++)
+	{
+	    walk_edge *edge = &w->edges[e];
+	    if (v != rep_NULL && rep_CONSP(v))
+	    {
+		fprintf (fh, "%s%d,%d,%ld\n", first ? "" : ",", EDGE_PROPERTY,
+			 edge->position == 0 ? STR_CAR : STR_CDR,
+			 edge->to * NODE_FIELDS);
+	    }
+	    else
+	    {
+		fprintf (fh, "%s%d,%ld,%ld\n", first ? "" : ",", EDGE_ELEMENT,
+			 edge->position, edge->to * NODE_FIELDS);
+	    }
+	    first = rep_FALSE;
+	}
+    }
+
+    fputs ("],\n\"trace_function_infos\":[],\"trace_tree\":[],"
+	   "\"samples\":[],\"locations\":[],\n\"strings\":[", fh);
+    for (i = 0; i < N_FIXED_STRINGS; i++)
+    {
+	if (i > 0)
+	    putc (',', fh);
+	put_json_string (fh, fixed_strings[i], strlen (fixed_strings[i]));
+    }
+    for (i = 0; i < rep_TYPE_SLOTS; i++)
+    {
+	const char *name = types[i] != 0 ? types[i]->name : "";
+	putc (',', fh);
+	put_json_string (fh, name, strlen (name));
+    }
+    for (i = 0; i < w->n_objects; i++)
+    {
+	repv name = node_name (w->objects[i]);
+	if (name != rep_NULL)
+	{
+	    putc (',', fh);
+	    put_json_string (fh, rep_STR(name),
+			     MIN (rep_STRING_LEN(name), SNAPSHOT_NAME_MAX));
+	}
+    }
+    fputs ("]}\n", fh);
+    return !ferror (fh);
+}
+
+DEFUN("dump-heap", Fdump_heap, Sdump_heap, (repv file), rep_Subr1) /*
+::doc:rep.data#dump-heap::
+dump-heap FILE-NAME
+
+Collect garbage, then write the graph of the objects still in use to
+the file called FILE-NAME, as a heap snapshot in the JSON format used by
+V8 (the `.heapsnapshot' files of Chrome's developer tools). Each object
+is a node, named by its type, except strings, symbols, closures and
+structures which are named by their contents or names.
+::end:: */
+{
+    heap_walk w;
+    repv local;
+    FILE *fh;
+    rep_bool ok;
+
+    rep_DECLARE1(file, rep_STRINGP);
+    local = Flocal_file_name (file);
+    if (local == rep_NULL)
+	return rep_NULL;
+    if (!rep_STRINGP(local))
+	return rep_signal_file_error (file);
+
+    if (!rep_prepare_heap_walk ())
+	return rep_mem_error ();
+    init_walk (&w, rep_TRUE);
+    ok = walk_from (&w, rep_NULL);
+    rep_finish_heap_walk ();
+    if (!ok)
+    {
+	free_walk (&w);
+	return rep_mem_error ();
+    }
+
+    fh = fopen (rep_STR(local), "w");
+    if (fh != 0)
+    {
+	ok = write_snapshot (&w, fh);
+	if (fclose (fh) != 0)
+	    ok = rep_FALSE;
+    }
+    else
+	ok = rep_FALSE;
+    free_walk (&w);
+
+    if (!ok)
+	return rep_signal_file_error (file);
+    return file;
+}
+
+
+/* init */
+
+void
+rep_heap_census_init (void)
+{
+    repv tem = rep_push_structure ("rep.data");
+    rep_ADD_SUBR(Sheap_census);
+    rep_ADD_SUBR(Sheap_largest_objects);
+    rep_ADD_SUBR(Sheap_retained_size);
+    rep_ADD_SUBR(Sdump_heap);
+    rep_pop_structure (tem);
+}
@@ -0,0 +1,1186 @@
+/* images.c -- saving the Lisp heap to a file, and restoring it
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
+
+/* A heap image records the state of the Lisp world -- every structure
+   in the module registry, their bindings, and everything reachable
+   from them -- so that rep can start from it instead of loading and
+   evaluating the bootstrap modules.
+
+   The file is a header followed by one record per saved object, each
+   a sequence of words. A word referring to another object is either an
+   immediate value (a fixnum or float), copied verbatim, or the number
+   of the object's record shifted left two bits with the two low bits
+   set. No Lisp value has its low bit set.
+
+   Loading maps the file into memory and merges the saved structures
+   into the running system straight away, but each binding's value is
+   left as the reference to its record (see rep_IMAGE_PENDING_P). The
+   object is only built when the binding is first looked up, so a short
+   lived process touches little of the image. Objects are remembered as
+   they're built, so sharing and cycles are preserved.
+
+   Objects held by the static roots C code registered before the
+   environment was loaded are saved as the number of the root, keeping
+   their identity, and subrs are found by name. Special variables that
+   were defined in C and not changed while the environment was loaded
+   aren't saved at all, so the new process keeps its own values (e.g.
+   command-line-args). An image can only be used by the same build of
+   rep that saved it, with the same dynamically loaded libraries. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include "bytecodes.h"
+#include "serialize.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#if defined (HAVE_MMAP) && defined (HAVE_MUNMAP)
+# define USE_MMAP
+#endif
+
+typedef unsigned rep_PTR_SIZED_INT img_word;
+
+#define IMAGE_MAGIC	"rep-heap"
+#define IMAGE_VERSION	1
+#define IMAGE_BYTE_ORDER 0x01020304
+
+#define WORD_SIZE	sizeof (img_word)
+#define WORDS(bytes)	(((bytes) + WORD_SIZE - 1) / WORD_SIZE)
+
+/* References to other records */
+#define REFP(w)		(((w) & 1) != 0)
+#define MAKE_REF(i)	((((img_word) (i)) << 2) | 3)
+#define REF_INDEX(w)	((w) >> 2)
+
+typedef struct {
+    char magic[8];
+    img_word version;
+    img_word word_size;
+    img_word byte_order;
+    img_word bytecode_version;
+    char rep_version[32];
+    img_word n_roots;		/* core static roots, their types follow */
+    img_word n_objects;		/* record offsets follow the root types */
+    img_word structures;	/* list of structures to merge */
+    img_word libraries;		/* list of dl library file names */
+    img_word printers;		/* datum printers, (ID . PRINTER) */
+} image_header;
+
+/* The first word of each record is its kind, plus KIND_BITS of extra
+   information */
+enum image_record {
+    REC_STATIC = 1, REC_CONS, REC_SYMBOL, REC_STRING, REC_VECTOR,
+    REC_COMPILED, REC_FLOAT, REC_NUMBER, REC_SUBR, REC_CLOSURE,
+    REC_STRUCTURE, REC_DATUM, REC_NUMVEC, REC_BYTEVECTOR
+};
+
+#define KIND_BITS	REP_SERIAL_KIND_BITS
+#define REC_KIND(w)	((w) & ((1 << KIND_BITS) - 1))
+#define REC_AUX(w)	((w) >> KIND_BITS)
+
+/* REC_STATIC records, objects that exist before any image is loaded */
+enum image_static {
+    STATIC_NIL, STATIC_VOID, STATIC_LEXTAG,
+    STATIC_STDIN, STATIC_STDOUT, STATIC_STDERR, STATIC_ROOT
+};
+
+/* Where REC_SYMBOL symbols are interned */
+enum { SYM_UNINTERNED, SYM_OBARRAY, SYM_KEYWORD };
+
+/* How REC_STRUCTURE records find their structure */
+enum { HOME_NEW, HOME_REGISTERED, HOME_ROOT };
+
+/* The static roots registered before the environment was loaded, the
+   values they had then, and their number */
+static repv core_values;
+static int n_core_roots;
+
+/* Special variables defined and not changed by the bootstrap, (SYMBOL
+   . VALUE) while loading, then the list of SYMBOLs */
+static repv core_specials;
+
+DEFSTRING(no_core, "Can't save image before the environment is loaded");
+DEFSTRING(unsaveable, "Can't save object in heap image");
+
+
+/* Noting the state of the system */
+
+static repv
+special_bindings (void)
+{
+    rep_struct *s = rep_STRUCTURE (rep_specials_structure);
+    repv list = Qnil;
+    int i;
+    for (i = 0; i < s->total_buckets; i++)
+    {
+	rep_struct_node *n;
+	for (n = s->buckets[i]; n != 0; n = n->next)
+	    list = Fcons (Fcons (n->symbol, n->binding), list);
+    }
+    return list;
+}
+
+/* Called before the environment is loaded */
+void
+rep_note_core_state (void)
+{
+    repv **roots = rep_static_roots (&n_core_roots);
+    int i;
+    core_values = rep_make_vector (n_core_roots);
+    for (i = 0; i < n_core_roots; i++)
+	rep_VECTI (core_values, i) = *roots[i];
+    core_specials = special_bindings ();
+}
+
+/* Called after the environment is loaded */
+void
+rep_note_bootstrap_state (void)
+{
+    repv now = special_bindings ();
+    repv list = Qnil;
+    for (; rep_CONSP (now); now = rep_CDR (now))
+    {
+	repv old = Fassq (rep_CAR (rep_CAR (now)), core_specials);
+	if (old && rep_CONSP (old) && rep_CDR (old) == rep_CDR (rep_CAR (now)))
+	    list = Fcons (rep_CAR (old), list);
+    }
+    core_specials = list;
+}
+
+static int
+root_type (repv v)
+{
+    return (v == 0) ? 0 : rep_CELLP (v) ? rep_CELL_TYPE (v) : 1;
+}
+
+
+/* Saving */
+
+typedef struct {
+    repv value;
+    int index;
+} root_entry;
+
+typedef struct {
+    rep_serializer s;
+
+    /* Unchanged core roots, sorted by value */
+    root_entry *roots;
+    int n_roots;
+} image_out;
+
+#define IMAGE_OUT(s) ((image_out *) (s))
+
+static rep_serial_word
+ref_word (rep_serializer *out, repv v)
+{
+    if (v == 0 || !rep_CELLP (v))
+	return v;
+    else
+	return MAKE_REF (rep_value_number (&out->records, v, rep_TRUE));
+}
+
+static int
+root_cmp (const void *a, const void *b)
+{
+    repv x = ((const root_entry *) a)->value;
+    repv y = ((const root_entry *) b)->value;
+    return (x < y) ? -1 : (x > y) ? 1 : ((const root_entry *) a)->index
+					 - ((const root_entry *) b)->index;
+}
+
+/* Return the number of the unchanged core root holding V, or -1 */
+static int
+root_index (image_out *out, repv v)
+{
+    int lo = 0, hi = out->n_roots;
+    while (lo < hi)
+    {
+	int mid = (lo + hi) / 2;
+	if (out->roots[mid].value < v)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return (lo < out->n_roots && out->roots[lo].value == v)
+	    ? out->roots[lo].index : -1;
+}
+
+static void
+find_roots (image_out *out)
+{
+    repv **roots;
+    int i, n;
+    roots = rep_static_roots (&n);
+    out->roots = rep_alloc (sizeof (root_entry) * n_core_roots + 1);
+    out->n_roots = 0;
+    for (i = 0; i < n_core_roots && i < n; i++)
+    {
+	repv v = *roots[i];
+	if (v != 0 && rep_CELLP (v) && v == rep_VECTI (core_values, i))
+	{
+	    out->roots[out->n_roots].value = v;
+	    out->roots[out->n_roots].index = i;
+	    out->n_roots++;
+	}
+    }
+    qsort (out->roots, out->n_roots, sizeof (root_entry), root_cmp);
+}
+
+static int
+symbol_home (repv sym)
+{
+    if (rep_SYM (sym)->car & rep_SF_KEYWORD)
+    {
+	if (Ffind_symbol (rep_SYM (sym)->name, rep_keyword_obarray) == sym)
+	    return SYM_KEYWORD;
+    }
+    else if (Ffind_symbol (rep_SYM (sym)->name, rep_obarray) == sym)
+	return SYM_OBARRAY;
+    return SYM_UNINTERNED;
+}
+
+static void
+put_static (rep_serializer *out, int code, int root)
+{
+    rep_serial_put_word (out, REC_STATIC | (code << KIND_BITS));
+    rep_serial_put_word (out, root);
+}
+
+static void
+write_structure (rep_serializer *out, repv v)
+{
+    rep_struct *s = rep_STRUCTURE (v);
+    rep_bool specials = (v == rep_specials_structure);
+    int root = root_index (IMAGE_OUT (out), v);
+    long count = 0;
+    int i, vm;
+
+    vm = rep_structure_vm_code (v);
+    if (vm < 0)
+    {
+	out->error = v;
+	return;
+    }
+
+    rep_serial_put_word (out, REC_STRUCTURE);
+    if (root >= 0)
+	rep_serial_put_word (out, HOME_ROOT + root);
+    else if (s->name != Qnil && Fget_structure (s->name) == v)
+	rep_serial_put_word (out, HOME_REGISTERED);
+    else
+	rep_serial_put_word (out, HOME_NEW);
+    rep_serial_put_ref (out, s->name);
+    rep_serial_put_word (out, ((s->car & ~rep_STF_EXCLUSION)
+			       >> rep_CELL16_TYPE_BITS));
+    rep_serial_put_ref (out, s->inherited);
+    rep_serial_put_ref (out, s->imports);
+    rep_serial_put_ref (out, s->accessible);
+    rep_serial_put_ref (out, s->special_env);
+    rep_serial_put_word (out, vm);
+
+    for (i = 0; i < s->total_buckets; i++)
+    {
+	rep_struct_node *n;
+	for (n = s->buckets[i]; n != 0; n = n->next)
+	{
+	    if (!specials || Fmemq (n->symbol, core_specials) == Qnil)
+		count++;
+	}
+    }
+    rep_serial_put_word (out, count);
+    for (i = 0; i < s->total_buckets; i++)
+    {
+	rep_struct_node *n;
+	for (n = s->buckets[i]; n != 0; n = n->next)
+	{
+	    if (specials && Fmemq (n->symbol, core_specials) != Qnil)
+		continue;
+	    if (rep_IMAGE_PENDING_P (n->binding))
+		rep_image_force_binding (n);
+	    rep_serial_put_ref (out, n->symbol);
+	    rep_serial_put_ref (out, n->binding);
+	    rep_serial_put_word (out, n->is_exported | (n->is_constant << 1));
+	}
+    }
+}
+
+static void
+write_record (rep_serializer *out, repv v)
+{
+    int root, home;
+
+    if (v == Qnil)
+	put_static (out, STATIC_NIL, 0);
+    else if (v == rep_void_value)
+	put_static (out, STATIC_VOID, 0);
+    else if (v == rep_VAL (&rep_lextag))
+	put_static (out, STATIC_LEXTAG, 0);
+    else if (rep_FILEP (v) && v == Fstdin_file ())
+	put_static (out, STATIC_STDIN, 0);
+    else if (rep_FILEP (v) && v == Fstdout_file ())
+	put_static (out, STATIC_STDOUT, 0);
+    else if (rep_FILEP (v) && v == Fstderr_file ())
+	put_static (out, STATIC_STDERR, 0);
+    else if (rep_STRUCTUREP (v))
+	write_structure (out, v);
+    else if (rep_SYMBOLP (v)
+	     && ((home = symbol_home (v)) != SYM_UNINTERNED
+		 || root_index (IMAGE_OUT (out), v) < 0))
+    {
+	repv name = rep_SYM (v)->name;
+	rep_serial_put_word (out, REC_SYMBOL | (home << KIND_BITS));
+	rep_serial_put_word (out, rep_SYM (v)->car >> rep_CELL8_TYPE_BITS);
+	rep_serial_put_word (out, rep_STRING_LEN (name));
+	rep_serial_put_bytes (out, rep_STR (name), rep_STRING_LEN (name));
+    }
+    else if ((root = root_index (IMAGE_OUT (out), v)) >= 0)
+	put_static (out, STATIC_ROOT, root);
+    else if (rep_CONSP (v))
+    {
+	rep_serial_put_word (out, REC_CONS);
+	rep_serial_put_ref (out, rep_CAR (v));
+	rep_serial_put_ref (out, rep_CDR (v));
+    }
+    else if (rep_STRINGP (v))
+	rep_serial_put_string (out, REC_STRING, v);
+    else if (rep_VECTORP (v) || rep_COMPILEDP (v))
+    {
+	rep_serial_put_vector (out, rep_VECTORP (v)
+			       ? REC_VECTOR : REC_COMPILED, v);
+    }
+    else if (rep_NUMBERP (v) && rep_NUMBER_FLOAT_P (v))
+	rep_serial_put_float (out, REC_FLOAT, v);
+    else if (rep_NUMBERP (v))
+	rep_serial_put_number (out, REC_NUMBER, v);
+    else if (rep_CELL8P (v) && (rep_CELL8_TYPE (v) == rep_SF
+				|| (rep_CELL8_TYPE (v) >= rep_Subr0
+				    && rep_CELL8_TYPE (v) <= rep_SubrN)))
+    {
+	repv s = rep_XSUBR (v)->structure;
+	if (s == rep_NULL || !rep_STRUCTUREP (s)
+	    || !rep_SYMBOLP (rep_STRUCTURE (s)->name))
+	{
+	    out->error = v;
+	    return;
+	}
+	rep_serial_put_word (out, REC_SUBR);
+	rep_serial_put_ref (out, rep_STRUCTURE (s)->name);
+	rep_serial_put_ref (out, rep_XSUBR (v)->name);
+    }
+    else if (rep_FUNARGP (v))
+    {
+	rep_serial_put_word (out, REC_CLOSURE);
+	rep_serial_put_word (out, rep_FUNARG (v)->car >> rep_CELL8_TYPE_BITS);
+	rep_serial_put_ref (out, rep_FUNARG (v)->fun);
+	rep_serial_put_ref (out, rep_FUNARG (v)->name);
+	rep_serial_put_ref (out, rep_FUNARG (v)->env);
+	rep_serial_put_ref (out, rep_FUNARG (v)->structure);
+    }
+    else if (rep_datump (v))
+    {
+	rep_serial_put_word (out, REC_DATUM);
+	rep_serial_put_ref (out, rep_TUPLE (v)->a);
+	rep_serial_put_ref (out, rep_TUPLE (v)->b);
+    }
+    else if (rep_NUMVECP (v))
+    {
+	long i, len = rep_numvec_length (v);
+	rep_serial_put_word (out, REC_NUMVEC);
+	rep_serial_put_ref (out, Fnumeric_vector_type (v));
+	rep_serial_put_word (out, len);
+	for (i = 0; i < len; i++)
+	    rep_serial_put_ref (out, rep_numvec_ref (v, i));
+    }
+    else if (rep_BYTEVECTORP (v))
+    {
+	rep_serial_put_word (out, REC_BYTEVECTOR);
+	rep_serial_put_word (out, rep_bytevector_length (v));
+	rep_serial_put_bytes (out, rep_bytevector_data (v),
+			      rep_bytevector_length (v));
+    }
+    else
+	out->error = v;
+}
+
+/* Return a list of the structures to save: all registered structures,
+   then those held by core roots, with the registry itself last */
+static repv
+structures_to_save (void)
+{
+    repv registry = rep_structure_registry ();
+    rep_struct *s = rep_STRUCTURE (registry);
+    repv list = Qnil;
+    int i;
+
+    for (i = 0; i < s->total_buckets; i++)
+    {
+	rep_struct_node *n;
+	for (n = s->buckets[i]; n != 0; n = n->next)
+	{
+	    repv v;
+	    if (rep_IMAGE_PENDING_P (n->binding))
+		rep_image_force_binding (n);
+	    v = n->binding;
+	    if (rep_STRUCTUREP (v) && v != registry
+		&& Fmemq (v, list) == Qnil)
+		list = Fcons (v, list);
+	}
+    }
+    for (i = 0; i < n_core_roots; i++)
+    {
+	repv v = rep_VECTI (core_values, i);
+	if (v != 0 && rep_STRUCTUREP (v) && v != registry
+	    && Fmemq (v, list) == Qnil)
+	    list = Fcons (v, list);
+    }
+    return Fnreverse (Fcons (registry, list));
+}
+
+static rep_bool
+write_image (rep_serializer *out, FILE *fh)
+{
+    image_header h;
+    long i;
+
+    memset (&h, 0, sizeof (h));
+    memcpy (h.magic, IMAGE_MAGIC, sizeof (h.magic));
+    h.version = IMAGE_VERSION;
+    h.word_size = WORD_SIZE;
+    h.byte_order = IMAGE_BYTE_ORDER;
+    h.bytecode_version = ((BYTECODE_MAJOR_VERSION << 16)
+			  | BYTECODE_MINOR_VERSION);
+    strncpy (h.rep_version, rep_VERSION, sizeof (h.rep_version) - 1);
+    h.n_roots = n_core_roots;
+
+    h.structures = ref_word (out, structures_to_save ());
+#ifdef HAVE_DYNAMIC_LOADING
+    {
+	/* the libraries may have been found relative to the
+	   current directory */
+	repv libs, ptr;
+	for (libs = ptr = rep_dl_library_names ();
+	     rep_CONSP (ptr); ptr = rep_CDR (ptr))
+	{
+	    repv tem = Fexpand_file_name (rep_CAR (ptr), Qnil);
+	    if (tem == rep_NULL)
+		return rep_FALSE;
+	    /* file handlers may have run a collection */
+	    rep_CAR (ptr) = tem;
+	    rep_CONS_BARRIER (ptr);
+	}
+	h.libraries = ref_word (out, libs);
+    }
+#else
+    h.libraries = ref_word (out, Qnil);
+#endif
+    h.printers = ref_word (out, rep_datum_printers ());
+
+    if (!rep_serial_write_records (out))
+	return rep_FALSE;
+    h.n_objects = out->records.n_values;
+
+    if (fwrite (&h, sizeof (h), 1, fh) != 1)
+	return rep_FALSE;
+    for (i = 0; i < n_core_roots; i++)
+    {
+	if (!rep_serial_fwrite_word (out, root_type (rep_VECTI (core_values, i)),
+				     fh))
+	{
+	    return rep_FALSE;
+	}
+    }
+    for (i = 0; i < (long) h.n_objects; i++)
+    {
+	if (!rep_serial_fwrite_word (out, (sizeof (h)
+					   + (n_core_roots + h.n_objects)
+					   * WORD_SIZE + out->offsets[i]), fh))
+	{
+	    return rep_FALSE;
+	}
+    }
+    return fwrite (out->buf, 1, out->len, fh) == out->len;
+}
+
+DEFUN("save-image", Fsave_image, Ssave_image, (repv file), rep_Subr1) /*
+::doc:rep.system#save-image::
+save-image FILE-NAME
+
+Write the current state of the Lisp system to the file called FILE-NAME,
+as a heap image. Starting rep with the option `--image FILE-NAME' (or
+with the environment variable `REPIMAGE' set to FILE-NAME) restores
+that state, instead of loading the standard modules.
+
+All structures with names are saved, with the values of their bindings
+and everything reachable from them. An error is signalled if one of
+those objects can't be saved, e.g. a process or an open file.
+::end:: */
+{
+    image_out out;
+    repv local;
+    FILE *fh;
+    char *temp;
+    int fd;
+    rep_bool ok;
+
+    rep_DECLARE1 (file, rep_STRINGP);
+    if (core_values == Qnil)
+	return Fsignal (Qerror, rep_LIST_1 (rep_VAL (&no_core)));
+
+    local = Flocal_file_name (file);
+    if (local == rep_NULL)
+	return rep_NULL;
+    if (!rep_STRINGP (local))
+	return rep_signal_file_error (file);
+
+    rep_serial_init (&out.s, WORD_SIZE, rep_FALSE);
+    out.s.ref_word = ref_word;
+    out.s.write_record = write_record;
+    find_roots (&out);
+
+    /* The image this process started from may be FILE, and is still
+       mapped; write a new file beside it and rename that over FILE
+       instead of overwriting the pages being used */
+    temp = rep_alloc (strlen (rep_STR (local)) + 32);
+    sprintf (temp, "%s.%lu~", rep_STR (local), rep_getpid ());
+    fd = open (temp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    fh = (fd >= 0) ? fdopen (fd, "wb") : 0;
+    if (fh != 0)
+    {
+	ok = write_image (&out.s, fh);
+	if (fclose (fh) != 0)
+	    ok = rep_FALSE;
+	if (ok && rename (temp, rep_STR (local)) != 0)
+	    ok = rep_FALSE;
+	if (!ok)
+	    unlink (temp);
+    }
+    else
+    {
+	if (fd >= 0)
+	{
+	    close (fd);
+	    unlink (temp);
+	}
+	ok = rep_FALSE;
+    }
+    rep_free (temp);
+
+    rep_serial_free (&out.s);
+    rep_free (out.roots);
+
+    if (out.s.error != rep_NULL)
+    {
+	return Fsignal (Qerror, rep_list_2 (rep_VAL (&unsaveable),
+					    out.s.error));
+    }
+    else if (!ok)
+	return rep_signal_file_error (file);
+    else
+	return file;
+}
+
+
+/* Loading */
+
+/* The image, its size, and whether it's mapped */
+static char *image_data;
+static size_t image_size;
+static rep_bool image_mapped;
+
+static img_word *image_offsets;
+static long image_n_objects;
+
+/* The objects built so far, or zero */
+static repv image_objects;
+
+#define RECORD(i) ((img_word *) (image_data + image_offsets[i]))
+
+static repv build_object (long i);
+
+static inline repv
+image_value (img_word w)
+{
+    return REFP (w) ? build_object (REF_INDEX (w)) : w;
+}
+
+/* Return the value for a binding, leaving it to be built later if
+   it hasn't been already */
+static inline repv
+binding_value (img_word w)
+{
+    if (REFP (w) && rep_VECTI (image_objects, REF_INDEX (w)) == 0)
+	return w;
+    else
+	return image_value (w);
+}
+
+static repv
+build_structure (long i, img_word *w)
+{
+    repv name = image_value (w[2]);
+    repv v;
+    rep_struct *s;
+    img_word *b;
+    long j;
+
+    if (w[1] >= HOME_ROOT)
+	v = rep_VECTI (core_values, w[1] - HOME_ROOT);
+    else if (w[1] == HOME_REGISTERED && rep_SYMBOLP (name))
+    {
+	v = Fget_structure (name);
+	if (v == Qnil)
+	    v = Fmake_structure (Qnil, Qnil, Qnil, name);
+    }
+    else
+    {
+	v = Fmake_structure (Qnil, Qnil, Qnil, Qnil);
+	rep_STRUCTURE (v)->name = name;
+    }
+    rep_VECTI (image_objects, i) = v;
+
+    s = rep_STRUCTURE (v);
+    s->car = ((s->car & ((1 << rep_CELL16_TYPE_BITS) - 1))
+	      | (w[3] << rep_CELL16_TYPE_BITS));
+    for (j = 0, b = w + 10; j < (long) w[9]; j++, b += 3)
+    {
+	repv sym = image_value (b[0]);
+	rep_struct_node *n;
+	if (!rep_SYMBOLP (sym))
+	    continue;
+	n = rep_structure_add_binding (v, sym);
+	n->binding = binding_value (b[1]);
+	n->is_exported = (b[2] & 1) != 0;
+	n->is_constant = (b[2] & 2) != 0;
+    }
+    s->inherited = image_value (w[4]);
+    s->imports = image_value (w[5]);
+    s->accessible = image_value (w[6]);
+    s->special_env = image_value (w[7]);
+    rep_structure_set_vm_code (v, w[8]);
+    return v;
+}
+
+static repv
+build_object (long i)
+{
+    img_word *w;
+    repv v;
+    long j;
+
+    v = rep_VECTI (image_objects, i);
+    if (v != 0)
+	return v;
+
+    w = RECORD (i);
+    switch (REC_KIND (w[0]))
+    {
+	char *text;
+	int sign;
+	double d;
+
+    case REC_CONS:
+	/* Build the spine of lists iteratively. Building doesn't call
+	   Lisp, so no collection can happen before the new cells are
+	   filled in, and storing into them needs no barrier */
+	v = Fcons (Qnil, Qnil);
+	rep_VECTI (image_objects, i) = v;
+	for (;;)
+	{
+	    repv next;
+	    rep_CAR (v) = image_value (w[1]);
+	    if (!REFP (w[2]) || rep_VECTI (image_objects, REF_INDEX (w[2])) != 0
+		|| REC_KIND (RECORD (REF_INDEX (w[2]))[0]) != REC_CONS)
+	    {
+		rep_CDR (v) = image_value (w[2]);
+		break;
+	    }
+	    next = Fcons (Qnil, Qnil);
+	    rep_VECTI (image_objects, REF_INDEX (w[2])) = next;
+	    rep_CDR (v) = next;
+	    v = next;
+	    w = RECORD (REF_INDEX (w[2]));
+	}
+	break;
+
+    case REC_SYMBOL:
+	v = rep_string_dupn ((char *) (w + 3), w[2]);
+	if (REC_AUX (w[0]) == SYM_OBARRAY)
+	    v = Fintern (v, rep_obarray);
+	else if (REC_AUX (w[0]) == SYM_KEYWORD)
+	    v = Fintern (v, rep_keyword_obarray);
+	else
+	    v = Fmake_symbol (v);
+	rep_SYM (v)->car |= w[1] << rep_CELL8_TYPE_BITS;
+	rep_VECTI (image_objects, i) = v;
+	break;
+
+    case REC_STRING:
+	v = rep_string_dupn ((char *) (w + 2), w[1]);
+	rep_VECTI (image_objects, i) = v;
+	break;
+
+    case REC_VECTOR:
+    case REC_COMPILED:
+	if (REC_KIND (w[0]) == REC_COMPILED)
+	{
+	    /* size the inline caches from the constant vector's record */
+	    long n_caches = 0;
+	    if (w[1] > 1 && REFP (w[3])
+		&& REC_KIND (RECORD (REF_INDEX (w[3]))[0]) == REC_VECTOR)
+	    {
+		n_caches = RECORD (REF_INDEX (w[3]))[1];
+	    }
+	    v = rep_make_compiled (w[1], n_caches);
+	}
+	else
+	{
+	    v = rep_make_vector (w[1]);
+	    for (j = 0; j < (long) w[1]; j++)
+		rep_VECTI (v, j) = Qnil;
+	}
+	rep_VECTI (image_objects, i) = v;
+	for (j = 0; j < (long) w[1]; j++)
+	    rep_VECTI (v, j) = image_value (w[2 + j]);
+	break;
+
+    case REC_FLOAT:
+	memcpy (&d, w + 1, sizeof (d));
+	v = rep_make_float (d, rep_TRUE);
+	rep_VECTI (image_objects, i) = v;
+	break;
+
+    case REC_NUMBER:
+	text = (char *) (w + 2);
+	sign = 1;
+	if (*text == '-')
+	{
+	    sign = -1;
+	    text++;
+	}
+	v = rep_parse_number (text, strlen (text), 10, sign,
+			      (REC_AUX (w[0]) == rep_NUMBER_RATIONAL)
+			      ? rep_NUMBER_RATIONAL : 0);
+	if (v == rep_NULL)
+	    v = rep_MAKE_INT (0);
+	rep_VECTI (image_objects, i) = v;
+	break;
+
+    case REC_CLOSURE:
+	v = Fmake_closure (Qnil, Qnil);
+	rep_VECTI (image_objects, i) = v;
+	rep_FUNARG (v)->car = ((rep_FUNARG (v)->car & rep_CELL8_TYPE_MASK)
+			       | (w[1] << rep_CELL8_TYPE_BITS));
+	rep_FUNARG (v)->fun = image_value (w[2]);
+	rep_FUNARG (v)->name = image_value (w[3]);
+	rep_FUNARG (v)->env = image_value (w[4]);
+	rep_FUNARG (v)->structure = image_value (w[5]);
+	break;
+
+    case REC_STRUCTURE:
+	v = build_structure (i, w);
+	break;
+
+    case REC_DATUM:
+	v = Fmake_datum (Qnil, Qnil);
+	rep_VECTI (image_objects, i) = v;
+	rep_TUPLE (v)->a = image_value (w[1]);
+	rep_TUPLE (v)->b = image_value (w[2]);
+	break;
+
+    case REC_NUMVEC:
+	v = Fmake_numeric_vector (image_value (w[1]),
+				  rep_MAKE_INT (w[2]), Qnil);
+	rep_VECTI (image_objects, i) = v;
+	for (j = 0; j < (long) w[2]; j++)
+	    rep_numvec_set (v, j, image_value (w[3 + j]));
+	break;
+
+    case REC_BYTEVECTOR:
+	v = Fmake_bytevector (rep_MAKE_INT (w[1]), Qnil);
+	memcpy (rep_bytevector_data (v), w + 2, w[1]);
+	rep_VECTI (image_objects, i) = v;
+	break;
+
+    default:
+	/* statics and subrs are found when the image is loaded */
+	abort ();
+    }
+
+    return rep_VECTI (image_objects, i);
+}
+
+void
+rep_image_force_binding (rep_struct_node *n)
+{
+    n->binding = build_object (REF_INDEX (n->binding));
+    /* everything built is reachable from the binding */
+    rep_OBJECT_BARRIER (image_objects, n->binding);
+}
+
+static inline rep_bool
+bad_ref (img_word w)
+{
+    return REFP (w) && REF_INDEX (w) >= (img_word) image_n_objects;
+}
+
+/* Return the number of words in the record at W, with AVAIL words
+   before the next record, or zero if it's invalid */
+static size_t
+check_record (img_word *w, size_t avail)
+{
+    size_t size, i;
+
+    if (avail < 3)
+	return 0;
+    switch (REC_KIND (w[0]))
+    {
+    case REC_STATIC:
+	if (REC_AUX (w[0]) > STATIC_ROOT
+	    || (REC_AUX (w[0]) == STATIC_ROOT && w[1] >= (img_word) n_core_roots))
+	    return 0;
+	return 2;
+
+    case REC_CONS: case REC_SUBR: case REC_DATUM:
+	return (bad_ref (w[1]) || bad_ref (w[2])) ? 0 : 3;
+
+    case REC_SYMBOL:
+	return (w[2] < avail * WORD_SIZE) ? 3 + WORDS (w[2] + 1) : 0;
+
+    case REC_STRING: case REC_NUMBER: case REC_BYTEVECTOR:
+	return (w[1] < avail * WORD_SIZE) ? 2 + WORDS (w[1] + 1) : 0;
+
+    case REC_FLOAT:
+	return 1 + WORDS (sizeof (double) + 1);
+
+    case REC_VECTOR: case REC_COMPILED:
+	if (w[1] > avail - 2)
+	    return 0;
+	for (i = 0; i < w[1]; i++)
+	{
+	    if (bad_ref (w[2 + i]))
+		return 0;
+	}
+	return 2 + w[1];
+
+    case REC_CLOSURE:
+	if (avail < 6)
+	    return 0;
+	for (i = 2; i < 6; i++)
+	{
+	    if (bad_ref (w[i]))
+		return 0;
+	}
+	return 6;
+
+    case REC_STRUCTURE:
+	if (avail < 10 || w[9] > (avail - 10) / 3)
+	    return 0;
+	size = 10 + w[9] * 3;
+	if (bad_ref (w[2]) || bad_ref (w[4]) || bad_ref (w[5])
+	    || bad_ref (w[6]) || bad_ref (w[7]))
+	    return 0;
+	for (i = 10; i < size; i += 3)
+	{
+	    if (bad_ref (w[i]) || bad_ref (w[i + 1]))
+		return 0;
+	}
+	return size;
+
+    case REC_NUMVEC:
+	if (w[2] > avail - 3 || bad_ref (w[1]))
+	    return 0;
+	for (i = 0; i < w[2]; i++)
+	{
+	    if (bad_ref (w[3 + i]))
+		return 0;
+	}
+	return 3 + w[2];
+
+    default:
+	return 0;
+    }
+}
+
+/* Check that the loaded image can be used, returning an error message
+   if not */
+static const char *
+check_image (void)
+{
+    image_header *h = (image_header *) image_data;
+    img_word *types;
+    size_t start;
+    long i;
+
+    if (image_size < sizeof (image_header)
+	|| memcmp (h->magic, IMAGE_MAGIC, sizeof (h->magic)) != 0)
+	return "not a heap image";
+    if (h->version != IMAGE_VERSION || h->word_size != WORD_SIZE
+	|| h->byte_order != IMAGE_BYTE_ORDER)
+	return "unsupported format";
+    if (h->bytecode_version != ((BYTECODE_MAJOR_VERSION << 16)
+				| BYTECODE_MINOR_VERSION)
+	|| strncmp (h->rep_version, rep_VERSION, sizeof (h->rep_version)) != 0)
+	return "made by a different version of rep";
+    if (h->n_roots != (img_word) n_core_roots)
+	return "made by a different build of rep";
+    if (h->n_objects > image_size / WORD_SIZE)
+	return "image is truncated";
+
+    types = (img_word *) (image_data + sizeof (image_header));
+    start = sizeof (image_header) + (h->n_roots + h->n_objects) * WORD_SIZE;
+    if (start > image_size)
+	return "image is truncated";
+    for (i = 0; i < n_core_roots; i++)
+    {
+	if (types[i] != (img_word) root_type (rep_VECTI (core_values, i)))
+	    return "made by a different build of rep";
+    }
+
+    image_n_objects = h->n_objects;
+    image_offsets = types + h->n_roots;
+    for (i = 0; i < image_n_objects; i++)
+    {
+	size_t next = (i + 1 < image_n_objects
+		       ? image_offsets[i + 1] : image_size);
+	if (image_offsets[i] < start || image_offsets[i] % WORD_SIZE != 0
+	    || next > image_size || next <= image_offsets[i]
+	    || (check_record (RECORD (i), (next - image_offsets[i]) / WORD_SIZE)
+		> (next - image_offsets[i]) / WORD_SIZE))
+	    return "image is corrupt";
+	start = next;
+    }
+    if (bad_ref (h->structures) || bad_ref (h->libraries)
+	|| bad_ref (h->printers))
+	return "image is corrupt";
+    return 0;
+}
+
+/* Find the existing objects that the image refers to, before any
+   structures are merged. Subrs are found once the dl libraries have
+   been opened, if SUBRS is true */
+static const char *
+find_statics (rep_bool subrs)
+{
+    long i;
+    for (i = 0; i < image_n_objects; i++)
+    {
+	img_word *w = RECORD (i);
+	repv v = rep_NULL;
+	if (REC_KIND (w[0]) == REC_STATIC && !subrs)
+	{
+	    switch (REC_AUX (w[0]))
+	    {
+	    case STATIC_NIL: v = Qnil; break;
+	    case STATIC_VOID: v = rep_void_value; break;
+	    case STATIC_LEXTAG: v = rep_VAL (&rep_lextag); break;
+	    case STATIC_STDIN: v = Fstdin_file (); break;
+	    case STATIC_STDOUT: v = Fstdout_file (); break;
+	    case STATIC_STDERR: v = Fstderr_file (); break;
+	    case STATIC_ROOT: v = rep_VECTI (core_values, w[1]); break;
+	    }
+	    if (v == rep_NULL || v == 0)
+		return "image refers to missing object";
+	}
+	else if (REC_KIND (w[0]) == REC_SUBR && subrs)
+	{
+	    repv s = image_value (w[1]);
+	    repv name = image_value (w[2]);
+	    if (rep_SYMBOLP (s) && rep_STRINGP (name))
+		s = Fget_structure (s);
+	    if (rep_STRUCTUREP (s))
+	    {
+		v = F_structure_ref (s, Fintern (name, Qnil));
+		if (!(rep_CELL8P (v) && (rep_CELL8_TYPE (v) == rep_SF
+					 || (rep_CELL8_TYPE (v) >= rep_Subr0
+					     && rep_CELL8_TYPE (v) <= rep_SubrN))
+		      && rep_XSUBR (v)->structure == s))
+		    v = rep_NULL;
+	    }
+	    else
+		v = rep_NULL;
+	    if (v == rep_NULL)
+		return "image refers to missing subr";
+	}
+	if (v != rep_NULL)
+	    rep_VECTI (image_objects, i) = v;
+    }
+    return 0;
+}
+
+static void
+unload_image (void)
+{
+    if (image_data != 0)
+    {
+#ifdef USE_MMAP
+	if (image_mapped)
+	    munmap (image_data, image_size);
+	else
+#endif
+	    rep_free (image_data);
+    }
+    image_data = 0;
+    image_objects = Qnil;
+}
+
+/* Restore the state saved in the heap image called FILE, returning
+   true if successful, otherwise print a warning and return false */
+rep_bool
+rep_load_image (const char *file)
+{
+    image_header *h;
+    const char *error = 0;
+    struct stat st;
+    int fd;
+    long i;
+
+    fd = open (file, O_RDONLY);
+    if (fd < 0 || fstat (fd, &st) != 0)
+    {
+	if (fd >= 0)
+	    close (fd);
+	fprintf (stderr, "rep: can't open heap image %s\n", file);
+	return rep_FALSE;
+    }
+
+    image_size = st.st_size;
+#ifdef USE_MMAP
+    image_data = mmap (0, image_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image_data != MAP_FAILED)
+	image_mapped = rep_TRUE;
+    else
+#endif
+    {
+	size_t done = 0;
+	image_mapped = rep_FALSE;
+	image_data = rep_alloc (image_size + 1);
+	while (done < image_size)
+	{
+	    ssize_t this = read (fd, image_data + done, image_size - done);
+	    if (this <= 0)
+		break;
+	    done += this;
+	}
+	if (done < image_size)
+	    image_size = done;
+    }
+    close (fd);
+
+    /* Words in the file must be aligned */
+    if ((unsigned rep_PTR_SIZED_INT) image_data % WORD_SIZE != 0)
+	error = "misaligned image";
+    else
+	error = check_image ();
+    if (error != 0)
+	goto fail;
+
+    h = (image_header *) image_data;
+    image_objects = rep_make_vector (image_n_objects);
+    for (i = 0; i < image_n_objects; i++)
+	rep_VECTI (image_objects, i) = 0;
+    error = find_statics (rep_FALSE);
+    if (error != 0)
+	goto fail;
+
+#ifdef HAVE_DYNAMIC_LOADING
+    {
+	repv libs;
+	for (libs = image_value (h->libraries);
+	     rep_CONSP (libs); libs = rep_CDR (libs))
+	{
+	    if (rep_STRINGP (rep_CAR (libs))
+		&& rep_open_dl_library (rep_CAR (libs)) == rep_NULL)
+	    {
+		error = "can't open dl library";
+		goto fail;
+	    }
+	}
+    }
+#endif
+
+    /* Variables the libraries initialised keep their values in
+       images saved by this process, as when the libraries are
+       loaded normally */
+    core_specials = special_bindings ();
+
+    error = find_statics (rep_TRUE);
+    if (error != 0)
+	goto fail;
+
+    /* Merging each structure as it's built */
+    image_value (h->structures);
+    {
+	repv printers = image_value (h->printers);
+	for (printers = Freverse (printers);
+	     rep_CONSP (printers); printers = rep_CDR (printers))
+	{
+	    repv cell = rep_CAR (printers);
+	    if (rep_CONSP (cell))
+		Fdefine_datum_printer (rep_CAR (cell), rep_CDR (cell));
+	}
+    }
+    return rep_TRUE;
+
+fail:
+    if (rep_throw_value != rep_NULL)
+	rep_throw_value = rep_NULL;
+    fprintf (stderr, "rep: can't load heap image %s: %s\n", file, error);
+    unload_image ();
+    return rep_FALSE;
+}
+
+
+/* dl hooks */
+
+void
+rep_images_init (void)
+{
+    repv tem;
+    core_values = Qnil;
+    core_specials = Qnil;
+    image_objects = Qnil;
+    rep_mark_static (&core_values);
+    rep_mark_static (&core_specials);
+    rep_mark_static (&image_objects);
+
+    tem = rep_push_structure ("rep.system");
+    rep_ADD_SUBR (Ssave_image);
+    rep_pop_structure (tem);
+}
+
+void
+rep_images_kill (void)
+{
+    unload_image ();
+}
@@ -0,0 +1,1127 @@
+/* jit.c -- translating byte-code to native x86-64 code
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
+
+/* A template compiler. Each instruction of a hot compiled function is
+   replaced by a fixed sequence of machine code working on the VM's own
+   stack and slots, so control can pass between the native code and
+   the interpreter at any instruction boundary.
+
+   The common cases (fixnum arithmetic and comparisons, car and cdr of
+   conses, vector elements, stack and slot traffic, jumps) are
+   open-coded. Instructions
+   that the interpreter implements by calling a C function call the
+   same function. Everything else -- calls, bindings, returns, and
+   guards that fail -- leaves the native code, returning the offset of
+   the instruction to the interpreter which runs it; the interpreter
+   comes back at the next jump or after the next call (see MAYBE_JIT
+   in lispmach.h).
+
+   Registers while running native code:
+
+	rbx	the rep_jit_frame
+	r12	stack pointer (address of the top element)
+	r13	slots
+	r14	constants
+	r15	base of the stack
+	rbp	Qnil
+
+   The value returned by the native code (and rep_jit_run) is twice the
+   byte-code offset to continue from, plus one if an error occurred,
+   in which case the top of the stack is null. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include "bytecodes.h"
+#include <string.h>
+#include <stddef.h>
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#if defined (__x86_64__) && rep_PTR_SIZED_INT_SIZEOF == 8 \
+    && defined (HAVE_MMAP) && defined (HAVE_MUNMAP) && defined (HAVE_MPROTECT)
+# define JIT_SUPPORTED
+#endif
+
+/* True if hot compiled functions should be translated to native code */
+rep_bool rep_bytecode_jit = rep_FALSE;
+
+#ifdef JIT_SUPPORTED
+
+#if !defined (MAP_ANONYMOUS) && defined (MAP_ANON)
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+enum { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* Condition codes */
+enum { CC_O = 0x0, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc,
+       CC_GE = 0xd, CC_LE = 0xe, CC_G = 0xf };
+
+/* Instructions that must be run natively to make entering the native
+   code worthwhile */
+#define MIN_RUN 4
+
+/* Offsets into rep_jit_frame */
+#define FRAME_STACKP	offsetof (rep_jit_frame, stackp)
+#define FRAME_STACK	offsetof (rep_jit_frame, stack)
+#define FRAME_SLOTS	offsetof (rep_jit_frame, slots)
+#define FRAME_CONSTS	offsetof (rep_jit_frame, consts)
+#define FRAME_GC_COUNT	offsetof (rep_jit_frame, gc_count)
+
+typedef struct {
+    int position;			/* of a rel32 field */
+    int target;				/* byte-code offset, or exit value */
+} fixup;
+
+typedef struct {
+    unsigned char *buf;
+    int len, size;
+    rep_bool failed;
+
+    /* Native offset of each instruction, by byte-code offset */
+    int *native;
+
+    /* Jumps to instructions, and to exits to the interpreter */
+    fixup *jumps, *exits;
+    int n_jumps, n_exits, max_jumps, max_exits;
+
+    int exit_label;
+} jit_state;
+
+
+/* Emitting machine code */
+
+static void
+emit1 (jit_state *s, int byte)
+{
+    if (s->len == s->size)
+    {
+	int new_size = s->size * 2;
+	unsigned char *new_buf = rep_realloc (s->buf, new_size);
+	if (new_buf == 0)
+	{
+	    s->failed = rep_TRUE;
+	    s->len = 0;
+	    return;
+	}
+	s->buf = new_buf;
+	s->size = new_size;
+    }
+    s->buf[s->len++] = byte;
+}
+
+static void
+emit4 (jit_state *s, unsigned int x)
+{
+    emit1 (s, x & 0xff);
+    emit1 (s, (x >> 8) & 0xff);
+    emit1 (s, (x >> 16) & 0xff);
+    emit1 (s, (x >> 24) & 0xff);
+}
+
+static void
+emit8 (jit_state *s, unsigned long x)
+{
+    emit4 (s, x & 0xffffffff);
+    emit4 (s, x >> 32);
+}
+
+static void
+emit_rex (jit_state *s, rep_bool wide, int reg, int rm)
+{
+    int rex = (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+    if (rex != 0)
+	emit1 (s, 0x40 | rex);
+}
+
+/* OP with REG and the memory operand [BASE + DISP] */
+static void
+emit_mem (jit_state *s, rep_bool wide, int op, int reg, int base, int disp)
+{
+    emit_rex (s, wide, reg, base);
+    emit1 (s, op);
+    emit1 (s, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+	emit1 (s, 0x24);
+    emit4 (s, disp);
+}
+
+/* mov REG, [BASE + DISP] */
+static void
+emit_load (jit_state *s, int reg, int base, int disp)
+{
+    emit_mem (s, rep_TRUE, 0x8b, reg, base, disp);
+}
+
+/* mov [BASE + DISP], REG */
+static void
+emit_store (jit_state *s, int reg, int base, int disp)
+{
+    emit_mem (s, rep_TRUE, 0x89, reg, base, disp);
+}
+
+/* OP RM, REG, for two-register instructions like mov, add or cmp */
+static void
+emit_rr (jit_state *s, int op, int rm, int reg)
+{
+    emit_rex (s, rep_TRUE, reg, rm);
+    emit1 (s, op);
+    emit1 (s, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+#define emit_mov(s, dst, src) emit_rr (s, 0x89, dst, src)
+#define emit_add(s, dst, src) emit_rr (s, 0x01, dst, src)
+#define emit_sub(s, dst, src) emit_rr (s, 0x29, dst, src)
+#define emit_and(s, dst, src) emit_rr (s, 0x21, dst, src)
+#define emit_cmp(s, dst, src) emit_rr (s, 0x39, dst, src)
+
+/* Group-1 operation DIGIT (0 add, 4 and, 5 sub, 7 cmp) of RM and IMM */
+static void
+emit_ri (jit_state *s, int digit, int rm, int imm)
+{
+    emit_rex (s, rep_TRUE, 0, rm);
+    emit1 (s, 0x81);
+    emit1 (s, 0xc0 | (digit << 3) | (rm & 7));
+    emit4 (s, imm);
+}
+
+#define emit_addi(s, rm, imm) emit_ri (s, 0, rm, imm)
+#define emit_andi(s, rm, imm) emit_ri (s, 4, rm, imm)
+#define emit_subi(s, rm, imm) emit_ri (s, 5, rm, imm)
+#define emit_cmpi(s, rm, imm) emit_ri (s, 7, rm, imm)
+
+/* test RM, IMM */
+static void
+emit_testi (jit_state *s, int rm, int imm)
+{
+    emit_rex (s, rep_TRUE, 0, rm);
+    emit1 (s, 0xf7);
+    emit1 (s, 0xc0 | (rm & 7));
+    emit4 (s, imm);
+}
+
+/* mov REG, IMM */
+static void
+emit_movi (jit_state *s, int reg, unsigned long imm)
+{
+    emit_rex (s, rep_TRUE, 0, reg);
+    emit1 (s, 0xb8 | (reg & 7));
+    emit8 (s, imm);
+}
+
+/* cmovCC DST, SRC */
+static void
+emit_cmov (jit_state *s, int cc, int dst, int src)
+{
+    emit_rex (s, rep_TRUE, dst, src);
+    emit1 (s, 0x0f);
+    emit1 (s, 0x40 | cc);
+    emit1 (s, 0xc0 | ((dst & 7) << 3) | (src & 7));
+}
+
+/* Shift DIGIT (4 shl, 5 shr, 7 sar) of RM by N */
+static void
+emit_shift (jit_state *s, int digit, int rm, int n)
+{
+    emit_rex (s, rep_TRUE, 0, rm);
+    emit1 (s, 0xc1);
+    emit1 (s, 0xc0 | (digit << 3) | (rm & 7));
+    emit1 (s, n);
+}
+
+#define emit_shli(s, rm, n) emit_shift (s, 4, rm, n)
+#define emit_shri(s, rm, n) emit_shift (s, 5, rm, n)
+#define emit_sari(s, rm, n) emit_shift (s, 7, rm, n)
+
+/* imul DST, SRC */
+static void
+emit_imul (jit_state *s, int dst, int src)
+{
+    emit_rex (s, rep_TRUE, dst, src);
+    emit1 (s, 0x0f);
+    emit1 (s, 0xaf);
+    emit1 (s, 0xc0 | ((dst & 7) << 3) | (src & 7));
+}
+
+static void
+emit_push (jit_state *s, int reg)
+{
+    emit_rex (s, rep_FALSE, 0, reg);
+    emit1 (s, 0x50 | (reg & 7));
+}
+
+static void
+emit_pop (jit_state *s, int reg)
+{
+    emit_rex (s, rep_FALSE, 0, reg);
+    emit1 (s, 0x58 | (reg & 7));
+}
+
+/* Returns the position of the rel32 field of a jcc or jmp, to be
+   filled in later */
+static int
+emit_jcc (jit_state *s, int cc)
+{
+    emit1 (s, 0x0f);
+    emit1 (s, 0x80 | cc);
+    emit4 (s, 0);
+    return s->len - 4;
+}
+
+static int
+emit_jmp (jit_state *s)
+{
+    emit1 (s, 0xe9);
+    emit4 (s, 0);
+    return s->len - 4;
+}
+
+/* Point the rel32 field at POSITION to TARGET */
+static void
+patch (jit_state *s, int position, int target)
+{
+    unsigned int rel = target - (position + 4);
+    if (s->failed)
+	return;
+    s->buf[position] = rel & 0xff;
+    s->buf[position + 1] = (rel >> 8) & 0xff;
+    s->buf[position + 2] = (rel >> 16) & 0xff;
+    s->buf[position + 3] = (rel >> 24) & 0xff;
+}
+
+static void
+add_fixup (jit_state *s, fixup **vec, int *n, int *max, int pos, int target)
+{
+    if (*n == *max)
+    {
+	int new_max = *max == 0 ? 32 : *max * 2;
+	fixup *new_vec = rep_realloc (*vec, sizeof (fixup) * new_max);
+	if (new_vec == 0)
+	{
+	    s->failed = rep_TRUE;
+	    return;
+	}
+	*vec = new_vec;
+	*max = new_max;
+    }
+    (*vec)[*n].position = pos;
+    (*vec)[*n].target = target;
+    (*n)++;
+}
+
+/* Jump to the native code for the instruction at byte-code TARGET */
+static void
+jump_to_insn (jit_state *s, int position, int target)
+{
+    add_fixup (s, &s->jumps, &s->n_jumps, &s->max_jumps, position, target);
+}
+
+/* Leave the native code, returning VALUE */
+static void
+jump_to_exit (jit_state *s, int position, int value)
+{
+    add_fixup (s, &s->exits, &s->n_exits, &s->max_exits, position, value);
+}
+
+
+/* Templates */
+
+/* add r12, 8; mov [r12], REG */
+static void
+emit_push_value (jit_state *s, int reg)
+{
+    emit_addi (s, R12, sizeof (repv));
+    emit_store (s, reg, R12, 0);
+}
+
+/* Leave the native code to let the interpreter run the instruction at
+   OFFSET */
+static void
+emit_exit (jit_state *s, int offset)
+{
+    emit1 (s, 0xb8);			/* mov eax, IMM */
+    emit4 (s, offset << 1);
+    emit1 (s, 0xe9);			/* jmp exit */
+    emit4 (s, s->exit_label - (s->len + 4));
+}
+
+/* Make the GC's count of the VM's stack cover everything to r12 */
+static void
+emit_sync_gc (jit_state *s)
+{
+    emit_mov (s, RAX, R12);
+    emit_sub (s, RAX, R15);
+    emit_sari (s, RAX, 3);
+    emit_load (s, RCX, RBX, FRAME_GC_COUNT);
+    emit_mem (s, rep_FALSE, 0x89, RAX, RCX, 0);	/* mov [rcx], eax */
+}
+
+/* Replace the top ARITY stack elements by the result of calling FUN
+   on them, leaving the native code if that's an error */
+static void
+emit_call (jit_state *s, void *fun, int arity, int next)
+{
+    static const int arg_regs[3] = { RDI, RSI, RDX };
+    int i;
+    if (arity > 1)
+	emit_subi (s, R12, (arity - 1) * sizeof (repv));
+    emit_sync_gc (s);
+    for (i = 0; i < arity; i++)
+	emit_load (s, arg_regs[i], R12, i * sizeof (repv));
+    emit_movi (s, RAX, (unsigned long) fun);
+    emit1 (s, 0xff);			/* call rax */
+    emit1 (s, 0xd0);
+    emit_store (s, RAX, R12, 0);
+    emit_rr (s, 0x85, RAX, RAX);	/* test rax, rax */
+    jump_to_exit (s, emit_jcc (s, CC_E), (next << 1) | 1);
+}
+
+/* Load the top two stack elements into rcx (lower) and rax (top),
+   leaving the native code at OFFSET unless both are fixnums */
+static void
+emit_fixnum_pair (jit_state *s, int offset, int slow_label_fixups[2],
+		  rep_bool exit_if_not)
+{
+    emit_load (s, RAX, R12, 0);
+    emit_load (s, RCX, R12, - (int) sizeof (repv));
+    emit_mov (s, RDX, RAX);
+    emit_and (s, RDX, RCX);
+    emit_testi (s, RDX, rep_VALUE_IS_INT);
+    if (exit_if_not)
+	jump_to_exit (s, emit_jcc (s, CC_E), offset << 1);
+    else
+	slow_label_fixups[0] = emit_jcc (s, CC_E);
+}
+
+/* Push t if the flags (of cmp rcx, rax) satisfy CC, else nil */
+static void
+emit_set_boolean (jit_state *s, int cc)
+{
+    emit_mov (s, RAX, RBP);
+    emit_movi (s, RDX, Qt);
+    emit_cmov (s, cc, RAX, RDX);
+}
+
+/* Fixnum + - or *, calling FUN when an operand isn't a fixnum, or the
+   result would overflow */
+static void
+emit_arith (jit_state *s, int op, void *fun, int offset, int next)
+{
+    int slow[2], done;
+    emit_fixnum_pair (s, offset, slow, rep_FALSE);
+    emit_mov (s, RDX, RCX);
+    switch (op)
+    {
+    case OP_ADD:
+	emit_subi (s, RDX, rep_VALUE_IS_INT);
+	emit_add (s, RDX, RAX);
+	slow[1] = emit_jcc (s, CC_O);
+	break;
+
+    case OP_SUB:
+	emit_sub (s, RDX, RAX);
+	slow[1] = emit_jcc (s, CC_O);
+	emit_addi (s, RDX, rep_VALUE_IS_INT);
+	break;
+
+    case OP_MUL:
+	emit_sari (s, RDX, rep_VALUE_INT_SHIFT);
+	emit_subi (s, RAX, rep_VALUE_IS_INT);
+	emit_imul (s, RDX, RAX);
+	slow[1] = emit_jcc (s, CC_O);
+	emit_addi (s, RDX, rep_VALUE_IS_INT);
+	break;
+    }
+    emit_subi (s, R12, sizeof (repv));
+    emit_store (s, RDX, R12, 0);
+    done = emit_jmp (s);
+    patch (s, slow[0], s->len);
+    patch (s, slow[1], s->len);
+    emit_call (s, fun, 2, next);
+    patch (s, done, s->len);
+}
+
+/* 1+ or 1-, calling FUN in the same cases */
+static void
+emit_inc (jit_state *s, int delta, void *fun, int next)
+{
+    int slow[2], done;
+    emit_load (s, RAX, R12, 0);
+    emit_testi (s, RAX, rep_VALUE_IS_INT);
+    slow[0] = emit_jcc (s, CC_E);
+    emit_addi (s, RAX, delta << rep_VALUE_INT_SHIFT);
+    slow[1] = emit_jcc (s, CC_O);
+    emit_store (s, RAX, R12, 0);
+    done = emit_jmp (s);
+    patch (s, slow[0], s->len);
+    patch (s, slow[1], s->len);
+    emit_call (s, fun, 1, next);
+    patch (s, done, s->len);
+}
+
+/* Fixnum comparisons; other operands are left to the interpreter */
+static void
+emit_compare (jit_state *s, int cc, int offset)
+{
+    emit_fixnum_pair (s, offset, 0, rep_TRUE);
+    emit_cmp (s, RCX, RAX);
+    emit_set_boolean (s, cc);
+    emit_subi (s, R12, sizeof (repv));
+    emit_store (s, RAX, R12, 0);
+}
+
+/* Load the top of the stack into rax, jumping to the two fixups in
+   NOT_CONS unless it's a cons */
+static void
+emit_cons_test (jit_state *s, int not_cons[2])
+{
+    emit_load (s, RAX, R12, 0);
+    emit_testi (s, RAX, rep_VALUE_IS_INT | rep_VALUE_IS_FLONUM);
+    not_cons[0] = emit_jcc (s, CC_NE);
+    emit_load (s, RDX, RAX, 0);
+    emit_testi (s, RDX, rep_CELL_IS_8);
+    not_cons[1] = emit_jcc (s, CC_NE);
+}
+
+/* car or cdr (at byte offset FIELD of the cons) */
+static void
+emit_cxr (jit_state *s, int field)
+{
+    int not_cons[2], done;
+    emit_cons_test (s, not_cons);
+    emit_load (s, RAX, RAX, field);
+    emit_store (s, RAX, R12, 0);
+    done = emit_jmp (s);
+    patch (s, not_cons[0], s->len);
+    patch (s, not_cons[1], s->len);
+    emit_store (s, RBP, R12, 0);
+    patch (s, done, s->len);
+}
+
+/* consp, atom and listp */
+static void
+emit_cons_predicate (jit_state *s, int op)
+{
+    int not_cons[2], done;
+    emit_cons_test (s, not_cons);
+    emit_movi (s, RAX, op == OP_ATOM ? Qnil : Qt);
+    emit_store (s, RAX, R12, 0);
+    done = emit_jmp (s);
+    patch (s, not_cons[0], s->len);
+    patch (s, not_cons[1], s->len);
+    if (op == OP_LISTP)
+    {
+	emit_cmp (s, RAX, RBP);
+	emit_set_boolean (s, CC_E);
+    }
+    else
+	emit_movi (s, RAX, op == OP_ATOM ? Qt : Qnil);
+    emit_store (s, RAX, R12, 0);
+    patch (s, done, s->len);
+}
+
+/* zerop and not-zero-p of fixnums; other operands are left to the
+   interpreter */
+static void
+emit_zerop (jit_state *s, int cc, int offset)
+{
+    emit_load (s, RCX, R12, 0);
+    emit_testi (s, RCX, rep_VALUE_IS_INT);
+    jump_to_exit (s, emit_jcc (s, CC_E), offset << 1);
+    emit_cmpi (s, RCX, rep_MAKE_INT (0));
+    emit_set_boolean (s, cc);
+    emit_store (s, RAX, R12, 0);
+}
+
+/* With a vector in rcx and a fixnum index in rax, leave the address of
+   the element in rsi. Jumps to the four fixups in SLOW if they're not,
+   or the index is out of range, or (when WRITE) the vector is
+   read-only. */
+static void
+emit_vector_element (jit_state *s, rep_bool write, int slow[4])
+{
+    emit_testi (s, RAX, rep_VALUE_IS_INT);
+    slow[0] = emit_jcc (s, CC_E);
+    emit_testi (s, RCX, rep_VALUE_IS_INT | rep_VALUE_IS_FLONUM);
+    slow[1] = emit_jcc (s, CC_NE);
+    emit_load (s, RDX, RCX, 0);
+    emit_mov (s, RSI, RDX);
+    emit_andi (s, RSI, rep_CELL8_TYPE_MASK
+	       | (write ? rep_CELL_STATIC_BIT : 0));
+    emit_cmpi (s, RSI, rep_Vector);
+    slow[2] = emit_jcc (s, CC_NE);
+    emit_shri (s, RDX, 8);
+    emit_mov (s, RSI, RAX);
+    emit_sari (s, RSI, rep_VALUE_INT_SHIFT);
+    emit_cmp (s, RSI, RDX);
+    slow[3] = emit_jcc (s, CC_AE);
+    emit_shli (s, RSI, 3);
+    emit_add (s, RSI, RCX);
+}
+
+/* aref and aset, calling FUN when not a vector or out of range, or to
+   store while an incremental collection is marking (for the write
+   barrier) */
+static void
+emit_vector_ref (jit_state *s, rep_bool write, void *fun, int next)
+{
+    int slow[5], done, i, n_slow = 4;
+    if (!write)
+    {
+	emit_load (s, RAX, R12, 0);
+	emit_load (s, RCX, R12, - (int) sizeof (repv));
+	emit_vector_element (s, rep_FALSE, slow);
+	emit_load (s, RAX, RSI, offsetof (rep_vector, array));
+	emit_subi (s, R12, sizeof (repv));
+    }
+    else
+    {
+	emit_load (s, RAX, R12, - (int) sizeof (repv));
+	emit_load (s, RCX, R12, -2 * (int) sizeof (repv));
+	emit_vector_element (s, rep_TRUE, slow);
+	emit_movi (s, RDX, (unsigned long) &rep_gc_marking);
+	emit_mem (s, rep_FALSE, 0x8b, RDX, RDX, 0);	/* mov edx, [rdx] */
+	emit_cmpi (s, RDX, 0);
+	slow[n_slow++] = emit_jcc (s, CC_NE);
+	emit_load (s, RAX, R12, 0);
+	emit_store (s, RAX, RSI, offsetof (rep_vector, array));
+	emit_subi (s, R12, 2 * sizeof (repv));
+    }
+    emit_store (s, RAX, R12, 0);
+    done = emit_jmp (s);
+    for (i = 0; i < n_slow; i++)
+	patch (s, slow[i], s->len);
+    emit_call (s, fun, write ? 3 : 2, next);
+    patch (s, done, s->len);
+}
+
+/* Before a backwards jump, let the interpreter see to interrupts and
+   garbage collection if either is due */
+static void
+emit_jump_checks (jit_state *s, int offset)
+{
+    emit_movi (s, RCX, (unsigned long) &rep_test_int_counter);
+    emit_mem (s, rep_FALSE, 0x8b, RAX, RCX, 0);		/* mov eax, [rcx] */
+    emit1 (s, 0x83);					/* add eax, 1 */
+    emit1 (s, 0xc0);
+    emit1 (s, 1);
+    emit_mem (s, rep_FALSE, 0x89, RAX, RCX, 0);		/* mov [rcx], eax */
+    emit_movi (s, RCX, (unsigned long) &rep_test_int_period);
+    emit_mem (s, rep_FALSE, 0x3b, RAX, RCX, 0);		/* cmp eax, [rcx] */
+    jump_to_exit (s, emit_jcc (s, CC_G), offset << 1);
+    emit_movi (s, RCX, (unsigned long) &rep_data_after_gc);
+    emit_mem (s, rep_FALSE, 0x8b, RAX, RCX, 0);
+    emit_movi (s, RCX, (unsigned long) &rep_gc_threshold);
+    emit_mem (s, rep_FALSE, 0x3b, RAX, RCX, 0);
+    jump_to_exit (s, emit_jcc (s, CC_GE), offset << 1);
+}
+
+/* The jump instructions. TEST is zero for unconditional jumps, else
+   the jump is taken when TOP is nil (CC_E) or not nil (CC_NE). The
+   stack is popped on the taken or fall-through paths as requested. */
+static void
+emit_branch (jit_state *s, int offset, int target, int cc,
+	     rep_bool pop_taken, rep_bool pop_not_taken)
+{
+    int not_taken = -1;
+    if (cc != 0)
+    {
+	emit_load (s, RAX, R12, 0);
+	emit_cmp (s, RAX, RBP);
+	not_taken = emit_jcc (s, cc ^ 1);
+    }
+    if (target <= offset)
+	emit_jump_checks (s, offset);
+    if (pop_taken)
+	emit_subi (s, R12, sizeof (repv));
+    jump_to_insn (s, emit_jmp (s), target);
+    if (not_taken >= 0)
+    {
+	patch (s, not_taken, s->len);
+	if (pop_not_taken)
+	    emit_subi (s, R12, sizeof (repv));
+    }
+}
+
+/* Instructions implemented by calling a C function, as CALL_1, CALL_2
+   and CALL_3 do in lispmach.h */
+static const struct {
+    unsigned char op, arity;
+    void *fun;
+} call_insns[] = {
+    { OP_CONS, 2, Fcons }, { OP_RPLACA, 2, Frplaca },
+    { OP_RPLACD, 2, Frplacd }, { OP_NTH, 2, Fnth },
+    { OP_NTHCDR, 2, Fnthcdr }, { OP_LENGTH, 1, Flength },
+    { OP_NEG, 1, rep_number_neg }, { OP_DIV, 2, rep_number_div },
+    { OP_REM, 2, Fremainder }, { OP_QUOTIENT, 2, Fquotient },
+    { OP_MOD, 2, Fmod }, { OP_LNOT, 1, Flognot },
+    { OP_LOR, 2, rep_number_logior }, { OP_LXOR, 2, rep_number_logxor },
+    { OP_LAND, 2, rep_number_logand }, { OP_ASH, 2, Fash },
+    { OP_MAX, 2, rep_number_max }, { OP_MIN, 2, rep_number_min },
+    { OP_MEMQ, 2, Fmemq }, { OP_MEMQL, 2, Fmemql },
+    { OP_ASSQ, 2, Fassq }, { OP_EQL, 2, Feql },
+    { OP_REVERSE, 1, Freverse }, { OP_NREVERSE, 1, Fnreverse },
+    { OP_LAST, 1, Flast },
+    { 0, 0, 0 }
+};
+
+/* Length of the instruction at PC */
+static int
+insn_length (unsigned char *pc)
+{
+    int op = *pc;
+    if (op <= OP_LAST_WITH_ARGS)
+	return (op & 7) == 7 ? 3 : (op & 7) == 6 ? 2 : 1;
+    else if (op > OP_LAST_BEFORE_JMPS)
+	return 3;
+    else if (op == OP_PUSHI)
+	return 2;
+    else if (op == OP_PUSHIWN || op == OP_PUSHIWP)
+	return 3;
+    else
+	return 1;
+}
+
+/* The argument of the instruction at PC, which has one */
+static int
+insn_arg (unsigned char *pc)
+{
+    if (*pc <= OP_LAST_WITH_ARGS)
+    {
+	switch (*pc & 7)
+	{
+	case 6:
+	    return pc[1];
+	case 7:
+	    return (pc[1] << ARG_SHIFT) | pc[2];
+	default:
+	    return *pc & 7;
+	}
+    }
+    else
+	return (pc[1] << ARG_SHIFT) | pc[2];
+}
+
+/* Emit the native code for the instruction at OFFSET into the code
+   CODE (of LENGTH bytes). Returns false if it just leaves the native
+   code. */
+static rep_bool
+translate_insn (jit_state *s, unsigned char *code, int length,
+		int offset, int n_consts, int n_slots)
+{
+    unsigned char *pc = code + offset;
+    int next = offset + insn_length (pc);
+    int op = *pc, arg, i;
+
+    if (op <= OP_LAST_WITH_ARGS)
+    {
+	arg = insn_arg (pc);
+	switch (op & ~7)
+	{
+	case OP_SLOT_REF:
+	    if (arg >= n_slots)
+		break;
+	    emit_load (s, RAX, R13, arg * sizeof (repv));
+	    emit_push_value (s, RAX);
+	    return rep_TRUE;
+
+	case OP_SLOT_SET:
+	    if (arg >= n_slots)
+		break;
+	    emit_load (s, RAX, R12, 0);
+	    emit_subi (s, R12, sizeof (repv));
+	    emit_store (s, RAX, R13, arg * sizeof (repv));
+	    return rep_TRUE;
+
+	case OP_PUSH:
+	    if (arg >= n_consts)
+		break;
+	    emit_load (s, RAX, R14, arg * sizeof (repv));
+	    emit_push_value (s, RAX);
+	    return rep_TRUE;
+	}
+	emit_exit (s, offset);
+	return rep_FALSE;
+    }
+
+    if (op > OP_LAST_BEFORE_JMPS)
+    {
+	int target = insn_arg (pc);
+	if (target >= length || s->native[target] < 0)
+	{
+	    emit_exit (s, offset);
+	    return rep_FALSE;
+	}
+	switch (op)
+	{
+	case OP_JMP:
+	    emit_branch (s, offset, target, 0, rep_FALSE, rep_FALSE);
+	    return rep_TRUE;
+	case OP_JN:
+	    emit_branch (s, offset, target, CC_E, rep_TRUE, rep_TRUE);
+	    return rep_TRUE;
+	case OP_JT:
+	    emit_branch (s, offset, target, CC_NE, rep_TRUE, rep_TRUE);
+	    return rep_TRUE;
+	case OP_JPN:
+	    emit_branch (s, offset, target, CC_E, rep_TRUE, rep_FALSE);
+	    return rep_TRUE;
+	case OP_JPT:
+	    emit_branch (s, offset, target, CC_NE, rep_TRUE, rep_FALSE);
+	    return rep_TRUE;
+	case OP_JNP:
+	    emit_branch (s, offset, target, CC_E, rep_FALSE, rep_TRUE);
+	    return rep_TRUE;
+	case OP_JTP:
+	    emit_branch (s, offset, target, CC_NE, rep_FALSE, rep_TRUE);
+	    return rep_TRUE;
+	}
+	emit_exit (s, offset);
+	return rep_FALSE;
+    }
+
+    switch (op)
+    {
+    case OP_DUP:
+	emit_load (s, RAX, R12, 0);
+	emit_push_value (s, RAX);
+	return rep_TRUE;
+
+    case OP_SWAP:
+	emit_load (s, RAX, R12, 0);
+	emit_load (s, RCX, R12, - (int) sizeof (repv));
+	emit_store (s, RCX, R12, 0);
+	emit_store (s, RAX, R12, - (int) sizeof (repv));
+	return rep_TRUE;
+
+    case OP_POP:
+	emit_subi (s, R12, sizeof (repv));
+	return rep_TRUE;
+
+    case OP_POP_ALL:
+	emit_mov (s, R12, R15);
+	return rep_TRUE;
+
+    case OP_NIL:
+	emit_push_value (s, RBP);
+	return rep_TRUE;
+
+    case OP_T:
+	emit_movi (s, RAX, Qt);
+	emit_push_value (s, RAX);
+	return rep_TRUE;
+
+    case OP_PUSHI0: case OP_PUSHI1: case OP_PUSHI2:
+    case OP_PUSHIM1: case OP_PUSHIM2: case OP_PUSHI:
+    case OP_PUSHIWN: case OP_PUSHIWP:
+	switch (op)
+	{
+	case OP_PUSHI0: arg = 0; break;
+	case OP_PUSHI1: arg = 1; break;
+	case OP_PUSHI2: arg = 2; break;
+	case OP_PUSHIM1: arg = -1; break;
+	case OP_PUSHIM2: arg = -2; break;
+	case OP_PUSHI: arg = pc[1] < 128 ? pc[1] : pc[1] - 256; break;
+	case OP_PUSHIWN: arg = - insn_arg (pc); break;
+	default: arg = insn_arg (pc);
+	}
+	emit_movi (s, RAX, rep_MAKE_INT ((long) arg));
+	emit_push_value (s, RAX);
+	return rep_TRUE;
+
+    case OP_NOT: case OP_NULL:
+	emit_load (s, RCX, R12, 0);
+	emit_cmp (s, RCX, RBP);
+	emit_set_boolean (s, CC_E);
+	emit_store (s, RAX, R12, 0);
+	return rep_TRUE;
+
+    case OP_EQ:
+	emit_load (s, RAX, R12, 0);
+	emit_subi (s, R12, sizeof (repv));
+	emit_load (s, RCX, R12, 0);
+	emit_cmp (s, RCX, RAX);
+	emit_set_boolean (s, CC_E);
+	emit_store (s, RAX, R12, 0);
+	return rep_TRUE;
+
+    case OP_CAR:
+	emit_cxr (s, offsetof (rep_cons, car));
+	return rep_TRUE;
+
+    case OP_CDR:
+	emit_cxr (s, offsetof (rep_cons, cdr));
+	return rep_TRUE;
+
+    case OP_CONSP: case OP_ATOM: case OP_LISTP:
+	emit_cons_predicate (s, op);
+	return rep_TRUE;
+
+    case OP_ZEROP:
+	emit_zerop (s, CC_E, offset);
+	return rep_TRUE;
+
+    case OP_NOT_ZERO_P:
+	emit_zerop (s, CC_NE, offset);
+	return rep_TRUE;
+
+    case OP_AREF:
+	emit_vector_ref (s, rep_FALSE, Faref, next);
+	return rep_TRUE;
+
+    case OP_ASET:
+	emit_vector_ref (s, rep_TRUE, Faset, next);
+	return rep_TRUE;
+
+    case OP_ADD:
+	emit_arith (s, op, rep_number_add, offset, next);
+	return rep_TRUE;
+
+    case OP_SUB:
+	emit_arith (s, op, rep_number_sub, offset, next);
+	return rep_TRUE;
+
+    case OP_MUL:
+	emit_arith (s, op, rep_number_mul, offset, next);
+	return rep_TRUE;
+
+    case OP_INC:
+	emit_inc (s, 1, Fplus1, next);
+	return rep_TRUE;
+
+    case OP_DEC:
+	emit_inc (s, -1, Fsub1, next);
+	return rep_TRUE;
+
+    case OP_NUM_EQ:
+	emit_compare (s, CC_E, offset);
+	return rep_TRUE;
+
+    case OP_LT:
+	emit_compare (s, CC_L, offset);
+	return rep_TRUE;
+
+    case OP_GT:
+	emit_compare (s, CC_G, offset);
+	return rep_TRUE;
+
+    case OP_LE:
+	emit_compare (s, CC_LE, offset);
+	return rep_TRUE;
+
+    case OP_GE:
+	emit_compare (s, CC_GE, offset);
+	return rep_TRUE;
+    }
+
+    for (i = 0; call_insns[i].fun != 0; i++)
+    {
+	if (call_insns[i].op == op)
+	{
+	    emit_call (s, call_insns[i].fun, call_insns[i].arity, next);
+	    return rep_TRUE;
+	}
+    }
+
+    emit_exit (s, offset);
+    return rep_FALSE;
+}
+
+/* Entry: rep_jit_run calls the code as a function of the frame and
+   the address to start at. Exit: eax holds the value to return. */
+static void
+emit_prologue (jit_state *s)
+{
+    emit_push (s, RBX);
+    emit_push (s, RBP);
+    emit_push (s, R12);
+    emit_push (s, R13);
+    emit_push (s, R14);
+    emit_push (s, R15);
+    emit_subi (s, RSP, 8);		/* keep rsp 16-byte aligned */
+    emit_mov (s, RBX, RDI);
+    emit_load (s, R12, RBX, FRAME_STACKP);
+    emit_load (s, R15, RBX, FRAME_STACK);
+    emit_load (s, R13, RBX, FRAME_SLOTS);
+    emit_load (s, R14, RBX, FRAME_CONSTS);
+    emit_movi (s, RBP, Qnil);
+    emit1 (s, 0xff);			/* jmp rsi */
+    emit1 (s, 0xe6);
+
+    s->exit_label = s->len;
+    emit_store (s, R12, RBX, FRAME_STACKP);
+    emit_addi (s, RSP, 8);
+    emit_pop (s, R15);
+    emit_pop (s, R14);
+    emit_pop (s, R13);
+    emit_pop (s, R12);
+    emit_pop (s, RBP);
+    emit_pop (s, RBX);
+    emit1 (s, 0xc3);			/* ret */
+}
+
+/* Returns the native code for compiled function FUN, or null if it
+   can't be made */
+rep_jit_code *
+rep_jit_compile (repv fun)
+{
+    repv code_string = rep_COMPILED_CODE (fun);
+    unsigned char *code = (unsigned char *) rep_STR (code_string);
+    int length = rep_STRING_LEN (code_string);
+    int n_consts = rep_VECT_LEN (rep_COMPILED_CONSTANTS (fun));
+    int n_slots = rep_INT (rep_COMPILED_STACK (fun)) >> 20;
+    rep_jit_code *jit = 0;
+    jit_state s;
+    int offset, i, run;
+
+    memset (&s, 0, sizeof (s));
+    s.size = 1024;
+    s.buf = rep_alloc (s.size);
+    s.native = rep_alloc (sizeof (int) * (length + 1));
+    jit = rep_alloc (sizeof (rep_jit_code) + sizeof (unsigned int) * length);
+    if (s.buf == 0 || s.native == 0 || jit == 0)
+	goto fail;
+
+    /* Find where the instructions start */
+    for (i = 0; i < length; i++)
+	s.native[i] = -1;
+    for (offset = 0; offset < length; offset += insn_length (code + offset))
+	s.native[offset] = 0;
+    if (offset != length)
+	goto fail;
+
+    emit_prologue (&s);
+
+    memset (jit->entries, 0, sizeof (unsigned int) * length);
+    for (offset = 0; offset < length; offset += insn_length (code + offset))
+    {
+	s.native[offset] = s.len;
+	if (translate_insn (&s, code, length, offset, n_consts, n_slots))
+	    jit->entries[offset] = s.native[offset];
+    }
+
+    /* Only let the interpreter enter the native code where it can run
+       for a while: at a jump, or at least MIN_RUN instructions before
+       the next exit */
+    run = 0;
+    for (offset = length - 1; offset >= 0; offset--)
+    {
+	if (s.native[offset] < 0)
+	    continue;
+	if (jit->entries[offset] == 0)
+	    run = 0;
+	else if (code[offset] > OP_LAST_BEFORE_JMPS)
+	    run = MIN_RUN;
+	else
+	    run++;
+	if (run < MIN_RUN)
+	    jit->entries[offset] = 0;
+    }
+
+    for (i = 0; i < s.n_jumps; i++)
+	patch (&s, s.jumps[i].position, s.native[s.jumps[i].target]);
+    for (i = 0; i < s.n_exits; i++)
+    {
+	patch (&s, s.exits[i].position, s.len);
+	emit1 (&s, 0xb8);		/* mov eax, IMM */
+	emit4 (&s, s.exits[i].target);
+	emit1 (&s, 0xe9);		/* jmp exit */
+	emit4 (&s, s.exit_label - (s.len + 4));
+    }
+    if (s.failed)
+	goto fail;
+
+    /* Copy the code to memory that may be executed, but not written */
+    jit->length = length;
+    jit->size = (s.len + getpagesize () - 1) & ~(getpagesize () - 1);
+    jit->code = mmap (0, jit->size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+	goto fail;
+    memcpy (jit->code, s.buf, s.len);
+    if (mprotect (jit->code, jit->size, PROT_READ | PROT_EXEC) != 0)
+    {
+	munmap (jit->code, jit->size);
+	goto fail;
+    }
+
+    rep_free (s.buf);
+    rep_free (s.native);
+    rep_free (s.jumps);
+    rep_free (s.exits);
+    return jit;
+
+fail:
+    rep_free (s.buf);
+    rep_free (s.native);
+    rep_free (s.jumps);
+    rep_free (s.exits);
+    rep_free (jit);
+    return 0;
+}
+
+/* Run JIT from the instruction at byte-code OFFSET, with the state of
+   the VM in FRAME. Returns -1 if the native code can't be entered at
+   OFFSET, otherwise as described at the top of this file. */
+int
+rep_jit_run (rep_jit_code *jit, rep_jit_frame *frame, int offset)
+{
+    unsigned int entry;
+    if (offset >= jit->length || (entry = jit->entries[offset]) == 0)
+	return -1;
+    return ((int (*) (rep_jit_frame *, void *)) jit->code) (frame,
+							    jit->code + entry);
+}
+
+void
+rep_jit_free (rep_jit_code *jit)
+{
+    munmap (jit->code, jit->size);
+    rep_free (jit);
+}
+
+#else /* JIT_SUPPORTED */
+
+rep_jit_code *
+rep_jit_compile (repv fun)
+{
+    return 0;
+}
+
+int
+rep_jit_run (rep_jit_code *jit, rep_jit_frame *frame, int offset)
+{
+    return -1;
+}
+
+void
+rep_jit_free (rep_jit_code *jit)
+{
+}
+
+#endif /* !JIT_SUPPORTED */
@@ -350,7 +350,10 @@ read_list(repv strm, register int *c_p)
 		{
 		    repv this = readl(strm, c_p, Qpremature_end_of_stream);
 		    if (this != rep_NULL)
+		    {
 			rep_CDR (last) = this;
+			rep_CONS_BARRIER (last);
+		    }
 		    else
 		    {
 			result = rep_NULL;
@@ -391,10 +394,14 @@ read_list(repv strm, register int *c_p)
 	    {
 		register repv this = Fcons(Qnil, Qnil);
 		if(last)
+		{
 		    rep_CDR(last) = this;
+		    rep_CONS_BARRIER(last);
+		}
 		else
 		    result = this;
 		rep_CAR(this) = readl(strm, c_p, Qpremature_end_of_stream);
+		rep_CONS_BARRIER(this);
 		if(rep_CAR (this) == rep_NULL)
 		    result = rep_NULL;
 		last = this;
@@ -867,6 +874,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 					    strm, "During ` or ' syntax");
 	    }
 	    rep_CADR(form) = readl(strm, c_p, Qpremature_end_of_stream);
+	    rep_CONS_BARRIER(rep_CDR(form));
 	    rep_POPGC;
 	    if(rep_CADR(form) != rep_NULL)
 		return form;
@@ -895,6 +903,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 		}
 	    }
 	    rep_CADR(form) = readl(strm, c_p, Qpremature_end_of_stream);
+	    rep_CONS_BARRIER(rep_CDR(form));
 	    rep_POPGC;
 	    if(rep_CADR(form) != rep_NULL)
 		return form;
@@ -947,6 +956,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 						strm, "During #' syntax");
 		}
 		rep_CADR(form) = readl(strm, c_p, Qpremature_end_of_stream);
+		rep_CONS_BARRIER(rep_CDR(form));
 		rep_POPGC;
 		if(rep_CADR(form) == rep_NULL)
 		    return rep_NULL;
@@ -963,10 +973,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 			   && rep_VECTORP (rep_COMPILED_CONSTANTS (vec))
 			   && rep_INTP (rep_COMPILED_STACK (vec)))
 			{
-			    rep_COMPILED(vec)->car = (rep_COMPILED(vec)->car
-						   & ~rep_CELL8_TYPE_MASK)
-						  | rep_Compiled;
-			    return vec;
+			    return rep_vector_to_compiled (vec);
 			}
 			return signal_reader_error (Qinvalid_read_syntax,
 						    strm, "Invalid bytecode object");
@@ -1128,6 +1135,14 @@ rep_readl (repv stream, int *c_p)
     return form;
 }
 
+/* Return the object read as `#!optional', `#!rest' or `#!key', when C
+   is `o', `r' or `k' respectively */
+repv
+rep_lambda_list_marker (int c)
+{
+    return c == 'o' ? ex_optional : c == 'r' ? ex_rest : ex_key;
+}
+
 
 /* Evaluating */
 
@@ -1153,6 +1168,7 @@ eval_list(repv list)
 	    result = rep_NULL;
 	    break;
 	}
+	rep_CONS_LOC_BARRIER(last, result);
 	list = rep_CDR(list);
 	last = &rep_CDR(*last);
 	rep_TEST_INT;
@@ -1533,6 +1549,10 @@ rep_load_autoload(repv funarg)
 	}
 	else
 	    rep_FUNARG(funarg)->fun = Qnil;
+	rep_OBJECT_BARRIER(funarg, rep_FUNARG(funarg)->fun);
+	rep_OBJECT_BARRIER(funarg, rep_FUNARG(funarg)->name);
+	rep_OBJECT_BARRIER(funarg, rep_FUNARG(funarg)->env);
+	rep_OBJECT_BARRIER(funarg, rep_FUNARG(funarg)->structure);
     }
     return fun;
 }
@@ -1577,7 +1597,7 @@ apply (repv fun, repv arglist, repv tail_posn)
     rep_PUSH_CALL (lc);
 
     if(rep_data_after_gc >= rep_gc_threshold)
-	Fgarbage_collect (Qnil);
+	rep_auto_gc ();
 
 again:
     if (rep_FUNARGP(fun))
@@ -1909,6 +1929,7 @@ eval(repv obj, repv tail_posn)
 			    repv *vec = alloca (len * sizeof (repv));
 			    copy_to_vector (rep_CDR (args), len, vec);
 			    rep_CDR (args) = Flist_star (len, vec);
+			    rep_CONS_BARRIER (args);
 			}
 		    }
 		    else
@@ -1956,7 +1977,7 @@ rep_eval (repv obj, repv tail_posn)
     {
 	rep_GC_root gc_obj;
 	rep_PUSHGC(gc_obj, obj);
-	Fgarbage_collect (Qnil);
+	rep_auto_gc ();
 	rep_POPGC;
     }
 
@@ -2011,6 +2032,7 @@ rep_eval (repv obj, repv tail_posn)
 		{
 		    rep_push_regexp_data(&re_data);
 		    rep_CAR(dbargs) = result;
+		    rep_CONS_BARRIER(dbargs);
 		    dbres = (rep_call_with_barrier
 			     (Ffuncall, Fcons (Fsymbol_value (Qdebug_exit, Qt),
 					       dbargs), rep_TRUE, 0, 0, 0));
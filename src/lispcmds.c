@@ -262,6 +262,7 @@ to the beginning of the next list. Returns the new list.
 	}
 
 	*res_end = argv[i];
+	rep_CONS_LOC_BARRIER (res_end, res);
 
 	while (rep_CONSP (*res_end))
 	{
@@ -287,6 +288,7 @@ Returns the CONS-CELL.
     if(!rep_CONS_WRITABLE_P(cons))
 	return Fsignal(Qsetting_constant, rep_LIST_1(cons));
     rep_CAR(cons) = car;
+    rep_CONS_BARRIER(cons);
     return(cons);
 }
 
@@ -302,6 +304,7 @@ Returns the CONS-CELL.
     if(!rep_CONS_WRITABLE_P(cons))
 	return Fsignal(Qsetting_constant, rep_LIST_1(cons));
     rep_CDR(cons) = cdr;
+    rep_CONS_BARRIER(cons);
     return(cons);
 }
 
@@ -347,6 +350,7 @@ were. This function is destructive towards it's argument.
 	else
 	    nxt = rep_NULL;
 	rep_CDR(head) = res;
+	rep_CONS_BARRIER(head);
 	res = head;
 	rep_TEST_INT;
 	if(rep_INTERRUPTP)
@@ -540,14 +544,19 @@ returns a new list constructed from the results, ie,
     while(res != rep_NULL && rep_CONSP(list))
     {
 	rep_TEST_INT;
-	if(rep_INTERRUPTP
-	   || !(*last = Fcons(Qnil, Qnil))
-	   || !(rep_CAR(*last) = rep_call_lisp1(fun, rep_CAR(list))))
+	if(rep_INTERRUPTP || !(*last = Fcons(Qnil, Qnil)))
 	    res = rep_NULL;
 	else
 	{
-	    last = &rep_CDR(*last);
-	    list = rep_CDR(list);
+	    rep_CONS_LOC_BARRIER(last, res);
+	    if(!(rep_CAR(*last) = rep_call_lisp1(fun, rep_CAR(list))))
+		res = rep_NULL;
+	    else
+	    {
+		rep_CONS_BARRIER(*last);
+		last = &rep_CDR(*last);
+		list = rep_CDR(list);
+	    }
 	}
     }
     rep_POPGC; rep_POPGC; rep_POPGC;
@@ -608,6 +617,7 @@ PREDICATE returns t when applied to; i.e. something like
 	if(!rep_NILP(tem))
 	{
 	    *ptr = Fcons(rep_CAR(list), Qnil);
+	    rep_CONS_LOC_BARRIER(ptr, output);
 	    ptr = &rep_CDR(*ptr);
 	}
 	list = rep_CDR(list);
@@ -703,7 +713,10 @@ Returns LIST with any members `equal' to ELT destructively removed.
     while(rep_CONSP(*head))
     {
 	if(!rep_value_cmp(elt, rep_CAR(*head)))
+	{
 	    *head = rep_CDR(*head);
+	    rep_CONS_LOC_BARRIER(head, list);
+	}
 	else
 	    head = &rep_CDR(*head);
 	rep_TEST_INT;
@@ -725,7 +738,10 @@ Returns LIST with any members `eq' to ELT destructively removed.
     while(rep_CONSP(*head))
     {
 	if(elt == rep_CAR(*head))
+	{
 	    *head = rep_CDR(*head);
+	    rep_CONS_LOC_BARRIER(head, list);
+	}
 	else
 	    head = &rep_CDR(*head);
 	rep_TEST_INT;
@@ -762,7 +778,10 @@ applied to that element, ie,
 	    break;
 	}
 	if(!rep_NILP(tmp))
+	{
 	    *head = rep_CDR(*head);
+	    rep_CONS_LOC_BARRIER(head, list);
+	}
 	else
 	    head = &rep_CDR(*head);
     }
@@ -797,7 +816,10 @@ applied to that element, ie,
 	    break;
 	}
 	if(rep_NILP(tmp))
+	{
 	    *head = rep_CDR(*head);
+	    rep_CONS_LOC_BARRIER(head, list);
+	}
 	else
 	    head = &rep_CDR(*head);
     }
@@ -853,16 +875,19 @@ arrayp ARG
 Returns t when ARG is an array.
 ::end:: */
 {
-    return((rep_VECTORP(arg) || rep_STRINGP(arg) || rep_COMPILEDP(arg)) ? Qt : Qnil);
+    return((rep_VECTORP(arg) || rep_STRINGP(arg) || rep_COMPILEDP(arg)
+	    || rep_NUMVECP(arg) || rep_BYTEVECTORP(arg)) ? Qt : Qnil);
 }
 
 DEFUN("aset", Faset, Saset, (repv array, repv index, repv new), rep_Subr3) /*
 ::doc:rep.data#aset::
 aset ARRAY INDEX NEW-VALUE
 
-Sets element number INDEX (a positive integer) of ARRAY (can be a vector
-or a string) to NEW-VALUE, returning NEW-VALUE. Note that strings
-can only contain characters (ie, integers).
+Sets element number INDEX (a positive integer) of ARRAY (can be a vector,
+a string, a numeric vector or a bytevector) to NEW-VALUE, returning
+NEW-VALUE. Note that strings can only contain characters (ie, integers),
+numeric vectors numbers of their type, and bytevectors integers between
+0 and 255.
 ::end:: */
 {
     rep_DECLARE2(index, rep_INTP);
@@ -887,9 +912,23 @@ can only contain characters (ie, integers).
 	if(rep_INT(index) < rep_VECT_LEN(array))
 	{
 	    rep_VECTI(array, rep_INT(index)) = new;
+	    rep_OBJECT_BARRIER(array, new);
+	    if (rep_COMPILEDP (array))
+		/* verify it again before it next runs */
+		rep_COMPILED_CACHES (array)->verified = 0;
 	    return(new);
 	}
     }
+    else if(rep_NUMVECP(array))
+    {
+	if(rep_INT(index) < rep_numvec_length(array))
+	    return rep_numvec_set(array, rep_INT(index), new);
+    }
+    else if(rep_BYTEVECTORP(array))
+    {
+	if(rep_INT(index) < rep_bytevector_length(array))
+	    return rep_bytevector_set(array, rep_INT(index), new);
+    }
     else
 	return(rep_signal_arg_error(array, 1));
     return(rep_signal_arg_error(index, 2));
@@ -900,7 +939,8 @@ DEFUN("aref", Faref, Saref, (repv array, repv index), rep_Subr2) /*
 aref ARRAY INDEX
 
 Returns the INDEXth (a non-negative integer) element of ARRAY, which
-can be a vector or a string. INDEX starts at zero.
+can be a vector, a string, a numeric vector or a bytevector. INDEX
+starts at zero.
 ::end:: */
 {
     rep_DECLARE2(index, rep_INTP);
@@ -916,6 +956,16 @@ can be a vector or a string. INDEX starts at zero.
 	if(rep_INT(index) < rep_VECT_LEN(array))
 	    return(rep_VECTI(array, rep_INT(index)));
     }
+    else if(rep_NUMVECP(array))
+    {
+	if(rep_INT(index) < rep_numvec_length(array))
+	    return rep_numvec_ref(array, rep_INT(index));
+    }
+    else if(rep_BYTEVECTORP(array))
+    {
+	if(rep_INT(index) < rep_bytevector_length(array))
+	    return rep_bytevector_ref(array, rep_INT(index));
+    }
     else
 	return rep_signal_arg_error (array, 1);
     return rep_signal_arg_error (index, 2);
@@ -1079,11 +1129,16 @@ DEFUN("length", Flength, Slength, (repv sequence), rep_Subr1) /*
 ::doc:rep.data#length::
 length SEQUENCE
 
-Returns the number of elements in SEQUENCE (a string, list or vector).
+Returns the number of elements in SEQUENCE (a string, list, vector,
+numeric vector or bytevector).
 ::end:: */
 {
     if (sequence == Qnil)
 	return rep_MAKE_INT (0);
+    else if (rep_NUMVECP (sequence))
+	return rep_MAKE_INT (rep_numvec_length (sequence));
+    else if (rep_BYTEVECTORP (sequence))
+	return rep_MAKE_INT (rep_bytevector_length (sequence));
 
     switch(rep_TYPE(sequence))
     {
@@ -1138,7 +1193,10 @@ Returns a new sequence whose elements are eq to those in SEQUENCE.
 	    }
 	}
 	break;
-    case rep_Vector: case rep_Compiled:
+    case rep_Compiled:
+	res = rep_vector_to_compiled (seq);
+	break;
+    case rep_Vector:
 	res = rep_make_vector(rep_VECT_LEN(seq));
 	if(res)
 	{
@@ -1152,7 +1210,12 @@ Returns a new sequence whose elements are eq to those in SEQUENCE.
 	res = rep_string_dupn(rep_STR(seq), rep_STRING_LEN(seq));
 	break;
     default:
-	res = rep_signal_arg_error(seq, 1);
+	if (rep_NUMVECP(seq))
+	    res = rep_numvec_copy(seq, 0, rep_numvec_length(seq));
+	else if (rep_BYTEVECTORP(seq))
+	    res = rep_bytevector_copy(seq, 0, rep_bytevector_length(seq));
+	else
+	    res = rep_signal_arg_error(seq, 1);
     }
     return(res);
 }
@@ -1248,6 +1311,10 @@ within STRUCTURE. The value of the last form evaluated is returned.
     rep_DECLARE1 (name, rep_STRINGP);
     rep_DECLARE2 (structure, rep_STRUCTUREP);
 
+    /* Compiled files in binary form are loaded without the reader */
+    if (rep_load_compiled_file (name, structure, &result))
+	return result;
+
     rep_PUSHGC (gc_stream, name);
     rep_PUSHGC (gc_bindings, structure);
     stream = Fopen_file (name, Qread);
@@ -1341,7 +1408,8 @@ NO-PATH is non-nil the `load-path' variable is not used, just the value
 of FILE. If NO-SUFFIX is non-nil no suffixes are appended to FILE.
 
 If the compiled version is older than it's source code, the source code is
-loaded and a warning is displayed.
+loaded and a warning is displayed. The source is also used if the compiled
+version was written in a format this version of rep can't load.
 ::end:: */
 {
     /* Avoid the need to protect these args from GC. */
@@ -1422,6 +1490,13 @@ research:
 			tem = load_file_exists_p (try);
 			if(!tem)
 			    goto path_error;
+			if(tem != Qnil && !trying_dl && i == 1
+			   && rep_compiled_file_stale_p (try))
+			{
+			    /* compiled for another version of rep, or
+			       another byte order; use the source */
+			    tem = Qnil;
+			}
 			if(tem != Qnil)
 			{
 			    if(name != Qnil)
@@ -1867,10 +1942,12 @@ DEFUN("sequencep", Fsequencep, Ssequencep, (repv arg), rep_Subr1) /*
 ::doc:rep.data#sequencep::
 sequencep ARG
 
-Returns t is ARG is a sequence (a list, vector or string).
+Returns t is ARG is a sequence (a list, vector, string, numeric vector
+or bytevector).
 ::end:: */
 {
-    if(rep_LISTP(arg) || rep_VECTORP(arg) || rep_STRINGP(arg) || rep_COMPILEDP(arg))
+    if(rep_LISTP(arg) || rep_VECTORP(arg) || rep_STRINGP(arg) || rep_COMPILEDP(arg)
+       || rep_NUMVECP(arg) || rep_BYTEVECTORP(arg))
 	return Qt;
     else
 	return Qnil;
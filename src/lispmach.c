@@ -69,6 +69,15 @@ static int bytecode_profile[256];
 
 #define BC_APPLY_SELF 0
 
+/* True if hot compiled functions should be quickened */
+rep_bool rep_bytecode_quickening = rep_TRUE;
+
+/* Let hot compiled functions run as native code (see jit.c) */
+#define BYTECODE_JIT 1
+
+/* Run code that doesn't verify (see verify.c) with checks */
+#define BYTECODE_VERIFY 1
+
 #include "lispmach.h"
 
 
@@ -101,7 +110,7 @@ DEFUN("run-byte-code", Frun_byte_code, Srun_byte_code,
     b_stkreq = (rep_INT (stkreq) >> 10) & 0x3ff;
     s_stkreq = rep_INT (stkreq) >> 20;
 
-    return vm (code, consts, 0, 0, v_stkreq, b_stkreq, s_stkreq);
+    return vm (code, consts, Qnil, 0, 0, v_stkreq, b_stkreq, s_stkreq);
 }
 
 DEFUN("validate-byte-code", Fvalidate_byte_code, Svalidate_byte_code, (repv bc_major, repv bc_minor), rep_Subr2) /*
@@ -125,6 +134,42 @@ executed. If not, an error will be signalled.
 	return Qt;
 }
 
+DEFUN("set-bytecode-quickening", Fset_bytecode_quickening,
+      Sset_bytecode_quickening, (repv status), rep_Subr1) /*
+::doc:rep.vm.interpreter#set-bytecode-quickening::
+set-bytecode-quickening STATUS
+
+When STATUS is true, a compiled function that has been called, or has
+looped, often enough runs from a private copy of its code, in which
+generic instructions rewrite themselves to forms specialized for the
+types of operand they have seen (e.g. addition of fixnums, or the car
+of a cons cell), reverting if they later see other types. Returns the
+previous status. Quickening is enabled initially.
+::end:: */
+{
+    repv old = rep_bytecode_quickening ? Qt : Qnil;
+    rep_bytecode_quickening = (status != Qnil);
+    return old;
+}
+
+DEFUN("set-bytecode-jit", Fset_bytecode_jit,
+      Sset_bytecode_jit, (repv status), rep_Subr1) /*
+::doc:rep.vm.interpreter#set-bytecode-jit::
+set-bytecode-jit STATUS
+
+When STATUS is true, a compiled function that has been called, or has
+looped, often enough is translated to native code, and runs as that
+from then on, returning to the byte-code interpreter for anything the
+native code doesn't handle. Only supported on x86-64 systems; elsewhere
+this has no effect. Returns the previous status. Native code is
+disabled initially, the `--jit' command line option enables it.
+::end:: */
+{
+    repv old = rep_bytecode_jit ? Qt : Qnil;
+    rep_bytecode_jit = (status != Qnil);
+    return old;
+}
+
 DEFUN("make-byte-code-subr", Fmake_byte_code_subr, Smake_byte_code_subr, (repv args), rep_SubrN) /*
 ::doc:rep.vm.interpreter#make-byte-code-subr::
 make-byte-code-subr CODE CONSTANTS STACK [DOC] [INTERACTIVE]
@@ -163,18 +208,53 @@ Return an object that can be used as the function value of a symbol.
 	    used--;
     }
 
-    vec = Fmake_vector(rep_MAKE_INT(used), Qnil);
+    vec = rep_make_compiled (used, rep_VECTORP (obj[1])
+			     ? rep_VECT_LEN (obj[1]) : 0);
     if(vec != rep_NULL)
     {
 	int i;
-	rep_COMPILED(vec)->car = ((rep_COMPILED(vec)->car
-				   & ~rep_CELL8_TYPE_MASK) | rep_Compiled);
 	for(i = 0; i < used; i++)
 	    rep_VECTI(vec, i) = obj[i];
+	rep_verify_compiled (vec);
     }
     return vec;
 }
 
+DEFUN("verify-byte-code", Fverify_byte_code, Sverify_byte_code,
+      (repv fun), rep_Subr1) /*
+::doc:rep.vm.interpreter#verify-byte-code::
+verify-byte-code FUNCTION
+
+Check that the compiled function FUNCTION can't overflow or underflow
+its stacks, jump outside its code, or refer to constants or slots that
+don't exist, by following every path through its code. Returns t if
+so, otherwise signals a `bytecode-error' describing the first problem
+found and where it is.
+
+Compiled functions are checked like this before they first run. Those
+found to have a fault, or too complex to check, are still run, but
+with each instruction checked first.
+::end:: */
+{
+    repv why;
+    int where, stkreq, env_need;
+
+    if (rep_FUNARGP (fun))
+	fun = rep_FUNARG (fun)->fun;
+    rep_DECLARE1 (fun, rep_COMPILEDP);
+    rep_DECLARE (1, fun, rep_INTP (rep_COMPILED_STACK (fun)));
+
+    stkreq = rep_INT (rep_COMPILED_STACK (fun));
+    if (rep_verify_bytecode (rep_COMPILED_CODE (fun),
+			     rep_COMPILED_CONSTANTS (fun), stkreq & 0x3ff,
+			     (stkreq >> 10) & 0x3ff, stkreq >> 20,
+			     &env_need, &why, &where) > 0)
+	return Qt;
+    else
+	return Fsignal (Qbytecode_error,
+			rep_LIST_3 (why, fun, rep_MAKE_INT (where)));
+}
+
 DEFUN("bytecodep", Fbytecodep, Sbytecodep, (repv arg), rep_Subr1) /*
 ::doc:rep.vm.interpreter#bytecodep::
 bytecodep ARG
@@ -213,12 +293,16 @@ rep_lispmach_init(void)
     rep_ADD_SUBR(Svalidate_byte_code);
     rep_ADD_SUBR(Smake_byte_code_subr);
     rep_ADD_SUBR(Sbytecodep);
+    rep_ADD_SUBR(Sverify_byte_code);
+    rep_ADD_SUBR(Sset_bytecode_quickening);
+    rep_ADD_SUBR(Sset_bytecode_jit);
 #ifdef BYTECODE_PROFILE
     rep_ADD_SUBR(Sbytecode_profile);
     atexit (print_bytecode_profile);
 #endif
     rep_INTERN(bytecode_error); rep_ERROR(bytecode_error);
     rep_pop_structure (tem);
+    rep_verify_init ();
 }
 
 void
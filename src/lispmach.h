@@ -28,12 +28,14 @@
 	THREADED_VM
 	CACHE_TOS
 	BC_APPLY_SELF
+	BYTECODE_JIT
+	BYTECODE_VERIFY
 	EXTRA_VM_CODE
 	OPTIMIZE_FOR_SPACE
 
    defined functions:
 
-	vm (repv code, repv consts, int argc, repv *argv,
+	vm (repv code, repv consts, repv fun, int argc, repv *argv,
 	    int v_stkreq, int b_stkreq, int s_stkreq);
 	inline_apply_bytecode (repv subr, int nargs, repv *args); */
 
@@ -49,7 +51,7 @@
 DEFSTRING(err_bytecode_error, "Byte-code error");
 DEFSTRING(unknown_op, "Unknown lisp opcode");
 
-static repv vm (repv code, repv consts, int argc, repv *argv,
+static repv vm (repv code, repv consts, repv fun, int argc, repv *argv,
 		int v_stkreq, int b_stkreq, int s_stkreq);
 
 #ifndef OPTIMIZE_FOR_SPACE
@@ -131,6 +133,81 @@ snap_environment (int count)
     return ptr;
 }
 
+/* True if the code at PC (in the function whose code starts at BASE)
+   returns the value on top of the stack without doing anything else
+   that matters once the current frame is discarded. A call followed
+   by such code is in tail position. Only looks a few instructions
+   ahead, and assumes no dynamic bindings are in effect. */
+static inline rep_bool
+returns_top_p (unsigned char *base, unsigned char *pc)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+	switch (*pc)
+	{
+	case OP_RETURN:
+	    return rep_TRUE;
+
+	case OP_JMP:
+	    pc = base + ((pc[1] << ARG_SHIFT) | pc[2]);
+	    break;
+
+	case OP_SWAP:
+	    /* drops the value under the top of the stack */
+	    if (pc[1] != OP_POP)
+		return rep_FALSE;
+	    pc += 2;
+	    break;
+
+	case OP_UNBIND:
+	    /* only lexical bindings, replaced by the callee's environment */
+	    pc++;
+	    break;
+
+	default:
+	    return rep_FALSE;
+	}
+    }
+    return rep_FALSE;
+}
+
+/* A tail call that didn't fit in the frame of the vm () invocation
+   making it. That invocation returns rep_NULL with FUN set, then
+   inline_apply_bytecode makes the call from a fresh frame at least as
+   large as the old one. Arguments of a byte-code call come from a
+   byte-code stack, so at most 0x3ff of them. */
+#define TAIL_CALL_MAX_ARGS 0x400
+
+static struct {
+    repv fun;
+    int argc;
+    int v_stkreq, b_stkreq, s_stkreq;
+    repv argv[TAIL_CALL_MAX_ARGS];
+} pending_tail_call;
+
+/* Calls of a compiled function plus jumps taken in it, after which it
+   runs from a private copy of its code that can be quickened */
+#define QUICKEN_THRESHOLD 64
+
+/* Return the private copy of the code of compiled function FUN, making
+   it if necessary, or null if no memory */
+static unsigned char *
+quicken_code (repv fun)
+{
+    rep_inline_caches *caches = rep_COMPILED_CACHES (fun);
+    if (caches->quick == 0)
+    {
+	repv code = rep_COMPILED_CODE (fun);
+	caches->quick = rep_alloc (rep_STRING_LEN (code));
+	if (caches->quick != 0)
+	    memcpy (caches->quick, rep_STR (code), rep_STRING_LEN (code));
+	else
+	    caches->hits = 0;
+    }
+    return caches->quick;
+}
+
 static repv
 search_special_bindings (repv sym)
 {
@@ -192,7 +269,7 @@ list_ref (repv list, int elt)
     do {					\
 	ASSERT (STK_USE <= v_stkreq);		\
 	ASSERT (BIND_USE <= b_stkreq + 1);	\
-	ASSERT (((char *)pc - rep_STR (code)) < rep_STRING_LEN (code)); \
+	ASSERT ((pc - base) < rep_STRING_LEN (code));	\
     } while (0)
 
 #ifdef BYTECODE_PROFILE
@@ -217,6 +294,90 @@ list_ref (repv list, int elt)
 #define FETCH	    (*pc++)
 #define FETCH2(var) ((var) = (FETCH << ARG_SHIFT), (var) += FETCH)
 
+/* When running from the private copy of a function's code, replace
+   the instruction just fetched by OP. Used both to quicken generic
+   instructions and to return quickened instructions to generic form. */
+#define QUICKEN(op)	do { if (quickened) pc[-1] = (op); } while (0)
+
+#ifdef BYTECODE_VERIFY
+
+/* True when running code that the verifier found a fault in or
+   couldn't decide about, or that refers further up the lexical
+   environment than it goes. Each
+   instruction is checked before it runs, including that any jump it
+   makes stays inside the code, and the code isn't quickened or
+   translated to native code. */
+# define CHECKED checked
+
+/* Signal an error unless the instruction at PC can be run safely */
+# define CHECK_INSN							\
+    do {								\
+	repv why__ = rep_check_insn (code, consts, pc - base, STK_USE,	\
+				     BIND_USE, STK_USE > 0 ? TOP : Qnil, \
+				     BIND_USE > 0 ? BIND_TOP : Qnil,	\
+				     slotp, v_stkreq, b_stkreq, s_stkreq); \
+	if (why__ != rep_NULL)						\
+	{								\
+	    Fsignal (Qbytecode_error,					\
+		     rep_LIST_3 (why__, fun, rep_MAKE_INT (pc - base)));	\
+	    HANDLE_ERROR;						\
+	}								\
+    } while (0)
+
+#else
+# define CHECKED rep_FALSE
+# define CHECK_INSN do { } while (0)
+#endif
+
+/* Switch to running from the private copy of the code of the current
+   function, if it's been used often enough. BASE is the start of the
+   code being run. */
+#define MAYBE_QUICKEN						\
+    do {							\
+	if (!quickened && !CHECKED && caches != 0		\
+	    && rep_bytecode_quickening				\
+	    && (caches->quick != 0				\
+		|| ++caches->hits >= QUICKEN_THRESHOLD))	\
+	{							\
+	    unsigned char *quick__ = quicken_code (fun);	\
+	    if (quick__ != 0)					\
+	    {							\
+		pc = quick__ + (pc - base);			\
+		base = quick__;					\
+		quickened = rep_TRUE;				\
+	    }							\
+	}							\
+    } while (0)
+
+#ifdef BYTECODE_JIT
+
+/* Calls of a compiled function plus jumps taken in it, after which it
+   is translated to native code */
+# define JIT_THRESHOLD 1000
+
+/* Continue in the native code of the current function, making it if
+   it's been used often enough, if it can be entered at PC */
+# define MAYBE_JIT							\
+    do {								\
+	if (caches != 0 && rep_bytecode_jit && !CHECKED)		\
+	{								\
+	    if (caches->jit == 0 && caches->jit_hits++ == JIT_THRESHOLD) \
+		caches->jit = rep_jit_compile (fun);			\
+	    if (caches->jit != 0					\
+		&& caches->jit->entries[pc - base] != 0)		\
+		goto run_native;					\
+	}								\
+    } while (0)
+
+#else
+# define MAYBE_JIT do { } while (0)
+#endif
+
+/* True if the product of fixnums X and Y can't overflow a long long */
+#define MUL_FIX_SAFE_P(x, y)				\
+    (rep_INT (x) >= -0x7fffffffL && rep_INT (x) <= 0x7fffffffL	\
+     && rep_INT (y) >= -0x7fffffffL && rep_INT (y) <= 0x7fffffffL)
+
 #define SYNC_GC				\
     do {				\
 	UPDATE;				\
@@ -251,7 +412,7 @@ list_ref (repv list, int elt)
 /* Non-threaded interpretation, just use a big switch statement in
    a while loop. */
 
-# define BEGIN_DISPATCH fetch: switch (FETCH) {
+# define BEGIN_DISPATCH fetch: if (CHECKED) CHECK_INSN; switch (FETCH) {
 # define END_DISPATCH }
 
 /* Output the case statement for an instruction OP, with an embedded
@@ -400,10 +561,10 @@ list_ref (repv list, int elt)
  &&TAG(OP_SET), &&TAG(OP_REQUIRED_ARG), &&TAG(OP_OPTIONAL_ARG), &&TAG(OP_REST_ARG), /*C8*/ \
  &&TAG(OP_NOT_ZERO_P), &&TAG(OP_KEYWORD_ARG), &&TAG(OP_OPTIONAL_ARG_), &&TAG(OP_KEYWORD_ARG_),	\
 										\
- &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, /*D0*/	\
- &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
- &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, /*D8*/	\
- &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
+ &&TAG(OP_ADD_FIX), &&TAG(OP_SUB_FIX), &&TAG(OP_MUL_FIX), &&TAG(OP_INC_FIX), /*D0*/ \
+ &&TAG(OP_DEC_FIX), &&TAG(OP_NUM_EQ_FIX), &&TAG(OP_LT_FIX), &&TAG(OP_GT_FIX),	\
+ &&TAG(OP_LE_FIX), &&TAG(OP_GE_FIX), &&TAG(OP_CAR_CONS), &&TAG(OP_CDR_CONS), /*D8*/ \
+ &&TAG(OP_AREF_VECT), &&TAG(OP_ASET_VECT), &&TAG_DEFAULT, &&TAG_DEFAULT,	\
  &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, /*E0*/	\
  &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
  &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, /*E8*/	\
@@ -500,21 +661,49 @@ list_ref (repv list, int elt)
 #endif
 
 DEFSTRING(max_depth, "max-lisp-depth exceeded, possible infinite recursion?");
+DEFSTRING(bad_frame_size, "Invalid frame size");
+DEFSTRING(bad_rethrow, "Rethrowing something that wasn't thrown");
+
+/* Make the call saved in pending_tail_call. The arguments are copied
+   into this frame, which is popped again before the next call is
+   made, so a chain of calls through here uses constant C stack. */
+static repv
+run_pending_tail_call (void)
+{
+    repv fun = pending_tail_call.fun;
+    int argc = pending_tail_call.argc;
+    int stkreq = rep_INT (rep_COMPILED_STACK (fun));
+    int v_stkreq = MAX (stkreq & 0x3ff, pending_tail_call.v_stkreq);
+    int b_stkreq = MAX ((stkreq >> 10) & 0x3ff, pending_tail_call.b_stkreq);
+    int s_stkreq = MAX (stkreq >> 20, pending_tail_call.s_stkreq);
+    repv *argv = alloca (sizeof (repv) * argc);
+
+    memcpy (argv, pending_tail_call.argv, sizeof (repv) * argc);
+    pending_tail_call.fun = rep_NULL;
+    return vm (rep_COMPILED_CODE (fun), rep_COMPILED_CONSTANTS (fun),
+	       fun, argc, argv, v_stkreq, b_stkreq, s_stkreq);
+}
 
 static inline repv
 inline_apply_bytecode (repv subr, int nargs, repv *args)
 {
-    return vm (rep_COMPILED_CODE (subr), rep_COMPILED_CONSTANTS (subr),
-	       nargs, args, rep_INT (rep_COMPILED_STACK (subr)) & 0x3ff,
-	       (rep_INT (rep_COMPILED_STACK (subr)) >> 10) & 0x3ff,
-	       rep_INT (rep_COMPILED_STACK (subr) >> 20));
+    repv ret = vm (rep_COMPILED_CODE (subr), rep_COMPILED_CONSTANTS (subr),
+		   subr, nargs, args, rep_INT (rep_COMPILED_STACK (subr)) & 0x3ff,
+		   (rep_INT (rep_COMPILED_STACK (subr)) >> 10) & 0x3ff,
+		   rep_INT (rep_COMPILED_STACK (subr) >> 20));
+    /* the trampoline for tail calls that vm () couldn't make itself */
+    while (ret == rep_NULL && pending_tail_call.fun != rep_NULL)
+	ret = run_pending_tail_call ();
+    return ret;
 }
 
+/* FUN is the compiled function being called, or nil when running
+   top-level code */
 static repv
-vm (repv code, repv consts, int argc, repv *argv,
+vm (repv code, repv consts, repv fun, int argc, repv *argv,
     int v_stkreq, int b_stkreq, int s_stkreq)
 {
-    rep_GC_root gc_code, gc_consts;
+    rep_GC_root gc_code, gc_consts, gc_fun;
     /* The `gcv_N' field is only filled in with the stack-size when there's
        a chance of gc.	*/
     rep_GC_n_roots gc_stack, gc_bindstack, gc_slots, gc_argv;
@@ -535,6 +724,14 @@ vm (repv code, repv consts, int argc, repv *argv,
 	return Fsignal(Qerror, rep_LIST_1(rep_VAL(&max_depth)));
     }
 
+    /* The slot count comes from the function's stack word unmasked */
+    if (s_stkreq < 0 || s_stkreq > BYTECODE_MAX_SLOTS)
+    {
+	rep_lisp_depth--;
+	return Fsignal (Qbytecode_error,
+			rep_LIST_2 (rep_VAL (&bad_frame_size), fun));
+    }
+
     /* When tail-calling we'll only allocate a new stack if the current
        is too small. (this guarantees bounded space requirements) */
     stack = alloca (sizeof (repv) * (v_stkreq + 1));
@@ -543,6 +740,7 @@ vm (repv code, repv consts, int argc, repv *argv,
     repv_bzero (slots, s_stkreq);
 
 #ifdef SLOW_GC_PROTECT
+    rep_PUSHGC(gc_fun, fun);
     rep_PUSHGC(gc_code, code);
     rep_PUSHGC(gc_consts, consts);
     rep_PUSHGCN(gc_bindstack, bindstack, 0);
@@ -554,6 +752,7 @@ vm (repv code, repv consts, int argc, repv *argv,
        [ this ordering is known by popping code at end of fn ] */
     gc_code.ptr = &code;
     gc_consts.ptr = &consts;
+    gc_fun.ptr = &fun;
     gc_bindstack.first= bindstack;
     gc_stack.first = stack + 1;
     gc_slots.first = slots;
@@ -562,7 +761,8 @@ vm (repv code, repv consts, int argc, repv *argv,
     gc_argv.count = argc;
 
     gc_code.next = &gc_consts;
-    gc_consts.next = rep_gc_root_stack;
+    gc_consts.next = &gc_fun;
+    gc_fun.next = rep_gc_root_stack;
     rep_gc_root_stack = &gc_code;
 
     gc_bindstack.next = &gc_stack;
@@ -582,6 +782,16 @@ again: {
     register repv tos TOS_REG;
 #endif
     int argptr = 0;
+    rep_inline_caches *caches = (fun != Qnil
+				 ? rep_COMPILED_CACHES (fun) : 0);
+    unsigned char *base;
+    rep_bool quickened = rep_FALSE;
+#ifdef BYTECODE_VERIFY
+    rep_bool checked = (fun == Qnil
+			? !rep_verify_top_level (code, consts, v_stkreq,
+						 b_stkreq, s_stkreq)
+			: caches->verified != 1 && !rep_verify_compiled (fun));
+#endif
 
     /* Make sure that even when the stack has no entries, the TOP
        element still != 0 (for the error-detection at label quit:) */
@@ -595,17 +805,27 @@ again: {
     bindp = bindstack;
     slotp = slots;
     impurity = 0;
-    pc = (unsigned char *) rep_STR(code);
+    base = (unsigned char *) rep_STR(code);
+    pc = base;
+    MAYBE_QUICKEN;
 
     /* Start of the VM fetch-execute sequence. */
     {
 #ifdef THREADED_VM
 	static void *cfa__[256] = { JUMP_TABLE };
 	register void **cfa CFA_REG = cfa__;
+# ifdef BYTECODE_VERIFY
+	/* in checked mode every instruction goes via checked_dispatch */
+	static void *checked_cfa__[256] = { [0 ... 255] = &&checked_dispatch };
+	if (checked)
+	    cfa = checked_cfa__;
+# endif
 #endif
 	unsigned int arg;
 	repv tmp, tmp2;
 
+	MAYBE_JIT;
+
 	BEGIN_DISPATCH
 
 	BEGIN_INSN_WITH_ARG (OP_CALL)
@@ -748,78 +968,89 @@ again: {
 
 			if (bc_apply == BC_APPLY_SELF)	/* calling self */
 			{
-			    if (impurity != 0 || *pc != OP_RETURN)
+			    int n_req_v, n_req_b, n_req_s;
+
+			    if (impurity != 0 || CHECKED
+				|| !returns_top_p (base, pc))
+				goto call_bytecode;
+
+			    /* A tail call that's safe for eliminating.
+			       The arguments stay where they are, and
+			       become the callee's argv, so it needs a
+			       different stack. The first tail call of
+			       each frame allocates a spare one, after
+			       that they're swapped. */
+			    n_req_v = rep_INT (rep_COMPILED_STACK (tmp)) & 0x3ff;
+			    n_req_b = (rep_INT (rep_COMPILED_STACK (tmp)) >> 10) & 0x3ff;
+			    n_req_s = rep_INT (rep_COMPILED_STACK (tmp)) >> 20;
+			    if (argv_base == 0)
+			    {
+				argv_size = MAX (v_stkreq, n_req_v);
+				argv_base = alloca (sizeof (repv) * (argv_size+1));
+			    }
+			    if ((argv_size < n_req_v || b_stkreq < n_req_b
+				 || s_stkreq < n_req_s) && fun == Qnil)
+			    {
+				/* too small, and no trampoline to return to */
+				goto call_bytecode;
+			    }
+
+			    /* snap the call stack when tail calling */
+			    rep_call_stack = lc.next;
+			    rep_call_stack->fun = lc.fun;
+			    rep_call_stack->args = lc.args;
+
+			    /* since impurity==0 there can only be lexical
+			       bindings; these were unbound when switching
+			       environments.. */
+
+			    if (argv_size < n_req_v || b_stkreq < n_req_b
+				|| s_stkreq < n_req_s)
 			    {
-				TOP = inline_apply_bytecode (tmp, arg,
-							     stackp+1);
+				/* This frame is too small for the callee,
+				   return to the trampoline in
+				   inline_apply_bytecode and make the call
+				   from there. */
+				pending_tail_call.fun = tmp;
+				pending_tail_call.argc = arg;
+				memcpy (pending_tail_call.argv, stackp + 1,
+					sizeof (repv) * arg);
+				pending_tail_call.v_stkreq = v_stkreq;
+				pending_tail_call.b_stkreq = b_stkreq;
+				pending_tail_call.s_stkreq = s_stkreq;
+				TOP = rep_NULL;
+				RETURN;
 			    }
-			    else
+
+			    /* Arguments for the function call */
+			    argv = stackp + 1;
+			    argc = arg;
+
+			    /* Switch old argv and stack */
 			    {
-				/* A tail call that's safe for eliminating */
-				int n_req_v, n_req_b, n_req_s;
-
-				/* snap the call stack when tail calling */
-				rep_call_stack = lc.next;
-				rep_call_stack->fun = lc.fun;
-				rep_call_stack->args = lc.args;
-
-				/* since impurity==0 there can only be lexical
-				   bindings; these were unbound when switching
-				   environments.. */
-
-				/* Arguments for the function call */
-				argv = stackp + 1;
-				argc = arg;
-
-				/* Switch old argv and stack, or reallocate? */
-				n_req_v = rep_INT (rep_COMPILED_STACK (tmp)) & 0x3ff;
-				if (argv_size >= n_req_v)
-				{
-				    /* argv is big enough to be new stack */
-				    repv *tem_stack = stack;
-				    int tem_size = v_stkreq;
-				    stack = argv_base;
-				    v_stkreq = argv_size;
-				    argv_base = tem_stack;
-				    argv_size = tem_size;
-				}
-				else
-				{
-				    argv_base = stack;
-				    argv_size = v_stkreq;
-				    stack = alloca (sizeof (repv) * (n_req_v+1));
-				    v_stkreq = n_req_v;
-				}
-
-				/* inputs: tmp=bytecode-subr */
-			    do_tail_recursion:
-				/* Allocate new bind-stack? */
-				n_req_b = (rep_INT (rep_COMPILED_STACK (tmp)) >> 10) & 0x3ff;
-				if (b_stkreq < n_req_b)
-				{
-				    bindstack = alloca (sizeof (repv) * (n_req_b+1));
-				    b_stkreq = n_req_b;
-				}
-
-				/* Allocate new slots? */
-				n_req_s = rep_INT (rep_COMPILED_STACK (tmp)) >> 20;
-				if (s_stkreq < n_req_s)
-				{
-				    slots = alloca (sizeof (repv) * n_req_s);
-				    s_stkreq = n_req_s;
-				    repv_bzero (slots, s_stkreq);
-				}
-				
-				code = rep_COMPILED_CODE (tmp);
-				consts = rep_COMPILED_CONSTANTS (tmp);
-				gc_bindstack.first = bindstack;
-				gc_stack.first = stack + 1;
-				gc_slots.first = slots;
-				gc_slots.count = s_stkreq;
-				gc_argv.first = argv;
-				gc_argv.count = argc;
-				goto again;
+				repv *tem_stack = stack;
+				int tem_size = v_stkreq;
+				stack = argv_base;
+				v_stkreq = argv_size;
+				argv_base = tem_stack;
+				argv_size = tem_size;
 			    }
+
+			    /* inputs: tmp=bytecode-subr */
+			do_tail_recursion:
+			    code = rep_COMPILED_CODE (tmp);
+			    consts = rep_COMPILED_CONSTANTS (tmp);
+			    fun = tmp;
+			    gc_bindstack.first = bindstack;
+			    gc_stack.first = stack + 1;
+			    gc_slots.first = slots;
+			    gc_slots.count = s_stkreq;
+			    gc_argv.first = argv;
+			    gc_argv.count = argc;
+			    goto again;
+
+			call_bytecode:
+			    TOP = inline_apply_bytecode (tmp, arg, stackp+1);
 			}
 			else
 			{
@@ -849,6 +1080,8 @@ again: {
 		NEXT;
 	    }
 	    rep_POP_CALL(lc);
+	    if (!ERROR_OCCURRED_P)
+		MAYBE_JIT;
 	    INLINE_NEXT;
 	END_INSN
 
@@ -935,37 +1168,34 @@ again: {
 	BEGIN_INSN_WITH_ARG (OP_SETN)
 	    ASSERT (rep_list_length (rep_env) > arg);
 	    POP1 (tmp);
-	    rep_CAR (snap_environment (arg)) = tmp;
+	    tmp2 = snap_environment (arg);
+	    rep_CAR (tmp2) = tmp;
+	    rep_CONS_BARRIER (tmp2);
 	    SAFE_NEXT;
 	END_INSN
 
 	BEGIN_INSN_WITH_ARG (OP_REFG)
-	    /* this code expanded from F_structure_ref () and lookup ()
-	       in structures.c */
 	    rep_struct *s = rep_STRUCTURE (rep_structure);
+	    rep_inline_cache *c = 0;
 	    rep_struct_node *n;
-	    repv var;
 	    ASSERT (arg < rep_VECT_LEN (consts));
-	    var = rep_VECT(consts)->array[arg];
-	    if (s->total_buckets != 0)
+	    if (caches != 0 && arg < caches->count)
 	    {
-		for (n = s->buckets[rep_STRUCT_HASH (var, s->total_buckets)];
-		     n != 0; n = n->next)
+		c = &caches->cache[arg];
+		if (c->epoch == s->epoch)
 		{
-		    if (n->symbol == var)
-		    {
-			PUSH (n->binding);
-			SAFE_NEXT;
-		    }
+		    PUSH (c->node->binding);
+		    SAFE_NEXT;
 		}
 	    }
-	    n = rep_search_imports (s, var);
+	    tmp = rep_VECT(consts)->array[arg];
+	    n = rep_structure_cached_lookup (s, tmp, c);
 	    if (n != 0)
 	    {
 		PUSH (n->binding);
 		SAFE_NEXT;
 	    }
-	    Fsignal (Qvoid_value, rep_LIST_1 (var));
+	    Fsignal (Qvoid_value, rep_LIST_1 (tmp));
 	    HANDLE_ERROR;
 	END_INSN
 
@@ -1180,18 +1410,26 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_CAR)
+	op_car:
 	    tmp = TOP;
 	    if(rep_CONSP(tmp))
+	    {
+		QUICKEN (OP_CAR_CONS);
 		TOP = rep_CAR(tmp);
+	    }
 	    else
 		TOP = Qnil;
 	    SAFE_NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_CDR)
+	op_cdr:
 	    tmp = TOP;
 	    if(rep_CONSP(tmp))
+	    {
+		QUICKEN (OP_CDR_CONS);
 		TOP = rep_CDR(tmp);
+	    }
 	    else
 		TOP = Qnil;
 	    SAFE_NEXT;
@@ -1214,11 +1452,21 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_ASET)
-	    CALL_3(Faset);
+	op_aset:
+	    POP2 (tmp, tmp2);
+	    if (rep_VECTORP (TOP) && rep_INTP (tmp2))
+		QUICKEN (OP_ASET_VECT);
+	    TOP = Faset (TOP, tmp2, tmp);
+	    NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_AREF)
-	    CALL_2(Faref);
+	op_aref:
+	    POP1 (tmp);
+	    if (rep_VECTORP (TOP) && rep_INTP (tmp))
+		QUICKEN (OP_AREF_VECT);
+	    TOP = Faref (TOP, tmp);
+	    NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_LENGTH)
@@ -1226,12 +1474,14 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_ADD)
+	op_add:
 	    /* open-code fixnum arithmetic */
 	    POP1 (tmp);
 	    tmp2 = TOP;
 	    if (rep_INTP (tmp) && rep_INTP (tmp2))
 	    {
 		long x = rep_INT (tmp2) + rep_INT (tmp);
+		QUICKEN (OP_ADD_FIX);
 		if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT)
 		{
 		    TOP = rep_MAKE_INT (x);
@@ -1259,12 +1509,14 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_SUB)
+	op_sub:
 	    /* open-code fixnum arithmetic */
 	    POP1 (tmp);
 	    tmp2 = TOP;
 	    if (rep_INTP (tmp) && rep_INTP (tmp2))
 	    {
 		long x = rep_INT (tmp2) - rep_INT (tmp);
+		QUICKEN (OP_SUB_FIX);
 		if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT)
 		{
 		    TOP = rep_MAKE_INT (x);
@@ -1276,7 +1528,12 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_MUL)
-	    CALL_2(rep_number_mul);
+	op_mul:
+	    POP1 (tmp);
+	    if (rep_INTP (tmp) && rep_INTP (TOP))
+		QUICKEN (OP_MUL_FIX);
+	    TOP = rep_number_mul (TOP, tmp);
+	    NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_DIV)
@@ -1341,10 +1598,12 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_GT)
+	op_gt:
 	    POP1 (tmp);
 	    tmp2 = TOP;
 	    if (rep_INTP (tmp2) && rep_INTP (tmp))
 	    {
+		QUICKEN (OP_GT_FIX);
 		TOP = (rep_INT (tmp2) > rep_INT (tmp)) ? Qt : Qnil;
 		SAFE_NEXT;
 	    }
@@ -1361,10 +1620,12 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_GE)
+	op_ge:
 	    POP1 (tmp);
 	    tmp2 = TOP;
 	    if (rep_INTP (tmp2) && rep_INTP (tmp))
 	    {
+		QUICKEN (OP_GE_FIX);
 		TOP = (rep_INT (tmp2) >= rep_INT (tmp)) ? Qt : Qnil;
 		SAFE_NEXT;
 	    }
@@ -1381,10 +1642,12 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_LT)
+	op_lt:
 	    POP1 (tmp);
 	    tmp2 = TOP;
 	    if (rep_INTP (tmp2) && rep_INTP (tmp))
 	    {
+		QUICKEN (OP_LT_FIX);
 		TOP = (rep_INT (tmp2) < rep_INT (tmp)) ? Qt : Qnil;
 		SAFE_NEXT;
 	    }
@@ -1401,10 +1664,12 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_LE)
+	op_le:
 	    POP1 (tmp);
 	    tmp2 = TOP;
 	    if (rep_INTP (tmp2) && rep_INTP (tmp))
 	    {
+		QUICKEN (OP_LE_FIX);
 		TOP = (rep_INT (tmp2) <= rep_INT (tmp)) ? Qt : Qnil;
 		SAFE_NEXT;
 	    }
@@ -1421,10 +1686,12 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_INC)
+	op_inc:
 	    tmp = TOP;
 	    if (rep_INTP (tmp))
 	    {
 		long x = rep_INT (tmp) + 1;
+		QUICKEN (OP_INC_FIX);
 		if (x <= rep_LISP_MAX_INT)
 		{
 		    TOP = rep_MAKE_INT (x);
@@ -1436,10 +1703,12 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_DEC)
+	op_dec:
 	    tmp = TOP;
 	    if (rep_INTP (tmp))
 	    {
 		long x = rep_INT (tmp) - 1;
+		QUICKEN (OP_DEC_FIX);
 		if (x >= rep_LISP_MIN_INT)
 		{
 		    TOP = rep_MAKE_INT (x);
@@ -1868,37 +2137,57 @@ again: {
 	    POP1 (args);
 	    tmp = TOP;
 	    SYNC_GC;
-	    if (impurity == 0 && *pc == OP_RETURN && rep_FUNARGP (tmp)
+	    if (impurity == 0 && !CHECKED && returns_top_p (base, pc)
+		&& rep_FUNARGP (tmp)
 		&& rep_COMPILEDP (rep_FUNARG (tmp)->fun)
-		&& rep_STRUCTURE (rep_FUNARG (tmp)->structure)->apply_bytecode == 0)
+		&& (rep_STRUCTURE (rep_FUNARG (tmp)->structure)->apply_bytecode
+		    == BC_APPLY_SELF))
 	    {
-		/* a doable tail-call */
-		int nargs, i, n_req_v;
-		rep_USE_FUNARG (tmp);
-		tmp = rep_FUNARG (tmp)->fun;
+		/* a doable tail-call. The arguments go in the spare
+		   stack, and the current stack is reused */
+		int nargs, i, n_req_v, n_req_b, n_req_s;
+		repv callee = rep_FUNARG (tmp)->fun;
 		nargs = rep_list_length (args);
-		if (nargs <= argv_size)
-		    argv = argv_base;
-		else
+		n_req_v = rep_INT (rep_COMPILED_STACK (callee)) & 0x3ff;
+		n_req_b = (rep_INT (rep_COMPILED_STACK (callee)) >> 10) & 0x3ff;
+		n_req_s = rep_INT (rep_COMPILED_STACK (callee)) >> 20;
+		if (argv_base == 0)
 		{
-		    /* Can't just copy over argv, reallocate */
-		    argv = alloca (sizeof (repv) * nargs);
-		    argv_base = argv; argv_size = nargs;
+		    argv_size = MAX (v_stkreq, nargs);
+		    argv_base = alloca (sizeof (repv) * (argv_size+1));
 		}
-		for (i = 0; i < nargs; i++)
+		if (nargs <= argv_size && n_req_v <= v_stkreq
+		    && n_req_b <= b_stkreq && n_req_s <= s_stkreq)
 		{
-		    argv[i] = rep_CAR (args);
-		    args = rep_CDR (args);
+		    rep_USE_FUNARG (tmp);
+		    argv = argv_base;
+		    for (i = 0; i < nargs; i++)
+		    {
+			argv[i] = rep_CAR (args);
+			args = rep_CDR (args);
+		    }
+		    argc = nargs;
+		    tmp = callee;
+		    goto do_tail_recursion;	/* passes `tmp' */
 		}
-		argc = nargs;
-		n_req_v = rep_INT (rep_COMPILED_STACK (tmp)) & 0x3ff;
-		if (n_req_v > v_stkreq)
+		else if (fun != Qnil && nargs <= TAIL_CALL_MAX_ARGS)
 		{
-		    /* Reallocate stack */
-		    stack = alloca (sizeof (repv) * (n_req_v+1));
-		    v_stkreq = n_req_v;
+		    /* too small, let inline_apply_bytecode make the call */
+		    rep_USE_FUNARG (tmp);
+		    for (i = 0; i < nargs; i++)
+		    {
+			pending_tail_call.argv[i] = rep_CAR (args);
+			args = rep_CDR (args);
+		    }
+		    pending_tail_call.argc = nargs;
+		    /* room for the next call like this one in the spare */
+		    pending_tail_call.v_stkreq = MAX (v_stkreq, nargs);
+		    pending_tail_call.b_stkreq = b_stkreq;
+		    pending_tail_call.s_stkreq = s_stkreq;
+		    pending_tail_call.fun = callee;
+		    TOP = rep_NULL;
+		    RETURN;
 		}
-		goto do_tail_recursion;	/* passes `tmp' */
 	    }
 	    /* not a tail call */
 	    TOP = rep_apply (tmp, args);
@@ -2000,10 +2289,12 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_NUM_EQ)
+	op_num_eq:
 	    POP1 (tmp);
 	    tmp2 = TOP;
 	    if (rep_INTP (tmp) && rep_INTP (tmp2))
 	    {
+		QUICKEN (OP_NUM_EQ_FIX);
 		TOP = (tmp2 == tmp) ? Qt : Qnil;
 		SAFE_NEXT;
 	    }
@@ -2122,6 +2413,16 @@ again: {
 	    POP1 (tmp);
 	    if(rep_NILP(tmp))
 		goto do_jmp;
+	    if (!rep_CONSP (tmp))
+	    {
+		/* Only ever given what a handler was entered with, unless
+		   the code is broken, and everything catching the throw
+		   assumes it's a cons */
+		Fsignal (Qbytecode_error,
+			 rep_LIST_3 (rep_VAL (&bad_rethrow), fun,
+				     rep_MAKE_INT (pc - base - 1)));
+		HANDLE_ERROR;
+	    }
 	    rep_throw_value = tmp;
 	    HANDLE_ERROR;
 	END_INSN
@@ -2180,7 +2481,8 @@ again: {
 
 	BEGIN_INSN (OP_JMP)
 	do_jmp:
-	    pc = (unsigned char *) rep_STR(code) + ((pc[0] << ARG_SHIFT) | pc[1]);
+	    pc = base + ((pc[0] << ARG_SHIFT) | pc[1]);
+	    MAYBE_QUICKEN;
 
 	    /* Test if an interrupt occurred... */
 	    rep_TEST_INT;
@@ -2191,14 +2493,239 @@ again: {
 
 	    /* ...or if it's time to gc... */
 	    if(rep_data_after_gc >= rep_gc_threshold)
-		Fgarbage_collect (Qnil);
+		rep_auto_gc ();
 
 	    /* ...or time to switch threads */
 	    rep_MAY_YIELD;
 
+	    MAYBE_JIT;
 	    SAFE_NEXT;
 	END_INSN
 
+	/* Quickened instructions. Each checks that its operands are of
+	   the types it's specialized for, if not it returns itself to
+	   the generic instruction and runs that. */
+
+	BEGIN_INSN (OP_ADD_FIX)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_INTP (tmp) || !rep_INTP (tmp2))
+	    {
+		QUICKEN (OP_ADD);
+		goto op_add;
+	    }
+	    POP;
+	    {
+		long x = rep_INT (tmp2) + rep_INT (tmp);
+		if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT)
+		{
+		    TOP = rep_MAKE_INT (x);
+		    SAFE_NEXT;
+		}
+	    }
+	    TOP = rep_number_add (tmp2, tmp);
+	    INLINE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_SUB_FIX)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_INTP (tmp) || !rep_INTP (tmp2))
+	    {
+		QUICKEN (OP_SUB);
+		goto op_sub;
+	    }
+	    POP;
+	    {
+		long x = rep_INT (tmp2) - rep_INT (tmp);
+		if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT)
+		{
+		    TOP = rep_MAKE_INT (x);
+		    SAFE_NEXT;
+		}
+	    }
+	    TOP = rep_number_sub (tmp2, tmp);
+	    INLINE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_MUL_FIX)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_INTP (tmp) || !rep_INTP (tmp2))
+	    {
+		QUICKEN (OP_MUL);
+		goto op_mul;
+	    }
+	    POP;
+	    if (MUL_FIX_SAFE_P (tmp2, tmp))
+	    {
+		rep_long_long x = (rep_long_long) rep_INT (tmp2) * rep_INT (tmp);
+		if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT)
+		{
+		    TOP = rep_MAKE_INT (x);
+		    SAFE_NEXT;
+		}
+	    }
+	    TOP = rep_number_mul (tmp2, tmp);
+	    INLINE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_INC_FIX)
+	    tmp = TOP;
+	    if (!rep_INTP (tmp))
+	    {
+		QUICKEN (OP_INC);
+		goto op_inc;
+	    }
+	    if (rep_INT (tmp) < rep_LISP_MAX_INT)
+	    {
+		TOP = rep_MAKE_INT (rep_INT (tmp) + 1);
+		SAFE_NEXT;
+	    }
+	    TOP = Fplus1 (tmp);
+	    NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_DEC_FIX)
+	    tmp = TOP;
+	    if (!rep_INTP (tmp))
+	    {
+		QUICKEN (OP_DEC);
+		goto op_dec;
+	    }
+	    if (rep_INT (tmp) > rep_LISP_MIN_INT)
+	    {
+		TOP = rep_MAKE_INT (rep_INT (tmp) - 1);
+		SAFE_NEXT;
+	    }
+	    TOP = Fsub1 (tmp);
+	    NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_NUM_EQ_FIX)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_INTP (tmp) || !rep_INTP (tmp2))
+	    {
+		QUICKEN (OP_NUM_EQ);
+		goto op_num_eq;
+	    }
+	    POP;
+	    TOP = (tmp2 == tmp) ? Qt : Qnil;
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_LT_FIX)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_INTP (tmp) || !rep_INTP (tmp2))
+	    {
+		QUICKEN (OP_LT);
+		goto op_lt;
+	    }
+	    POP;
+	    TOP = (rep_INT (tmp2) < rep_INT (tmp)) ? Qt : Qnil;
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_GT_FIX)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_INTP (tmp) || !rep_INTP (tmp2))
+	    {
+		QUICKEN (OP_GT);
+		goto op_gt;
+	    }
+	    POP;
+	    TOP = (rep_INT (tmp2) > rep_INT (tmp)) ? Qt : Qnil;
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_LE_FIX)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_INTP (tmp) || !rep_INTP (tmp2))
+	    {
+		QUICKEN (OP_LE);
+		goto op_le;
+	    }
+	    POP;
+	    TOP = (rep_INT (tmp2) <= rep_INT (tmp)) ? Qt : Qnil;
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_GE_FIX)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_INTP (tmp) || !rep_INTP (tmp2))
+	    {
+		QUICKEN (OP_GE);
+		goto op_ge;
+	    }
+	    POP;
+	    TOP = (rep_INT (tmp2) >= rep_INT (tmp)) ? Qt : Qnil;
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_CAR_CONS)
+	    tmp = TOP;
+	    if (!rep_CONSP (tmp))
+	    {
+		QUICKEN (OP_CAR);
+		goto op_car;
+	    }
+	    TOP = rep_CAR (tmp);
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_CDR_CONS)
+	    tmp = TOP;
+	    if (!rep_CONSP (tmp))
+	    {
+		QUICKEN (OP_CDR);
+		goto op_cdr;
+	    }
+	    TOP = rep_CDR (tmp);
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_AREF_VECT)
+	    tmp = TOP;
+	    tmp2 = stackp[-1];
+	    if (!rep_VECTORP (tmp2) || !rep_INTP (tmp))
+	    {
+		QUICKEN (OP_AREF);
+		goto op_aref;
+	    }
+	    POP;
+	    if (rep_INT (tmp) >= 0 && rep_INT (tmp) < rep_VECT_LEN (tmp2))
+	    {
+		TOP = rep_VECTI (tmp2, rep_INT (tmp));
+		SAFE_NEXT;
+	    }
+	    TOP = Faref (tmp2, tmp);
+	    NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_ASET_VECT)
+	    if (!rep_VECTORP (stackp[-2]) || !rep_INTP (stackp[-1]))
+	    {
+		QUICKEN (OP_ASET);
+		goto op_aset;
+	    }
+	    POP2 (tmp, tmp2);
+	    if (rep_INT (tmp2) >= 0 && rep_INT (tmp2) < rep_VECT_LEN (TOP)
+		&& rep_VECTOR_WRITABLE_P (TOP))
+	    {
+		rep_VECTI (TOP, rep_INT (tmp2)) = tmp;
+		rep_OBJECT_BARRIER (TOP, tmp);
+		TOP = tmp;
+		SAFE_NEXT;
+	    }
+	    TOP = Faset (TOP, tmp2, tmp);
+	    NEXT;
+	END_INSN
+
 	BEGIN_DEFAULT_INSN
 	    Fsignal(Qbytecode_error, rep_list_2(rep_VAL(&unknown_op),
 						rep_MAKE_INT(pc[-1])));
@@ -2210,6 +2737,33 @@ again: {
 	END_INSN
 
 	END_DISPATCH
+
+#ifdef BYTECODE_JIT
+	/* Run the native code of the current function from PC, then
+	   carry on from wherever it stops. */
+    run_native:
+	{
+	    rep_jit_frame frame;
+	    int ret;
+
+	    SYNC_GC;
+	    frame.stackp = stackp;
+	    frame.stack = stack;
+	    frame.slots = slotp;
+	    frame.consts = rep_VECT (consts)->array;
+	    frame.gc_count = &gc_stack.count;
+	    ret = rep_jit_run (caches->jit, &frame, pc - base);
+	    if (ret >= 0)
+	    {
+		stackp = frame.stackp;
+		RELOAD;
+		pc = base + (ret >> 1);
+		if (ret & 1)
+		    HANDLE_ERROR;
+	    }
+	    SAFE_NEXT;
+	}
+#endif
 	
 	/* Check if the instruction raised an exception. */
     check_error:
@@ -2249,7 +2803,7 @@ again: {
 		    RELOAD;
 		    PUSH(rep_throw_value);
 		    rep_throw_value = rep_NULL;
-		    pc = (unsigned char *) rep_STR(code) + rep_INT(rep_CAR(item));
+		    pc = base + rep_INT(rep_CAR(item));
 		    impurity--;
 		    SAFE_NEXT;
 		}
@@ -2267,6 +2821,14 @@ again: {
     safe_next:
 #endif
 	SAFE_NEXT__;
+
+#if defined (THREADED_VM) && defined (BYTECODE_VERIFY)
+	/* Check the instruction just fetched, then run it */
+    checked_dispatch:
+	pc--;
+	CHECK_INSN;
+	goto *cfa__[FETCH];
+#endif
     }
 
 quit:
@@ -2277,17 +2839,23 @@ quit:
 
     /* close the register scope */ }
 
-    /* moved to after the execution, to avoid needing to gc protect argv */
-    if(rep_data_after_gc >= rep_gc_threshold)
-	Fgarbage_collect (Qnil);
-    rep_MAY_YIELD;
+    /* moved to after the execution, to avoid needing to gc protect argv.
+       Not when leaving a tail call for the trampoline, nothing protects
+       its arguments and another thread could make its own tail call */
+    if (code != rep_NULL || pending_tail_call.fun == rep_NULL)
+    {
+	if(rep_data_after_gc >= rep_gc_threshold)
+	    rep_auto_gc ();
+	rep_MAY_YIELD;
+    }
 
     rep_lisp_depth--;
 
 #ifdef SLOW_GC_PROTECT
-    rep_POPGCN; rep_POPGCN; rep_POPGCN; rep_POPGCN; rep_POPGC; rep_POPGC;
+    rep_POPGCN; rep_POPGCN; rep_POPGCN; rep_POPGCN;
+    rep_POPGC; rep_POPGC; rep_POPGC;
 #else
-    rep_gc_root_stack = gc_consts.next;
+    rep_gc_root_stack = gc_fun.next;
     rep_gc_n_roots_stack = gc_argv.next;
 #endif
 
@@ -73,6 +73,9 @@ static void rep_main_init(void);
 
 DEFSTRING(noarg, "No argument for option");
 
+/* The heap image to start from, or null */
+static char *image_file;
+
 /* Look for the command line option called OPTION. If ARGP is non-null,
    the option requires an argument, it will be stored in *ARGP. If
    the option isn't given return false, else return true. */
@@ -126,7 +129,7 @@ get_main_options(char *prog_name, int *argc_p, char ***argv_p)
 {
     int argc = *argc_p;
     char **argv = *argv_p;
-    repv head, *last;
+    repv head, *last, opt;
 
     /* any command line args are made into a list of strings
        in symbol command-line-args.  */
@@ -154,6 +157,17 @@ get_main_options(char *prog_name, int *argc_p, char ***argv_p)
 	rep_record_origins = rep_TRUE;
     }
 
+    if (rep_get_option("--jit", 0))
+	rep_bytecode_jit = rep_TRUE;
+
+    if (rep_get_option("--image", &opt))
+    {
+	image_file = rep_alloc (rep_STRING_LEN (opt) + 1);
+	strcpy (image_file, rep_STR (opt));
+    }
+    else
+	image_file = getenv ("REPIMAGE");
+
     return rep_TRUE;
 }
 
@@ -252,6 +266,11 @@ rep_init_from_dump(char *prog_name, int *argc, char ***argv,
 	rep_datums_init();
 	rep_fluids_init();
 	rep_weak_refs_init ();
+	rep_numeric_vectors_init ();
+	rep_bytevectors_init ();
+	rep_heap_census_init ();
+	rep_images_init ();
+	rep_compiled_files_init ();
 	rep_sys_os_init();
 
 	/* XXX Assumes that argc is on the stack. I can't think of
@@ -299,16 +318,23 @@ rep_load_environment (repv file)
 
     rep_PUSHGC (gc_file, file);
 
-    /* 1. Do the rep bootstrap */
+    /* 1. Do the rep bootstrap, from a heap image if possible */
+
+    rep_note_core_state ();
 
     if (rep_dumped_non_constants != rep_NULL)
 	res = Feval (rep_dumped_non_constants);
 
-    for (ptr = init; res != rep_NULL && *ptr != 0; ptr++)
+    if (image_file == 0 || *image_file == 0 || !rep_load_image (image_file))
     {
-	res = rep_bootstrap_structure (*ptr);
+	for (ptr = init; res != rep_NULL && *ptr != 0; ptr++)
+	{
+	    res = rep_bootstrap_structure (*ptr);
+	}
     }
 
+    rep_note_bootstrap_state ();
+
     /* 2. Do the caller-local bootstrap */
 
     if (res != rep_NULL && rep_STRINGP(file))
@@ -323,6 +349,7 @@ rep_kill(void)
 {
     rep_sys_os_kill();
     rep_find_kill();
+    rep_images_kill ();
     rep_files_kill();
 #ifdef HAVE_DYNAMIC_LOADING
     rep_kill_dl_libraries();
@@ -359,9 +386,9 @@ rep_on_idle(long since_last_event)
 
     if(rep_on_idle_fun != 0 && (*rep_on_idle_fun)(since_last_event))
 	res = rep_TRUE;
-    else if(rep_data_after_gc > rep_idle_gc_threshold)
-	/* nothing was saved so try a GC */
-	Fgarbage_collect (Qnil);
+    else if(rep_data_after_gc > rep_idle_gc_threshold || rep_gc_marking)
+	/* nothing was saved so try a GC, or the next step of one */
+	rep_auto_gc ();
     else if(!called_hook && depth == 1)
     {
 	repv hook = Fsymbol_value(Qidle_hook, Qt);
@@ -391,6 +391,16 @@ Returns the name of the host which the editor is running on.
     return rep_system_name();
 }
 
+DEFUN("processor-count", Fprocessor_count, Sprocessor_count, (void), rep_Subr0) /*
+::doc:rep.system#processor-count::
+processor-count
+
+Returns the number of processors available to run processes.
+::end:: */
+{
+    return rep_MAKE_INT(rep_processor_count());
+}
+
 DEFUN("message", Fmessage, Smessage, (repv string, repv now), rep_Subr2) /*
 ::doc:rep.system#message::
 message STRING [DISPLAY-NOW]
@@ -627,6 +637,7 @@ rep_misc_init(void)
     rep_ADD_SUBR(Suser_full_name);
     rep_ADD_SUBR(Suser_home_directory);
     rep_ADD_SUBR(Ssystem_name);
+    rep_ADD_SUBR(Sprocessor_count);
     rep_ADD_SUBR(Smessage);
 
     rep_pop_structure (tem);
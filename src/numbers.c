@@ -153,6 +153,65 @@ typedef struct rep_number_block_struct {
 #define ZEROP(x) \
     (rep_INTP (x) ? (x) == rep_MAKE_INT (0) : Fzerop (x) != Qnil)
 
+#ifdef rep_VALUE_IS_FLONUM
+
+/* Immediate floats. A double whose top four exponent bits are 0111
+   or 1000 (a magnitude between 2^-127 and 2^129) is rotated left four
+   bits, moving its sign and top three exponent bits to bits 3->0 of
+   the repv. Bits 0 to 2 are then overwritten by the tag, since they
+   can be recovered from the fourth exponent bit, now bit 63. The
+   encoding of 2^-127 itself is used for 0.0 instead; all other doubles
+   (including -0.0, infinities and NaNs) are allocated as cells. */
+
+#define FLONUM_ZERO \
+    (rep_VALUE_CONST (0x8000000000000000) | rep_VALUE_IS_FLONUM)
+
+typedef union {
+    double d;
+    repv bits;
+} flonum_bits;
+
+/* Return the immediate float representing D, or rep_NULL */
+static inline repv
+make_flonum (double d)
+{
+    flonum_bits u;
+    int top;
+    u.d = d;
+    top = (u.bits >> 59) & 15;
+    if ((top == 7 || top == 8)
+	&& u.bits != rep_VALUE_CONST (0x3800000000000000))
+    {
+	repv v = (u.bits << 4) | (u.bits >> 60);
+	return (v & ~(repv) 7) | rep_VALUE_IS_FLONUM;
+    }
+    else if (u.bits == 0)
+	return FLONUM_ZERO;
+    else
+	return rep_NULL;
+}
+
+static inline double
+flonum_value (repv v)
+{
+    flonum_bits u;
+    if (v == FLONUM_ZERO)
+	return 0.0;
+    v = (v & ~(repv) 7) | (4 - (v >> 63));
+    u.bits = (v >> 4) | (v << 60);
+    return u.d;
+}
+
+/* The value of float V, immediate or not */
+#define rep_FLOAT(v) \
+    (rep_FLONUMP (v) ? flonum_value (v) : rep_NUMBER (v,f))
+
+#else /* rep_VALUE_IS_FLONUM */
+
+#define rep_FLOAT(v) rep_NUMBER (v,f)
+
+#endif /* !rep_VALUE_IS_FLONUM */
+
 
 /* number object handling */
 
@@ -161,6 +220,13 @@ static rep_number *number_freelist[3];
 static int number_allocations[3], number_sizeofs[3];
 static int allocated_numbers, used_numbers;
 
+/* Blocks that haven't been swept since the last collection. They're
+   swept when the free list of their type is empty, or before the next
+   marking (see rep_sweep_number_block). */
+static rep_number_block *number_unswept[3];
+
+static void sweep_number_block (rep_number_block *cb, int idx);
+
 static inline int
 type_to_index (int type)
 {
@@ -174,6 +240,13 @@ make_number (int type)
     rep_number *cn;
     int idx = type_to_index (type);
     cn = number_freelist[idx];
+    while (cn == NULL && number_unswept[idx] != NULL)
+    {
+	rep_number_block *cb = number_unswept[idx];
+	number_unswept[idx] = cb->next.p;
+	sweep_number_block (cb, idx);
+	cn = number_freelist[idx];
+    }
     if(cn == NULL)
     {
 	int i;
@@ -197,87 +270,143 @@ make_number (int type)
     number_freelist[idx] = (rep_number *) cn->car;
     cn->car = rep_Number | type;
     used_numbers++;
-    rep_data_after_gc += sizeof (rep_number);
+    rep_NOTE_ALLOC (rep_Number, sizeof (rep_number));
     return cn;
 }
 
-static void
-number_sweep(void)
+/* Return a float with value D, only allocating it if it can't be
+   represented as an immediate value */
+static repv
+make_float (double d)
 {
-    int idx;
-    used_numbers = 0;
-    for (idx = 0; idx < 3; idx++)
-    {
-	rep_number_block *cb = number_block_chain[idx];
-	number_block_chain[idx] = 0;
-	number_freelist[idx] = 0;
-	while (cb != 0)
+    rep_number_f *f;
+#ifdef rep_VALUE_IS_FLONUM
+    repv v = make_flonum (d);
+    if (v != rep_NULL)
+	return v;
+#endif
+    f = make_number (rep_NUMBER_FLOAT);
+    f->f = d;
+    return rep_VAL (f);
+}
+
+/* Free the unmarked numbers of block CB, of type index IDX, adding
+   them to the free list, and put it back on the block chain (unless
+   it's empty, in which case it's freed). */
+static void
+sweep_number_block (rep_number_block *cb, int idx)
+{
+    rep_number *newfree = 0, *newfreetail = 0, *this;
+    int i, newused = 0;
+    for (i = 0, this = cb->data;
+	 i < number_allocations[idx];
+	 i++, this = (rep_number *) (((char *) this) + number_sizeofs[idx]))
+    {
+	/* if on the freelist then the CELL_IS_8 bit
+	   will be unset (since the pointer is long aligned) */
+	if (rep_CELL_CONS_P(rep_VAL(this))
+	    || !rep_GC_CELL_MARKEDP ((repv) this))
 	{
-	    rep_number_block *nxt = cb->next.p;
-	    rep_number *newfree = 0, *newfreetail = 0, *this;
-	    int i, newused = 0;
-	    for (i = 0, this = cb->data;
-		 i < number_allocations[idx];
-		 i++, this = (rep_number *) (((char *) this)
-					     + number_sizeofs[idx]))
+	    if (!newfreetail)
+		newfreetail = this;
+	    if (!rep_CELL_CONS_P(rep_VAL(this)))
 	    {
-		/* if on the freelist then the CELL_IS_8 bit
-		   will be unset (since the pointer is long aligned) */
-		if (rep_CELL_CONS_P(rep_VAL(this))
-		    || !rep_GC_CELL_MARKEDP ((repv) this))
+		switch (idx)
 		{
-		    if (!newfreetail)
-			newfreetail = this;
-		    if (!rep_CELL_CONS_P(rep_VAL(this)))
-		    {
-			switch (idx)
-			{
-			case 0:
+		case 0:
 #ifdef HAVE_GMP
-			    mpz_clear (((rep_number_z *)this)->z);
+		    mpz_clear (((rep_number_z *)this)->z);
 #else
-			    ((rep_number_z *)this)->z = 0;
+		    ((rep_number_z *)this)->z = 0;
 #endif
-			    break;
+		    break;
 
-			case 1:
+		case 1:
 #ifdef HAVE_GMP
-			    mpq_clear (((rep_number_q *)this)->q);
+		    mpq_clear (((rep_number_q *)this)->q);
 #endif
-			    break;
-			}
-		    }
-		    this->car = rep_VAL (newfree);
-		    newfree = this;
-		}
-		else
-		{
-		    rep_GC_CLR_CELL ((repv) this);
-		    newused++;
-		}
-	    }
-	    if(newused == 0)
-	    {
-		/* Whole block unused, lets get rid of it.  */
-		rep_free(cb);
-		allocated_numbers -= number_allocations[idx];
-	    }
-	    else
-	    {
-		if(newfreetail != NULL)
-		{
-		    /* Link this mini-freelist onto the main one.  */
-		    newfreetail->car = rep_VAL (number_freelist[idx]);
-		    number_freelist[idx] = newfree;
-		    used_numbers += newused;
+		    break;
 		}
-		/* Have to rebuild the block chain as well.  */
-		cb->next.p = number_block_chain[idx];
-		number_block_chain[idx] = cb;
 	    }
-	    cb = nxt;
+	    this->car = rep_VAL (newfree);
+	    newfree = this;
+	}
+	else
+	{
+	    rep_GC_CLR_CELL ((repv) this);
+	    newused++;
+	}
+    }
+    if(newused == 0)
+    {
+	/* Whole block unused, lets get rid of it.  */
+	rep_free(cb);
+	allocated_numbers -= number_allocations[idx];
+    }
+    else
+    {
+	if(newfreetail != NULL)
+	{
+	    /* Link this mini-freelist onto the main one.  */
+	    newfreetail->car = rep_VAL (number_freelist[idx]);
+	    number_freelist[idx] = newfree;
+	}
+	used_numbers += newused;
+	cb->next.p = number_block_chain[idx];
+	number_block_chain[idx] = cb;
+    }
+}
+
+static unsigned long
+number_size (repv x)
+{
+    int type = rep_NUMBER_TYPE (x);
+    unsigned long size = number_sizeofs[type_to_index (type)];
+#ifdef HAVE_GMP
+    if (type == rep_NUMBER_BIGNUM)
+	size += mpz_size (rep_NUMBER (x,z)) * sizeof (mp_limb_t);
+    else if (type == rep_NUMBER_RATIONAL)
+    {
+	size += ((mpz_size (mpq_numref (rep_NUMBER (x,q)))
+		  + mpz_size (mpq_denref (rep_NUMBER (x,q))))
+		 * sizeof (mp_limb_t));
+    }
+#endif
+    return size;
+}
+
+/* Blocks are swept lazily, by make_number */
+static void
+number_sweep(void)
+{
+    int idx;
+    used_numbers = 0;
+    for (idx = 0; idx < 3; idx++)
+    {
+	assert (number_unswept[idx] == 0);
+	number_unswept[idx] = number_block_chain[idx];
+	number_block_chain[idx] = 0;
+	number_freelist[idx] = 0;
+    }
+}
+
+/* Sweep one of the blocks left unswept by the last collection,
+   returning false if there were none. */
+rep_bool
+rep_sweep_number_block (void)
+{
+    int idx;
+    for (idx = 0; idx < 3; idx++)
+    {
+	rep_number_block *cb = number_unswept[idx];
+	if (cb != 0)
+	{
+	    number_unswept[idx] = cb->next.p;
+	    sweep_number_block (cb, idx);
+	    return rep_TRUE;
 	}
     }
+    return rep_FALSE;
 }
 
 
@@ -289,7 +418,6 @@ dup__ (repv in)
     switch (rep_NUMBER_TYPE (in))
     {
 	rep_number_z *z;
-	rep_number_f *f;
 
     case rep_NUMBER_BIGNUM:
 	z = make_number (rep_NUMBER_BIGNUM);
@@ -310,9 +438,8 @@ dup__ (repv in)
 #endif
 
     case rep_NUMBER_FLOAT:
-	f = make_number (rep_NUMBER_FLOAT);
-	f->f = rep_NUMBER(in,f);
-	return rep_VAL (f);
+	/* floats are never modified in place */
+	return in;
     }
     abort ();
 }
@@ -337,7 +464,6 @@ promote_to (repv in, int type)
     switch (in_type)
     {
 	rep_number_z *z;
-	rep_number_f *f;
 
     case rep_NUMBER_INT:
 	switch (type)
@@ -363,10 +489,7 @@ promote_to (repv in, int type)
 #endif
 
 	case rep_NUMBER_FLOAT:
-	    f = make_number (rep_NUMBER_FLOAT);
-	    f->f = (double) rep_INT(in);
-	    return rep_VAL (f);
-	    break;
+	    return make_float ((double) rep_INT(in));
 
 	default:
 	    abort();
@@ -386,13 +509,11 @@ promote_to (repv in, int type)
 #endif
 
 	case rep_NUMBER_FLOAT:
-	    f = make_number (rep_NUMBER_FLOAT);
 #ifdef HAVE_GMP
-	    f->f = mpz_get_d (rep_NUMBER(in,z));
+	    return make_float (mpz_get_d (rep_NUMBER(in,z)));
 #else
-	    f->f = rep_NUMBER(in,z);
+	    return make_float (rep_NUMBER(in,z));
 #endif
-	    return rep_VAL (f);
 
 	default:
 	    abort();
@@ -401,9 +522,7 @@ promote_to (repv in, int type)
 #ifdef HAVE_GMP
     case rep_NUMBER_RATIONAL:
 	assert (type == rep_NUMBER_FLOAT);
-	f = make_number (rep_NUMBER_FLOAT);
-	f->f = mpq_get_d (rep_NUMBER(in,q));
-	return rep_VAL (f);
+	return make_float (mpq_get_d (rep_NUMBER(in,q)));
 #endif
 
     default:
@@ -588,7 +707,7 @@ rep_get_long_uint (repv in)
 #endif
 
 	case rep_NUMBER_FLOAT:
-	    return (unsigned long) rep_NUMBER(in,f);
+	    return (unsigned long) rep_FLOAT (in);
 	}
     }
     else if (rep_CONSP (in)
@@ -621,7 +740,7 @@ rep_get_long_int (repv in)
 #endif
 
 	case rep_NUMBER_FLOAT:
-	    return (long) rep_NUMBER(in,f);
+	    return (long) rep_FLOAT (in);
 	}
     }
     else if (rep_CONSP (in)
@@ -703,7 +822,7 @@ rep_get_longlong_int (repv in)
 #endif
 
 	case rep_NUMBER_FLOAT:
-	    return (rep_long_long) rep_NUMBER(in,f);
+	    return (rep_long_long) rep_FLOAT (in);
 	}
     }
     else if (rep_CONSP (in)
@@ -735,7 +854,6 @@ rep_get_longlong_int (repv in)
 repv
 rep_make_float (double in, rep_bool force)
 {
-    rep_number_f *f;
     if (!force && floor (in) == in)
     {
 	if (in < LONG_MAX && in > LONG_MIN)
@@ -746,9 +864,7 @@ rep_make_float (double in, rep_bool force)
 #endif
     }
 
-    f = make_number (rep_NUMBER_FLOAT);
-    f->f = in;
-    return rep_VAL (f);
+    return make_float (in);
 }
 
 double
@@ -774,7 +890,7 @@ rep_get_float (repv in)
 #endif
 
 	case rep_NUMBER_FLOAT:
-	    return rep_NUMBER(in,f);
+	    return rep_FLOAT (in);
 	}
     }
     return 0.0;
@@ -807,7 +923,7 @@ rep_compare_numbers (repv v1, repv v2)
 #endif
 
     case rep_NUMBER_FLOAT:
-	d = rep_NUMBER(v1,f) - rep_NUMBER(v2,f);
+	d = rep_FLOAT (v1) - rep_FLOAT (v2);
 	return (d < 0) ? -1 : (d > 0) ? +1 : 0;
     }
     return 1;
@@ -848,7 +964,7 @@ number_cmp (repv v1, repv v2)
 #endif
 
     case rep_NUMBER_FLOAT:
-	d = rep_NUMBER(v1,f) - rep_NUMBER(v2,f);
+	d = rep_FLOAT (v1) - rep_FLOAT (v2);
 	return (d < 0) ? -1 : (d > 0) ? +1 : 0;
     }
     return 1;
@@ -917,7 +1033,6 @@ rep_parse_number (char *buf, unsigned int len, unsigned int radix, int sign, uns
 #ifdef HAVE_GMP
 	rep_number_q *q;
 #endif
-	rep_number_f *f;
 	char *tem, *copy, *old_locale;
 	double d;
 	unsigned int bits;
@@ -1021,9 +1136,7 @@ rep_parse_number (char *buf, unsigned int len, unsigned int radix, int sign, uns
 			}
 			else
 			{
-			    f = make_number (rep_NUMBER_FLOAT);
-			    f->f = d;
-			    return rep_VAL (f);
+			    return make_float (d);
 			}
 		    }
 		    else
@@ -1085,9 +1198,7 @@ rep_parse_number (char *buf, unsigned int len, unsigned int radix, int sign, uns
 #endif
 	if (tem - buf != len)
 	    goto error;
-	f = make_number (rep_NUMBER_FLOAT);
-	f->f = d * sign;
-	return rep_VAL (f);
+	return make_float (d * sign);
     }
 error:
     return rep_NULL;
@@ -1175,9 +1286,9 @@ rep_print_number_to_string (repv obj, int radix, int prec)
 	INSTALL_LOCALE (old_locale, LC_NUMERIC, "C");
 #endif
 #ifdef HAVE_SNPRINTF
-	snprintf(buf, sizeof(buf), fmt, rep_NUMBER(obj,f));
+	snprintf(buf, sizeof(buf), fmt, rep_FLOAT (obj));
 #else
-	sprintf(buf, fmt, rep_NUMBER(obj,f));
+	sprintf(buf, fmt, rep_FLOAT (obj));
 #endif
 #ifdef HAVE_SETLOCALE
 	if (old_locale != 0)
@@ -1386,7 +1497,7 @@ rep_number_add (repv x, repv y)
 #endif
     
 	case rep_NUMBER_FLOAT:
-	    rep_NUMBER (out,f) = rep_NUMBER (x,f) + rep_NUMBER (y,f);
+	    out = make_float (rep_FLOAT (x) + rep_FLOAT (y));
 	    break;
     }
     return out;
@@ -1424,7 +1535,7 @@ rep_number_neg (repv x)
 #endif
 
     case rep_NUMBER_FLOAT:
-	rep_NUMBER(out,f) = -rep_NUMBER(x,f);
+	out = make_float (-rep_FLOAT (x));
 	break;
     }
     return out;
@@ -1465,7 +1576,7 @@ rep_number_sub (repv x, repv y)
 #endif
     
     case rep_NUMBER_FLOAT:
-	rep_NUMBER (out,f) = rep_NUMBER (x,f) - rep_NUMBER (y,f);
+	out = make_float (rep_FLOAT (x) - rep_FLOAT (y));
 	break;
     }
     return out;
@@ -1509,7 +1620,7 @@ rep_number_mul (repv x, repv y)
 #endif
     
     case rep_NUMBER_FLOAT:
-	rep_NUMBER (out,f) = rep_NUMBER (x,f) * rep_NUMBER (y,f);
+	out = make_float (rep_FLOAT (x) * rep_FLOAT (y));
 	break;
     }
     return out;
@@ -1543,9 +1654,7 @@ rep_number_div (repv x, repv y)
 		mpq_neg (q->q, q->q);
 	    out = rep_VAL (q);
 #else
-	    rep_number_f *f = make_number (rep_NUMBER_FLOAT);
-	    f->f = ((double) rep_INT (x)) / ((double) rep_INT (y));
-	    out = rep_VAL (f);
+	    out = make_float (((double) rep_INT (x)) / ((double) rep_INT (y)));
 #endif
 	}
 	break;
@@ -1587,9 +1696,8 @@ rep_number_div (repv x, repv y)
 	}
 	else
 	{
-	    rep_number_f *f = make_number (rep_NUMBER_FLOAT);
-	    f->f = ((double) rep_NUMBER (x,z)) / ((double) rep_NUMBER (y,z));
-	    out = rep_VAL (f);
+	    out = make_float (((double) rep_NUMBER (x,z))
+			      / ((double) rep_NUMBER (y,z)));
 	}
 #endif
 	break;
@@ -1602,7 +1710,7 @@ rep_number_div (repv x, repv y)
 #endif
     
     case rep_NUMBER_FLOAT:
-	rep_NUMBER (out,f) = rep_NUMBER (x,f) / rep_NUMBER (y,f);
+	out = make_float (rep_FLOAT (x) / rep_FLOAT (y));
 	break;
     }
     return out;
@@ -2071,7 +2179,7 @@ Return t if NUMBER is zero.
 #endif
 
 	case rep_NUMBER_FLOAT:
-	    return rep_NUMBER(num,f) == 0 ? Qt : Qnil;
+	    return rep_FLOAT (num) == 0 ? Qt : Qnil;
 	}
     }
     return Qnil;
@@ -2114,9 +2222,7 @@ Return NUMBER plus 1.
 #endif
 
     case rep_NUMBER_FLOAT:
-	num = dup (num);
-	rep_NUMBER (num,f) = rep_NUMBER (num,f) + 1;
-	return num;
+	return make_float (rep_FLOAT (num) + 1);
     }
     abort ();
 }
@@ -2158,9 +2264,7 @@ Return NUMBER minus 1.
 #endif
 
     case rep_NUMBER_FLOAT:
-	num = dup (num);
-	rep_NUMBER (num,f) = rep_NUMBER (num,f) - 1;
-	return num;
+	return make_float (rep_FLOAT (num) - 1);
     }
     abort ();
 }
@@ -2255,7 +2359,7 @@ NUMBER.
 #endif
 
     case rep_NUMBER_FLOAT:
-	return rep_make_float (floor (rep_NUMBER (arg,f)), rep_TRUE);
+	return rep_make_float (floor (rep_FLOAT (arg)), rep_TRUE);
     }
     abort ();
 }	
@@ -2281,7 +2385,7 @@ NUMBER.
 #endif
 
     case rep_NUMBER_FLOAT:
-	return rep_make_float (ceil (rep_NUMBER (arg,f)), rep_TRUE);
+	return rep_make_float (ceil (rep_FLOAT (arg)), rep_TRUE);
     }
     abort ();
 }
@@ -2308,7 +2412,7 @@ Round NUMBER to the nearest integer between NUMBER and zero.
 	    d = mpq_get_d (rep_NUMBER(arg,q));
 	else
 #endif
-	    d = rep_NUMBER(arg,f);
+	    d = rep_FLOAT (arg);
 	d = (d < 0.0) ? -floor (-d) : floor (d);
 #ifdef HAVE_GMP
         if (rep_NUMBER_RATIONAL_P (arg))
@@ -2343,7 +2447,7 @@ nearest even integer.
 	    d = mpq_get_d (rep_NUMBER(arg,q));
 	else
 #endif
-	    d = rep_NUMBER(arg,f);
+	    d = rep_FLOAT (arg);
 	/* from guile */
 	plus_half = d + 0.5;
 	result = floor (plus_half);
@@ -2611,7 +2715,7 @@ Return t if ARG is a integer.
 	return Qnil;
 
     case rep_NUMBER_FLOAT:
-	return (floor (rep_NUMBER(arg,f)) == rep_NUMBER(arg,f)) ? Qt : Qnil;
+	return (floor (rep_FLOAT (arg)) == rep_FLOAT (arg)) ? Qt : Qnil;
 
     default:
 	abort ();
@@ -3062,6 +3166,7 @@ rep_numbers_init (void)
     rep_register_type(rep_Number, "number", number_cmp,
 		      number_prin, number_prin,
 		      number_sweep, 0, 0, 0, 0, 0, 0, 0, 0);
+    rep_set_type_size (rep_Number, number_size);
 
     number_sizeofs[0] = sizeof (rep_number_z);
     number_sizeofs[1] = sizeof (rep_number_q);
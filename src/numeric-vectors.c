@@ -0,0 +1,686 @@
+/* numeric-vectors.c -- vectors of unboxed numbers
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
+
+/* A numeric vector holds its elements as a contiguous C array of a
+   single machine type, instead of one repv per element. Since it can't
+   refer to other objects the collector never needs to look inside it. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Element types, the order of kind_names[] and kind_sizes[] */
+enum { NV_F64, NV_F32, NV_S32, NV_U32, NV_U8, NV_KINDS };
+
+typedef struct numvec_struct {
+    repv car;
+    struct numvec_struct *next;
+    long len;
+    int kind;
+    union {
+	double f64[1];
+	float f32[1];
+	int32_t s32[1];
+	uint32_t u32[1];
+	uint8_t u8[1];
+    } data;
+} numvec;
+
+#define NUMVEC(v)	((numvec *) rep_PTR (v))
+
+/* A single element value, converted from Lisp */
+typedef union {
+    double f;
+    rep_long_long i;
+} numvec_elt;
+
+int rep_numvec_type;
+
+static numvec *numvec_chain;
+
+DEFSYM(f64, "f64");
+DEFSYM(f32, "f32");
+DEFSYM(s32, "s32");
+DEFSYM(u32, "u32");
+DEFSYM(u8, "u8");
+
+static repv *kind_names[NV_KINDS] = { &Qf64, &Qf32, &Qs32, &Qu32, &Qu8 };
+
+static const size_t kind_sizes[NV_KINDS] = {
+    sizeof (double), sizeof (float), sizeof (int32_t),
+    sizeof (uint32_t), sizeof (uint8_t)
+};
+
+#define FLOAT_KIND_P(k) ((k) == NV_F64 || (k) == NV_F32)
+
+static int
+symbol_kind (repv sym)
+{
+    int k;
+    for (k = 0; k < NV_KINDS; k++)
+    {
+	if (sym == *kind_names[k])
+	    return k;
+    }
+    return -1;
+}
+
+static repv
+make_numvec (int kind, long len)
+{
+    size_t size = offsetof (numvec, data) + len * kind_sizes[kind];
+    numvec *v = rep_ALLOC_CELL (size);
+    if (v == 0)
+	return rep_mem_error ();
+    v->car = rep_numvec_type;
+    v->len = len;
+    v->kind = kind;
+    v->next = numvec_chain;
+    numvec_chain = v;
+    rep_NOTE_ALLOC (rep_numvec_type, size);
+    return rep_VAL (v);
+}
+
+/* Convert X to an element of vector kind KIND, storing it in *OUT.
+   Returns false if X isn't a number that kind of vector can hold. */
+static rep_bool
+convert_elt (int kind, repv x, numvec_elt *out)
+{
+    rep_long_long n;
+    if (FLOAT_KIND_P (kind))
+    {
+	if (!rep_NUMERICP (x))
+	    return rep_FALSE;
+	out->f = rep_get_float (x);
+	return rep_TRUE;
+    }
+    if (!rep_INTEGERP (x))
+	return rep_FALSE;
+    n = rep_get_longlong_int (x);
+    if (!rep_INTP (x) && rep_compare_numbers (x, rep_make_longlong_int (n)))
+	/* a bignum too large to convert */
+	return rep_FALSE;
+    switch (kind)
+    {
+    case NV_S32:
+	if (n < INT32_MIN || n > INT32_MAX)
+	    return rep_FALSE;
+	break;
+
+    case NV_U32:
+	if (n < 0 || n > UINT32_MAX)
+	    return rep_FALSE;
+	break;
+
+    case NV_U8:
+	if (n < 0 || n > UINT8_MAX)
+	    return rep_FALSE;
+	break;
+    }
+    out->i = n;
+    return rep_TRUE;
+}
+
+static inline void
+store_elt (numvec *v, long i, numvec_elt *x)
+{
+    switch (v->kind)
+    {
+    case NV_F64: v->data.f64[i] = x->f; break;
+    case NV_F32: v->data.f32[i] = (float) x->f; break;
+    case NV_S32: v->data.s32[i] = (int32_t) x->i; break;
+    case NV_U32: v->data.u32[i] = (uint32_t) x->i; break;
+    case NV_U8: v->data.u8[i] = (uint8_t) x->i; break;
+    }
+}
+
+static inline repv
+fetch_elt (numvec *v, long i)
+{
+    switch (v->kind)
+    {
+    case NV_F64: return rep_make_float (v->data.f64[i], rep_TRUE);
+    case NV_F32: return rep_make_float (v->data.f32[i], rep_TRUE);
+    case NV_S32: return rep_make_long_int (v->data.s32[i]);
+    case NV_U32: return rep_make_long_uint (v->data.u32[i]);
+    case NV_U8: return rep_MAKE_INT (v->data.u8[i]);
+    }
+    abort ();
+}
+
+static inline double
+fetch_double (numvec *v, long i)
+{
+    switch (v->kind)
+    {
+    case NV_F64: return v->data.f64[i];
+    case NV_F32: return v->data.f32[i];
+    case NV_S32: return v->data.s32[i];
+    case NV_U32: return v->data.u32[i];
+    case NV_U8: return v->data.u8[i];
+    }
+    abort ();
+}
+
+/* Check the optional START and END arguments (numbers ARGN and ARGN+1)
+   against the length of V, storing the range they denote */
+static rep_bool
+get_range (numvec *v, repv start, repv end, int argn, long *s, long *e)
+{
+    *s = 0;
+    *e = v->len;
+    if (start != Qnil)
+    {
+	if (!rep_INTP (start) || rep_INT (start) < 0
+	    || rep_INT (start) > v->len)
+	{
+	    rep_signal_arg_error (start, argn);
+	    return rep_FALSE;
+	}
+	*s = rep_INT (start);
+    }
+    if (end != Qnil)
+    {
+	if (!rep_INTP (end) || rep_INT (end) < *s || rep_INT (end) > v->len)
+	{
+	    rep_signal_arg_error (end, argn + 1);
+	    return rep_FALSE;
+	}
+	*e = rep_INT (end);
+    }
+    return rep_TRUE;
+}
+
+
+/* Entry points for aref, aset, length and copy-sequence */
+
+long
+rep_numvec_length (repv vec)
+{
+    return NUMVEC (vec)->len;
+}
+
+repv
+rep_numvec_ref (repv vec, long i)
+{
+    return fetch_elt (NUMVEC (vec), i);
+}
+
+repv
+rep_numvec_set (repv vec, long i, repv x)
+{
+    numvec_elt elt;
+    if (!convert_elt (NUMVEC (vec)->kind, x, &elt))
+	return rep_signal_arg_error (x, 3);
+    store_elt (NUMVEC (vec), i, &elt);
+    return x;
+}
+
+repv
+rep_numvec_copy (repv vec, long start, long end)
+{
+    numvec *v = NUMVEC (vec);
+    repv new = make_numvec (v->kind, end - start);
+    if (new != rep_NULL)
+    {
+	size_t size = kind_sizes[v->kind];
+	memcpy (&NUMVEC (new)->data, ((char *) &v->data) + start * size,
+		(end - start) * size);
+    }
+    return new;
+}
+
+
+/* Lisp functions */
+
+DEFUN("make-numeric-vector", Fmake_numeric_vector, Smake_numeric_vector,
+      (repv type, repv len, repv init), rep_Subr3) /*
+::doc:rep.data#make-numeric-vector::
+make-numeric-vector TYPE LENGTH [INITIAL-VALUE]
+
+Return a new numeric vector of LENGTH elements of type TYPE, each set to
+INITIAL-VALUE, or zero. TYPE is one of the symbols `f64' (double
+precision floats), `f32' (single precision floats), `s32' (signed
+32-bit integers), `u32' (unsigned 32-bit integers) or `u8' (unsigned
+bytes).
+
+The elements are stored unboxed, so the vector takes little space and
+garbage collection never examines its contents. They're accessed by
+`aref' and `aset' like the elements of any other array.
+::end:: */
+{
+    int kind = symbol_kind (type);
+    repv vec;
+    numvec_elt elt;
+    long i;
+
+    if (kind < 0)
+	return rep_signal_arg_error (type, 1);
+    rep_DECLARE2 (len, rep_INTP);
+    if (rep_INT (len) < 0)
+	return rep_signal_arg_error (len, 2);
+    if (init == Qnil)
+	init = rep_MAKE_INT (0);
+    if (!convert_elt (kind, init, &elt))
+	return rep_signal_arg_error (init, 3);
+
+    vec = make_numvec (kind, rep_INT (len));
+    if (vec != rep_NULL)
+    {
+	for (i = 0; i < rep_INT (len); i++)
+	    store_elt (NUMVEC (vec), i, &elt);
+    }
+    return vec;
+}
+
+DEFUN("numeric-vector", Fnumeric_vector, Snumeric_vector,
+      (int argc, repv *argv), rep_SubrV) /*
+::doc:rep.data#numeric-vector::
+numeric-vector TYPE ARGS...
+
+Return a new numeric vector of type TYPE (see `make-numeric-vector')
+whose elements are the numbers ARGS.
+::end:: */
+{
+    int kind, i;
+    repv vec;
+
+    if (argc < 1)
+	return rep_signal_missing_arg (1);
+    kind = symbol_kind (argv[0]);
+    if (kind < 0)
+	return rep_signal_arg_error (argv[0], 1);
+
+    vec = make_numvec (kind, argc - 1);
+    for (i = 1; vec != rep_NULL && i < argc; i++)
+    {
+	numvec_elt elt;
+	if (!convert_elt (kind, argv[i], &elt))
+	    return rep_signal_arg_error (argv[i], i + 1);
+	store_elt (NUMVEC (vec), i - 1, &elt);
+    }
+    return vec;
+}
+
+DEFUN("numeric-vector-p", Fnumeric_vector_p, Snumeric_vector_p,
+      (repv arg), rep_Subr1) /*
+::doc:rep.data#numeric-vector-p::
+numeric-vector-p ARG
+
+Returns t when ARG is a numeric vector.
+::end:: */
+{
+    return rep_NUMVECP (arg) ? Qt : Qnil;
+}
+
+DEFUN("numeric-vector-type", Fnumeric_vector_type, Snumeric_vector_type,
+      (repv vec), rep_Subr1) /*
+::doc:rep.data#numeric-vector-type::
+numeric-vector-type VECTOR
+
+Returns the symbol naming the type of the elements of numeric vector
+VECTOR.
+::end:: */
+{
+    rep_DECLARE1 (vec, rep_NUMVECP);
+    return *kind_names[NUMVEC (vec)->kind];
+}
+
+DEFUN("numeric-vector-fill", Fnumeric_vector_fill, Snumeric_vector_fill,
+      (repv vec, repv x, repv start, repv end), rep_Subr4) /*
+::doc:rep.data#numeric-vector-fill::
+numeric-vector-fill VECTOR VALUE [START [END]]
+
+Set the elements of numeric vector VECTOR from index START (or zero) up
+to END (or the end of the vector) to VALUE. Returns VECTOR.
+::end:: */
+{
+    numvec *v;
+    numvec_elt elt;
+    long i, s, e;
+
+    rep_DECLARE1 (vec, rep_NUMVECP);
+    v = NUMVEC (vec);
+    if (!convert_elt (v->kind, x, &elt))
+	return rep_signal_arg_error (x, 2);
+    if (!get_range (v, start, end, 3, &s, &e))
+	return rep_NULL;
+
+    if (v->kind == NV_U8)
+	memset (v->data.u8 + s, (int) elt.i, e - s);
+    else
+    {
+	for (i = s; i < e; i++)
+	    store_elt (v, i, &elt);
+    }
+    return vec;
+}
+
+DEFUN("numeric-vector-copy", Fnumeric_vector_copy, Snumeric_vector_copy,
+      (repv vec, repv start, repv end), rep_Subr3) /*
+::doc:rep.data#numeric-vector-copy::
+numeric-vector-copy VECTOR [START [END]]
+
+Return a new numeric vector of the same type as VECTOR, containing its
+elements from index START (or zero) up to END (or the end of VECTOR).
+::end:: */
+{
+    long s, e;
+    rep_DECLARE1 (vec, rep_NUMVECP);
+    if (!get_range (NUMVEC (vec), start, end, 2, &s, &e))
+	return rep_NULL;
+    return rep_numvec_copy (vec, s, e);
+}
+
+DEFUN("numeric-vector-replace", Fnumeric_vector_replace,
+      Snumeric_vector_replace, (repv dst, repv dst_start, repv src,
+				repv start, repv end), rep_Subr5) /*
+::doc:rep.data#numeric-vector-replace::
+numeric-vector-replace DEST DEST-START SOURCE [START [END]]
+
+Copy the elements of numeric vector SOURCE from index START (or zero)
+up to END (or its end) into numeric vector DEST, starting at index
+DEST-START. The two vectors may be the same, and may be of different
+types as long as each element copied fits the type of DEST. Returns
+DEST.
+::end:: */
+{
+    numvec *d, *v;
+    long i, s, e, ds;
+
+    rep_DECLARE1 (dst, rep_NUMVECP);
+    rep_DECLARE2 (dst_start, rep_INTP);
+    rep_DECLARE3 (src, rep_NUMVECP);
+    d = NUMVEC (dst);
+    v = NUMVEC (src);
+    if (!get_range (v, start, end, 4, &s, &e))
+	return rep_NULL;
+    ds = rep_INT (dst_start);
+    if (ds < 0 || ds + (e - s) > d->len)
+	return rep_signal_arg_error (dst_start, 2);
+
+    if (d->kind == v->kind)
+    {
+	size_t size = kind_sizes[v->kind];
+	memmove (((char *) &d->data) + ds * size,
+		 ((char *) &v->data) + s * size, (e - s) * size);
+    }
+    else
+    {
+	for (i = s; i < e; i++)
+	{
+	    repv x = fetch_elt (v, i);
+	    numvec_elt elt;
+	    if (!convert_elt (d->kind, x, &elt))
+		return rep_signal_arg_error (x, 3);
+	    store_elt (d, ds + (i - s), &elt);
+	}
+    }
+    return dst;
+}
+
+/* Reduce elements S to E of V into ACC by OP, where P points to the
+   elements of the right type */
+#define REDUCE(acc, p, s, e, op)		\
+    do {					\
+	long i__;				\
+	for (i__ = (s); i__ < (e); i__++)	\
+	    acc op (p)[i__];			\
+    } while (0)
+
+DEFUN("numeric-vector-sum", Fnumeric_vector_sum, Snumeric_vector_sum,
+      (repv vec, repv start, repv end), rep_Subr3) /*
+::doc:rep.data#numeric-vector-sum::
+numeric-vector-sum VECTOR [START [END]]
+
+Return the sum of the elements of numeric vector VECTOR from index
+START (or zero) up to END (or its end). The sum of a floating point
+vector is inexact, that of an integer vector is exact.
+::end:: */
+{
+    numvec *v;
+    long s, e;
+    double f = 0;
+    rep_long_long n = 0;
+
+    rep_DECLARE1 (vec, rep_NUMVECP);
+    v = NUMVEC (vec);
+    if (!get_range (v, start, end, 2, &s, &e))
+	return rep_NULL;
+
+    switch (v->kind)
+    {
+    case NV_F64: REDUCE (f, v->data.f64, s, e, +=); break;
+    case NV_F32: REDUCE (f, v->data.f32, s, e, +=); break;
+    case NV_S32: REDUCE (n, v->data.s32, s, e, +=); break;
+    case NV_U32: REDUCE (n, v->data.u32, s, e, +=); break;
+    case NV_U8: REDUCE (n, v->data.u8, s, e, +=); break;
+    }
+    if (FLOAT_KIND_P (v->kind))
+	return rep_make_float (f, rep_TRUE);
+    else
+	return rep_make_longlong_int (n);
+}
+
+/* Return the index of the smallest (if SIGN is 1) or largest (if SIGN
+   is -1) element in the range S to E of V, which mustn't be empty */
+static long
+extreme_index (numvec *v, long s, long e, int sign)
+{
+    long i, best = s;
+
+#define EXTREME(p)				\
+    for (i = s + 1; i < e; i++)			\
+    {						\
+	if (sign > 0 ? (p)[i] < (p)[best]	\
+	    : (p)[i] > (p)[best])		\
+	    best = i;				\
+    }
+
+    switch (v->kind)
+    {
+    case NV_F64: EXTREME (v->data.f64); break;
+    case NV_F32: EXTREME (v->data.f32); break;
+    case NV_S32: EXTREME (v->data.s32); break;
+    case NV_U32: EXTREME (v->data.u32); break;
+    case NV_U8: EXTREME (v->data.u8); break;
+    }
+#undef EXTREME
+    return best;
+}
+
+DEFUN("numeric-vector-min", Fnumeric_vector_min, Snumeric_vector_min,
+      (repv vec, repv start, repv end), rep_Subr3) /*
+::doc:rep.data#numeric-vector-min::
+numeric-vector-min VECTOR [START [END]]
+
+Return the smallest element of numeric vector VECTOR from index START
+(or zero) up to END (or its end), or false if the range is empty.
+::end:: */
+{
+    long s, e;
+    rep_DECLARE1 (vec, rep_NUMVECP);
+    if (!get_range (NUMVEC (vec), start, end, 2, &s, &e))
+	return rep_NULL;
+    if (s == e)
+	return Qnil;
+    return fetch_elt (NUMVEC (vec), extreme_index (NUMVEC (vec), s, e, 1));
+}
+
+DEFUN("numeric-vector-max", Fnumeric_vector_max, Snumeric_vector_max,
+      (repv vec, repv start, repv end), rep_Subr3) /*
+::doc:rep.data#numeric-vector-max::
+numeric-vector-max VECTOR [START [END]]
+
+Return the largest element of numeric vector VECTOR from index START
+(or zero) up to END (or its end), or false if the range is empty.
+::end:: */
+{
+    long s, e;
+    rep_DECLARE1 (vec, rep_NUMVECP);
+    if (!get_range (NUMVEC (vec), start, end, 2, &s, &e))
+	return rep_NULL;
+    if (s == e)
+	return Qnil;
+    return fetch_elt (NUMVEC (vec), extreme_index (NUMVEC (vec), s, e, -1));
+}
+
+DEFUN("numeric-vector-dot", Fnumeric_vector_dot, Snumeric_vector_dot,
+      (repv v1, repv v2), rep_Subr2) /*
+::doc:rep.data#numeric-vector-dot::
+numeric-vector-dot VECTOR1 VECTOR2
+
+Return the dot product of the numeric vectors VECTOR1 and VECTOR2,
+which must have the same length. It's calculated in double precision
+floating point, so the result is always inexact.
+::end:: */
+{
+    numvec *a, *b;
+    double sum = 0;
+    long i;
+
+    rep_DECLARE1 (v1, rep_NUMVECP);
+    rep_DECLARE2 (v2, rep_NUMVECP);
+    a = NUMVEC (v1);
+    b = NUMVEC (v2);
+    if (a->len != b->len)
+	return rep_signal_arg_error (v2, 2);
+
+    if (a->kind == NV_F64 && b->kind == NV_F64)
+    {
+	double *x = a->data.f64, *y = b->data.f64;
+	for (i = 0; i < a->len; i++)
+	    sum += x[i] * y[i];
+    }
+    else if (a->kind == NV_F32 && b->kind == NV_F32)
+    {
+	float *x = a->data.f32, *y = b->data.f32;
+	for (i = 0; i < a->len; i++)
+	    sum += (double) x[i] * y[i];
+    }
+    else
+    {
+	for (i = 0; i < a->len; i++)
+	    sum += fetch_double (a, i) * fetch_double (b, i);
+    }
+    return rep_make_float (sum, rep_TRUE);
+}
+
+
+/* Type hooks */
+
+static int
+numvec_cmp (repv v1, repv v2)
+{
+    numvec *a, *b;
+    long i;
+
+    if (rep_TYPE (v1) != rep_TYPE (v2))
+	return 1;
+    a = NUMVEC (v1);
+    b = NUMVEC (v2);
+    if (a->kind != b->kind)
+	return a->kind - b->kind;
+    for (i = 0; i < a->len && i < b->len; i++)
+    {
+	double x = fetch_double (a, i), y = fetch_double (b, i);
+	if (x != y)
+	    return x < y ? -1 : 1;
+    }
+    return (a->len == b->len) ? 0 : (a->len < b->len) ? -1 : 1;
+}
+
+static void
+numvec_print (repv stream, repv vec)
+{
+    char buf[64];
+#ifdef HAVE_SNPRINTF
+    snprintf (buf, sizeof (buf), "#<%s-vector %ld>",
+	      rep_STR (rep_SYM (*kind_names[NUMVEC (vec)->kind])->name),
+	      NUMVEC (vec)->len);
+#else
+    sprintf (buf, "#<%s-vector %ld>",
+	     rep_STR (rep_SYM (*kind_names[NUMVEC (vec)->kind])->name),
+	     NUMVEC (vec)->len);
+#endif
+    rep_stream_puts (stream, buf, -1, rep_FALSE);
+}
+
+static unsigned long
+numvec_size (repv vec)
+{
+    return (offsetof (numvec, data)
+	    + NUMVEC (vec)->len * kind_sizes[NUMVEC (vec)->kind]);
+}
+
+static void
+numvec_sweep (void)
+{
+    numvec *v = numvec_chain;
+    numvec_chain = 0;
+    while (v != 0)
+    {
+	numvec *next = v->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (v)))
+	    rep_FREE_CELL (v);
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL (v));
+	    v->next = numvec_chain;
+	    numvec_chain = v;
+	}
+	v = next;
+    }
+}
+
+void
+rep_numeric_vectors_init (void)
+{
+    repv tem;
+
+    /* no mark function, so marking a vector never visits its elements */
+    rep_numvec_type = rep_register_new_type ("numeric-vector", numvec_cmp,
+					     numvec_print, numvec_print,
+					     numvec_sweep, 0, 0,
+					     0, 0, 0, 0, 0, 0);
+    rep_set_type_size (rep_numvec_type, numvec_size);
+    rep_INTERN (f64);
+    rep_INTERN (f32);
+    rep_INTERN (s32);
+    rep_INTERN (u32);
+    rep_INTERN (u8);
+
+    tem = rep_push_structure ("rep.data");
+    rep_ADD_SUBR (Smake_numeric_vector);
+    rep_ADD_SUBR (Snumeric_vector);
+    rep_ADD_SUBR (Snumeric_vector_p);
+    rep_ADD_SUBR (Snumeric_vector_type);
+    rep_ADD_SUBR (Snumeric_vector_fill);
+    rep_ADD_SUBR (Snumeric_vector_copy);
+    rep_ADD_SUBR (Snumeric_vector_replace);
+    rep_ADD_SUBR (Snumeric_vector_sum);
+    rep_ADD_SUBR (Snumeric_vector_min);
+    rep_ADD_SUBR (Snumeric_vector_max);
+    rep_ADD_SUBR (Snumeric_vector_dot);
+    rep_pop_structure (tem);
+}
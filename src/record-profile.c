@@ -25,7 +25,13 @@
    Hook into the interrupt-checking code to record the current
    backtrace statistics. Uses SIGPROF to tell the lisp system when it
    should interrupt (can't run the profiler off the signal itself,
-   since data would need to be allocated from the signal handler) */
+   since data would need to be allocated from the signal handler)
+
+   The allocation profiler is called from rep_SAMPLE_ALLOC each time
+   roughly a given number of bytes has been allocated, and records the
+   names of the functions on the call stack. Since the object being
+   allocated may not be initialised yet it can't allocate Lisp data,
+   so the samples are kept in malloc'd tables until they're fetched */
 
 #define _GNU_SOURCE
 
@@ -50,6 +56,9 @@ char *alloca ();
 #include "repint.h"
 #include <signal.h>
 #include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
 
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
@@ -158,6 +167,228 @@ test_interrupt (void)
 }
 
 
+/* allocation sampling */
+
+/* Each distinct function name seen, indexed by its id */
+struct alloc_name {
+    struct alloc_name *next;
+    unsigned long hash;
+    int id;
+    char name[1];
+};
+
+/* Each distinct call stack seen, FRAMES are name ids, outermost first */
+struct alloc_stack {
+    struct alloc_stack *next;
+    unsigned long hash;
+    unsigned long bytes, samples;
+    int depth;
+    int frames[1];
+};
+
+#define ALLOC_BUCKETS 1024
+
+static struct alloc_name *name_buckets[ALLOC_BUCKETS];
+static struct alloc_name **names;
+static int n_names, names_size;
+
+static struct alloc_stack *stack_buckets[ALLOC_BUCKETS];
+
+static int *frame_buf;
+static int frame_buf_size;
+
+static rep_bool alloc_profiling;
+static long alloc_interval = 512 * 1024;	/* bytes */
+static unsigned long alloc_random = 1;
+
+/* Intervals are spread evenly between half and one and a half times
+   ALLOC_INTERVAL, so that regular allocation patterns aren't always
+   sampled at the same point */
+static long
+next_alloc_interval (void)
+{
+    /* xorshift, so as not to disturb the state of `random' */
+    alloc_random ^= alloc_random << 13;
+    alloc_random ^= alloc_random >> 7;
+    alloc_random ^= alloc_random << 17;
+    return alloc_interval / 2 + (long) (alloc_random % alloc_interval) + 1;
+}
+
+static unsigned long
+hash_name (const char *name)
+{
+    unsigned long hash = 0;
+    while (*name != 0)
+	hash = hash * 33 + (unsigned char) *name++;
+    return hash;
+}
+
+static int
+name_id (const char *name)
+{
+    unsigned long hash = hash_name (name);
+    struct alloc_name **ptr = &name_buckets[hash % ALLOC_BUCKETS];
+    struct alloc_name *n;
+
+    for (n = *ptr; n != 0; n = n->next)
+    {
+	if (n->hash == hash && strcmp (n->name, name) == 0)
+	    return n->id;
+    }
+
+    if (n_names == names_size)
+    {
+	int new_size = names_size == 0 ? 256 : names_size * 2;
+	struct alloc_name **new_names
+	    = realloc (names, sizeof (struct alloc_name *) * new_size);
+	if (new_names == 0)
+	    return -1;
+	names = new_names;
+	names_size = new_size;
+    }
+    n = malloc (sizeof (struct alloc_name) + strlen (name));
+    if (n == 0)
+	return -1;
+    strcpy (n->name, name);
+    n->hash = hash;
+    n->id = n_names;
+    n->next = *ptr;
+    *ptr = n;
+    names[n_names++] = n;
+    return n->id;
+}
+
+static const char *
+frame_name (repv fun)
+{
+    repv name;
+    switch (rep_TYPE (fun))
+    {
+    case rep_Subr0: case rep_Subr1: case rep_Subr2: case rep_Subr3:
+    case rep_Subr4: case rep_Subr5: case rep_SubrN:
+	name = rep_XSUBR (fun)->name;
+	break;
+
+    case rep_Funarg:
+	name = rep_FUNARG (fun)->name;
+	break;
+
+    default:
+	return 0;
+    }
+    if (rep_SYMBOLP (name))
+	name = rep_SYM (name)->name;
+    return rep_STRINGP (name) ? rep_STR (name) : 0;
+}
+
+static void
+record_alloc_stack (int depth, unsigned long bytes)
+{
+    unsigned long hash = depth;
+    struct alloc_stack **ptr, *st;
+    int i;
+
+    for (i = 0; i < depth; i++)
+	hash = hash * 31 + frame_buf[i];
+    ptr = &stack_buckets[hash % ALLOC_BUCKETS];
+
+    for (st = *ptr; st != 0; st = st->next)
+    {
+	if (st->hash == hash && st->depth == depth
+	    && memcmp (st->frames, frame_buf, sizeof (int) * depth) == 0)
+	{
+	    goto found;
+	}
+    }
+
+    st = malloc (sizeof (struct alloc_stack) + sizeof (int) * depth);
+    if (st == 0)
+	return;
+    memcpy (st->frames, frame_buf, sizeof (int) * depth);
+    st->depth = depth;
+    st->hash = hash;
+    st->bytes = st->samples = 0;
+    st->next = *ptr;
+    *ptr = st;
+
+found:
+    st->bytes += bytes;
+    st->samples++;
+}
+
+/* Called through rep_alloc_sample_fun, after at least the current
+   interval has been allocated. Each interval passed is counted as an
+   estimate of ALLOC_INTERVAL bytes allocated by the current stack. */
+static void
+sample_allocation (void)
+{
+    unsigned long bytes = 0;
+    struct rep_Call *c;
+    int depth = 0, i;
+
+    while (rep_alloc_sample_countdown < 0)
+    {
+	bytes += alloc_interval;
+	rep_alloc_sample_countdown += next_alloc_interval ();
+    }
+
+    for (c = rep_call_stack; c != 0 && c->fun != Qnil; c = c->next)
+    {
+	const char *name = frame_name (c->fun);
+	int id;
+	if (name == 0)
+	    continue;
+	id = name_id (name);
+	if (id < 0)
+	    return;
+	if (depth == frame_buf_size)
+	{
+	    int new_size = frame_buf_size == 0 ? 64 : frame_buf_size * 2;
+	    int *new_buf = realloc (frame_buf, sizeof (int) * new_size);
+	    if (new_buf == 0)
+		return;
+	    frame_buf = new_buf;
+	    frame_buf_size = new_size;
+	}
+	frame_buf[depth++] = id;
+    }
+
+    /* innermost first to outermost first */
+    for (i = 0; i < depth / 2; i++)
+    {
+	int tem = frame_buf[i];
+	frame_buf[i] = frame_buf[depth - i - 1];
+	frame_buf[depth - i - 1] = tem;
+    }
+
+    record_alloc_stack (depth, bytes);
+}
+
+static void
+free_alloc_profile (void)
+{
+    int i;
+    for (i = 0; i < ALLOC_BUCKETS; i++)
+    {
+	struct alloc_stack *st, *next_st;
+	struct alloc_name *n, *next_n;
+	for (st = stack_buckets[i]; st != 0; st = next_st)
+	{
+	    next_st = st->next;
+	    free (st);
+	}
+	for (n = name_buckets[i]; n != 0; n = next_n)
+	{
+	    next_n = n->next;
+	    free (n);
+	}
+	stack_buckets[i] = 0;
+	name_buckets[i] = 0;
+    }
+    n_names = 0;
+}
+
+
 /* interface */
 
 DEFUN ("start-profiler", Fstart_profiler, Sstart_profiler, (void), rep_Subr0)
@@ -189,6 +420,90 @@ DEFUN ("profile-interval", Fprofile_interval,
     return ret;
 }
 
+DEFUN ("start-allocation-profiler", Fstart_allocation_profiler,
+       Sstart_allocation_profiler, (repv interval), rep_Subr1) /*
+::doc:rep.lang.record-profile#start-allocation-profiler::
+start-allocation-profiler [INTERVAL]
+
+Discard any previous allocation profile, then start sampling the call
+stack each time roughly INTERVAL bytes (by default 512 kilobytes) of
+Lisp data have been allocated.
+::end:: */
+{
+    if (rep_INTP (interval) && rep_INT (interval) > 0)
+	alloc_interval = rep_INT (interval);
+    free_alloc_profile ();
+    alloc_profiling = rep_TRUE;
+    rep_alloc_sample_fun = sample_allocation;
+    rep_alloc_sample_countdown = next_alloc_interval ();
+    return Qt;
+}
+
+DEFUN ("stop-allocation-profiler", Fstop_allocation_profiler,
+       Sstop_allocation_profiler, (void), rep_Subr0) /*
+::doc:rep.lang.record-profile#stop-allocation-profiler::
+stop-allocation-profiler
+
+Stop sampling allocations, the samples recorded so far are kept.
+::end:: */
+{
+    alloc_profiling = rep_FALSE;
+    rep_alloc_sample_fun = 0;
+    rep_alloc_sample_countdown = LONG_MAX;
+    return Qt;
+}
+
+DEFUN ("fetch-allocation-profile", Ffetch_allocation_profile,
+       Sfetch_allocation_profile, (void), rep_Subr0) /*
+::doc:rep.lang.record-profile#fetch-allocation-profile::
+fetch-allocation-profile
+
+Return a list `((STACK BYTES SAMPLES) ...)' with an entry for each
+distinct call stack seen by the allocation profiler. STACK is the list
+of names of the functions called, outermost first, BYTES the estimated
+number of bytes they allocated and SAMPLES the number of times the
+stack was sampled.
+::end:: */
+{
+    repv *syms, out = Qnil;
+    int n = n_names, i;
+
+    /* the samples taken while this allocates may add names and
+       stacks, ids from N onwards are ignored */
+    syms = alloca (sizeof (repv) * (n + 1));
+    for (i = 0; i < n; i++)
+	syms[i] = Fintern (rep_string_dup (names[i]->name), Qnil);
+
+    for (i = 0; i < ALLOC_BUCKETS; i++)
+    {
+	struct alloc_stack *st;
+	for (st = stack_buckets[i]; st != 0; st = st->next)
+	{
+	    repv stack = Qnil;
+	    int j;
+	    for (j = st->depth - 1; j >= 0; j--)
+	    {
+		if (st->frames[j] < n)
+		    stack = Fcons (syms[st->frames[j]], stack);
+	    }
+	    out = Fcons (rep_list_3 (stack, rep_make_long_uint (st->bytes),
+				     rep_make_long_uint (st->samples)), out);
+	}
+    }
+    return out;
+}
+
+DEFUN ("allocation-profiling-p", Fallocation_profiling_p,
+       Sallocation_profiling_p, (void), rep_Subr0) /*
+::doc:rep.lang.record-profile#allocation-profiling-p::
+allocation-profiling-p
+
+Return true if the allocation profiler is running.
+::end:: */
+{
+    return alloc_profiling ? Qt : Qnil;
+}
+
 
 /* init */
 
@@ -201,6 +516,10 @@ rep_dl_init (void)
     rep_ADD_SUBR (Sstop_profiler);
     rep_ADD_SUBR (Sfetch_profile);
     rep_ADD_SUBR (Sprofile_interval);
+    rep_ADD_SUBR (Sstart_allocation_profiler);
+    rep_ADD_SUBR (Sstop_allocation_profiler);
+    rep_ADD_SUBR (Sfetch_allocation_profile);
+    rep_ADD_SUBR (Sallocation_profiling_p);
     rep_mark_static (&profile_table);
 
 #ifdef HAVE_SETITIMER
@@ -42,7 +42,7 @@ digest_to_repv (char digest[16])
     for (i = 0; i < 16; i++)
     {
 	hex_digest[i*2] = hex_digits[digest[i] & 15];
-	hex_digest[i*2+1] = hex_digits[digest[i] >> 4];
+	hex_digest[i*2+1] = hex_digits[(digest[i] >> 4) & 15];
     }
 
     return rep_parse_number (hex_digest, 32, 16, 1, 0);
@@ -53,15 +53,20 @@ DEFUN ("md5-string", Fmd5_string, Smd5_string, (repv data), rep_Subr1) /*
 md5-string STRING
 
 Return the integer representing the MD5 message digest of the bytes
-stored in STRING. This integer will have no more than 128 significant
-bits.
+stored in STRING (a string or bytevector). This integer will have no
+more than 128 significant bits.
 ::end:: */
 {
     char digest[16];
 
-    rep_DECLARE1 (data, rep_STRINGP);
-
-    md5_buffer (rep_STR (data), rep_STRING_LEN (data), digest);
+    if (rep_BYTEVECTORP (data))
+	md5_buffer (rep_bytevector_data (data),
+		    rep_bytevector_length (data), digest);
+    else
+    {
+	rep_DECLARE1 (data, rep_STRINGP);
+	md5_buffer (rep_STR (data), rep_STRING_LEN (data), digest);
+    }
 
     return digest_to_repv (digest);
 }
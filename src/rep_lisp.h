@@ -54,15 +54,20 @@ typedef unsigned rep_PTR_SIZED_INT repv;
    except during GC. If bit one is set the object is a 30-bit signed
    integer, with the data bits stored in the pointer as bits 2->31.
 
-   Otherwise (i.e. bit 1 of the pointer is clear), the value is a
-   pointer to a "cell"; all objects other than integers are represented
-   by various types of cells. Every cell has a repv as its first
+   On hosts with 64-bit pointers, if bit one is clear and bit two set
+   the value is an immediate floating point number, the other bits
+   holding a double whose exponent is in the common range (see
+   numbers.c). Floats that don't fit are allocated as cells.
+
+   Otherwise (the lowest bits are all zero), the value is a pointer to
+   a "cell"; all objects other than integers and immediate floats are
+   represented by various types of cells. Every cell has a repv as its first
    element (called the car), the lowest bits of this define the actual
    type of the cell.
 
    If bit zero of the car is unset, the cell is a cons, a pair of two
-   values the car and the cdr (the GC mark bit of the cons is bit zero
-   of the cdr).
+   values the car and the cdr (the GC mark bit of the cons is kept in
+   a bitmap in the header of the block containing the cell).
 
    If bit zero of the car is set, then further type information is
    stored in bits 1->5 of the car, with bit 5 used to denote statically
@@ -78,7 +83,6 @@ typedef unsigned rep_PTR_SIZED_INT repv;
    CC, we'll use the alignment attribute. Otherwise the rep_ALIGN macro
    needs setting.. */
 
-#define rep_VALUE_CONS_MARK_BIT	1
 #define rep_VALUE_IS_INT	2
 #define rep_VALUE_INT_SHIFT	2
 #define rep_CELL_ALIGNMENT	rep_PTR_SIZED_INT_SIZEOF
@@ -115,11 +119,26 @@ typedef unsigned rep_PTR_SIZED_INT repv;
 # define rep_ALIGN_CELL(d) d
 #endif
 
+#if rep_PTR_SIZED_INT_SIZEOF == 8
+  /* With eight-byte cell alignment bit 2 of a cell pointer is always
+     clear, so values with bits 0-2 set to 100 are free for immediate
+     floating point numbers (see numbers.c) */
+# define rep_VALUE_IS_FLONUM	4
+# define rep_VALUE_TAG_MASK	(rep_VALUE_IS_INT | rep_VALUE_IS_FLONUM)
+
 /* Is repv V a cell type? */
-#define rep_CELLP(v)		(((v) & rep_VALUE_IS_INT) == 0)
+# define rep_CELLP(v)		(((v) & rep_VALUE_TAG_MASK) == 0)
+
+/* Is repv V an immediate float? */
+# define rep_FLONUMP(v)		(((v) & rep_VALUE_TAG_MASK) \
+				 == rep_VALUE_IS_FLONUM)
+#else
+# define rep_CELLP(v)		(((v) & rep_VALUE_IS_INT) == 0)
+# define rep_FLONUMP(v)		0
+#endif
 
 /* Is repv V a fixnum (= an integer which fits in a Lisp poniter)? */
-#define rep_INTP(v)		(!rep_CELLP(v))
+#define rep_INTP(v)		(((v) & rep_VALUE_IS_INT) != 0)
 
 /* Convert a repv into a signed integer. */
 #define rep_INT(v)		(((rep_PTR_SIZED_INT)(v)) \
@@ -209,7 +228,7 @@ typedef struct {
 
 typedef struct {
     repv car;
-    repv cdr;				/* low bit is GC mark */
+    repv cdr;
 } rep_cons;
 
 #define rep_CONSP(v)	(rep_CELLP(v) && rep_CELL_CONS_P(v))
@@ -226,7 +245,7 @@ typedef struct {
 #define rep_CDRLOC(v)	(&(rep_CONS(v)->cdr))
 
 /* Get the cdr when GC is in progress. */
-#define rep_GCDR(v)	(rep_CDR(v) & ~rep_VALUE_CONS_MARK_BIT)
+#define rep_GCDR(v)	rep_CDR(v)
 
 /* True if cons cell V is mutable (i.e. not read-only). */
 #define rep_CONS_WRITABLE_P(v) \
@@ -278,6 +297,16 @@ typedef struct rep_type_struct {
     /* When non-null, a function to ``unbind'' OBJ, the result of
        the earlier bind call. */
     void (*unbind)(repv obj);
+
+    /* When non-null, a version of the mark function that may be
+       called by several threads at once, i.e. one that only reads OBJ
+       and marks what it refers to using rep_MARKVAL. Set by
+       rep_set_parallel_mark. */
+    void (*mark_parallel)(repv obj);
+
+    /* When non-null, returns the number of bytes of memory OBJ takes,
+       including any storage it owns. Set by rep_set_type_size. */
+    unsigned long (*size)(repv obj);
 } rep_type;
 
 /* Each type of Lisp object has a type code associated with it.
@@ -310,7 +339,9 @@ typedef struct rep_type_struct {
 			  : rep_CELL16_TYPE(v))
 
 /* Return a type code given a repv */
-#define rep_TYPE(v)	(rep_INTP(v) ? rep_Int : rep_CELL_TYPE(v))
+#define rep_TYPE(v)	(rep_INTP(v) ? rep_Int			\
+			 : rep_FLONUMP(v) ? rep_Number		\
+			 : rep_CELL_TYPE(v))
 
 /* true if V is of type T (T must be a cell8 type) */
 #define rep_CELL8_TYPEP(v, t) \
@@ -336,7 +367,8 @@ typedef struct {
 /* Numbers (private defs in numbers.c) */
 
 /* Is V a non-fixnum number? */
-#define rep_NUMBERP(v)		rep_CELL8_TYPEP(v, rep_Number)
+#define rep_NUMBERP(v)		(rep_FLONUMP(v) \
+				 || rep_CELL8_TYPEP(v, rep_Number))
 
 /* Is V numeric? */
 #define rep_NUMERICP(v)		(rep_INTP(v) || rep_NUMBERP(v))
@@ -350,7 +382,8 @@ typedef rep_cell rep_number;
 #define rep_NUMBER_RATIONAL	0x200
 #define rep_NUMBER_FLOAT	0x400
 
-#define rep_NUMBER_TYPE(v)	(((rep_number *)rep_PTR(v))->car & 0x700)
+#define rep_NUMBER_TYPE(v)	(rep_FLONUMP(v) ? rep_NUMBER_FLOAT \
+				 : ((rep_number *)rep_PTR(v))->car & 0x700)
 #define rep_NUMBER_BIGNUM_P(v)	(rep_NUMBER_TYPE(v) & rep_NUMBER_BIGNUM)
 #define rep_NUMBER_RATIONAL_P(v) (rep_NUMBER_TYPE(v) & rep_NUMBER_RATIONAL)
 #define rep_NUMBER_FLOAT_P(v)	(rep_NUMBER_TYPE(v) & rep_NUMBER_FLOAT)
@@ -365,9 +398,11 @@ typedef rep_cell rep_number;
 /* Strings */
 
 typedef struct rep_string_struct {
-    /* Bits 0->7 are standard cell8 defines. Bits 8->31 store the length
-       of the string. This means that strings can't contain more than
-       2^24-1 bytes (thats about 16.7MB) */
+    /* Bits 0->7 are standard cell8 defines. The remaining bits store
+       the length of the string, unless they're all set: then it's a
+       large string, whose length is in the word preceding its
+       characters. Only strings longer than 2^24-2 bytes (about 16.7MB)
+       on 32-bit hosts need to be large. */
     repv car;
 
     /* Pointer to the (zero-terminated) characters */
@@ -375,13 +410,25 @@ typedef struct rep_string_struct {
 } rep_string;
 
 #define rep_STRING_LEN_SHIFT	8
-#define rep_MAX_STRING \
+#define rep_STRING_LARGE_LEN \
     ((rep_VALUE_CONST(1) << (rep_VALUE_BITS - rep_STRING_LEN_SHIFT)) - 1)
+#define rep_MAX_SHORT_STRING	(rep_STRING_LARGE_LEN - 1)
+#define rep_MAX_STRING		((long) (~(repv) 0 >> 1))
+
+/* The number of bytes allocated before the characters of a large
+   string, ending with its length */
+#define rep_LARGE_STRING_PREFIX	sizeof (rep_long_long)
 
 #define rep_STRINGP(v)		rep_CELL8_TYPEP(v, rep_String)
 #define rep_STRING(v)		((rep_string *) rep_PTR(v))
 
-#define rep_STRING_LEN(v)	(rep_STRING(v)->car >> rep_STRING_LEN_SHIFT)
+#define rep_STRING_LEN_FIELD(v)	(rep_STRING(v)->car >> rep_STRING_LEN_SHIFT)
+#define rep_STRING_LARGE_P(v)	(rep_STRING_LEN_FIELD(v) == rep_STRING_LARGE_LEN)
+#define rep_LARGE_STRING_LEN(v)	(((long *) rep_STR(v))[-1])
+
+#define rep_STRING_LEN(v)				\
+    (rep_STRING_LARGE_P(v) ? rep_LARGE_STRING_LEN(v)	\
+     : (long) rep_STRING_LEN_FIELD(v))
 
 #define rep_MAKE_STRING_CAR(len) (((len) << rep_STRING_LEN_SHIFT) | rep_String)
 
@@ -673,10 +720,48 @@ typedef struct rep_funarg_struct {
 #define rep_GC_SET_CELL(v)	(rep_PTR(v)->car |= rep_CELL_MARK_BIT)
 #define rep_GC_CLR_CELL(v)	(rep_PTR(v)->car &= ~rep_CELL_MARK_BIT)
 
+/* Cons cells are allocated in blocks of rep_CONSBLK_BYTES, aligned to
+   their size, so that the header of the block containing any cell may
+   be found by masking its address. The header holds one bit per
+   cell-sized slot of the block in each of its bitmaps. */
+#define rep_CONSBLK_BYTES	16384
+#define rep_CONSBLK_SLOTS	(rep_CONSBLK_BYTES / sizeof (rep_cons))
+#define rep_CONSBLK_WORD_BITS	(sizeof (unsigned long) * 8)
+#define rep_CONSBLK_MAP_WORDS	(rep_CONSBLK_SLOTS / rep_CONSBLK_WORD_BITS)
+
+typedef struct rep_cons_block_struct rep_cons_block;
+
+typedef struct {
+    rep_cons_block *next;		/* in rep_cons_block_chain */
+    rep_cons_block *alloc_next;		/* in free or nursery list */
+    rep_cons *freelist;			/* free cells not yet in use */
+    int used;				/* live cells after last sweep */
+    unsigned long mark[rep_CONSBLK_MAP_WORDS];
+    unsigned long remembered[rep_CONSBLK_MAP_WORDS];
+} rep_cons_block_header;
+
+#define rep_CONSBLK_SIZE \
+    ((rep_CONSBLK_BYTES - sizeof (rep_cons_block_header)) / sizeof (rep_cons))
+
+struct rep_cons_block_struct {
+    rep_cons_block_header h;
+    rep_cons cons[rep_CONSBLK_SIZE];
+};
+
+/* The block containing cons V, and the bitmap word and bit of V */
+#define rep_CONS_BLOCK(v) \
+    ((rep_cons_block *) ((v) & ~(repv) (rep_CONSBLK_BYTES - 1)))
+#define rep_CONS_SLOT(v) \
+    (((v) & (rep_CONSBLK_BYTES - 1)) / sizeof (rep_cons))
+#define rep_CONS_MAP_WORD(map, v) \
+    (rep_CONS_BLOCK(v)->h.map[rep_CONS_SLOT(v) / rep_CONSBLK_WORD_BITS])
+#define rep_CONS_MAP_BIT(v) \
+    (1UL << (rep_CONS_SLOT(v) % rep_CONSBLK_WORD_BITS))
+
 /* gc macros for cons values */
-#define rep_GC_CONS_MARKEDP(v)	(rep_CDR(v) & rep_VALUE_CONS_MARK_BIT)
-#define rep_GC_SET_CONS(v)	(rep_CDR(v) |= rep_VALUE_CONS_MARK_BIT)
-#define rep_GC_CLR_CONS(v)	(rep_CDR(v) &= ~rep_VALUE_CONS_MARK_BIT)
+#define rep_GC_CONS_MARKEDP(v)	(rep_CONS_MAP_WORD(mark, v) & rep_CONS_MAP_BIT(v))
+#define rep_GC_SET_CONS(v)	(rep_CONS_MAP_WORD(mark, v) |= rep_CONS_MAP_BIT(v))
+#define rep_GC_CLR_CONS(v)	(rep_CONS_MAP_WORD(mark, v) &= ~rep_CONS_MAP_BIT(v))
 
 /* True when cell V has been marked. */
 #define rep_GC_MARKEDP(v) \
@@ -685,7 +770,7 @@ typedef struct rep_funarg_struct {
 /* Set the mark bit of cell V. */
 #define rep_GC_SET(v)		\
     do {			\
-	if(rep_CELLP(v))	\
+	if(!rep_CELL_CONS_P(v))	\
 	    rep_GC_SET_CELL(v);	\
 	else			\
 	    rep_GC_SET_CONS(v);	\
@@ -694,7 +779,7 @@ typedef struct rep_funarg_struct {
 /* Clear the mark bit of cell V. */
 #define rep_GC_CLR(v)		\
     do {			\
-	if(rep_CELLP(v))	\
+	if(!rep_CELL_CONS_P(v))	\
 	    rep_GC_CLR_CELL(v);	\
 	else			\
 	    rep_GC_CLR_CONS(v);	\
@@ -703,10 +788,84 @@ typedef struct rep_funarg_struct {
 /* Recursively mark object V. */
 #define rep_MARKVAL(v)						\
     do {							\
-	if(v != 0 && !rep_INTP(v) && !rep_GC_MARKEDP(v))	\
+	if(v != 0 && rep_CELLP(v) && !rep_GC_MARKEDP(v))	\
 	    rep_mark_value(v);					\
     } while(0)
 
+/* Objects of each type allocated since the last collection, and the
+   bytes they took (see gc-statistics). Indexed by rep_TYPE_SLOT of the
+   type code; cons cells are counted separately. */
+typedef struct {
+    unsigned long count, bytes;
+} rep_alloc_stats;
+
+#define rep_TYPE_SLOTS (32 + 256)
+#define rep_TYPE_SLOT(code)						\
+    (((code) & rep_CELL_IS_16)						\
+     ? 32 + (((code) >> rep_CELL16_TYPE_SHIFT) & 255) : (code) & 31)
+
+/* Count N bytes towards the next allocation sample. The sampler
+   mustn't allocate Lisp data, since the new object may not be
+   initialised yet. */
+#define rep_SAMPLE_ALLOC(n)						\
+    do {								\
+	if ((rep_alloc_sample_countdown -= (n)) < 0)			\
+	    rep_alloc_sample ();					\
+    } while (0)
+
+/* Account for a new object of type TYPE, taking N bytes. Counts
+   towards the garbage-threshold. */
+#define rep_NOTE_ALLOC(type, n)						\
+    do {								\
+	rep_alloc_stats *s__ = &rep_type_allocs[rep_TYPE_SLOT(type)];	\
+	s__->count++;							\
+	s__->bytes += (n);						\
+	rep_data_after_gc += (n);					\
+	rep_SAMPLE_ALLOC (n);						\
+    } while (0)
+
+/* Account for N bytes more storage used by an object of type TYPE */
+#define rep_NOTE_ALLOC_BYTES(type, n)					\
+    do {								\
+	rep_type_allocs[rep_TYPE_SLOT(type)].bytes += (n);		\
+	rep_data_after_gc += (n);					\
+	rep_SAMPLE_ALLOC (n);						\
+    } while (0)
+
+/* When generational collection is enabled, cons cells that survive a
+   collection aren't examined again until the next full collection, and
+   while an incremental collection is marking, cells already marked
+   aren't examined again. So after storing into either half of a cons
+   cell that may be older than the value stored, call this macro.
+   (Storing fixnums or interned symbols, or into a cell allocated since
+   the last possible garbage collection, doesn't require it.) */
+#define rep_CONS_BARRIER(v)					\
+    do {							\
+	if (rep_gc_barrier_active && rep_GC_CONS_MARKEDP(v))	\
+	    rep_gc_remember_cons (v);				\
+    } while (0)
+
+/* Similar, but LOC points to the car or cdr of a cons cell, or is
+   the address of the variable HEAD (i.e. a list being built by
+   storing through a tail pointer). */
+#define rep_CONS_LOC_BARRIER(loc, head)				\
+    do {							\
+	if ((loc) != &(head))					\
+	    rep_CONS_BARRIER (rep_VAL (loc)			\
+			      & ~(repv) (sizeof (rep_cons) - 1));	\
+    } while (0)
+
+/* While an incremental collection is marking, objects other than cons
+   cells aren't examined again once they've been marked, if their type
+   has a write barrier (see rep_set_write_barrier). After storing X into
+   such an object V that existed before the last point at which a
+   collection could have run, call this macro. */
+#define rep_OBJECT_BARRIER(v, x)				\
+    do {							\
+	if (rep_gc_marking && rep_GC_CELL_MARKEDP(v))		\
+	    rep_gc_remember_object (v, x);			\
+    } while (0)
+
 /* A stack of dynamic GC roots, i.e. objects to start marking from.  */
 typedef struct rep_gc_root {
     repv *ptr;
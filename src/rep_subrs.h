@@ -541,10 +541,15 @@ extern unsigned int rep_register_new_type(char *name,
 				   repv (*bind)(repv),
 				   void (*unbind)(repv));
 extern rep_type *rep_get_data_type(unsigned int code);
+extern void rep_set_parallel_mark (unsigned int code, void (*mark)(repv));
+extern void rep_set_write_barrier (unsigned int code);
+extern void rep_set_type_size (unsigned int code,
+			       unsigned long (*size)(repv));
 extern int rep_value_cmp(repv, repv);
 extern void rep_princ_val(repv, repv);
 extern void rep_print_val(repv, repv);
 extern repv rep_null_string(void);
+extern long rep_max_short_string;
 extern repv rep_box_string (char *ptr, long len);
 extern repv rep_make_string(long);
 extern repv rep_string_dupn(const char *, long);
@@ -570,8 +575,16 @@ extern rep_GC_n_roots *rep_gc_n_roots_stack;
 extern repv Vgarbage_threshold(repv val);
 extern repv Vidle_garbage_threshold(repv val);
 extern repv Fgarbage_collect(repv noStats);
+extern void rep_auto_gc (void);
+extern void rep_gc_remember_cons (repv cell);
+extern void rep_gc_remember_object (repv v, repv x);
 extern int rep_data_after_gc, rep_gc_threshold, rep_idle_gc_threshold;
-extern rep_bool rep_in_gc;
+extern rep_alloc_stats rep_type_allocs[rep_TYPE_SLOTS];
+extern long rep_alloc_sample_countdown;
+extern void (*rep_alloc_sample_fun)(void);
+extern void rep_alloc_sample (void);
+extern rep_bool rep_in_gc, rep_gc_generational, rep_gc_marking;
+extern rep_bool rep_gc_barrier_active;
 
 #ifdef rep_HAVE_UNIX
 
@@ -63,7 +63,7 @@ gdbm-open PATH ACCESS-TYPE [MODE] [FLAGS]
     dbm = rep_ALLOC_CELL (sizeof (rep_dbm));
     if (dbm == 0)
 	return rep_mem_error();
-    rep_data_after_gc += sizeof (rep_dbm);
+    rep_NOTE_ALLOC (dbm_type, sizeof (rep_dbm));
     dbm->car = dbm_type;
     dbm->path = file;
     dbm->access = type;
@@ -139,6 +139,10 @@ struct rep_struct_struct {
     /* Bytecode interpreter to use when calling functions defined here.
        If null, call rep_apply_bytecode  */
     repv (*apply_bytecode) (repv subr, int nargs, repv *args);
+
+    /* Changed whenever looking up a variable here could find a
+       different node. Never shared with another structure. */
+    unsigned long epoch;
 };
 
 extern int rep_structure_type;
@@ -157,8 +161,82 @@ extern int rep_structure_type;
 
 #define rep_SPECIAL_ENV   (rep_STRUCTURE(rep_structure)->special_env)
 
+/* Inline caches of global variable lookups by compiled code. The
+   vector of a compiled function is followed by one of these for each
+   of its constants, the node is only valid while EPOCH is the same as
+   the epoch of the current structure. */
+typedef struct rep_inline_cache_struct {
+    unsigned long epoch;
+    rep_struct_node *node;
+} rep_inline_cache;
+
+/* Native code translated from the byte-code of a compiled function
+   (see jit.c) */
+typedef struct rep_jit_code_struct {
+    unsigned char *code;
+    size_t size;			/* of the mapping at CODE */
+    int length;				/* of the byte-code */
+
+    /* For each byte-code offset, the offset into CODE of the native
+       code for the instruction there, or zero if it's not worth
+       entering the native code at that instruction */
+    unsigned int entries[1];
+} rep_jit_code;
+
+/* The state of the VM shared with native code while it runs */
+typedef struct rep_jit_frame_struct {
+    repv *stackp;
+    repv *stack;
+    repv *slots;
+    repv *consts;
+    int *gc_count;
+} rep_jit_frame;
+
+/* Per-function data following the vector of a compiled function: the
+   inline caches, the VM's private (quickened) copy of its code once
+   HITS has grown large enough, and its native code once JIT_HITS
+   has. VERIFIED is zero until the code has been verified, then one
+   plus the number of entries the environment must have for it to run
+   unchecked, minus one if it never may (see verify.c). */
+typedef struct rep_inline_caches_struct {
+    long count;
+    unsigned long hits;
+    unsigned char *quick;
+    unsigned long jit_hits;
+    rep_jit_code *jit;
+    int verified;
+    rep_inline_cache cache[1];
+} rep_inline_caches;
+
+#define rep_COMPILED_CACHES(v) \
+    ((rep_inline_caches *) &rep_VECT(v)->array[rep_VECT_LEN(v)])
+
+/* Numeric vectors (private defs in numeric-vectors.c) */
+
+extern int rep_numvec_type;
+
+#define rep_NUMVECP(v) rep_CELL16_TYPEP(v, rep_numvec_type)
+
+/* Element type names, also used by bytevectors.c */
+extern repv Qf64, Qf32, Qs32, Qu32, Qu8;
+
+/* Bytevectors (private defs in bytevectors.c) */
+
+extern int rep_bytevector_type;
+
+#define rep_BYTEVECTORP(v) rep_CELL16_TYPEP(v, rep_bytevector_type)
+
 #define rep_STRUCT_HASH(x,n) (((x) >> 3) % (n))
 
+/* Called for each object found while walking the heap (see
+   rep_visit_children) */
+typedef void rep_heap_visitor (repv obj, void *data);
+
+/* True if the binding value V is a reference into a heap image that
+   hasn't been loaded yet (see images.c). No Lisp value has its low bit
+   set, and the garbage collector ignores these values. */
+#define rep_IMAGE_PENDING_P(v) (((v) & 1) != 0)
+
 
 /* binding tracking */
 
@@ -220,22 +298,6 @@ typedef struct rep_guardian_struct {
 } rep_guardian;
 
 
-/* cons' */
-
-#define rep_CONSBLK_SIZE	1022		/* ~8k */
-
-/* Structure of cons allocation blocks */
-typedef struct rep_cons_block_struct {
-    union {
-	struct rep_cons_block_struct *p;
-	/* ensure that the following cons cell is aligned to at
-	   least sizeof (rep_cons) (for the dcache) */
-	rep_cons dummy;
-    } next;
-    rep_cons cons[rep_CONSBLK_SIZE];
-} rep_cons_block;
-
-
 /* prototypes */
 
 #include "repint_subrs.h"
@@ -254,6 +316,7 @@ inline_Fcons (repv x, repv y)
     rep_cons_freelist = rep_CONS (c->cdr);
     rep_used_cons++;
     rep_data_after_gc += sizeof(rep_cons);
+    rep_SAMPLE_ALLOC (sizeof(rep_cons));
 
     c->car = (x);
     c->cdr = (y);
@@ -22,13 +22,43 @@
 #ifndef REPINT_SUBRS_H
 #define REPINT_SUBRS_H
 
+/* from bytevectors.c */
+extern char *rep_bytevector_data (repv bv);
+extern long rep_bytevector_length (repv bv);
+extern void rep_bytevector_modified (repv bv);
+extern repv Fmake_bytevector (repv len, repv init);
+extern repv rep_bytevector_ref (repv bv, long i);
+extern repv rep_bytevector_set (repv bv, long i, repv x);
+extern repv rep_bytevector_copy (repv bv, long start, long end);
+extern void rep_bytevectors_init (void);
+
 /* from continuations.c */
 extern void rep_continuations_init (void);
 
 /* from datums.c */
+extern rep_bool rep_datump (repv arg);
+extern repv rep_datum_printers (void);
 extern void rep_pre_datums_init (void);
 extern void rep_datums_init (void);
 
+/* from heap-census.c */
+extern unsigned long rep_object_size (repv v);
+extern void rep_heap_census_init (void);
+
+/* from compiled-files.c */
+extern rep_bool rep_load_compiled_file (repv file, repv structure,
+					repv *result);
+extern rep_bool rep_compiled_file_stale_p (repv file);
+extern void rep_compiled_files_init (void);
+
+/* from images.c */
+extern void rep_image_force_binding (rep_struct_node *n);
+extern void rep_note_core_state (void);
+extern void rep_note_bootstrap_state (void);
+extern rep_bool rep_load_image (const char *file);
+extern void rep_images_init (void);
+extern void rep_images_kill (void);
+
 /* from files.c */
 extern void rep_files_init(void);
 extern void rep_files_kill(void);
@@ -37,15 +67,23 @@ extern void rep_files_kill(void);
 extern struct rep_saved_regexp_data *rep_saved_matches;
 extern void rep_string_modified (repv string);
 extern void rep_mark_regexp_data(void);
+extern void rep_regexp_string_moved(repv str, char *old);
 extern void rep_find_init(void);
 extern void rep_find_kill(void);
 
 /* from fluids.c */
 extern void rep_fluids_init (void);
 
+/* from jit.c */
+extern rep_bool rep_bytecode_jit;
+extern rep_jit_code *rep_jit_compile (repv fun);
+extern int rep_jit_run (rep_jit_code *jit, rep_jit_frame *frame, int offset);
+extern void rep_jit_free (rep_jit_code *jit);
+
 /* from lisp.c */
 extern repv rep_scm_t, rep_scm_f;
 extern repv rep_readl(repv, int *);
+extern repv rep_lambda_list_marker (int c);
 extern repv rep_eval (repv form, repv tail_posn);
 extern void rep_lisp_prin(repv, repv);
 extern void rep_string_princ(repv, repv);
@@ -74,6 +112,7 @@ extern repv Flethan (int, repv *);
 
 /* from lispmach.c */
 extern repv Qbytecode_error;
+extern rep_bool rep_bytecode_quickening;
 extern repv Frun_byte_code(repv code, repv consts, repv stkreq);
 extern repv rep_apply_bytecode (repv subr, int nargs, repv *args);
 extern void rep_lispmach_init(void);
@@ -101,6 +140,7 @@ extern void rep_misc_init(void);
 extern repv rep_parse_number (char *buf, unsigned int len, unsigned int radix,
 			      int sign, unsigned int type);
 extern void rep_numbers_init (void);
+extern rep_bool rep_sweep_number_block (void);
 extern repv Fplus(int, repv *);
 extern repv Fminus(int, repv *);
 extern repv Fproduct(int, repv *);
@@ -112,6 +152,15 @@ extern repv Fmax(int, repv *);
 extern repv Fmin(int, repv *);
 extern repv Fgcd (int, repv *);
 
+/* from numeric-vectors.c */
+extern long rep_numvec_length (repv vec);
+extern repv rep_numvec_ref (repv vec, long i);
+extern repv rep_numvec_set (repv vec, long i, repv x);
+extern repv rep_numvec_copy (repv vec, long start, long end);
+extern repv Fmake_numeric_vector (repv type, repv len, repv init);
+extern repv Fnumeric_vector_type (repv vec);
+extern void rep_numeric_vectors_init (void);
+
 /* from origin.c */
 extern rep_bool rep_record_origins;
 extern void rep_record_origin (repv form, repv stream, long start_line);
@@ -143,11 +192,18 @@ extern repv Fget_structure (repv);
 extern repv Fexport_binding (repv var);
 extern repv rep_get_initial_special_value (repv sym);
 extern repv rep_documentation_property (repv structure);
+extern repv rep_structure_registry (void);
+extern rep_struct_node *rep_structure_add_binding (repv s, repv var);
+extern int rep_structure_vm_code (repv s);
+extern void rep_structure_set_vm_code (repv s, int code);
+extern rep_struct_node *rep_structure_cached_lookup (rep_struct *s, repv var,
+						     rep_inline_cache *cache);
 extern void rep_pre_structures_init (void);
 extern void rep_structures_init (void);
 
 /* from symbols.c */
 extern repv rep_keyword_obarray;
+extern rep_cell rep_lextag;
 extern int rep_pre_symbols_init(void);
 extern void rep_symbols_init(void);
 extern int rep_allocated_funargs, rep_used_funargs;
@@ -160,6 +216,12 @@ extern void rep_sweep_tuples (void);
 extern void rep_tuples_kill(void);
 
 /* from values.c */
+extern repv **rep_static_roots (int *count);
+extern repv rep_make_compiled (int size, int n_caches);
+extern repv rep_vector_to_compiled (repv vec);
+extern char *rep_read_file_data (int fd, size_t *size);
+extern void rep_release_file_data (char *data);
+extern repv rep_box_mapped_string (char *data, long len);
 extern int rep_type_cmp(repv, repv);
 extern int rep_ptr_cmp(repv, repv);
 extern rep_cons_block *rep_cons_block_chain;
@@ -171,12 +233,32 @@ extern void rep_pre_values_init (void);
 extern void rep_values_init(void);
 extern void rep_values_kill (void);
 extern void rep_dumped_init(char *file);
+extern void rep_pin_string_data (repv v);
+extern rep_bool rep_prepare_heap_walk (void);
+extern void rep_finish_heap_walk (void);
+extern void rep_visit_roots (rep_heap_visitor *fn, void *data);
+extern void rep_visit_children (repv v, rep_heap_visitor *fn, void *data);
+
+/* from verify.c */
+extern void rep_verify_init (void);
+extern int rep_verify_bytecode (repv code, repv consts, int v_stkreq,
+				int b_stkreq, int s_stkreq, int *env_need,
+				repv *why, int *where);
+extern rep_bool rep_verify_compiled (repv fun);
+extern rep_bool rep_verify_top_level (repv code, repv consts, int v_stkreq,
+				      int b_stkreq, int s_stkreq);
+extern void rep_verify_before_gc (void);
+extern repv rep_check_insn (repv code, repv consts, unsigned int pc,
+			    int stk_use, int bind_use, repv top,
+			    repv bind_top, repv *slots,
+			    int v_stkreq, int b_stkreq, int s_stkreq);
 
 /* from weak-refs.c */
 extern repv Fmake_weak_ref (repv value);
 extern repv Fweak_ref (repv ref);
 extern repv Fweak_ref_set (repv ref, repv value);
 extern void rep_scan_weak_refs (void);
+extern void rep_scan_weak_refs_minor (void);
 extern void rep_weak_refs_init (void);
 
 #ifdef rep_HAVE_UNIX
@@ -185,6 +267,7 @@ extern void rep_weak_refs_init (void);
 extern repv rep_open_dl_library(repv file_name);
 extern void rep_mark_dl_data(void);
 extern void rep_kill_dl_libraries(void);
+extern repv rep_dl_library_names (void);
 extern int rep_intern_dl_library (repv file_name);
 extern void *rep_lookup_dl_symbol (int idx, const char *name);
 
@@ -228,6 +311,7 @@ extern repv rep_user_login_name(void);
 extern repv rep_user_full_name(void);
 extern repv rep_user_home_directory(repv user);
 extern repv rep_system_name(void);
+extern int rep_processor_count(void);
 extern void rep_pre_sys_os_init(void);
 extern void rep_sys_os_init(void);
 extern void rep_sys_os_kill(void);
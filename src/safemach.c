@@ -93,7 +93,7 @@ DEFUN("safe-run-byte-code", Fsafe_run_byte_code, Ssafe_run_byte_code,
     b_stkreq = (rep_INT (stkreq) >> 10) & 0x3ff;
     s_stkreq = rep_INT (stkreq) >> 20;
 
-    return vm (code, consts, 0, 0, v_stkreq, b_stkreq, s_stkreq);
+    return vm (code, consts, Qnil, 0, 0, v_stkreq, b_stkreq, s_stkreq);
 }
 
 DEFUN("safe-validate-byte-code", Fsafe_validate_byte_code,
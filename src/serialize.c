@@ -0,0 +1,261 @@
+/* serialize.c -- writing Lisp objects as numbered records
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA */
+
+/* The parts of writing heap images and compiled files that don't
+   depend on the format: numbering objects, laying out the words and
+   bytes of their records, and the records for strings, vectors and
+   numbers. Each format supplies the words referring to objects and
+   the records of everything else. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include "serialize.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define WORDS(out, bytes) \
+    (((bytes) + (out)->word_size - 1) / (out)->word_size)
+
+
+/* Sets of objects */
+
+static inline unsigned long
+hash_value (repv v, long size)
+{
+    return ((v >> 3) * 2654435761UL) % size;
+}
+
+static void
+grow_table (rep_value_set *s)
+{
+    long i;
+    rep_free (s->table);
+    s->table_size = s->table_size * 2 + 1021;
+    s->table = rep_alloc (s->table_size * sizeof (long));
+    memset (s->table, 0, s->table_size * sizeof (long));
+    for (i = 0; i < s->n_values; i++)
+    {
+	unsigned long h = hash_value (s->values[i], s->table_size);
+	while (s->table[h] != 0)
+	    h = (h + 1) % s->table_size;
+	s->table[h] = i + 1;
+    }
+}
+
+/* Return the number of V in set S, giving it the next number if ADD
+   is true and it doesn't have one, otherwise returning -1 */
+long
+rep_value_number (rep_value_set *s, repv v, rep_bool add)
+{
+    unsigned long h;
+    if (s->n_values * 2 >= s->table_size)
+	grow_table (s);
+    h = hash_value (v, s->table_size);
+    while (s->table[h] != 0)
+    {
+	if (s->values[s->table[h] - 1] == v)
+	    return s->table[h] - 1;
+	h = (h + 1) % s->table_size;
+    }
+    if (!add)
+	return -1;
+    if (s->n_values == s->n_allocated)
+    {
+	s->n_allocated = s->n_allocated * 2 + 1024;
+	s->values = rep_realloc (s->values, s->n_allocated * sizeof (repv));
+    }
+    s->values[s->n_values] = v;
+    s->table[h] = s->n_values + 1;
+    return s->n_values++;
+}
+
+void
+rep_free_value_set (rep_value_set *s)
+{
+    rep_free (s->values);
+    rep_free (s->table);
+}
+
+
+/* Records */
+
+void
+rep_serial_init (rep_serializer *out, int word_size, rep_bool little_endian)
+{
+    memset (out, 0, sizeof (*out));
+    out->word_size = word_size;
+    out->little_endian = little_endian;
+    out->error = rep_NULL;
+}
+
+void
+rep_serial_free (rep_serializer *out)
+{
+    rep_free_value_set (&out->records);
+    rep_free (out->offsets);
+    rep_free (out->buf);
+}
+
+/* Store W as a word at P, in the byte order of OUT */
+static void
+store_word (rep_serializer *out, unsigned char *p, rep_serial_word w)
+{
+    if (out->little_endian)
+    {
+	int i;
+	for (i = 0; i < out->word_size; i++, w >>= 8)
+	    p[i] = w & 0xff;
+    }
+    else if (out->word_size == sizeof (unsigned int))
+    {
+	unsigned int x = w;
+	memcpy (p, &x, sizeof (x));
+    }
+    else
+	memcpy (p, &w, sizeof (w));
+}
+
+/* Make room for LEN more bytes in the buffer */
+static inline void
+reserve (rep_serializer *out, size_t len)
+{
+    if (out->len + len > out->buf_size)
+    {
+	out->buf_size = out->buf_size * 2 + len + 65536;
+	out->buf = rep_realloc (out->buf, out->buf_size);
+    }
+}
+
+void
+rep_serial_put_word (rep_serializer *out, rep_serial_word w)
+{
+    reserve (out, out->word_size);
+    store_word (out, (unsigned char *) out->buf + out->len, w);
+    out->len += out->word_size;
+}
+
+/* Output LEN bytes from PTR padded with nulls to a whole number of
+   words, there's always at least one null */
+void
+rep_serial_put_bytes (rep_serializer *out, const void *ptr, size_t len)
+{
+    size_t total = WORDS (out, len + 1) * out->word_size;
+    reserve (out, total);
+    memcpy (out->buf + out->len, ptr, len);
+    memset (out->buf + out->len + len, 0, total - len);
+    out->len += total;
+}
+
+void
+rep_serial_put_ref (rep_serializer *out, repv v)
+{
+    rep_serial_put_word (out, out->ref_word (out, v));
+}
+
+/* KIND, the length of string V, then its characters */
+void
+rep_serial_put_string (rep_serializer *out, rep_serial_word kind, repv v)
+{
+    rep_serial_put_word (out, kind);
+    rep_serial_put_word (out, rep_STRING_LEN (v));
+    rep_serial_put_bytes (out, rep_STR (v), rep_STRING_LEN (v));
+}
+
+/* KIND, the length of vector or byte-code subr V, then its elements */
+void
+rep_serial_put_vector (rep_serializer *out, rep_serial_word kind, repv v)
+{
+    int i;
+    rep_serial_put_word (out, kind);
+    rep_serial_put_word (out, rep_VECT_LEN (v));
+    for (i = 0; i < rep_VECT_LEN (v); i++)
+	rep_serial_put_ref (out, rep_VECTI (v, i));
+}
+
+/* KIND, then the bytes of the double V, least significant first when
+   OUT is little-endian */
+void
+rep_serial_put_float (rep_serializer *out, rep_serial_word kind, repv v)
+{
+    double d = rep_get_float (v);
+    rep_serial_put_word (out, kind);
+#ifdef WORDS_BIGENDIAN
+    if (out->little_endian)
+    {
+	unsigned char *from = (unsigned char *) &d, bytes[sizeof (d)];
+	int i;
+	for (i = 0; i < (int) sizeof (d); i++)
+	    bytes[i] = from[sizeof (d) - 1 - i];
+	rep_serial_put_bytes (out, bytes, sizeof (d));
+	return;
+    }
+#endif
+    rep_serial_put_bytes (out, &d, sizeof (d));
+}
+
+/* KIND, with the number's type as its extra information, then the
+   printed form of the integer or rational V */
+void
+rep_serial_put_number (rep_serializer *out, rep_serial_word kind, repv v)
+{
+    char *text = rep_print_number_to_string (v, 10, -1);
+    if (text == 0)
+    {
+	out->error = v;
+	return;
+    }
+    rep_serial_put_word (out, kind | (rep_NUMERIC_TYPE (v)
+				      << REP_SERIAL_KIND_BITS));
+    rep_serial_put_word (out, strlen (text));
+    rep_serial_put_bytes (out, text, strlen (text));
+    free (text);
+}
+
+/* Write the records of the objects numbered so far, in the order they
+   were numbered, noting the offset of each. Writing each one may
+   number some more. Returns false if an object can't be written */
+rep_bool
+rep_serial_write_records (rep_serializer *out)
+{
+    long i;
+    for (i = 0; i < out->records.n_values && out->error == rep_NULL; i++)
+    {
+	if (i == out->n_offsets)
+	{
+	    out->n_offsets = out->n_offsets * 2 + 1024;
+	    out->offsets = rep_realloc (out->offsets,
+					out->n_offsets * sizeof (size_t));
+	}
+	out->offsets[i] = out->len;
+	out->write_record (out, out->records.values[i]);
+    }
+    return out->error == rep_NULL;
+}
+
+/* Write W to FH as a word of OUT, returning true if successful */
+rep_bool
+rep_serial_fwrite_word (rep_serializer *out, rep_serial_word w, FILE *fh)
+{
+    unsigned char bytes[sizeof (rep_serial_word)];
+    store_word (out, bytes, w);
+    return fwrite (bytes, out->word_size, 1, fh) == 1;
+}
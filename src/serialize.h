@@ -0,0 +1,97 @@
+/* serialize.h -- writing Lisp objects as numbered records
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA */
+
+#ifndef REP_SERIALIZE_H
+#define REP_SERIALIZE_H
+
+#include <stdio.h>
+
+/* Heap images (images.c) and compiled files (compiled-files.c) are
+   both written as a sequence of records, one for each object, in the
+   order the objects were numbered. Records are made of words, and
+   refer to other objects by their numbers. */
+
+typedef unsigned rep_PTR_SIZED_INT rep_serial_word;
+
+/* The first word of each record is its kind, plus extra information
+   above the low REP_SERIAL_KIND_BITS bits */
+#define REP_SERIAL_KIND_BITS 8
+
+/* A set of objects, each with a number */
+typedef struct {
+    repv *values;
+    long n_values, n_allocated;
+
+    /* Open hash table of value numbers plus one, or zero */
+    long *table;
+    long table_size;
+} rep_value_set;
+
+typedef struct rep_serializer_struct rep_serializer;
+
+struct rep_serializer_struct {
+    /* The objects that have records */
+    rep_value_set records;
+
+    /* The records written so far, and the offset of each one */
+    char *buf;
+    size_t len, buf_size;
+    size_t *offsets;
+    long n_offsets;
+
+    /* The size of each word, and whether words are written least
+       significant byte first instead of in the host's byte order */
+    int word_size;
+    rep_bool little_endian;
+
+    /* Return the word referring to V */
+    rep_serial_word (*ref_word) (rep_serializer *out, repv v);
+
+    /* Write the record for V, or set ERROR */
+    void (*write_record) (rep_serializer *out, repv v);
+
+    /* Set to an object that can't be written */
+    repv error;
+};
+
+extern long rep_value_number (rep_value_set *s, repv v, rep_bool add);
+extern void rep_free_value_set (rep_value_set *s);
+
+extern void rep_serial_init (rep_serializer *out, int word_size,
+			     rep_bool little_endian);
+extern void rep_serial_free (rep_serializer *out);
+extern void rep_serial_put_word (rep_serializer *out, rep_serial_word w);
+extern void rep_serial_put_bytes (rep_serializer *out,
+				  const void *ptr, size_t len);
+extern void rep_serial_put_ref (rep_serializer *out, repv v);
+extern void rep_serial_put_string (rep_serializer *out, rep_serial_word kind,
+				   repv v);
+extern void rep_serial_put_vector (rep_serializer *out, rep_serial_word kind,
+				   repv v);
+extern void rep_serial_put_float (rep_serializer *out, rep_serial_word kind,
+				  repv v);
+extern void rep_serial_put_number (rep_serializer *out, rep_serial_word kind,
+				   repv v);
+extern rep_bool rep_serial_write_records (rep_serializer *out);
+extern rep_bool rep_serial_fwrite_word (rep_serializer *out,
+					rep_serial_word w, FILE *fh);
+
+#endif /* REP_SERIALIZE_H */
@@ -83,7 +83,7 @@ static rep_socket *
 make_socket_ (int sock_fd, int namespace, int style)
 {
     rep_socket *s = rep_ALLOC_CELL (sizeof (rep_socket));
-    rep_data_after_gc += sizeof (rep_socket);
+    rep_NOTE_ALLOC (socket_type, sizeof (rep_socket));
 
     s->car = socket_type | IS_ACTIVE;
     s->sock = sock_fd;
@@ -242,6 +242,7 @@ top:
 		memcpy (rep_STR (new), rep_STR (args), len);
 		rep_CAR (stream) = new;
 		rep_CDR(stream) = rep_MAKE_INT (newlen);
+		rep_CONS_BARRIER (stream);
 		args = new;
 	    }
 	    ((unsigned char *)rep_STR (args))[len] = (unsigned char) c;
@@ -359,6 +360,7 @@ top:
 		memcpy (rep_STR (new), rep_STR (args), len);
 		rep_CAR (stream) = new;
 		rep_CDR (stream) = rep_MAKE_INT (newlen);
+		rep_CONS_BARRIER (stream);
 		args = new;
 	    }
 	    memcpy (rep_STR (args) + len, buf, bufLen);
@@ -528,12 +530,26 @@ DEFUN("write", Fwrite, Swrite, (repv stream, repv data, repv len), rep_Subr3) /*
 ::doc:rep.io.streams#write::
 write STREAM DATA [LENGTH]
 
-Writes DATA, which can either be a string or a character, to the stream
-STREAM, returning the number of characters actually written. If DATA is
-a string LENGTH can define how many characters to write.
+Writes DATA, which can either be a string, a bytevector or a character,
+to the stream STREAM, returning the number of characters actually
+written. If DATA is a string or bytevector LENGTH can define how many
+characters to write.
 ::end:: */
 {
     int actual;
+    if (rep_BYTEVECTORP (data))
+    {
+	actual = rep_bytevector_length (data);
+	if (rep_INTP (len))
+	{
+	    if (rep_INT (len) < 0 || rep_INT (len) > actual)
+		return rep_signal_arg_error (len, 3);
+	    actual = rep_INT (len);
+	}
+	actual = rep_stream_puts (stream, rep_bytevector_data (data),
+				  actual, rep_FALSE);
+	return !rep_INTERRUPTP ? rep_MAKE_INT (actual) : rep_NULL;
+    }
     switch (rep_TYPE (data))
     {
 	rep_bool vstring;
@@ -622,9 +638,15 @@ that point. If no characters are read, nil will be returned.
 ::end:: */
 {
     char *buf;
-    int len;
+    long len;
     rep_DECLARE2 (count, rep_INTP);
-    buf = alloca (rep_INT (count));
+    if (rep_INT (count) <= 0)
+	return Qnil;
+    /* read directly into the string's memory, the count may be far
+       too large for the stack */
+    buf = rep_alloc (rep_INT (count) + 1);
+    if (buf == 0)
+	return rep_mem_error ();
     if (rep_FILEP (stream) && rep_LOCAL_FILE_P (stream))
     {
 	/* Special case for local file streams. */
@@ -644,9 +666,79 @@ that point. If no characters are read, nil will be returned.
 	}
     }
     if (len > 0)
-	return rep_string_dupn (buf, len);
+    {
+	if (len < rep_INT (count))
+	{
+	    char *tem = rep_realloc (buf, len + 1);
+	    if (tem != 0)
+		buf = tem;
+	}
+	buf[len] = 0;
+	return rep_box_string (buf, len);
+    }
     else
+    {
+	rep_free (buf);
+	return Qnil;
+    }
+}
+
+DEFUN("read-into-bytevector", Fread_into_bytevector, Sread_into_bytevector,
+      (repv stream, repv bv), rep_Subr2) /*
+::doc:rep.io.streams#read-into-bytevector::
+read-into-bytevector STREAM BYTEVECTOR
+
+Read characters from the input stream STREAM directly into BYTEVECTOR
+(often a slice of a larger bytevector), until either it is full or EOF
+is reached. Returns the number of bytes stored, or nil if EOF was
+reached before reading anything.
+
+Local files and string input streams are copied from in one go, other
+streams are read a character at a time.
+::end:: */
+{
+    char *buf;
+    long len, count;
+    rep_DECLARE2 (bv, rep_BYTEVECTORP);
+    buf = rep_bytevector_data (bv);
+    count = rep_bytevector_length (bv);
+    if (count == 0)
+	return rep_MAKE_INT (0);
+    if (rep_FILEP (stream) && rep_LOCAL_FILE_P (stream))
+    {
+	len = fread (buf, sizeof (char), count, rep_FILE (stream)->file.fh);
+	rep_FILE (stream)->car |= rep_LFF_BOGUS_LINE_NUMBER;
+    }
+    else if (rep_CONSP (stream) && rep_INTP (rep_CAR (stream))
+	     && rep_STRINGP (rep_CDR (stream)))
+    {
+	/* String input streams are copied from directly. The bytevector
+	   may be a window on the same string, so the bytes may overlap */
+	long start = rep_INT (rep_CAR (stream));
+	len = rep_STRING_LEN (rep_CDR (stream)) - start;
+	if (len > count)
+	    len = count;
+	if (len > 0)
+	{
+	    memmove (buf, rep_STR (rep_CDR (stream)) + start, len);
+	    rep_CAR (stream) = rep_MAKE_INT (start + len);
+	}
+	else
+	    len = 0;
+    }
+    else
+    {
+	int c;
+	len = 0;
+	/* the bytevector may move between calls if it's a window on a
+	   string, so refetch its data each time */
+	while (len < count && (c = rep_stream_getc (stream)) != EOF)
+	    rep_bytevector_data (bv)[len++] = c;
+    }
+    if (len == 0)
 	return Qnil;
+    rep_bytevector_modified (bv);
+    return rep_MAKE_INT (len);
 }
 
 DEFUN("read-line", Fread_line, Sread_line, (repv stream), rep_Subr1) /*
@@ -1188,6 +1280,7 @@ return the new characters.
     /* Reset the stream. */
     rep_CAR (strm) = rep_string_dupn ("", 0);
     rep_CDR (strm) = rep_MAKE_INT (0);
+    rep_CONS_BARRIER (strm);
 
     return string;
 }
@@ -1294,6 +1387,7 @@ rep_streams_init (void)
     rep_ADD_SUBR(Sread_char);
     rep_ADD_SUBR(Speek_char);
     rep_ADD_SUBR(Sread_chars);
+    rep_ADD_SUBR(Sread_into_bytevector);
     rep_ADD_SUBR(Sread_line);
     rep_ADD_SUBR(Scopy_stream);
     rep_ADD_SUBR(Sread);
@@ -146,6 +146,7 @@ DEFSYM(external, "external");
 DEFSYM(local, "local");
 
 static rep_struct_node *lookup_or_add (rep_struct *s, repv var);
+static inline rep_struct_node *lookup (rep_struct *s, repv var);
 
 
 /* cached lookups */
@@ -392,6 +393,49 @@ cache_flush (void)
 #endif /* !SINGLE_DM_CACHE */
 
 
+/* inline caches
+
+   OP_REFG keeps the node it found for each constant of a compiled
+   function, stamped with the epoch of the structure it was looked up
+   in (see rep_inline_cache). Epochs are taken from a single counter,
+   so they also tell structures apart. */
+
+static unsigned long last_epoch;
+
+/* Invalidate the inline caches filled from S, or from any structure
+   when S is null (when the change could affect the structures that
+   import others) */
+static void
+invalidate_inline_caches (rep_struct *s)
+{
+    if (s != 0)
+	s->epoch = ++last_epoch;
+    else
+    {
+	for (s = all_structures; s != 0; s = s->next)
+	    s->epoch = ++last_epoch;
+    }
+}
+
+/* Look up VAR in structure S for OP_REFG, filling CACHE if it's
+   non-null. Returns null if VAR isn't bound */
+rep_struct_node *
+rep_structure_cached_lookup (rep_struct *s, repv var, rep_inline_cache *cache)
+{
+    unsigned long epoch = s->epoch;
+    rep_struct_node *n = lookup (s, var);
+    if (n == 0)
+	n = rep_search_imports (s, var);
+    /* if the lookup changed S the cache can't be trusted */
+    if (n != 0 && cache != 0 && epoch == s->epoch)
+    {
+	cache->epoch = epoch;
+	cache->node = n;
+    }
+    return n;
+}
+
+
 /* type hooks */
 
 static void
@@ -414,6 +458,14 @@ structure_mark (repv x)
     rep_MARKVAL (rep_STRUCTURE (x)->special_env);
 }
 
+static unsigned long
+structure_size (repv x)
+{
+    rep_struct *s = rep_STRUCTURE (x);
+    return (sizeof (rep_struct) + s->total_buckets * sizeof (rep_struct_node *)
+	    + s->total_bindings * sizeof (rep_struct_node));
+}
+
 static void
 free_structure (rep_struct *x)
 {
@@ -437,12 +489,16 @@ static void
 structure_sweep (void)
 {
     rep_struct *x = all_structures;
+    rep_bool freed = rep_FALSE;
     all_structures = 0;
     while (x != 0)
     {
 	rep_struct *next = x->next;
 	if (!rep_GC_CELL_MARKEDP (rep_VAL(x)))
+	{
 	    free_structure (x);
+	    freed = rep_TRUE;
+	}
 	else
 	{
 	    rep_GC_CLR_CELL (rep_VAL(x));
@@ -451,6 +507,8 @@ structure_sweep (void)
 	}
 	x = next;
     }
+    if (freed)
+	invalidate_inline_caches (0);
 }
 
 static void
@@ -494,8 +552,6 @@ structure_exports_inherited_p (rep_struct *s, repv var)
 static inline rep_struct_node *
 lookup (rep_struct *s, repv var)
 {
-    /* this is also in OP_REFG in lispmach.c */
-
     rep_struct_node *n;
     if (s->total_buckets != 0)
     {
@@ -503,7 +559,11 @@ lookup (rep_struct *s, repv var)
 	     n != 0; n = n->next)
 	{
 	    if (n->symbol == var)
+	    {
+		if (rep_IMAGE_PENDING_P (n->binding))
+		    rep_image_force_binding (n);
 		return n;
+	    }
 	}
     }
     return 0;
@@ -522,7 +582,8 @@ lookup_or_add (rep_struct *s, repv var)
 				    * s->total_buckets);
 	    memset (s->buckets, 0,
 		    sizeof (rep_struct_node *) * s->total_buckets);
-	    rep_data_after_gc += sizeof (rep_struct_node *) * s->total_buckets;
+	    rep_NOTE_ALLOC_BYTES (rep_structure_type, (sizeof (rep_struct_node *)
+						       * s->total_buckets));
 	}
 
 	if (s->total_bindings > s->total_buckets * MAX_MULTIPLIER)
@@ -532,7 +593,8 @@ lookup_or_add (rep_struct *s, repv var)
 		= rep_alloc (new_total * sizeof (rep_struct_node *));
 	    int i;
 	    memset (buckets, 0, new_total * sizeof (rep_struct_node *));
-	    rep_data_after_gc += new_total * sizeof (rep_struct_node *);
+	    rep_NOTE_ALLOC_BYTES (rep_structure_type,
+				  new_total * sizeof (rep_struct_node *));
 	    for (i = 0; i < s->total_buckets; i++)
 	    {
 		rep_struct_node *next;
@@ -549,7 +611,7 @@ lookup_or_add (rep_struct *s, repv var)
 	}
 
 	n = rep_alloc (sizeof (rep_struct_node));
-	rep_data_after_gc += sizeof (rep_struct_node);
+	rep_NOTE_ALLOC_BYTES (rep_structure_type, sizeof (rep_struct_node));
 	n->symbol = var;
 	n->is_constant = 0;
 	n->is_exported = (s->car & rep_STF_EXPORT_ALL) != 0;
@@ -564,6 +626,7 @@ lookup_or_add (rep_struct *s, repv var)
 	}
 
 	cache_invalidate_symbol (var);
+	invalidate_inline_caches (n->is_exported ? 0 : s);
     }
     return n;
 }
@@ -583,6 +646,7 @@ remove_binding (rep_struct *s, repv var)
 		rep_free (*n);
 		*n = next;
 		cache_invalidate_symbol (var);
+		invalidate_inline_caches (0);
 		return;
 	    }
 	}
@@ -679,6 +743,7 @@ Assign the name NAME (a symbol) to structure object STRUCTURE.
 			   rep_STRUCTURE (structure)->name, Qnil);
     }
     cache_flush ();
+    invalidate_inline_caches (0);
     return name;
 }
 
@@ -722,7 +787,7 @@ BODY-THUNK may be modified by this function!
 	rep_DECLARE4 (name, rep_SYMBOLP);
 
     s = rep_ALLOC_CELL (sizeof (rep_struct));
-    rep_data_after_gc += sizeof (rep_struct);
+    rep_NOTE_ALLOC (rep_structure_type, sizeof (rep_struct));
     s->car = rep_structure_type;
     s->inherited = sig;
     s->name = name;
@@ -730,6 +795,7 @@ BODY-THUNK may be modified by this function!
     s->imports = Qnil;
     s->accessible = Qnil;
     s->special_env = Qt;
+    s->epoch = ++last_epoch;
     if (rep_structure != rep_NULL)
 	s->apply_bytecode = rep_STRUCTURE (rep_structure)->apply_bytecode;
     else
@@ -748,9 +814,12 @@ BODY-THUNK may be modified by this function!
     {
 	repv tem;
 	s->imports = Fcons (Q_meta, s->imports);
+	invalidate_inline_caches (s);
 	rep_FUNARG (header_thunk)->structure = s_;
+	rep_OBJECT_BARRIER (header_thunk, s_);
 	tem = rep_call_lisp0 (header_thunk);
 	s->imports = Fdelq (Q_meta, s->imports);
+	invalidate_inline_caches (s);
 	if (tem == rep_NULL)
 	    s = 0;
     }
@@ -760,6 +829,7 @@ BODY-THUNK may be modified by this function!
     {
 	repv tem;
 	rep_FUNARG (body_thunk)->structure = s_;
+	rep_OBJECT_BARRIER (body_thunk, s_);
 	tem = rep_call_lisp0 (body_thunk);
 	if (tem == rep_NULL)
 	    s = 0;
@@ -796,7 +866,7 @@ Returns a void value if no such binding.
     rep_DECLARE2 (var, rep_SYMBOLP);
     s = rep_STRUCTURE (structure);
 
-    /* this is also in OP_REFG in lispmach.c */
+    /* this is also rep_structure_cached_lookup, used by OP_REFG */
 
     n = lookup (s, var);
     if (n == 0)
@@ -1046,6 +1116,7 @@ Set the interface of structure object STRUCTURE to INTERFACE.
     }
 
     cache_flush ();
+    invalidate_inline_caches (0);
     return Qt;
 }
 
@@ -1144,6 +1215,7 @@ named in the list STRUCT-NAMES.
     }
     rep_POPGC;
     cache_flush ();
+    invalidate_inline_caches (0);
     return ret;
 }
 
@@ -1179,6 +1251,7 @@ named in the list STRUCT-NAMES.
     }
     rep_POPGC;
     cache_flush ();
+    invalidate_inline_caches (0);
     return ret;
 }
 
@@ -1257,6 +1330,8 @@ value.
 	rep_struct_node *n;
 	for (n = s->buckets[i]; n != 0; n = n->next)
 	{
+	    if (rep_IMAGE_PENDING_P (n->binding))
+		rep_image_force_binding (n);
 	    if (!rep_VOIDP (n->binding))
 	    {
 		ret = rep_call_lisp2 (fun, n->symbol, n->binding);
@@ -1349,12 +1424,14 @@ Fexport_binding (repv var)
 	{
 	    n->is_exported = 1;
 	    cache_invalidate_symbol (var);
+	    invalidate_inline_caches (0);
 	}
     }
     else if (!structure_exports_inherited_p (s, var))
     {
 	s->inherited = Fcons (var, s->inherited);
 	cache_invalidate_symbol (var);
+	invalidate_inline_caches (0);
     }
 
     return Qnil;
@@ -1458,6 +1535,7 @@ loaded is either FILE (if given), or the print name of FEATURE.
 	    dst->imports = Fcons (feature, dst->imports);
 	    Fprovide (feature);
 	    cache_flush ();
+    invalidate_inline_caches (0);
 	}
     }
     return Qt;
@@ -1523,7 +1601,8 @@ rep_bootstrap_structure (const char *s)
 	  tem->imports = Fcons (Qrep_structures, tem->imports);
       if (tem->name != Qrep_lang_interpreter)
 	  tem->imports = Fcons (Qrep_lang_interpreter, tem->imports);
-      tem->imports = Fcons (Qrep_vm_interpreter, tem->imports); }
+      tem->imports = Fcons (Qrep_vm_interpreter, tem->imports);
+      invalidate_inline_caches (tem); }
 
     ret = Fload (Fstructure_file (name), Qnil, Qnil, Qnil, Qnil);
 
@@ -1587,6 +1666,43 @@ invalid_apply_bytecode (repv subr, int nargs, repv *args)
     return Fsignal (Qinvalid_function, rep_LIST_1 (subr));
 }
 
+/* Support for heap images (see images.c) */
+
+repv
+rep_structure_registry (void)
+{
+    return rep_structures_structure;
+}
+
+/* Return the binding of VAR in structure S, creating it if necessary */
+rep_struct_node *
+rep_structure_add_binding (repv s, repv var)
+{
+    cache_invalidate_symbol (var);
+    return lookup_or_add (rep_STRUCTURE (s), var);
+}
+
+/* Return zero if functions defined in structure S use the normal
+   bytecode interpreter, one if they can't be called, or -1 if they use
+   some other interpreter */
+int
+rep_structure_vm_code (repv s)
+{
+    if (rep_STRUCTURE (s)->apply_bytecode == 0)
+	return 0;
+    else if (rep_STRUCTURE (s)->apply_bytecode == invalid_apply_bytecode)
+	return 1;
+    else
+	return -1;
+}
+
+void
+rep_structure_set_vm_code (repv s, int code)
+{
+    rep_STRUCTURE (s)->apply_bytecode = (code == 0
+					 ? 0 : invalid_apply_bytecode);
+}
+
 DEFUN("structure-install-vm", Fstructure_install_vm,
       Sstructure_install_vm, (repv structure, repv vm), rep_Subr2)
 {
@@ -1666,6 +1782,8 @@ rep_pre_structures_init (void)
 						structure_sweep,
 						structure_mark,
 						0, 0, 0, 0, 0, 0, 0);
+    rep_set_parallel_mark (rep_structure_type, structure_mark);
+    rep_set_type_size (rep_structure_type, structure_size);
     rep_default_structure = Fmake_structure (Qnil, Qnil, Qnil, Qnil);
     rep_specials_structure = Fmake_structure (Qnil, Qnil, Qnil, Qnil);
     rep_structures_structure = Fmake_structure (Qnil, Qnil, Qnil, Qnil);
@@ -83,8 +83,8 @@ repv rep_void_value = rep_VAL(&void_object);
 #define OB_NIL rep_VAL(&void_object)
 
 /* Used to mark lexical bindings */
-rep_ALIGN_CELL(static rep_cell lextag) = { rep_Void };
-#define LEXTAG rep_VAL(&lextag)
+rep_ALIGN_CELL(rep_cell rep_lextag) = { rep_Void };
+#define LEXTAG rep_VAL(&rep_lextag)
 
 static rep_funarg_block *funarg_block_chain;
 static rep_funarg *funarg_freelist;
@@ -125,6 +125,18 @@ symbol_sweep(void)
     }
 }
 
+static unsigned long
+symbol_size (repv sym)
+{
+    return sizeof (rep_tuple);
+}
+
+static unsigned long
+funarg_size (repv fun)
+{
+    return sizeof (rep_funarg);
+}
+
 static int
 symbol_cmp(repv v1, repv v2)
 {
@@ -295,6 +307,8 @@ somewhere an error is signalled.
     hashid = hash(rep_STR(rep_SYM(sym)->name)) % vsize;
     rep_SYM(sym)->next = rep_VECT(ob)->array[hashid];
     rep_VECT(ob)->array[hashid] = sym;
+    rep_OBJECT_BARRIER(sym, rep_SYM(sym)->next);
+    rep_OBJECT_BARRIER(ob, sym);
     return(sym);
 }
 
@@ -342,6 +356,8 @@ Removes SYMBOL from OBARRAY (or the default). Use this with caution.
 	{
 	    rep_SYM(list)->next = rep_VECT(ob)->array[hashid];
 	    rep_VECT(ob)->array[hashid] = rep_VAL(list);
+	    rep_OBJECT_BARRIER(list, rep_SYM(list)->next);
+	    rep_OBJECT_BARRIER(ob, list);
 	}
 	list = nxt;
     }
@@ -380,7 +396,7 @@ current environment.
 
     f = funarg_freelist;
     funarg_freelist = rep_FUNARG (f->car);
-    rep_data_after_gc += sizeof (rep_funarg);
+    rep_NOTE_ALLOC (rep_Funarg, sizeof (rep_funarg));
     f->car = rep_Funarg;
     f->fun = fun;
     f->name = name;
@@ -411,6 +427,7 @@ Set the function value in the closure FUNARG to FUNCTION.
 {
     rep_DECLARE1(funarg, rep_FUNARGP);
     rep_FUNARG(funarg)->fun = fun;
+    rep_OBJECT_BARRIER(funarg, fun);
     return fun;
 }
 
@@ -456,6 +473,7 @@ DEFUN ("set-closure-structure", Fset_closure_structure,
     rep_DECLARE1 (closure, rep_FUNARGP);
     rep_DECLARE2 (structure, rep_STRUCTUREP);
     rep_FUNARG (closure)->structure = structure;
+    rep_OBJECT_BARRIER (closure, structure);
     return Qnil;
 }
 
@@ -947,7 +965,10 @@ do_set (repv sym, repv val, repv (*setter)(repv st, repv var, repv val))
 	    }
 	    tem = inlined_search_special_bindings (sym);
 	    if (tem != Qnil)
+	    {
 		rep_CDR (tem) = val;
+		rep_CONS_BARRIER (tem);
+	    }
 	    else
 		val = Fstructure_define (rep_specials_structure, sym, val);
 	}
@@ -959,7 +980,10 @@ do_set (repv sym, repv val, repv (*setter)(repv st, repv var, repv val))
 	/* lexical binding */
 	repv tem = search_environment (sym);
 	if (tem != Qnil)
+	{
 	    rep_CDR(tem) = val;
+	    rep_CONS_BARRIER(tem);
+	}
 	else
 	    val = setter (rep_structure, sym, val);
     }
@@ -1003,7 +1027,10 @@ Sets the default value of SYMBOL to VALUE, then returns VALUE.
 
 	    tem = search_special_bindings (sym);
 	    if (tem != Qnil)
+	    {
 		rep_CDR (tem) = val;
+		rep_CONS_BARRIER (tem);
+	    }
 	    else
 		val = Fstructure_define (rep_specials_structure, sym, val);
 	}
@@ -1256,6 +1283,7 @@ retrieved with the `get' function.
 		break;
 	    }
 	    rep_CAR(rep_CDR(plist)) = val;
+	    rep_CONS_BARRIER(rep_CDR(plist));
 	    return val;
 	}
 	plist = rep_CDR(rep_CDR(plist));
@@ -1436,6 +1464,10 @@ rep_pre_symbols_init(void)
     rep_register_type(rep_Funarg, "funarg", rep_ptr_cmp,
 		      rep_lisp_prin, rep_lisp_prin, funarg_sweep,
 		      0, 0, 0, 0, 0, 0, 0, 0);
+    rep_set_type_size (rep_Symbol, symbol_size);
+    rep_set_type_size (rep_Funarg, funarg_size);
+    rep_set_write_barrier (rep_Symbol);
+    rep_set_write_barrier (rep_Funarg);
     if(rep_obarray && rep_keyword_obarray)
     {
 	rep_mark_static(&rep_obarray);
@@ -82,6 +82,13 @@ table_mark (repv val)
     rep_MARKVAL(TABLE(val)->guardian);
 }
 
+static unsigned long
+table_size (repv val)
+{
+    return (sizeof (table) + TABLE(val)->total_buckets * sizeof (node *)
+	    + TABLE(val)->total_nodes * sizeof (node));
+}
+
 static void
 free_table (table *x)
 {
@@ -246,7 +253,7 @@ compare two keys (should return true if the keys are considered equal).
     rep_DECLARE(2, cmp_fun, Ffunctionp (cmp_fun) != Qnil);
 
     tab = rep_ALLOC_CELL (sizeof (table));
-    rep_data_after_gc += sizeof (table);
+    rep_NOTE_ALLOC (table_type, sizeof (table));
     tab->car = table_type;
     tab->next = all_tables;
     all_tables = tab;
@@ -387,7 +394,7 @@ Associate VALUE with KEY in hash table TABLE. Returns VALUE.
     {
 	int bin;
 	n = rep_alloc (sizeof (node));
-	rep_data_after_gc += sizeof (node);
+	rep_NOTE_ALLOC_BYTES (table_type, sizeof (node));
 	n->key = key;
 	n->value = value;
 	n->hash = hash_key (tab, key);
@@ -410,7 +417,7 @@ Associate VALUE with KEY in hash table TABLE. Returns VALUE.
 		new_size = (old_size + 1) * 2 - 1;
 
 	    new_bins = rep_alloc (sizeof (node *) * new_size);
-	    rep_data_after_gc += sizeof (node *) * new_size;
+	    rep_NOTE_ALLOC_BYTES (table_type, sizeof (node *) * new_size);
 	    memset (new_bins, 0, sizeof (node *) * new_size);
 
 	    TABLE(tab)->buckets = new_bins;
@@ -437,6 +444,8 @@ Associate VALUE with KEY in hash table TABLE. Returns VALUE.
 	    Fprimitive_guardian_push (TABLE(tab)->guardian, n->key);
     }
     n->value = value;
+    rep_OBJECT_BARRIER (tab, n->key);
+    rep_OBJECT_BARRIER (tab, value);
     return value;
 }
 
@@ -542,6 +551,9 @@ rep_dl_init (void)
     table_type = rep_register_new_type ("table", 0, table_print, table_print,
 					table_sweep, table_mark,
 					0, 0, 0, 0, 0, 0, 0);
+    rep_set_parallel_mark (table_type, table_mark);
+    rep_set_write_barrier (table_type);
+    rep_set_type_size (table_type, table_size);
     tem = Fsymbol_value (Qafter_gc_hook, Qt);
     if (rep_VOIDP (tem))
 	tem = Qnil;
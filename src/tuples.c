@@ -68,7 +68,7 @@ rep_make_tuple (repv car, repv a, repv b)
     t->a = a;
     t->b = b;
     rep_used_tuples++;
-    rep_data_after_gc += sizeof (rep_tuple);
+    rep_NOTE_ALLOC (car, sizeof (rep_tuple));
     return rep_VAL (t);
 }
 
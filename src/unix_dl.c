@@ -475,6 +475,19 @@ rep_mark_dl_data(void)
     }
 }
 
+/* Return a list of the file names of the libraries opened so far,
+   in the order they were opened */
+repv
+rep_dl_library_names (void)
+{
+    repv list = Qnil;
+    int i;
+
+    for (i = n_dl_libs - 1; i >= 0; i--)
+	list = Fcons (dl_libs[i].file_name, list);
+    return list;
+}
+
 void
 rep_kill_dl_libraries(void)
 {
@@ -254,6 +254,18 @@ rep_system_name(void)
     return system_name;
 }
 
+/* The number of processors that are online, or one if it can't be found */
+int
+rep_processor_count(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n > 0)
+	return n;
+#endif
+    return 1;
+}
+
 
 /* Main input loop */
 
@@ -550,10 +550,101 @@ child_build_environ (void)
     }
 }
 
+/* Point every descriptor above 2 at /dev/null, so that a forked child
+   doesn't hold the parent's files, pipes and sockets open. They aren't
+   simply closed since objects copied from the parent may still close
+   them, which mustn't close whatever the child has opened since. */
+static void
+detach_inherited_fds (void)
+{
+    long max = sysconf (_SC_OPEN_MAX);
+    int null = open ("/dev/null", O_RDWR), fd;
+    if (null < 0)
+	return;
+    if (max < 0 || max > 65536)
+	max = 65536;
+    for (fd = 3; fd < max; fd++)
+    {
+	if (fd != null && fcntl (fd, F_GETFD) != -1)
+	    dup2 (null, fd);
+    }
+    close (null);
+}
+
+/* Signals whose handlers only make sense in the parent: ^C and
+   termination requests should just end the child, as they would a
+   program it had executed */
+static const int parent_signals[] = {
+#ifdef SIGINT
+    SIGINT,
+#endif
+#ifdef SIGTERM
+    SIGTERM,
+#endif
+#ifdef SIGHUP
+    SIGHUP,
+#endif
+#ifdef SIGUSR1
+    SIGUSR1,
+#endif
+#ifdef SIGUSR2
+    SIGUSR2,
+#endif
+#ifdef SIGALRM
+    SIGALRM,
+#endif
+#ifdef SIGPROF
+    SIGPROF,
+#endif
+    0
+};
+
+/* In the child of a process whose program is a Lisp function: forget
+   the parent's subprocesses, without killing them, and its open
+   files, restore the default handling of the signals it catches for
+   itself, then call the function and exit. Doesn't return. */
+static void
+run_lisp_child (struct Proc *pr)
+{
+    struct Proc *p;
+    repv result;
+    int status = 0, i;
+    sigset_t none;
+
+    for (i = 0; parent_signals[i] != 0; i++)
+	signal (parent_signals[i], SIG_DFL);
+    sigemptyset (&none);
+    sigprocmask (SIG_SETMASK, &none, 0);
+
+    for (p = process_chain; p != 0; p = p->pr_Next)
+    {
+	/* PR's own descriptors were closed when they were redirected */
+	if (p != pr)
+	    close_proc_files (p);
+	else
+	    p->pr_Stdin = p->pr_Stdout = p->pr_Stderr = 0;
+	PR_SET_STATUS (p, PR_DEAD);
+	p->pr_Pid = 0;
+	p->pr_NotifyNext = NULL;
+    }
+    notify_chain = NULL;
+    process_run_count = 0;
+    detach_inherited_fds ();
+
+    result = rep_funcall (pr->pr_Prog, pr->pr_Args, rep_FALSE);
+    if (result == rep_NULL)
+	status = rep_top_level_exit ();
+
+    fflush (stdout);
+    fflush (stderr);
+    _exit (status);
+}
+
 /* does the dirty stuff of getting the process running. if SYNC_INPUT
    is non-NULL it means to run the process synchronously with it's
    stdin connected to the file SYNC_INPUT. Otherwise this function returns
-   immediately after starting the process.  */
+   immediately after starting the process. If ARGV is NULL the program
+   is a Lisp function, called in a copy of this process.  */
 static rep_bool
 run_process(struct Proc *pr, char **argv, char *sync_input)
 {
@@ -663,6 +754,10 @@ run_process(struct Proc *pr, char **argv, char *sync_input)
 		}
 	    }
 
+	    /* Output buffered now would be written by both processes */
+	    if (argv == NULL)
+		fflush (NULL);
+
 	    switch(pr->pr_Pid = fork())
 	    {
 	    case 0:
@@ -734,6 +829,9 @@ run_process(struct Proc *pr, char **argv, char *sync_input)
 		}
 		signal (SIGPIPE, SIG_DFL);
 
+		if (argv == NULL)
+		    run_lisp_child (pr);
+
 		execvp(argv[0], argv);
 		int i;
 		fprintf(stderr, "Can't exec: ");
@@ -1033,12 +1131,12 @@ proc_prin(repv strm, repv obj)
     if(PR_RUNNING_P(pr))
     {
 	rep_stream_puts(strm, " running: ", -1, rep_FALSE);
-	rep_stream_puts(strm, rep_PTR(pr->pr_Prog), -1, rep_TRUE);
+	rep_princ_val(strm, pr->pr_Prog);
     }
     else if(PR_STOPPED_P(pr))
     {
 	rep_stream_puts(strm, " stopped: ", -1, rep_FALSE);
-	rep_stream_puts(strm, rep_PTR(pr->pr_Prog), -1, rep_TRUE);
+	rep_princ_val(strm, pr->pr_Prog);
     }
     else
     {
@@ -1093,7 +1191,7 @@ If the DIR parameter is nil it will be inherited from the
     if(pr != rep_NULL)
     {
 	rep_GC_root gc_pr;
-	rep_data_after_gc += sizeof (struct Proc);
+	rep_NOTE_ALLOC (process_type, sizeof (struct Proc));
 	VPROC(pr)->pr_Car = process_type;
 	VPROC(pr)->pr_Next = process_chain;
 	process_chain = VPROC(pr);
@@ -1151,6 +1249,10 @@ PROGRAM is the filename of the binary image, it will be searched for in
 all directories listed in the `PATH' environment variable.
 ARGS are the arguments to give to the process.
 
+PROGRAM may also be a function, in which case the child-process is a
+copy of the Lisp interpreter that applies it to ARGS, then exits. Its
+standard input and output are connected to PROCESS.
+
 If any of the optional parameters are unspecified they should have been
 set in the PROCESS prior to calling this function.
 ::end:: */
@@ -1172,13 +1274,24 @@ set in the PROCESS prior to calling this function.
     }
     if(rep_CONSP(arg_list))
     {
-	if(rep_STRINGP(rep_CAR(arg_list)))
+	if(rep_STRINGP(rep_CAR(arg_list))
+	   || Ffunctionp(rep_CAR(arg_list)) != Qnil)
 	    pr->pr_Prog = rep_CAR(arg_list);
 	arg_list = rep_CDR(arg_list);
 	if(rep_CONSP(arg_list))
 	    pr->pr_Args = arg_list;
     }
-    if(!rep_STRINGP(pr->pr_Prog))
+    if(!rep_STRINGP(pr->pr_Prog) && Ffunctionp(pr->pr_Prog) != Qnil)
+    {
+	if(run_process(pr, NULL, NULL))
+	    res = rep_VAL(pr);
+	else
+	{
+	    res = Fsignal(Qprocess_error, rep_list_2(rep_VAL(&cant_start),
+						       rep_VAL(pr)));
+	}
+    }
+    else if(!rep_STRINGP(pr->pr_Prog))
     {
 	res = Fsignal(Qprocess_error, rep_list_2(rep_VAL(&no_prog), rep_VAL(pr)));
     }
@@ -1698,11 +1811,13 @@ DEFUN("set-process-prog", Fset_process_prog, Sset_process_prog, (repv proc, repv
 ::doc:rep.io.processes#set-process-prog::
 set-process-prog PROCESS PROGRAM
 
-Sets the name of the program to run on PROCESS to FILE.
+Sets the name of the program to run on PROCESS to FILE, or to a
+function (see `start-process').
 ::end:: */
 {
     rep_DECLARE1(proc, PROCESSP);
-    rep_DECLARE2(prog, rep_STRINGP);
+    if (!rep_STRINGP(prog) && Ffunctionp(prog) == Qnil)
+	return rep_signal_arg_error(prog, 2);
     VPROC(proc)->pr_Prog = prog;
     return(prog);
 }
@@ -42,11 +42,33 @@ char *alloca ();
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 
 #ifdef NEED_MEMORY_H
 # include <memory.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#if defined (HAVE_MMAP) && defined (HAVE_MUNMAP) && defined (MAP_ANONYMOUS)
+# define USE_CONS_ARENAS
+# ifdef HAVE_MPROTECT
+#  define USE_STRING_ARENA
+# endif
+#endif
+
+#ifdef ENABLE_PARALLEL_GC
+# include <pthread.h>
+# include <signal.h>
+# include <sched.h>
+#endif
+
 /* #define GC_MONITOR_STK */
 
 #define rep_STRINGBLK_SIZE	510		/* ~4k */
@@ -70,6 +92,18 @@ repv rep_dumped_non_constants;
 int rep_guardian_type;
 
 DEFSYM(after_gc_hook, "after-gc-hook");
+DEFSYM(minor, "minor");
+DEFSYM(major, "major");
+DEFSYM(step, "step");
+DEFSYM(mark_stack, "mark-stack");
+DEFSYM(parallel, "parallel");
+DEFSYM(collections, "collections");
+DEFSYM(pauses, "pauses");
+DEFSYM(types, "types");
+
+static void remember_if_traced (repv cell);
+static rep_bool count_cons_blocks (int n);
+static int sweep_cons_block (rep_cons_block *cb, rep_bool remember);
 
 
 /* Type handling */
@@ -80,6 +114,14 @@ DEFSYM(after_gc_hook, "after-gc-hook");
 static unsigned int next_free_type = 0;
 static rep_type *data_types[TYPE_HASH_SIZE];
 
+/* Non-zero for the types of objects that may contain references to
+   other objects, indexed by cell8 type >> 1, or cell16 type >> 8 */
+static char cell8_traced[32], cell16_traced[256];
+
+/* Non-zero for the types declared by rep_set_write_barrier, indexed
+   in the same way */
+static char cell8_barrier[32], cell16_barrier[256];
+
 void
 rep_register_type(unsigned int code, char *name,
 		  int (*compare)(repv, repv),
@@ -115,8 +157,19 @@ rep_register_type(unsigned int code, char *name,
     t->puts = puts;
     t->bind = bind;
     t->unbind = unbind;
+    t->mark_parallel = 0;
+    t->size = 0;
     t->next = data_types[TYPE_HASH(code)];
     data_types[TYPE_HASH(code)] = t;
+
+    if (code & rep_CELL_IS_16)
+	cell16_traced[code >> rep_CELL16_TYPE_SHIFT] = (mark != 0);
+    else if (code & rep_CELL_IS_8)
+    {
+	cell8_traced[code >> 1] = (mark != 0 || code == rep_Vector
+				   || code == rep_Compiled
+				   || code == rep_Funarg);
+    }
 }
 
 unsigned int
@@ -153,6 +206,37 @@ rep_get_data_type(unsigned int code)
     return t;
 }
 
+/* Declare that MARK, which must do the same as the mark function of
+   type CODE, is safe to call from several threads at once. Objects of
+   types without one are marked by a single thread. */
+void
+rep_set_parallel_mark (unsigned int code, void (*mark)(repv))
+{
+    rep_get_data_type (code)->mark_parallel = mark;
+}
+
+/* Declare that every store into an object of type CODE that may make
+   it refer to another object is followed by rep_OBJECT_BARRIER. The
+   final step of an incremental collection then needn't mark the
+   objects of this type that it's already marked again. */
+void
+rep_set_write_barrier (unsigned int code)
+{
+    if (code & rep_CELL_IS_16)
+	cell16_barrier[code >> rep_CELL16_TYPE_SHIFT] = 1;
+    else
+	cell8_barrier[code >> 1] = 1;
+}
+
+/* Declare that SIZE returns the memory taken by an object of type
+   CODE (see heap-census.c). Objects of types without one are assumed
+   to be the size of a tuple. */
+void
+rep_set_type_size (unsigned int code, unsigned long (*size)(repv))
+{
+    rep_get_data_type (code)->size = size;
+}
+
 
 /* General object handling */
 
@@ -213,6 +297,482 @@ static rep_string_block *string_block_chain;
 static rep_string *string_freelist;
 static int allocated_strings, used_strings, allocated_string_bytes;
 
+/* Blocks that haven't been swept since the last collection. They're
+   swept when string_freelist is empty, or before the next marking. */
+static rep_string_block *string_unswept;
+
+static void sweep_string_block (rep_string_block *cb);
+
+#ifdef USE_STRING_ARENA
+
+/* The bodies of small strings made by rep_make_string are carved from
+   the chunks of a single region of reserved address space by bumping
+   a pointer, instead of being malloc'd one by one. Sweeping doesn't
+   free them: marking notes which chunks hold the body of a live
+   string, and after a full collection the others are reused in bulk
+   (see string_arena_sweep). Since strings only refer to their bodies
+   through the data field, the bodies in sparsely used chunks may also
+   be moved (see compact_string_arena). */
+
+#define STRING_ARENA_CHUNK	(64 * 1024)
+#define STRING_ARENA_BYTES	(sizeof (void *) > 4			\
+				 ? 1024 * 1024 * (size_t) 1024		\
+				 : 64 * 1024 * (size_t) 1024)
+#define STRING_ARENA_CHUNKS	(STRING_ARENA_BYTES / STRING_ARENA_CHUNK)
+
+/* The largest body allocated from the arena */
+#define STRING_ARENA_MAX	256
+
+/* Each body is preceded by its capacity, padded to keep the bodies
+   aligned as malloc would */
+#define STRING_ARENA_PREFIX	8
+#define ARENA_BODY_SIZE(len)	((STRING_ARENA_PREFIX + (len) + 7) & ~7)
+#define ARENA_BODY_CAPACITY(p)	(*(unsigned int *) ((p) - STRING_ARENA_PREFIX))
+
+#define IN_STRING_ARENA(p)					\
+    ((char *) (p) >= string_arena && (char *) (p) < string_arena_end)
+#define ARENA_CHUNK_INDEX(p)	(((char *) (p) - string_arena) / STRING_ARENA_CHUNK)
+
+/* Chunk flags */
+#define ARENA_USED	1		/* not on the free stack */
+#define ARENA_EVACUATE	2		/* bodies being moved out */
+
+static char *string_arena, *string_arena_end;
+static rep_bool string_arena_failed;
+
+/* Bodies are allocated from ARENA_PTR to ARENA_LIMIT, in chunk
+   ARENA_CHUNK. Chunks below ARENA_MAPPED have been made accessible. */
+static char *arena_ptr, *arena_limit;
+static int arena_chunk = -1, arena_mapped;
+
+static unsigned char arena_flags[STRING_ARENA_CHUNKS];
+
+/* Set by marking for the chunks holding bodies of live strings, and
+   those holding bodies that mustn't move. These are separate arrays
+   of bytes, only ever set to one, since parallel marking threads may
+   store to them at the same time. */
+static unsigned char arena_live[STRING_ARENA_CHUNKS];
+static unsigned char arena_pinned[STRING_ARENA_CHUNKS];
+static int arena_free[STRING_ARENA_CHUNKS], n_arena_free;
+
+/* Chunks less full than this percentage are compacted by full
+   collections, zero means never */
+static int string_arena_compaction;
+
+static rep_bool
+reserve_string_arena (void)
+{
+    char *mem = mmap (0, STRING_ARENA_BYTES, PROT_NONE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+	string_arena_failed = rep_TRUE;
+	return rep_FALSE;
+    }
+    string_arena = mem;
+    string_arena_end = mem + STRING_ARENA_BYTES;
+    return rep_TRUE;
+}
+
+/* Start allocating from a free chunk, returning false if there are
+   none left */
+static rep_bool
+next_arena_chunk (void)
+{
+    int i;
+    if (n_arena_free > 0)
+	i = arena_free[--n_arena_free];
+    else if (arena_mapped < STRING_ARENA_CHUNKS
+	     && mprotect (string_arena + arena_mapped * STRING_ARENA_CHUNK,
+			  STRING_ARENA_CHUNK, PROT_READ | PROT_WRITE) == 0)
+	i = arena_mapped++;
+    else
+	return rep_FALSE;
+    /* live until the next collection says otherwise */
+    arena_flags[i] = ARENA_USED;
+    arena_live[i] = 1;
+    arena_chunk = i;
+    arena_ptr = string_arena + i * STRING_ARENA_CHUNK;
+    arena_limit = arena_ptr + STRING_ARENA_CHUNK;
+    return rep_TRUE;
+}
+
+/* Return a body with room for LEN bytes, or null if LEN is too large
+   or the arena is full */
+static char *
+arena_alloc_body (long len)
+{
+    size_t size = ARENA_BODY_SIZE (len);
+    char *body;
+    if (len > STRING_ARENA_MAX)
+	return 0;
+    if (string_arena == 0
+	&& (string_arena_failed || !reserve_string_arena ()))
+	return 0;
+    if ((size_t) (arena_limit - arena_ptr) < size && !next_arena_chunk ())
+	return 0;
+    body = arena_ptr + STRING_ARENA_PREFIX;
+    arena_ptr += size;
+    ARENA_BODY_CAPACITY (body) = len;
+    return body;
+}
+
+/* Called before marking. */
+static void
+clear_arena_live (void)
+{
+    memset (arena_live, 0, arena_mapped);
+    memset (arena_pinned, 0, arena_mapped);
+}
+
+/* Called when marking the string STR */
+static inline void
+mark_arena_body (repv str)
+{
+    if (IN_STRING_ARENA (rep_STR (str)))
+	arena_live[ARENA_CHUNK_INDEX (rep_STR (str))] = 1;
+}
+
+/* Stop compaction moving the contents of V, if it's a string. Strings
+   referred to directly by GC roots or that are the code of compiled
+   functions may be being used through pointers to their contents (by
+   the bytecode interpreter for example). */
+void
+rep_pin_string_data (repv v)
+{
+    if (v != 0 && rep_STRINGP (v) && IN_STRING_ARENA (rep_STR (v)))
+	arena_pinned[ARENA_CHUNK_INDEX (rep_STR (v))] = 1;
+}
+
+/* Move the bodies of the marked strings in chunks less than
+   string_arena_compaction percent full to other chunks, leaving
+   the chunks they were in empty. Only done at the end of a full
+   collection, with every string block in string_block_chain. */
+static void
+compact_string_arena (void)
+{
+    static unsigned int live_bytes[STRING_ARENA_CHUNKS];
+    rep_string_block *cb;
+    int i, n_sparse = 0;
+
+    memset (live_bytes, 0, arena_mapped * sizeof (live_bytes[0]));
+    for (cb = string_block_chain; cb != 0; cb = cb->next.p)
+    {
+	rep_string *this;
+	for (i = 0, this = cb->data; i < rep_STRINGBLK_SIZE; i++, this++)
+	{
+	    if (!rep_CELL_CONS_P (rep_VAL (this))
+		&& rep_GC_CELL_MARKEDP (rep_VAL (this))
+		&& IN_STRING_ARENA (this->data))
+	    {
+		live_bytes[ARENA_CHUNK_INDEX (this->data)]
+		    += ARENA_BODY_SIZE (ARENA_BODY_CAPACITY (this->data));
+	    }
+	}
+    }
+
+    for (i = 0; i < arena_mapped; i++)
+    {
+	if (arena_live[i] && !arena_pinned[i]
+	    && live_bytes[i] * (rep_long_long) 100
+	       < string_arena_compaction * (rep_long_long) STRING_ARENA_CHUNK)
+	{
+	    arena_flags[i] |= ARENA_EVACUATE;
+	    n_sparse++;
+	}
+    }
+    if (n_sparse == 0)
+	return;
+
+    if (arena_chunk >= 0 && (arena_flags[arena_chunk] & ARENA_EVACUATE))
+    {
+	/* don't allocate where bodies are being moved from */
+	arena_ptr = arena_limit = 0;
+	arena_chunk = -1;
+    }
+
+    for (cb = string_block_chain; cb != 0; cb = cb->next.p)
+    {
+	rep_string *this;
+	for (i = 0, this = cb->data; i < rep_STRINGBLK_SIZE; i++, this++)
+	{
+	    char *old = this->data, *new;
+	    int chunk;
+	    if (rep_CELL_CONS_P (rep_VAL (this))
+		|| !rep_GC_CELL_MARKEDP (rep_VAL (this))
+		|| !IN_STRING_ARENA (old))
+	    {
+		continue;
+	    }
+	    chunk = ARENA_CHUNK_INDEX (old);
+	    if (!(arena_flags[chunk] & ARENA_EVACUATE))
+		continue;
+	    new = arena_alloc_body (ARENA_BODY_CAPACITY (old));
+	    if (new == 0)
+	    {
+		/* nowhere to put it, so its chunk has to stay */
+		arena_flags[chunk] &= ~ARENA_EVACUATE;
+		continue;
+	    }
+	    memcpy (new, old, ARENA_BODY_CAPACITY (old));
+	    arena_live[ARENA_CHUNK_INDEX (new)] = 1;
+	    this->data = new;
+	    rep_regexp_string_moved (rep_VAL (this), old);
+	}
+    }
+
+    for (i = 0; i < arena_mapped; i++)
+    {
+	if (arena_flags[i] & ARENA_EVACUATE)
+	{
+	    arena_flags[i] &= ~ARENA_EVACUATE;
+	    arena_live[i] = 0;
+	}
+    }
+}
+
+/* Called by a full collection, once marking is complete. The chunks
+   holding no bodies of live strings are returned to the free stack;
+   the dead strings pointing into them are never looked at again. */
+static void
+string_arena_sweep (void)
+{
+    int i;
+    if (string_arena_compaction > 0)
+	compact_string_arena ();
+    for (i = 0; i < arena_mapped; i++)
+    {
+	if (!(arena_flags[i] & ARENA_USED) || arena_live[i])
+	    continue;
+	if (i == arena_chunk)
+	{
+	    /* start again from the beginning */
+	    arena_ptr = string_arena + i * STRING_ARENA_CHUNK;
+	    continue;
+	}
+#ifdef HAVE_MADVISE
+	madvise (string_arena + i * STRING_ARENA_CHUNK,
+		 STRING_ARENA_CHUNK, MADV_DONTNEED);
+#endif
+	arena_flags[i] = 0;
+	arena_free[n_arena_free++] = i;
+    }
+}
+
+#else /* USE_STRING_ARENA */
+
+#define IN_STRING_ARENA(p) rep_FALSE
+#define arena_alloc_body(len) ((char *) 0)
+#define clear_arena_live() do { ; } while (0)
+#define mark_arena_body(str) do { ; } while (0)
+
+void
+rep_pin_string_data (repv v)
+{
+}
+#define string_arena_sweep() do { ; } while (0)
+
+#endif /* !USE_STRING_ARENA */
+
+/* Compiled Lisp files (see compiled-files.c) are read into another
+   reserved region of address space, so that strings can use the
+   characters in them without copying. The pages holding a file are
+   private anonymous memory, so changing or truncating the file after
+   it's been loaded has no effect on them. They're returned once the
+   loader has released them and no string uses them any more, which
+   full collections find out by marking the files the live strings
+   point into. */
+
+#ifdef USE_CONS_ARENAS
+
+#define MAPPED_FILES_BYTES	(sizeof (void *) > 4			\
+				 ? 1024 * 1024 * (size_t) 1024		\
+				 : 64 * 1024 * (size_t) 1024)
+
+#define IN_MAPPED_FILES(p)					\
+    ((char *) (p) >= mapped_files && (char *) (p) < mapped_files_end)
+
+static char *mapped_files, *mapped_files_end;
+static rep_bool mapped_files_failed;
+
+/* The files in the region, in order of address. LIVE is set by
+   marking (only ever to one, see arena_live), HELD while the loader
+   is still using the data. */
+typedef struct {
+    char *start;
+    size_t len;
+    unsigned char live, held;
+} mapped_file;
+
+static mapped_file *mapped_file_table;
+static int n_mapped_files, mapped_file_table_size;
+
+/* Read SIZE bytes of the file open on FD, from its start, into the
+   region, returning their address, or null if that's not possible.
+   The data is followed by at least one null byte. SIZE is set to the
+   number of bytes actually read. The data stays where it is at least
+   until it's passed to rep_release_file_data. */
+char *
+rep_read_file_data (int fd, size_t *size)
+{
+    size_t page = getpagesize ();
+    size_t len = (*size + page) & ~(page - 1);
+    size_t done = 0;
+    char *mem, *prev_end;
+    int i;
+
+    if (mapped_files == 0)
+    {
+	if (mapped_files_failed)
+	    return 0;
+	mem = mmap (0, MAPPED_FILES_BYTES, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+	{
+	    mapped_files_failed = rep_TRUE;
+	    return 0;
+	}
+	mapped_files = mem;
+	mapped_files_end = mem + MAPPED_FILES_BYTES;
+    }
+
+    /* the first gap between files that's big enough */
+    prev_end = mapped_files;
+    for (i = 0; i < n_mapped_files; i++)
+    {
+	if ((size_t) (mapped_file_table[i].start - prev_end) >= len)
+	    break;
+	prev_end = mapped_file_table[i].start + mapped_file_table[i].len;
+    }
+    if ((size_t) ((i < n_mapped_files ? mapped_file_table[i].start
+		   : mapped_files_end) - prev_end) < len)
+	return 0;
+
+    if (n_mapped_files == mapped_file_table_size)
+    {
+	int new_size = MAX (mapped_file_table_size * 2, 64);
+	mapped_file *table = rep_realloc (mapped_file_table,
+					  sizeof (mapped_file) * new_size);
+	if (table == 0)
+	    return 0;
+	mapped_file_table = table;
+	mapped_file_table_size = new_size;
+    }
+
+    mem = prev_end;
+    if (mprotect (mem, len, PROT_READ | PROT_WRITE) != 0)
+	return 0;
+    lseek (fd, 0, SEEK_SET);
+    while (done < *size)
+    {
+	ssize_t this = read (fd, mem + done, *size - done);
+	if (this <= 0)
+	    break;
+	done += this;
+    }
+    *size = done;
+
+    memmove (mapped_file_table + i + 1, mapped_file_table + i,
+	     sizeof (mapped_file) * (n_mapped_files - i));
+    n_mapped_files++;
+    mapped_file_table[i].start = mem;
+    mapped_file_table[i].len = len;
+    /* live until the next collection says otherwise */
+    mapped_file_table[i].live = 1;
+    mapped_file_table[i].held = 1;
+    return mem;
+}
+
+/* The index of the file in the region holding P */
+static int
+find_mapped_file (char *p)
+{
+    int lo = 0, hi = n_mapped_files;
+    while (lo < hi)
+    {
+	int mid = (lo + hi) / 2;
+	if (p < mapped_file_table[mid].start)
+	    hi = mid;
+	else if (p >= mapped_file_table[mid].start + mapped_file_table[mid].len)
+	    lo = mid + 1;
+	else
+	    return mid;
+    }
+    return -1;
+}
+
+/* Called when the loader has finished with the file data at DATA,
+   returned by rep_read_file_data */
+void
+rep_release_file_data (char *data)
+{
+    int i = find_mapped_file (data);
+    if (i >= 0)
+	mapped_file_table[i].held = 0;
+}
+
+/* Called before marking. */
+static void
+clear_mapped_files_live (void)
+{
+    int i;
+    for (i = 0; i < n_mapped_files; i++)
+	mapped_file_table[i].live = 0;
+}
+
+/* Called when marking the string STR */
+static inline void
+mark_mapped_body (repv str)
+{
+    if (IN_MAPPED_FILES (rep_STR (str)))
+    {
+	int i = find_mapped_file (rep_STR (str));
+	if (i >= 0)
+	    mapped_file_table[i].live = 1;
+    }
+}
+
+/* Called by a full collection, once marking is complete. Returns the
+   pages of the files that no live string uses to the system, leaving
+   their addresses reserved. */
+static void
+mapped_files_sweep (void)
+{
+    int i, j = 0;
+    for (i = 0; i < n_mapped_files; i++)
+    {
+	mapped_file *f = &mapped_file_table[i];
+	if (f->live || f->held
+	    || mmap (f->start, f->len, PROT_NONE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+		     -1, 0) == MAP_FAILED)
+	{
+	    mapped_file_table[j++] = *f;
+	}
+    }
+    n_mapped_files = j;
+}
+
+#else /* USE_CONS_ARENAS */
+
+#define IN_MAPPED_FILES(p) rep_FALSE
+#define clear_mapped_files_live() do { ; } while (0)
+#define mark_mapped_body(str) do { ; } while (0)
+#define mapped_files_sweep() do { ; } while (0)
+
+char *
+rep_read_file_data (int fd, size_t *size)
+{
+    return 0;
+}
+
+void
+rep_release_file_data (char *data)
+{
+}
+
+#endif /* !USE_CONS_ARENAS */
+
 DEFSTRING(null_string_const, "");
 
 repv
@@ -223,19 +783,27 @@ rep_null_string(void)
 
 DEFSTRING(string_overflow, "String too long");
 
-/* PTR should have been allocated using rep_alloc or malloc. Ownership
-   of its memory passes to the lisp system. LEN _doesn't_ include the zero
-   terminator */
-repv
-rep_box_string (char *ptr, long len)
+/* Strings with more characters than this are made large, see
+   large-string-threshold */
+long rep_max_short_string = rep_MAX_SHORT_STRING;
+
+/* Find a header for a string of LEN characters at DATA. If LARGE is
+   true DATA is preceded by rep_LARGE_STRING_PREFIX bytes in the same
+   block of memory, where the length will be stored. */
+static repv
+box_string (char *data, long len, rep_bool large)
 {
     rep_string *str;
 
-    if(len > rep_MAX_STRING)
-	return Fsignal(Qerror, rep_LIST_1(rep_VAL(&string_overflow)));
-
     /* find a string header */
     str = string_freelist;
+    while (str == NULL && string_unswept != NULL)
+    {
+	rep_string_block *cb = string_unswept;
+	string_unswept = cb->next.p;
+	sweep_string_block (cb);
+	str = string_freelist;
+    }
     if(str == NULL)
     {
 	rep_string_block *cb;
@@ -257,22 +825,78 @@ rep_box_string (char *ptr, long len)
     }
     string_freelist = rep_STRING(str->car);
     used_strings++;
-    rep_data_after_gc += sizeof(rep_string);
+    rep_NOTE_ALLOC (rep_String, sizeof (rep_string) + len);
 
-    str->car = rep_MAKE_STRING_CAR (len);
-    rep_data_after_gc += len;
-    str->data = ptr;
+    str->data = data;
+    if (large)
+    {
+	str->car = rep_MAKE_STRING_CAR (rep_STRING_LARGE_LEN);
+	rep_LARGE_STRING_LEN (rep_VAL (str)) = len;
+    }
+    else
+	str->car = rep_MAKE_STRING_CAR (len);
     return rep_VAL (str);
 }
 
+/* PTR should have been allocated using rep_alloc or malloc. Ownership
+   of its memory passes to the lisp system. LEN _doesn't_ include the zero
+   terminator */
+repv
+rep_box_string (char *ptr, long len)
+{
+    if(len > rep_MAX_STRING - (long) rep_LARGE_STRING_PREFIX)
+	return Fsignal(Qerror, rep_LIST_1(rep_VAL(&string_overflow)));
+
+    if(len > rep_max_short_string)
+    {
+	/* make room for the length */
+	char *mem = rep_realloc (ptr, len + 1 + rep_LARGE_STRING_PREFIX);
+	if (mem == NULL)
+	{
+	    rep_free (ptr);
+	    return rep_mem_error ();
+	}
+	memmove (mem + rep_LARGE_STRING_PREFIX, mem, len + 1);
+	return box_string (mem + rep_LARGE_STRING_PREFIX, len, rep_TRUE);
+    }
+    return box_string (ptr, len, rep_FALSE);
+}
+
+/* Return a string of the LEN characters at DATA, using them where
+   they are if they're in a file read by rep_read_file_data and
+   followed by a null, otherwise copying them */
+repv
+rep_box_mapped_string (char *data, long len)
+{
+    if (IN_MAPPED_FILES (data) && len <= rep_max_short_string
+	&& data[len] == 0)
+    {
+	return box_string (data, len, rep_FALSE);
+    }
+    else
+	return rep_string_dupn (data, len);
+}
+
 /* Return a string object with room for exactly LEN characters. No extra
    byte is allocated for a zero terminator; do this manually if required. */
 repv
 rep_make_string(long len)
 {
-    char *data = rep_alloc (len);
+    char *data;
+    if(len - 1 > rep_MAX_STRING - (long) rep_LARGE_STRING_PREFIX)
+	return Fsignal(Qerror, rep_LIST_1(rep_VAL(&string_overflow)));
+    if(len - 1 > rep_max_short_string)
+    {
+	data = rep_alloc (len + rep_LARGE_STRING_PREFIX);
+	if(data == NULL)
+	    return rep_NULL;
+	return box_string (data + rep_LARGE_STRING_PREFIX, len - 1, rep_TRUE);
+    }
+    data = arena_alloc_body (len);
+    if(data == NULL)
+	data = rep_alloc (len);
     if(data != NULL)
-	return rep_box_string (data, len - 1);
+	return box_string (data, len - 1, rep_FALSE);
     else
 	return rep_NULL;
 }
@@ -336,70 +960,100 @@ string_cmp(repv v1, repv v2)
 	return 1;
 }
 
+static unsigned long
+string_size (repv str)
+{
+    return sizeof (rep_string) + rep_STRING_LEN(str) + 1;
+}
+
+/* Free the characters of the string STR */
+static inline void
+free_string_data (rep_string *str)
+{
+    if (rep_STRING_LARGE_P (rep_VAL (str)))
+	rep_free (str->data - rep_LARGE_STRING_PREFIX);
+    else if (!IN_STRING_ARENA (str->data) && !IN_MAPPED_FILES (str->data))
+	rep_free (str->data);
+}
+
+/* Free the unmarked strings of block CB, adding their headers to the
+   free list, and put it back on the block chain (unless it's empty, in
+   which case it's freed). */
 static void
-string_sweep(void)
+sweep_string_block (rep_string_block *cb)
 {
-    rep_string_block *cb = string_block_chain;
-    string_block_chain = NULL;
-    string_freelist = NULL;
-    used_strings = 0;
-    allocated_string_bytes = 0;
-    while(cb != NULL)
+    rep_string *newfree = NULL, *newfreetail = NULL, *this;
+    int i, newused = 0;
+    for(i = 0, this = cb->data; i < rep_STRINGBLK_SIZE; i++, this++)
     {
-	rep_string_block *nxt = cb->next.p;
-	rep_string *newfree = NULL, *newfreetail = NULL, *this;
-	int i, newused = 0;
-	for(i = 0, this = cb->data; i < rep_STRINGBLK_SIZE; i++, this++)
+	/* if on the freelist then the CELL_IS_8 bit
+	   will be unset (since the pointer is long aligned) */
+	if(rep_CELL_CONS_P(rep_VAL(this))
+	   || !rep_GC_CELL_MARKEDP(rep_VAL(this)))
 	{
-	    /* if on the freelist then the CELL_IS_8 bit
-	       will be unset (since the pointer is long aligned) */
-	    if(rep_CELL_CONS_P(rep_VAL(this))
-	       || !rep_GC_CELL_MARKEDP(rep_VAL(this)))
-	    {
-		if(!newfreetail)
-		    newfreetail = this;
-		if (!rep_CELL_CONS_P(rep_VAL(this)))
-		    rep_free (this->data);
-		this->car = rep_VAL(newfree);
-		newfree = this;
-	    }
-	    else
-	    {
-		rep_GC_CLR_CELL(rep_VAL(this));
-		allocated_string_bytes += rep_STRING_LEN(rep_VAL(this));
-		newused++;
-	    }
+	    if(!newfreetail)
+		newfreetail = this;
+	    if (!rep_CELL_CONS_P(rep_VAL(this)))
+		free_string_data (this);
+	    this->car = rep_VAL(newfree);
+	    newfree = this;
 	}
-	if(newused == 0)
+	else
 	{
-	    /* Whole block is unused, get rid of it.  */
-	    rep_free(cb);
-	    allocated_strings -= rep_STRINGBLK_SIZE;
+	    rep_GC_CLR_CELL(rep_VAL(this));
+	    allocated_string_bytes += rep_STRING_LEN(rep_VAL(this));
+	    newused++;
 	}
-	else
+    }
+    if(newused == 0)
+    {
+	/* Whole block is unused, get rid of it.  */
+	rep_free(cb);
+	allocated_strings -= rep_STRINGBLK_SIZE;
+    }
+    else
+    {
+	if(newfreetail != NULL)
 	{
-	    if(newfreetail != NULL)
-	    {
-		/* Link this mini-freelist onto the main one.  */
-		newfreetail->car = rep_VAL(string_freelist);
-		string_freelist = newfree;
-		used_strings += newused;
-	    }
-	    /* Have to rebuild the block chain as well.  */
-	    cb->next.p = string_block_chain;
-	    string_block_chain = cb;
+	    /* Link this mini-freelist onto the main one.  */
+	    newfreetail->car = rep_VAL(string_freelist);
+	    string_freelist = newfree;
 	}
-	cb = nxt;
+	used_strings += newused;
+	cb->next.p = string_block_chain;
+	string_block_chain = cb;
     }
 }
 
+/* Blocks are swept lazily, by rep_box_string */
+static void
+string_sweep(void)
+{
+    assert (string_unswept == NULL);
+    string_arena_sweep ();
+    mapped_files_sweep ();
+    string_unswept = string_block_chain;
+    string_block_chain = NULL;
+    string_freelist = NULL;
+    used_strings = 0;
+    allocated_string_bytes = 0;
+}
+
 /* Sets the length-field of the dynamic string STR to LEN. */
 rep_bool
 rep_set_string_len(repv str, long len)
 {
     if(rep_STRING_WRITABLE_P(str))
     {
-	rep_STRING(str)->car = rep_MAKE_STRING_CAR(len);
+	if(rep_STRING_LARGE_P(str))
+	    rep_LARGE_STRING_LEN(str) = len;
+	else
+	{
+	    /* keep the mark bit, the block may not have been swept yet */
+	    rep_STRING(str)->car = (rep_MAKE_STRING_CAR(len)
+				    | (rep_STRING(str)->car
+				       & rep_CELL_MARK_BIT));
+	}
 	return rep_TRUE;
     }
     else
@@ -459,31 +1113,288 @@ rep_cons_block *rep_cons_block_chain;
 rep_cons *rep_cons_freelist;
 int rep_allocated_cons, rep_used_cons;
 
-rep_cons *
-rep_allocate_cons (void)
+/* Blocks with free cells that haven't been allocated from since the
+   last gc, and blocks that have (the nursery). Only cells in the
+   nursery can be younger than the last gc, so that's all a minor
+   collection needs to sweep. */
+static rep_cons_block *cons_free_blocks, *cons_nursery;
+
+/* Blocks with free cells whose free lists haven't been rebuilt since
+   the last full collection. Sweeping is done lazily, a block at a time
+   as the allocator needs one. */
+static rep_cons_block *cons_unswept;
+
+/* Sum of the `used' fields of all cons blocks, and the number of cells
+   marked by the current full collection. After a full collection the
+   `used' fields are out of date until count_cons_blocks has reached
+   each block, but cons_live is set from marked_cons at once. */
+static int cons_live, marked_cons;
+
+/* The first block in rep_cons_block_chain not yet reached by
+   count_cons_blocks since the last full collection, or null, and the
+   block before it (null while it was the head of the chain when the
+   collection finished). Blocks added to the chain since then are
+   before it. */
+static rep_cons_block *cons_uncounted, *cons_counted_prev;
+
+/* True once a full collection has built the remembered set */
+static rep_bool remembered_valid;
+
+/* True when a cell couldn't be added to the remembered set, which is
+   then invalid until the next full collection has rebuilt it */
+static rep_bool remembered_overflowed;
+
+/* Empty blocks count_cons_blocks may still keep for allocation */
+static int cons_spare_blocks;
+
+/* The next block whose marks clear_cons_marks_step has to clear, while
+   cons_clearing is true */
+static rep_cons_block *cons_uncleared;
+static rep_bool cons_clearing;
+
+/* Blocks count_cons_blocks looks at when the allocator has none to
+   allocate from */
+#define CONS_COUNT_BATCH 32
+
+#ifdef USE_CONS_ARENAS
+
+/* Cons blocks are carved from arenas of CONS_ARENA_BLOCKS blocks mapped
+   directly from the system, aligned to their size, so that the memory
+   of blocks that full collections find to be empty can be given back
+   (see free_cons_block). With huge pages, arenas are only returned
+   once all their blocks are empty, releasing single blocks would split
+   the pages. */
+
+#define CONS_ARENA_BYTES	(2 * 1024 * 1024)
+#define CONS_ARENA_BLOCKS	(CONS_ARENA_BYTES / rep_CONSBLK_BYTES)
+#define CONS_ARENA_MAP_WORDS	(CONS_ARENA_BLOCKS / rep_CONSBLK_WORD_BITS)
+
+typedef struct cons_arena_struct {
+    struct cons_arena_struct *next;
+    char *base;
+    int n_free;
+    rep_bool huge;
+    /* a bit set for each block not in use */
+    unsigned long free_map[CONS_ARENA_MAP_WORDS];
+} cons_arena;
+
+static cons_arena *cons_arenas;
+static int n_cons_arenas;
+
+#endif /* USE_CONS_ARENAS */
+
+/* True if new arenas should use transparent huge pages */
+static rep_bool cons_huge_pages;
+
+/* Number of blocks in rep_cons_block_chain */
+static int n_cons_blocks;
+
+#ifdef USE_CONS_ARENAS
+
+/* True if the unused blocks of arena A still take up memory */
+#ifdef HAVE_MADVISE
+# define RETAINS_FREE_BLOCKS(a) ((a)->huge)
+#else
+# define RETAINS_FREE_BLOCKS(a) rep_TRUE
+#endif
+
+/* Map SIZE bytes aligned to SIZE */
+static char *
+map_aligned (size_t size)
 {
-    rep_cons *cn;
-    cn = rep_cons_freelist;
-    if(cn == NULL)
-    {
-	rep_cons_block *cb;
-	cb = rep_alloc(sizeof(rep_cons_block));
-	if(cb != NULL)
+    char *mem, *aligned;
+    mem = mmap (0, size * 2, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+	return 0;
+    aligned = (char *) (((repv) mem + size - 1) & ~(repv) (size - 1));
+    if (aligned > mem)
+	munmap (mem, aligned - mem);
+    munmap (aligned + size, mem + size - aligned);
+    return aligned;
+}
+
+static cons_arena *
+make_cons_arena (void)
+{
+    cons_arena *a = rep_alloc (sizeof (cons_arena));
+    if (a == 0)
+	return 0;
+    a->base = map_aligned (CONS_ARENA_BYTES);
+    if (a->base == 0)
+    {
+	rep_free (a);
+	return 0;
+    }
+    a->huge = rep_FALSE;
+#ifdef MADV_HUGEPAGE
+    if (cons_huge_pages)
+	a->huge = (madvise (a->base, CONS_ARENA_BYTES, MADV_HUGEPAGE) == 0);
+#endif
+    a->n_free = CONS_ARENA_BLOCKS;
+    memset (a->free_map, 0xff, sizeof (a->free_map));
+    a->next = cons_arenas;
+    cons_arenas = a;
+    n_cons_arenas++;
+    return a;
+}
+
+static rep_cons_block *
+alloc_cons_block (void)
+{
+    cons_arena *a;
+    unsigned long word;
+    int i, bit;
+    for (a = cons_arenas; a != 0 && a->n_free == 0; a = a->next)
+	;
+    if (a == 0 && (a = make_cons_arena ()) == 0)
+	return 0;
+    for (i = 0; a->free_map[i] == 0; i++)
+	;
+    word = a->free_map[i];
+    for (bit = 0; !(word & (1UL << bit)); bit++)
+	;
+    a->free_map[i] = word & ~(1UL << bit);
+    a->n_free--;
+    return (rep_cons_block *) (a->base + (i * rep_CONSBLK_WORD_BITS + bit)
+			       * rep_CONSBLK_BYTES);
+}
+
+/* Give the memory of block CB back to its arena, and the arena back
+   to the system once none of its blocks are in use */
+static void
+free_cons_block (rep_cons_block *cb)
+{
+    char *base = (char *) ((repv) cb & ~(repv) (CONS_ARENA_BYTES - 1));
+    cons_arena *a, **ptr;
+    int i = ((char *) cb - base) / rep_CONSBLK_BYTES;
+    for (a = cons_arenas; a->base != base; a = a->next)
+	;
+    a->free_map[i / rep_CONSBLK_WORD_BITS] |= 1UL << (i % rep_CONSBLK_WORD_BITS);
+    a->n_free++;
+    if (a->n_free == CONS_ARENA_BLOCKS)
+    {
+	munmap (a->base, CONS_ARENA_BYTES);
+	for (ptr = &cons_arenas; *ptr != a; ptr = &(*ptr)->next)
+	    ;
+	*ptr = a->next;
+	n_cons_arenas--;
+	rep_free (a);
+    }
+#ifdef HAVE_MADVISE
+    else if (!a->huge)
+	madvise ((void *) cb, rep_CONSBLK_BYTES, MADV_DONTNEED);
+#endif
+}
+
+#else /* USE_CONS_ARENAS */
+
+static rep_cons_block *
+alloc_cons_block (void)
+{
+    rep_cons_block *cb;
+#ifdef HAVE_POSIX_MEMALIGN
+    void *mem;
+    if (posix_memalign (&mem, rep_CONSBLK_BYTES, sizeof (rep_cons_block)) != 0)
+	return 0;
+    cb = mem;
+#else
+    /* Over-allocate, then store the real address before the block */
+    char *mem = malloc (sizeof (rep_cons_block) + rep_CONSBLK_BYTES);
+    if (mem == 0)
+	return 0;
+    cb = (rep_cons_block *) (((repv) mem + sizeof (void *)
+			      + rep_CONSBLK_BYTES - 1)
+			     & ~(repv) (rep_CONSBLK_BYTES - 1));
+    ((void **) cb)[-1] = mem;
+#endif
+    return cb;
+}
+
+static void
+free_cons_block (rep_cons_block *cb)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+    free (cb);
+#else
+    free (((void **) cb)[-1]);
+#endif
+}
+
+#endif /* !USE_CONS_ARENAS */
+
+static rep_cons_block *
+make_cons_block (void)
+{
+    rep_cons_block *cb = alloc_cons_block ();
+    int i;
+    if (cb == 0)
+	return 0;
+    memset (&cb->h, 0, sizeof (cb->h));
+    for (i = 0; i < (rep_CONSBLK_SIZE - 1); i++)
+	cb->cons[i].cdr = rep_CONS_VAL(&cb->cons[i + 1]);
+    cb->cons[i].cdr = 0;
+    cb->h.freelist = cb->cons;
+    cb->h.next = rep_cons_block_chain;
+    rep_cons_block_chain = cb;
+    rep_allocated_cons += rep_CONSBLK_SIZE;
+    n_cons_blocks++;
+    return cb;
+}
+
+/* Sweep block CB, which has been taken from one of the queues of
+   blocks with free cells, updating the count of live cells. Returns
+   true if it has any free cells. */
+static rep_bool
+resweep_cons_block (rep_cons_block *cb)
+{
+    int used = sweep_cons_block (cb, rep_FALSE);
+    cons_live += used - cb->h.used;
+    cb->h.used = used;
+    return used < rep_CONSBLK_SIZE;
+}
+
+/* Called when rep_cons_freelist is empty. Makes the free cells of the
+   next block with space current, returning the first of them. Blocks
+   left unswept by the last full collection are used first. A block
+   waiting in the free queue is swept again too, a minor collection
+   may have marked (i.e. promoted) some of its free cells through stale
+   references, and a marked cell must never be handed out as new. (But
+   not while incremental marking is in progress, or its marks are
+   being cleared, when unmarked cells may still be live; there are no
+   unswept blocks then.) */
+rep_cons *
+rep_allocate_cons (void)
+{
+    rep_cons_block *cb;
+    if (cons_unswept == 0)
+	count_cons_blocks (CONS_COUNT_BATCH);
+    for (;;)
+    {
+	if ((cb = cons_unswept) != 0)
+	    cons_unswept = cb->h.alloc_next;
+	else if ((cb = cons_free_blocks) != 0)
 	{
-	    int i;
-	    rep_allocated_cons += rep_CONSBLK_SIZE;
-	    cb->next.p = rep_cons_block_chain;
-	    rep_cons_block_chain = cb;
-	    for(i = 0; i < (rep_CONSBLK_SIZE - 1); i++)
-		cb->cons[i].cdr = rep_CONS_VAL(&cb->cons[i + 1]);
-	    cb->cons[i].cdr = 0;
-	    rep_cons_freelist = cb->cons;
+	    cons_free_blocks = cb->h.alloc_next;
+	    if (rep_gc_marking || cons_clearing)
+		break;
 	}
 	else
+	    break;
+	if (resweep_cons_block (cb))
+	    break;
+    }
+    if (cb == 0)
+    {
+	cb = make_cons_block ();
+	if (cb == 0)
 	    return rep_CONS (rep_mem_error ());
-	cn = rep_cons_freelist;
     }
-    return cn;
+    cb->h.alloc_next = cons_nursery;
+    cons_nursery = cb;
+    rep_cons_freelist = cb->h.freelist;
+    cb->h.freelist = 0;
+    return rep_cons_freelist;
 }
 
 DEFUN("cons", Fcons, Scons, (repv car, repv cdr), rep_Subr2) /*
@@ -499,47 +1410,186 @@ Returns a new cons-cell with car CAR and cdr CDR.
     rep_cons_freelist = rep_CONS (c->cdr);
     rep_used_cons++;
     rep_data_after_gc += sizeof(rep_cons);
+    rep_SAMPLE_ALLOC (sizeof(rep_cons));
 
     c->car = car;
     c->cdr = cdr;
     return rep_CONS_VAL (c);
 }
 
+/* The cell is left for the next sweep of its block to collect, it
+   can't be put straight back on a free list since the block's list
+   may be rebuilt from the mark bits before then. */
 void
 rep_cons_free(repv cn)
 {
-    rep_CDR(cn) = rep_CONS_VAL(rep_cons_freelist);
-    rep_cons_freelist = rep_CONS(cn);
+    if (rep_gc_marking && rep_GC_CONS_MARKEDP(cn))
+	marked_cons--;
+    rep_GC_CLR_CONS(cn);
+    rep_CONS_MAP_WORD(remembered, cn) &= ~rep_CONS_MAP_BIT(cn);
+    rep_CAR(cn) = rep_CDR(cn) = Qnil;
     rep_used_cons--;
 }
 
-static void
-cons_sweep(void)
+/* Rebuild the free list of block CB from its unmarked cells, returning
+   the number of marked cells. Mark bits aren't cleared, a marked cell
+   stays marked (i.e. old) until the next full collection. Unless
+   REMEMBER is false, old cells referring to objects that minor
+   collections need to trace are added to the remembered set. */
+static int
+sweep_cons_block (rep_cons_block *cb, rep_bool remember)
 {
-    rep_cons_block *cb;
-    rep_cons *tem_freelist = 0;
-    int tem_used = 0;
-    for (cb = rep_cons_block_chain; cb != 0; cb = cb->next.p)
+    rep_cons *freelist = 0;
+    int i, used = 0;
+    for (i = rep_CONSBLK_SIZE - 1; i >= 0; i--)
+    {
+	repv cell = rep_CONS_VAL (cb->cons + i);
+	if (!rep_GC_CONS_MARKEDP (cell))
+	{
+	    cb->cons[i].cdr = rep_CONS_VAL (freelist);
+	    freelist = cb->cons + i;
+	}
+	else
+	{
+	    used++;
+	    if (remember && rep_gc_generational)
+		remember_if_traced (cell);
+	}
+    }
+    cb->h.freelist = freelist;
+    return used;
+}
+
+static inline int
+count_bits (unsigned long word)
+{
+#ifdef __GNUC__
+    return __builtin_popcountl (word);
+#else
+    int n = 0;
+    for (; word != 0; word &= word - 1)
+	n++;
+    return n;
+#endif
+}
+
+/* Return the number of marked cells in block CB. When generational,
+   those that minor collections need to know about are also added to
+   the remembered set. */
+static int
+count_marked_conses (rep_cons_block *cb)
+{
+    int i, used = 0;
+    for (i = 0; i < rep_CONSBLK_MAP_WORDS; i++)
     {
-	register rep_cons *this = cb->cons;
-	rep_cons *last = cb->cons + rep_CONSBLK_SIZE;
-	while (this < last)
+	unsigned long word = cb->h.mark[i];
+	used += count_bits (word);
+	if (rep_gc_generational)
 	{
-	    if (!rep_GC_CONS_MARKEDP (rep_CONS_VAL (this)))
+	    int slot = i * rep_CONSBLK_WORD_BITS;
+	    for (; word != 0; word >>= 1, slot++)
 	    {
-		this->cdr = rep_CONS_VAL (tem_freelist);
-		tem_freelist = rep_CONS (this);
+		if (word & 1)
+		    remember_if_traced ((repv) cb + slot * sizeof (rep_cons));
 	    }
-	    else
+	}
+    }
+    return used;
+}
+
+/* The sweep of a full collection. Nothing is done to the blocks yet,
+   count_cons_blocks does that later, a few at a time. */
+static void
+cons_sweep(void)
+{
+    cons_spare_blocks = (rep_gc_threshold
+			 / (rep_CONSBLK_SIZE * sizeof (rep_cons)) + 1);
+    cons_unswept = cons_free_blocks = cons_nursery = 0;
+    rep_cons_freelist = 0;
+    cons_live = rep_used_cons = marked_cons;
+    cons_uncounted = rep_cons_block_chain;
+    cons_counted_prev = 0;
+    /* the remembered set is rebuilt as the blocks are counted */
+    remembered_overflowed = rep_FALSE;
+    remembered_valid = rep_gc_generational && cons_uncounted == 0;
+}
+
+/* Remove block CB from rep_cons_block_chain and free it */
+static void
+unchain_cons_block (rep_cons_block *cb, rep_cons_block *prev)
+{
+    if (prev != 0)
+	prev->h.next = cb->h.next;
+    else
+    {
+	rep_cons_block **ptr = &rep_cons_block_chain;
+	while (*ptr != cb)
+	    ptr = &(*ptr)->h.next;
+	*ptr = cb->h.next;
+    }
+    free_cons_block (cb);
+    rep_allocated_cons -= rep_CONSBLK_SIZE;
+    n_cons_blocks--;
+}
+
+/* Finish the sweep of the last full collection for up to N more
+   blocks. Only the mark bitmaps are looked at, the blocks with free
+   cells are queued to have their free lists rebuilt when needed.
+   Empty blocks beyond those needed to allocate garbage-threshold
+   bytes of cells are given back (see free_cons_block). Returns false
+   if no blocks are left. */
+static rep_bool
+count_cons_blocks (int n)
+{
+    while (cons_uncounted != 0 && n-- > 0)
+    {
+	rep_cons_block *cb = cons_uncounted;
+	cons_uncounted = cb->h.next;
+	cb->h.used = count_marked_conses (cb);
+	if (cb->h.used == 0 && cons_spare_blocks-- <= 0)
+	    unchain_cons_block (cb, cons_counted_prev);
+	else
+	{
+	    cb->h.freelist = 0;
+	    if (cb->h.used < rep_CONSBLK_SIZE)
 	    {
-		rep_GC_CLR_CONS (rep_CONS_VAL (this));
-		tem_used++;
+		cb->h.alloc_next = cons_unswept;
+		cons_unswept = cb;
 	    }
-	    this++;
+	    cons_counted_prev = cb;
+	}
+	if (cons_uncounted == 0)
+	    remembered_valid = rep_gc_generational && !remembered_overflowed;
+    }
+    return cons_uncounted != 0;
+}
+
+/* Sweep only the blocks allocated from since the last gc */
+static void
+cons_sweep_nursery (void)
+{
+    rep_cons_block *cb = cons_nursery, *next;
+    cons_nursery = 0;
+    rep_cons_freelist = 0;
+    for (; cb != 0; cb = next)
+    {
+	int used = sweep_cons_block (cb, rep_TRUE);
+	next = cb->h.alloc_next;
+	cons_live += used - cb->h.used;
+	cb->h.used = used;
+	if (used < rep_CONSBLK_SIZE)
+	{
+	    cb->h.alloc_next = cons_free_blocks;
+	    cons_free_blocks = cb;
 	}
     }
-    rep_cons_freelist = tem_freelist;
-    rep_used_cons = tem_used;
+    rep_used_cons = cons_live;
+}
+
+static unsigned long
+cons_size (repv cn)
+{
+    return sizeof (rep_cons);
 }
 
 static int
@@ -602,11 +1652,55 @@ rep_make_vector(int size)
 	v->next = vector_chain;
 	vector_chain = v;
 	used_vector_slots += size;
-	rep_data_after_gc += len;
+	rep_NOTE_ALLOC (rep_Vector, len);
     }
     return rep_VAL(v);
 }
 
+/* Make a compiled function of SIZE slots, each nil, followed by
+   N_CACHES empty inline caches */
+repv
+rep_make_compiled (int size, int n_caches)
+{
+    int len = (rep_VECT_SIZE (size) + sizeof (rep_inline_caches)
+	       + sizeof (rep_inline_cache) * (n_caches > 0 ? n_caches - 1 : 0));
+    rep_vector *v = rep_ALLOC_CELL (len);
+    if (v != NULL)
+    {
+	rep_inline_caches *caches;
+	int i;
+	v->car = (size << 8) | rep_Compiled;
+	for (i = 0; i < size; i++)
+	    v->array[i] = Qnil;
+	caches = rep_COMPILED_CACHES (rep_VAL (v));
+	memset (caches, 0, len - rep_VECT_SIZE (size));
+	caches->count = n_caches;
+	v->next = vector_chain;
+	vector_chain = v;
+	used_vector_slots += size;
+	rep_NOTE_ALLOC (rep_Compiled, len);
+    }
+    return rep_VAL (v);
+}
+
+/* Return a new compiled function with the same slots as vector or
+   compiled function VEC, whose second slot is the constant vector */
+repv
+rep_vector_to_compiled (repv vec)
+{
+    int len = rep_VECT_LEN (vec), i;
+    repv consts = rep_VECTI (vec, 1);
+    repv fun = rep_make_compiled (len, rep_VECTORP (consts)
+				  ? rep_VECT_LEN (consts) : 0);
+    if (fun != rep_NULL)
+    {
+	for (i = 0; i < len; i++)
+	    rep_VECTI (fun, i) = rep_VECTI (vec, i);
+	rep_verify_compiled (fun);
+    }
+    return fun;
+}
+
 static void
 vector_sweep(void)
 {
@@ -617,7 +1711,17 @@ vector_sweep(void)
     {
 	rep_vector *nxt = this->next;
 	if(!rep_GC_CELL_MARKEDP(rep_VAL(this)))
+	{
+	    if (rep_COMPILEDP (rep_VAL (this)))
+	    {
+		rep_inline_caches *caches = rep_COMPILED_CACHES (rep_VAL (this));
+		if (caches->quick != 0)
+		    rep_free (caches->quick);
+		if (caches->jit != 0)
+		    rep_jit_free (caches->jit);
+	    }
 	    rep_FREE_CELL(this);
+	}
 	else
 	{
 	    this->next = vector_chain;
@@ -629,6 +1733,20 @@ vector_sweep(void)
     }
 }
 
+static unsigned long
+vector_size (repv v)
+{
+    return rep_VECT_SIZE(rep_VECT_LEN(v));
+}
+
+static unsigned long
+compiled_size (repv v)
+{
+    long n = rep_COMPILED_CACHES (v)->count;
+    return (rep_VECT_SIZE (rep_VECT_LEN (v)) + sizeof (rep_inline_caches)
+	    + sizeof (rep_inline_cache) * (n > 0 ? n - 1 : 0));
+}
+
 static int
 vector_cmp(repv v1, repv v2)
 {
@@ -652,7 +1770,7 @@ DEFUN("make-primitive-guardian", Fmake_primitive_guardian,
       Smake_primitive_guardian, (void), rep_Subr0)
 {
     rep_guardian *g = rep_ALLOC_CELL (sizeof (rep_guardian));
-    rep_data_after_gc += sizeof (rep_guardian);
+    rep_NOTE_ALLOC (rep_guardian_type, sizeof (rep_guardian));
     g->car = rep_guardian_type;
     g->accessible = Qnil;
     g->inaccessible = Qnil;
@@ -703,16 +1821,16 @@ run_guardians (void)
     for (g = guardians; g != 0; g = g->next)
     {
 	repv *ptr = &g->accessible;
-	/* cons cells store mark bit in CDR, so mask it out. */
-	while ((*ptr & ~rep_VALUE_CONS_MARK_BIT) != Qnil)
+	while (*ptr != Qnil)
 	{
-	    repv cell = *ptr & ~rep_VALUE_CONS_MARK_BIT;
-	    if (!rep_GC_MARKEDP (rep_CAR (cell)))
+	    repv cell = *ptr;
+	    if (rep_CELLP (rep_CAR (cell)) && !rep_GC_MARKEDP (rep_CAR (cell)))
 	    {
-		/* move object to inaccessible list */
+		/* move object to inaccessible list. No barrier is
+		   needed, every cell of the lists is marked below,
+		   so none is younger than another after the sweep */
 		struct saved *new;
-		/* have to preserve the cons mark bit in *ptr */
-		*ptr = rep_GCDR (cell) | (*ptr & rep_VALUE_CONS_MARK_BIT);
+		*ptr = rep_CDR (cell);
 		rep_CDR (cell) = g->inaccessible;
 		g->inaccessible = cell;
 
@@ -726,7 +1844,11 @@ run_guardians (void)
 		ptr = rep_CDRLOC (cell);
 
 	    /* mark the list infrastructure */
-	    rep_GC_SET_CONS (cell);
+	    if (!rep_GC_CONS_MARKEDP (cell))
+	    {
+		rep_GC_SET_CONS (cell);
+		marked_cons++;
+	    }
 	}
     }
 
@@ -780,6 +1902,231 @@ rep_bool rep_in_gc = rep_FALSE;
    rep_idle_gc_threshold = value that DAGC should be before gc'ing in idle time */
 int rep_data_after_gc, rep_gc_threshold = 200000, rep_idle_gc_threshold = 20000;
 
+/* When true, automatic collections are minor (i.e. only free cons cells
+   allocated since the last gc) until major_gc_threshold bytes of data
+   have survived minor collections; then a full collection is done */
+rep_bool rep_gc_generational = rep_FALSE;
+static int major_gc_threshold = 2000000;
+
+/* True while a minor collection is in progress */
+static rep_bool gc_minor;
+
+/* When non-zero, full collections triggered automatically are done
+   incrementally: marking is divided into steps of about this many
+   microseconds, run from allocation points and when idle, between
+   which evaluation continues. */
+static int gc_max_pause;
+
+/* True while an incremental collection is marking */
+rep_bool rep_gc_marking;
+
+/* True if rep_CONS_BARRIER has anything to do, i.e. when generational
+   collection is enabled or incremental marking is in progress */
+rep_bool rep_gc_barrier_active;
+
+/* Bytes of data that have survived minor collections since the last
+   full collection */
+static int old_growth;
+
+/* Old cons cells that may refer to younger cells, or to objects that
+   can't be skipped by minor collections (see TRACED_P). Membership is
+   also recorded in the `remembered' bitmaps of the cons blocks. */
+static repv *remembered;
+static int n_remembered, allocated_remembered;
+
+/* Non-cons objects marked by the current minor collection. Since only
+   conses are swept, these are unmarked once it's finished. */
+static repv *minor_marked;
+static int n_minor_marked, allocated_minor_marked;
+
+/* True when an object couldn't be added to minor_marked. The minor
+   collection then marks nothing else, and a full collection is done
+   instead (see minor_gc). */
+static rep_bool minor_marked_overflowed;
+
+/* Objects reached by marking whose children are yet to be marked
+   (i.e. the grey objects). Marking uses this instead of recursion, so
+   deep structures can't overflow the C stack. It grows up to
+   MARK_STACK_MAX entries; after that conses that can't be pushed are
+   marked, and their children found later by scanning the marked cells
+   of all cons blocks (see rescan_marked_conses).
+
+   Vectors are marked MARK_SLICE elements at a time: the rest of a
+   vector is left on the stack as two entries, the vector and above it
+   the fixnum index of the first element still to be marked. */
+static repv *mark_stack;
+static int n_mark_stack, allocated_mark_stack;
+static rep_bool mark_stack_overflowed;
+
+#define MARK_STACK_MAX (1024 * 1024)
+#define MARK_SLICE 1024
+
+/* The deepest the mark stack has been, and the number of objects
+   that couldn't be pushed on it */
+static int mark_stack_peak, mark_stack_overflows;
+
+/* Depth of nested rep_mark_value calls; only the outermost call marks
+   anything, the others push their object on the mark stack. */
+static int mark_depth;
+
+#ifdef __GNUC__
+# define PREFETCH(v) __builtin_prefetch (rep_PTR (v))
+#else
+# define PREFETCH(v) do { } while (0)
+#endif
+
+#ifdef ENABLE_PARALLEL_GC
+
+/* Parallel marking. Full collections that aren't incremental may
+   divide the marking between gc_mark_threads threads. The calling
+   thread marks the roots, pushing them on its own stack, then each
+   thread marks from its private stack, moving some of its entries to
+   a shared stack when it has plenty and the shared stack is empty,
+   and taking the shared entries of the others when it runs out.
+   Objects are claimed by atomically setting their mark bits. Mark
+   functions are only called concurrently for types registered with
+   rep_set_parallel_mark; objects of other types are set aside, and
+   marked by the calling thread once the others have stopped. */
+
+#define MAX_MARK_THREADS 32
+
+/* Number of stack entries moved to the shared stack at once */
+#define MARK_SHARE_BATCH 64
+
+struct mark_worker {
+    /* Only used by the worker's own thread */
+    repv *stack;
+    int n_stack, allocated_stack;
+    unsigned int round;
+
+    /* Objects of each type this worker has marked, the bytes of
+       string data among them, and the cons cells it's marked */
+    unsigned long live[rep_TYPE_SLOTS];
+    unsigned long live_string_bytes;
+    int live_cons;
+
+    /* Entries other threads may take, protected by LOCK */
+    pthread_mutex_t lock;
+    repv *shared;
+    volatile int n_shared;
+    int allocated_shared;
+};
+
+/* Worker zero is the thread doing the collection */
+static struct mark_worker mark_workers[MAX_MARK_THREADS];
+
+/* Number of threads to mark with; one or less means don't */
+static int gc_mark_threads = 1;
+
+/* Full collections only mark in parallel when at least this many cons
+   cells are allocated, with smaller heaps it costs more than it saves */
+static int parallel_mark_min_cons = 1024 * 1024;
+
+/* True while marking in parallel */
+static rep_bool gc_parallel;
+
+/* The worker of the current thread while gc_parallel is set */
+static __thread struct mark_worker *current_worker;
+
+/* Helper threads started so far, and the number of workers (including
+   worker zero) in the current round of marking */
+static int n_mark_threads, n_round_workers;
+
+/* Each round of marking ends once all workers are idle */
+static volatile int idle_workers;
+static unsigned int mark_round;
+static int finished_workers;
+static pthread_mutex_t mark_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mark_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t mark_done_cond = PTHREAD_COND_INITIALIZER;
+
+/* Claimed objects whose types have no parallel mark function,
+   protected by mark_lock */
+static repv *deferred_marks;
+static int n_deferred_marks, allocated_deferred_marks;
+
+/* When deferred_marks can't be grown, a helper thread leaves its
+   object here for worker zero to mark straight away, waiting on
+   HANDED_MARK_COND while the slot is full. Protected by mark_lock. */
+static volatile repv handed_mark;
+static pthread_cond_t handed_mark_cond = PTHREAD_COND_INITIALIZER;
+
+/* Number of collections that marked in parallel */
+static int parallel_collections;
+
+# define GC_PARALLEL gc_parallel
+# define LIVE_COUNTS (gc_parallel ? current_worker->live : marked_live)
+# define LIVE_STRING_BYTES (*(gc_parallel				\
+			      ? &current_worker->live_string_bytes	\
+			      : &marked_string_bytes))
+# define LIVE_CONS (*(gc_parallel ? &current_worker->live_cons : &marked_cons))
+#else
+# define GC_PARALLEL 0
+# define LIVE_COUNTS marked_live
+# define LIVE_STRING_BYTES marked_string_bytes
+# define LIVE_CONS marked_cons
+#endif
+
+/* Non-cons objects that may refer to other objects (see TRACED_P)
+   marked by the incremental collection in progress, whose types don't
+   have write barriers (see rep_set_write_barrier). Stores into these
+   objects aren't tracked, so the final step scans them all again. */
+static repv *rescan;
+static int n_rescan, allocated_rescan;
+
+/* True when an object couldn't be added to rescan. The objects marked
+   since can't be found again, so the collection is finished without
+   letting evaluation continue (see rep_auto_gc). */
+static rep_bool rescan_overflowed;
+
+/* Pause times of minor and full collections, in microseconds */
+struct gc_stats {
+    int count;
+    rep_long_long total_time, max_time;
+    rep_long_long freed_cons;
+};
+static struct gc_stats minor_stats, major_stats, step_stats;
+
+/* Number of pauses of each kind lasting less than each of these
+   microseconds, the last entry counts the longer ones */
+static const int pause_limits[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+#define N_PAUSE_BUCKETS (sizeof (pause_limits) / sizeof (pause_limits[0]) + 1)
+static int pause_histogram[N_PAUSE_BUCKETS];
+
+/* See rep_NOTE_ALLOC */
+rep_alloc_stats rep_type_allocs[rep_TYPE_SLOTS];
+
+/* Bytes left to allocate before rep_alloc_sample_fun is next called,
+   see rep_SAMPLE_ALLOC. The function should reset the countdown. */
+long rep_alloc_sample_countdown = LONG_MAX;
+void (*rep_alloc_sample_fun)(void);
+
+void
+rep_alloc_sample (void)
+{
+    if (rep_alloc_sample_fun != 0)
+	(*rep_alloc_sample_fun) ();
+    else
+	rep_alloc_sample_countdown = LONG_MAX;
+}
+
+/* rep_used_cons when the last collection finished, and the number of
+   cons cells it found to be live */
+static int cons_used_after_gc, cons_live_after_gc;
+
+/* Objects of each type (other than conses) found to be live by the
+   last full collection, and those marked so far by the current one */
+static unsigned long type_live[rep_TYPE_SLOTS], marked_live[rep_TYPE_SLOTS];
+
+/* Bytes taken by the strings marked by the current full collection */
+static unsigned long marked_string_bytes;
+
+/* When non-zero, the percentage of the data found to be live by each
+   full collection that may be allocated before the next collection,
+   within the bounds below. Otherwise rep_gc_threshold is left alone. */
+static int gc_threshold_growth;
+static int min_gc_threshold = 200000, max_gc_threshold = 64 * 1024 * 1024;
+
 #ifdef GC_MONITOR_STK
 static int *gc_stack_high_tide;
 #endif
@@ -802,109 +2149,737 @@ rep_mark_static(repv *obj)
     static_roots[next_static_root++] = obj;
 }
 
-/* Mark a single Lisp object.
-   This attempts to eliminate as much tail-recursion as possible (by
-   changing the rep_VAL and jumping back to the `again' label).
+/* Return the array of static roots, storing their number in *COUNT */
+repv **
+rep_static_roots (int *count)
+{
+    *count = next_static_root;
+    return static_roots;
+}
 
-   Note that rep_VAL must not be NULL, and must not already have been
-   marked, (see the rep_MARKVAL macro in lisp.h) */
-void
-rep_mark_value(register repv val)
+#define REMEMBEREDP(cell) \
+    (rep_CONS_MAP_WORD(remembered, cell) & rep_CONS_MAP_BIT(cell))
+
+/* True if non-cons object V may refer to other objects */
+#define TRACED_P(v)							\
+    (!rep_CELL_STATIC_P(v)						\
+     && (rep_CELL16P(v)							\
+	 ? cell16_traced[rep_CELL16_TYPE(v) >> rep_CELL16_TYPE_SHIFT]	\
+	 : cell8_traced[rep_CELL8_TYPE(v) >> 1]))
+
+/* True if stores into non-cons object V call rep_OBJECT_BARRIER */
+#define WRITE_BARRIER_P(v)						\
+    (rep_CELL16P(v)							\
+     ? cell16_barrier[rep_CELL16_TYPE(v) >> rep_CELL16_TYPE_SHIFT]	\
+     : cell8_barrier[rep_CELL8_TYPE(v) >> 1])
+
+/* True if V is something that an old cons cell referring to it must
+   be remembered for: a young cons, or a non-leaf object. */
+static inline rep_bool
+needs_remembering (repv v)
 {
-#ifdef GC_MONITOR_STK
-    int dummy;
-    /* Assumes that the stack grows downwards (towards 0) */
-    if(&dummy < gc_stack_high_tide)
-	gc_stack_high_tide = &dummy;
-#endif
+    if (v == 0 || !rep_CELLP(v))
+	return rep_FALSE;
+    else if (rep_CELL_CONS_P(v))
+	return !rep_GC_CONS_MARKEDP(v);
+    else
+	return TRACED_P(v);
+}
 
-again:
-    if(rep_INTP(val))
-	return;
+/* Append V to the growable array *ARRAY, currently holding *N of
+   *ALLOCATED elements. Returns false if the array couldn't be grown,
+   leaving it unchanged. */
+static rep_bool
+push_value (repv **array, int *n, int *allocated, repv v)
+{
+    if (*n == *allocated)
+    {
+	int new_size = *allocated ? (*allocated * 2) : 1024;
+	repv *new;
+	if (*array != 0)
+	    new = rep_realloc (*array, new_size * sizeof (repv));
+	else
+	    new = rep_alloc (new_size * sizeof (repv));
+	if (new == 0)
+	    return rep_FALSE;
+	*array = new;
+	*allocated = new_size;
+    }
+    (*array)[(*n)++] = v;
+    return rep_TRUE;
+}
 
-    /* must be a cell */
-    if(rep_CELL_CONS_P(val))
+static void
+remember_cons (repv cell)
+{
+    /* the bit is set either way, the bitmaps are cleared by the full
+       collection that rebuilds the set */
+    rep_CONS_MAP_WORD(remembered, cell) |= rep_CONS_MAP_BIT(cell);
+    if (remembered_overflowed
+	|| !push_value (&remembered, &n_remembered,
+			&allocated_remembered, cell))
     {
-	if(rep_CONS_WRITABLE_P(val))
+	remembered_overflowed = rep_TRUE;
+	remembered_valid = rep_FALSE;
+    }
+}
+
+static void mark_object (repv val);
+
+static rep_bool
+grow_mark_stack (void)
+{
+    int new_size = allocated_mark_stack ? (allocated_mark_stack * 2) : 1024;
+    repv *new;
+    if (new_size > MARK_STACK_MAX)
+	return rep_FALSE;
+    if (mark_stack != 0)
+	new = rep_realloc (mark_stack, new_size * sizeof (repv));
+    else
+	new = rep_alloc (new_size * sizeof (repv));
+    if (new == 0)
+	return rep_FALSE;
+    mark_stack = new;
+    allocated_mark_stack = new_size;
+    return rep_TRUE;
+}
+
+/* Make V grey: it will be marked once the objects above it on the
+   mark stack have been */
+static inline void
+push_mark (repv v)
+{
+    if (n_mark_stack == allocated_mark_stack && !grow_mark_stack ())
+    {
+	mark_stack_overflows++;
+	if (rep_CELL_CONS_P(v) && !gc_minor)
 	{
-	    /* A cons. Attempts to walk though whole lists at a time
-	       (since Lisp lists mainly link from the cdr).  */
-	    rep_GC_SET_CONS(val);
-	    if(rep_NILP(rep_GCDR(val)))
-		/* End of a list. We can safely
-		   mark the car non-recursively.  */
-		val = rep_CAR(val);
-	    else
+	    /* leave the children for rescan_marked_conses () */
+	    if (rep_CONS_WRITABLE_P(v))
 	    {
-		rep_MARKVAL(rep_CAR(val));
-		val = rep_GCDR(val);
+		rep_GC_SET_CONS(v);
+		marked_cons++;
 	    }
-	    if(val && !rep_INTP(val) && !rep_GC_MARKEDP(val))
-		goto again;
-	    return;
+	    mark_stack_overflowed = rep_TRUE;
 	}
 	else
 	{
-	    /* A constant cons cell. */
-	    return;
+	    /* there's no way of finding other marked objects (in a
+	       minor collection old cells may be dead, and refer to
+	       freed objects), so fall back to recursion */
+	    mark_depth++;
+	    mark_object (v);
+	    mark_depth--;
 	}
+	return;
     }
+    mark_stack[n_mark_stack++] = v;
+    if (n_mark_stack > mark_stack_peak)
+	mark_stack_peak = n_mark_stack;
+}
 
-    if (rep_CELL16P(val))
+/* Pop the object at the top of the mark stack */
+static inline repv
+pop_mark (void)
+{
+    repv v = mark_stack[--n_mark_stack];
+    if (n_mark_stack > 0)
+	PREFETCH (mark_stack[n_mark_stack - 1]);
+    return v;
+}
+
+/* Mark the elements of vector V from index FROM onwards, leaving all
+   but the first MARK_SLICE of them on the mark stack. Returns the
+   number of elements marked. */
+static int
+mark_vector_slice (repv v, int from)
+{
+    int i, len = rep_VECT_LEN(v), end = len;
+    if (len - from > MARK_SLICE
+	&& n_mark_stack + 2 <= MARK_STACK_MAX
+	&& (n_mark_stack + 2 <= allocated_mark_stack || grow_mark_stack ()))
     {
-	/* A user allocated type. */
-	rep_type *t = rep_get_data_type(rep_CELL16_TYPE(val));
-	rep_GC_SET_CELL(val);
-	if (t->mark != 0)
-	    t->mark(val);
-	return;
+	/* pushed first, so the elements of this slice are marked
+	   before the next slice is started */
+	end = from + MARK_SLICE;
+	mark_stack[n_mark_stack++] = v;
+	mark_stack[n_mark_stack++] = rep_MAKE_INT(end);
+	if (n_mark_stack > mark_stack_peak)
+	    mark_stack_peak = n_mark_stack;
     }
+    for (i = from; i < end; i++)
+	rep_MARKVAL(rep_VECTI(v, i));
+    return end - from;
+}
 
-    /* So we know that it's a cell8 object */
-    switch(rep_CELL8_TYPE(val))
+/* Mark the entry at the top of the mark stack, returning a measure of
+   the work done */
+static inline int
+mark_top_entry (void)
+{
+    repv v = pop_mark ();
+    if (rep_INTP(v))
     {
-	rep_type *t;
-
-    case rep_Vector:
-    case rep_Compiled:
-	if(rep_VECTOR_WRITABLE_P(val))
-	{
-	    int i, len = rep_VECT_LEN(val);
-	    rep_GC_SET_CELL(val);
-	    for(i = 0; i < len; i++)
-		rep_MARKVAL(rep_VECTI(val, i));
-	}
-	break;
+	/* the rest of a vector */
+	int from = rep_INT(v);
+	return mark_vector_slice (pop_mark (), from);
+    }
+    if (!rep_GC_MARKEDP(v))
+	mark_object (v);
+    return 1;
+}
 
-    case rep_Symbol:
-	/* Dumped symbols are dumped read-write, so no worries.. */
-	rep_GC_SET_CELL(val);
-	rep_MARKVAL(rep_SYM(val)->name);
-	val = rep_SYM(val)->next;
-	if(val && !rep_INTP(val) && !rep_GC_MARKEDP(val))
-	    goto again;
-	break;
+static inline rep_bool
+traced_object_p (repv v)
+{
+    return v != 0 && rep_CELLP(v) && !rep_CELL_CONS_P(v) && TRACED_P(v);
+}
 
-    case rep_String:
-	if(!rep_STRING_WRITABLE_P(val))
-	    break;
-	rep_GC_SET_CELL(val);
-	break;
+/* Called by the sweepers for each surviving cell. At this point all
+   reachable conses are marked, only non-leaf objects matter. */
+static void
+remember_if_traced (repv cell)
+{
+    if (!REMEMBEREDP(cell)
+	&& (traced_object_p (rep_CAR(cell))
+	    || traced_object_p (rep_CDR(cell))))
+    {
+	remember_cons (cell);
+    }
+}
 
-    case rep_Number:
-	rep_GC_SET_CELL(val);
-	break;
+/* The write barrier, called by rep_CONS_BARRIER after storing into the
+   old (i.e. marked) cons cell CELL. */
+void
+rep_gc_remember_cons (repv cell)
+{
+    if (rep_gc_marking)
+    {
+	/* CELL is black, so anything it refers to has to be at least
+	   grey. The remembered set is rebuilt by the sweep. */
+	repv car = rep_CAR(cell), cdr = rep_CDR(cell);
+	if (car != 0 && rep_CELLP(car) && !rep_GC_MARKEDP(car))
+	    push_mark (car);
+	if (cdr != 0 && rep_CELLP(cdr) && !rep_GC_MARKEDP(cdr))
+	    push_mark (cdr);
+    }
+    else if (!REMEMBEREDP(cell)
+	&& (needs_remembering (rep_CAR(cell))
+	    || needs_remembering (rep_CDR(cell))))
+    {
+	remember_cons (cell);
+    }
+}
+
+/* The write barrier of the other types that have one, called by
+   rep_OBJECT_BARRIER after storing X into the marked object V while an
+   incremental collection is marking. X is made grey, rather than V,
+   so that a large object changed at every step isn't marked again at
+   every step. */
+void
+rep_gc_remember_object (repv v, repv x)
+{
+    if (WRITE_BARRIER_P(v)
+	&& x != 0 && rep_CELLP(x) && !rep_GC_MARKEDP(x))
+    {
+	push_mark (x);
+    }
+}
+
+/* Drop cells from the remembered set that no longer refer to anything
+   interesting; after a minor gc there are no young cells. */
+static void
+prune_remembered (void)
+{
+    int i, j;
+    for (i = j = 0; i < n_remembered; i++)
+    {
+	repv cell = remembered[i];
+	if (!REMEMBEREDP(cell))
+	    continue;
+	if (traced_object_p (rep_CAR(cell)) || traced_object_p (rep_CDR(cell)))
+	    remembered[j++] = cell;
+	else
+	    rep_CONS_MAP_WORD(remembered, cell) &= ~rep_CONS_MAP_BIT(cell);
+    }
+    n_remembered = j;
+}
+
+#ifdef ENABLE_PARALLEL_GC
+
+/* Double the size of the array *ARRAY of *ALLOCATED values. Marking
+   threads use the system allocator directly, rep_alloc isn't
+   thread-safe when debugging allocations. */
+static rep_bool
+grow_worker_array (repv **array, int *allocated)
+{
+    int new_size = *allocated ? (*allocated * 2) : 1024;
+    repv *new = realloc (*array, new_size * sizeof (repv));
+    if (new == 0)
+	return rep_FALSE;
+    *array = new;
+    *allocated = new_size;
+    return rep_TRUE;
+}
+
+/* Push V on the private stack of the current thread */
+static void
+worker_push (repv v)
+{
+    struct mark_worker *w = current_worker;
+    if (w->n_stack == w->allocated_stack
+	&& !grow_worker_array (&w->stack, &w->allocated_stack))
+    {
+	mark_object (v);
+	return;
+    }
+    w->stack[w->n_stack++] = v;
+}
+
+/* Claim the unmarked object VAL for the current thread, by setting its
+   mark bit. Returns false if another thread got there first. Objects
+   that are never marked are always claimed. */
+static inline rep_bool
+claim_object (repv val)
+{
+    if (rep_CELL_CONS_P(val))
+    {
+	unsigned long bit;
+	if (!rep_CONS_WRITABLE_P(val))
+	    return rep_TRUE;
+	bit = rep_CONS_MAP_BIT(val);
+	return !(__sync_fetch_and_or (&rep_CONS_MAP_WORD(mark, val), bit)
+		 & bit);
+    }
+    else if (!rep_CELL16P(val)
+	     && ((rep_CELL8_TYPE(val) >= rep_SF
+		  && rep_CELL8_TYPE(val) <= rep_SubrN)
+		 || (rep_CELL_STATIC_P(val)
+		     && rep_CELL8_TYPE(val) != rep_Symbol)))
+    {
+	return rep_TRUE;
+    }
+    else
+    {
+	return !(__sync_fetch_and_or (&rep_PTR(val)->car, rep_CELL_MARK_BIT)
+		 & rep_CELL_MARK_BIT);
+    }
+}
+
+/* Leave the claimed object V for the thread doing the collection. If
+   there's no room to keep it, that thread marks it now: no other
+   thread calls the mark functions that aren't thread-safe. */
+static void
+defer_mark (repv v)
+{
+    pthread_mutex_lock (&mark_lock);
+    if (n_deferred_marks < allocated_deferred_marks
+	|| grow_worker_array (&deferred_marks, &allocated_deferred_marks))
+    {
+	deferred_marks[n_deferred_marks++] = v;
+    }
+    else if (current_worker == &mark_workers[0])
+    {
+	pthread_mutex_unlock (&mark_lock);
+	rep_get_data_type (rep_CELL_TYPE(v))->mark (v);
+	return;
+    }
+    else
+    {
+	while (handed_mark != 0)
+	    pthread_cond_wait (&handed_mark_cond, &mark_lock);
+	handed_mark = v;
+    }
+    pthread_mutex_unlock (&mark_lock);
+}
+
+/* Called by worker zero to mark the object handed to it, if any.
+   Returns true if there was one. */
+static rep_bool
+mark_handed_object (void)
+{
+    repv v;
+    if (handed_mark == 0)
+	return rep_FALSE;
+    pthread_mutex_lock (&mark_lock);
+    v = handed_mark;
+    handed_mark = 0;
+    pthread_cond_signal (&handed_mark_cond);
+    pthread_mutex_unlock (&mark_lock);
+    if (v == 0)
+	return rep_FALSE;
+    rep_get_data_type (rep_CELL_TYPE(v))->mark (v);
+    return rep_TRUE;
+}
+
+/* Make a batch of W's private entries available to other threads */
+static void
+share_work (struct mark_worker *w)
+{
+    pthread_mutex_lock (&w->lock);
+    if (w->n_shared == 0
+	&& (w->allocated_shared >= MARK_SHARE_BATCH
+	    || grow_worker_array (&w->shared, &w->allocated_shared)))
+    {
+	w->n_stack -= MARK_SHARE_BATCH;
+	memcpy (w->shared, w->stack + w->n_stack,
+		MARK_SHARE_BATCH * sizeof (repv));
+	w->n_shared = MARK_SHARE_BATCH;
+    }
+    pthread_mutex_unlock (&w->lock);
+}
+
+/* Move the shared entries of VICTIM to W's private stack. Returns
+   false if there were none. */
+static rep_bool
+take_work (struct mark_worker *w, struct mark_worker *victim)
+{
+    int n;
+    if (victim->n_shared == 0)
+	return rep_FALSE;
+    pthread_mutex_lock (&victim->lock);
+    n = victim->n_shared;
+    while (w->n_stack + n > w->allocated_stack)
+    {
+	if (!grow_worker_array (&w->stack, &w->allocated_stack))
+	{
+	    n = 0;
+	    break;
+	}
+    }
+    if (n > 0)
+    {
+	memcpy (w->stack + w->n_stack, victim->shared, n * sizeof (repv));
+	w->n_stack += n;
+	victim->n_shared = 0;
+    }
+    pthread_mutex_unlock (&victim->lock);
+    return n > 0;
+}
+
+/* Look for shared entries, W's own first. If PEEK, only report
+   whether there appear to be any. */
+static rep_bool
+find_work (struct mark_worker *w, rep_bool peek)
+{
+    int self = w - mark_workers, i;
+    for (i = 0; i < n_round_workers; i++)
+    {
+	struct mark_worker *victim
+	    = &mark_workers[(self + i) % n_round_workers];
+	if (peek ? victim->n_shared > 0 : take_work (w, victim))
+	    return rep_TRUE;
+    }
+    return rep_FALSE;
+}
+
+/* Mark until no thread has anything left to mark */
+static void
+parallel_mark_loop (struct mark_worker *w)
+{
+    current_worker = w;
+    for (;;)
+    {
+	while (w->n_stack > 0)
+	{
+	    repv v = w->stack[--w->n_stack];
+	    if (w->n_stack > 0)
+		PREFETCH (w->stack[w->n_stack - 1]);
+	    if (!rep_GC_MARKEDP(v))
+		mark_object (v);
+	    if (w->n_stack >= 2 * MARK_SHARE_BATCH && w->n_shared == 0)
+		share_work (w);
+	    if (w == &mark_workers[0])
+		mark_handed_object ();
+	}
+	if (find_work (w, rep_FALSE)
+	    || (w == &mark_workers[0] && mark_handed_object ()))
+	{
+	    continue;
+	}
+
+	/* Only busy threads can create work, so once every thread is
+	   idle marking is finished. A thread stops being idle before
+	   taking anything. */
+	__sync_fetch_and_add (&idle_workers, 1);
+	for (;;)
+	{
+	    /* a helper may have handed over an object just before
+	       becoming idle */
+	    if (idle_workers == n_round_workers
+		&& (w != &mark_workers[0] || handed_mark == 0))
+	    {
+		return;
+	    }
+	    if (find_work (w, rep_TRUE)
+		|| (w == &mark_workers[0] && handed_mark != 0))
+	    {
+		__sync_fetch_and_sub (&idle_workers, 1);
+		break;
+	    }
+	    sched_yield ();
+	}
+    }
+}
+
+static void *
+mark_thread (void *arg)
+{
+    struct mark_worker *w = arg;
+    pthread_mutex_lock (&mark_lock);
+    for (;;)
+    {
+	while (w->round == mark_round)
+	    pthread_cond_wait (&mark_start_cond, &mark_lock);
+	w->round = mark_round;
+	if (w - mark_workers < n_round_workers)
+	{
+	    pthread_mutex_unlock (&mark_lock);
+	    parallel_mark_loop (w);
+	    pthread_mutex_lock (&mark_lock);
+	    if (++finished_workers == n_round_workers - 1)
+		pthread_cond_signal (&mark_done_cond);
+	}
+    }
+    return 0;
+}
+
+/* Make sure there are at least N helper threads. They never handle
+   signals. */
+static void
+start_mark_threads (int n)
+{
+    sigset_t all, old;
+    sigfillset (&all);
+    pthread_sigmask (SIG_BLOCK, &all, &old);
+    while (n_mark_threads < n)
+    {
+	struct mark_worker *w = &mark_workers[n_mark_threads + 1];
+	pthread_t thread;
+	w->round = mark_round;
+	if (pthread_create (&thread, 0, mark_thread, w) != 0)
+	    break;
+	pthread_detach (thread);
+	n_mark_threads++;
+    }
+    pthread_sigmask (SIG_SETMASK, &old, 0);
+}
+
+/* Run a round of marking from the stack of worker zero, in this
+   thread and the helpers */
+static void
+run_mark_workers (void)
+{
+    pthread_mutex_lock (&mark_lock);
+    idle_workers = 0;
+    finished_workers = 0;
+    mark_round++;
+    pthread_cond_broadcast (&mark_start_cond);
+    pthread_mutex_unlock (&mark_lock);
+
+    parallel_mark_loop (&mark_workers[0]);
+
+    pthread_mutex_lock (&mark_lock);
+    while (finished_workers < n_round_workers - 1)
+	pthread_cond_wait (&mark_done_cond, &mark_lock);
+    pthread_mutex_unlock (&mark_lock);
+}
+
+/* The helper threads don't survive fork () */
+static void
+mark_threads_after_fork (void)
+{
+    n_mark_threads = 0;
+}
+
+#endif /* ENABLE_PARALLEL_GC */
+
+/* Call the mark function of VAL, whose type is T */
+static inline void
+call_mark_hook (rep_type *t, repv val)
+{
+#ifdef ENABLE_PARALLEL_GC
+    if (gc_parallel)
+    {
+	if (t->mark_parallel != 0)
+	    t->mark_parallel (val);
+	else
+	    defer_mark (val);
+	return;
+    }
+#endif
+    t->mark (val);
+}
+
+/* The cons mark bitmaps are shared by many cells, when marking in
+   parallel they're only changed by claim_object */
+#define GC_SET_CONS(v)				\
+    do {					\
+	if (!GC_PARALLEL)			\
+	    rep_GC_SET_CONS(v);			\
+    } while (0)
+
+/* Set the mark bit of the non-cons cell V. When marking in parallel
+   V has already been claimed, but it hasn't been counted yet; the
+   final step of an incremental collection marks some objects again.
+   A minor collection that can't record V leaves it unmarked, and
+   returns without marking its children. */
+#define GC_SET_CELL(v)						\
+    do {							\
+	if (!gc_minor && (GC_PARALLEL || !rep_GC_CELL_MARKEDP(v)))	\
+	    LIVE_COUNTS[rep_TYPE_SLOT (rep_CELL16P(v)		\
+				       ? rep_CELL16_TYPE(v)	\
+				       : rep_CELL8_TYPE(v))]++;	\
+	if (gc_minor)						\
+	{							\
+	    if (minor_marked_overflowed				\
+		|| !push_value (&minor_marked, &n_minor_marked,	\
+				&allocated_minor_marked, v))	\
+	    {							\
+		minor_marked_overflowed = rep_TRUE;		\
+		return;						\
+	    }							\
+	}							\
+	else if (rep_gc_marking && TRACED_P(v) && !WRITE_BARRIER_P(v) \
+		 && !push_value (&rescan, &n_rescan, &allocated_rescan, v)) \
+	{							\
+	    rescan_overflowed = rep_TRUE;			\
+	}							\
+	rep_GC_SET_CELL(v);					\
+    } while (0)
+
+/* Continue marking with the unmarked object VAL: directly (by jumping
+   back to `again'), or when marking incrementally, in a later step. */
+#define MARK_NEXT(val)				\
+    do {					\
+	if (rep_gc_marking)			\
+	{					\
+	    push_mark (val);			\
+	    return;				\
+	}					\
+	goto again;				\
+    } while (0)
+
+/* Mark a single Lisp object, pushing the objects it refers to on the
+   mark stack. This attempts to eliminate as much tail-recursion as
+   possible (by changing the rep_VAL and jumping back to the `again'
+   label).
+
+   Note that rep_VAL must not be NULL, and must not already have been
+   marked, (see the rep_MARKVAL macro in lisp.h) */
+static void
+mark_object(register repv val)
+{
+#ifdef GC_MONITOR_STK
+    int dummy;
+    /* Assumes that the stack grows downwards (towards 0) */
+    if(&dummy < gc_stack_high_tide)
+	gc_stack_high_tide = &dummy;
+#endif
+
+again:
+    if(!rep_CELLP(val))
+	return;
+
+#ifdef ENABLE_PARALLEL_GC
+    if (gc_parallel && !claim_object (val))
+	return;
+#endif
+
+    /* must be a cell */
+    if(rep_CELL_CONS_P(val))
+    {
+	if(rep_CONS_WRITABLE_P(val))
+	{
+	    /* A cons. Attempts to walk though whole lists at a time
+	       (since Lisp lists mainly link from the cdr).  */
+	    GC_SET_CONS(val);
+	    LIVE_CONS++;
+	    if(rep_NILP(rep_CDR(val)))
+		/* End of a list. We can safely
+		   mark the car non-recursively.  */
+		val = rep_CAR(val);
+	    else
+	    {
+		rep_MARKVAL(rep_CAR(val));
+		val = rep_CDR(val);
+	    }
+	    if(val && rep_CELLP(val) && !rep_GC_MARKEDP(val))
+		MARK_NEXT(val);
+	    return;
+	}
+	else
+	{
+	    /* A constant cons cell. */
+	    return;
+	}
+    }
+
+    if (rep_CELL16P(val))
+    {
+	/* A user allocated type. */
+	rep_type *t = rep_get_data_type(rep_CELL16_TYPE(val));
+	GC_SET_CELL(val);
+	if (t->mark != 0)
+	    call_mark_hook (t, val);
+	return;
+    }
+
+    /* So we know that it's a cell8 object */
+    switch(rep_CELL8_TYPE(val))
+    {
+	rep_type *t;
+
+    case rep_Vector:
+    case rep_Compiled:
+	if(rep_VECTOR_WRITABLE_P(val))
+	{
+	    GC_SET_CELL(val);
+	    if (rep_COMPILEDP(val))
+		rep_pin_string_data(rep_COMPILED_CODE(val));
+	    if (!GC_PARALLEL && mark_depth > 0)
+		mark_vector_slice (val, 0);
+	    else
+	    {
+		int i, len = rep_VECT_LEN(val);
+		for(i = 0; i < len; i++)
+		    rep_MARKVAL(rep_VECTI(val, i));
+	    }
+	}
+	break;
+
+    case rep_Symbol:
+	/* Dumped symbols are dumped read-write, so no worries.. */
+	GC_SET_CELL(val);
+	rep_MARKVAL(rep_SYM(val)->name);
+	val = rep_SYM(val)->next;
+	if(val && rep_CELLP(val) && !rep_GC_MARKEDP(val))
+	    MARK_NEXT(val);
+	break;
+
+    case rep_String:
+	if(!rep_STRING_WRITABLE_P(val))
+	    break;
+	GC_SET_CELL(val);
+	mark_arena_body(val);
+	mark_mapped_body(val);
+	LIVE_STRING_BYTES += sizeof (rep_string) + rep_STRING_LEN(val);
+	break;
+
+    case rep_Number:
+	GC_SET_CELL(val);
+	break;
 
     case rep_Funarg:
 	if (!rep_FUNARG_WRITABLE_P(val))
 	    break;
-	rep_GC_SET_CELL(val);
+	GC_SET_CELL(val);
 	rep_MARKVAL(rep_FUNARG(val)->name);
 	rep_MARKVAL(rep_FUNARG(val)->env);
 	rep_MARKVAL(rep_FUNARG(val)->structure);
 	val = rep_FUNARG(val)->fun;
 	if (val && !rep_GC_MARKEDP(val))
-	    goto again;
+	    MARK_NEXT(val);
 	break;
 
     case rep_Subr0:
@@ -919,55 +2894,560 @@ again:
 
     default:
 	t = rep_get_data_type(rep_CELL8_TYPE(val));
-	rep_GC_SET_CELL(val);
+	GC_SET_CELL(val);
 	if (t->mark != 0)
-	    t->mark(val);
+	    call_mark_hook (t, val);
+    }
+}
+
+/* When the mark stack has overflowed, the children of the cells that
+   couldn't be pushed are found by scanning the marked cells of every
+   cons block. This is the next block to scan, or null when no scan is
+   in progress. A scan may be spread over several incremental steps;
+   blocks are only freed by sweeping, and blocks allocated meanwhile
+   are added at the head of the chain, where the scan has been. */
+static rep_cons_block *rescan_block;
+
+/* Push the unmarked halves of the marked cells of block CB. Only called
+   by full collections, where every marked cell was reached by the
+   current collection, with mark_depth non-zero. */
+static void
+rescan_marked_conses (rep_cons_block *cb)
+{
+    int i;
+    for (i = 0; i < rep_CONSBLK_SIZE; i++)
+    {
+	repv cell = rep_CONS_VAL (cb->cons + i);
+	if (rep_GC_CONS_MARKEDP (cell))
+	{
+	    rep_MARKVAL (rep_CAR (cell));
+	    rep_MARKVAL (rep_CDR (cell));
+	}
+    }
+}
+
+/* Mark grey objects, including those only found by scanning after the
+   mark stack overflowed, until none are left, returning true. If
+   LIMITED, stop and return false once the pause that began at START
+   has lasted gc_max_pause microseconds. */
+static rep_bool
+mark_grey_objects (rep_bool limited, rep_long_long start)
+{
+    int count = 0;
+    for (;;)
+    {
+	if (n_mark_stack > 0)
+	    count += mark_top_entry ();
+	else if (rescan_block != 0)
+	{
+	    rescan_marked_conses (rescan_block);
+	    rescan_block = rescan_block->h.next;
+	    count += 256;
+	}
+	else if (mark_stack_overflowed)
+	{
+	    /* cells scanned before any new overflow need scanning
+	       again, so start from the beginning */
+	    mark_stack_overflowed = rep_FALSE;
+	    rescan_block = rep_cons_block_chain;
+	}
+	else
+	    return rep_TRUE;
+
+	/* reading the clock isn't free */
+	if (limited && count >= 256)
+	{
+	    if (rep_utime () - start >= gc_max_pause)
+		return rep_FALSE;
+	    count = 0;
+	}
+    }
+}
+
+/* Mark everything on the mark stack */
+static void
+drain_mark_stack (void)
+{
+    mark_grey_objects (rep_FALSE, 0);
+}
+
+/* While non-null, rep_mark_value passes each object it's given to this
+   function instead of marking it (see rep_visit_children) */
+static rep_heap_visitor *walk_visitor;
+static void *walk_data;
+
+void
+rep_mark_value(repv val)
+{
+    if (walk_visitor != 0)
+    {
+	walk_visitor (val, walk_data);
+	return;
+    }
+#ifdef ENABLE_PARALLEL_GC
+    if (gc_parallel)
+    {
+	worker_push (val);
+	return;
+    }
+#endif
+    if (mark_depth > 0)
+    {
+	/* called while marking another object */
+	push_mark (val);
+	return;
+    }
+    mark_depth++;
+    mark_object (val);
+    /* incremental marking does the rest in later steps */
+    if (!rep_gc_marking)
+	drain_mark_stack ();
+    mark_depth--;
+}
+
+DEFUN("garbage-threshold", Fgarbage_threshold, Sgarbage_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-threshold::
+garbage-threshold [NEW-VALUE]
+
+The number of bytes of storage which must be used before a garbage-
+collection is triggered. This may be set by each full collection, see
+`garbage-threshold-growth'.
+::end:: */
+{
+    return rep_handle_var_int(val, &rep_gc_threshold);
+}
+
+DEFUN("idle-garbage-threshold", Fidle_garbage_threshold, Sidle_garbage_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#idle-garbage-threshold::
+idle-garbage-threshold [NEW-VALUE]
+
+The number of bytes of storage which must be used before a garbage-
+collection is triggered when the editor is idle.
+::end:: */
+{
+    return rep_handle_var_int(val, &rep_idle_gc_threshold);
+}
+
+DEFUN("garbage-threshold-growth", Fgarbage_threshold_growth,
+      Sgarbage_threshold_growth, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-threshold-growth::
+garbage-threshold-growth [NEW-VALUE]
+
+When non-zero, each full garbage collection sets `garbage-threshold' to
+this percentage of the size of the data it found to be in use, bounded
+by `min-garbage-threshold' and `max-garbage-threshold'. Zero (the
+default) means the threshold is only changed explicitly.
+::end:: */
+{
+    return rep_handle_var_int(val, &gc_threshold_growth);
+}
+
+DEFUN("min-garbage-threshold", Fmin_garbage_threshold,
+      Smin_garbage_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#min-garbage-threshold::
+min-garbage-threshold [NEW-VALUE]
+
+The smallest value `garbage-threshold' is given when it is computed from
+the size of the data in use, see `garbage-threshold-growth'.
+::end:: */
+{
+    return rep_handle_var_int(val, &min_gc_threshold);
+}
+
+DEFUN("max-garbage-threshold", Fmax_garbage_threshold,
+      Smax_garbage_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#max-garbage-threshold::
+max-garbage-threshold [NEW-VALUE]
+
+The largest value `garbage-threshold' is given when it is computed from
+the size of the data in use, see `garbage-threshold-growth'.
+::end:: */
+{
+    return rep_handle_var_int(val, &max_gc_threshold);
+}
+
+DEFUN("major-garbage-threshold", Fmajor_garbage_threshold,
+      Smajor_garbage_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#major-garbage-threshold::
+major-garbage-threshold [NEW-VALUE]
+
+When generational garbage collection is enabled, the number of bytes of
+storage which must survive minor collections before a full collection
+is triggered.
+::end:: */
+{
+    return rep_handle_var_int(val, &major_gc_threshold);
+}
+
+DEFUN("gc-max-pause", Fgc_max_pause, Sgc_max_pause, (repv val), rep_Subr1) /*
+::doc:rep.data#gc-max-pause::
+gc-max-pause [NEW-VALUE]
+
+When non-zero, full garbage collections triggered automatically are
+done incrementally, with marking divided into steps of about this many
+microseconds between which evaluation continues. The steps are run
+when `garbage-threshold' bytes have been allocated, and when idle.
+Zero (the default) means collections are never incremental.
+::end:: */
+{
+    return rep_handle_var_int(val, &gc_max_pause);
+}
+
+DEFUN("gc-mark-threads", Fgc_mark_threads, Sgc_mark_threads,
+      (repv val), rep_Subr1) /*
+::doc:rep.data#gc-mark-threads::
+gc-mark-threads [NEW-VALUE]
+
+The number of threads used to mark reachable data in full garbage
+collections that aren't incremental, when the heap is large enough for
+it to be worthwhile. One (the default) means marking is never done in
+parallel. Always one when parallel marking wasn't enabled when librep
+was configured.
+::end:: */
+{
+#ifdef ENABLE_PARALLEL_GC
+    repv old = rep_MAKE_INT (gc_mark_threads);
+    if (rep_INTP (val))
+	gc_mark_threads = MAX (1, MIN (rep_INT (val), MAX_MARK_THREADS));
+    return old;
+#else
+    return rep_MAKE_INT (1);
+#endif
+}
+
+DEFUN("large-string-threshold", Flarge_string_threshold,
+      Slarge_string_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#large-string-threshold::
+large-string-threshold [NEW-VALUE]
+
+Strings longer than this many bytes are created as large strings, whose
+length is stored with their characters instead of in their header. This
+is only needed for strings of more than 16 megabytes on 32-bit hosts,
+the default is the longest length that fits in the header. Lowering it
+lets the handling of large strings be tested. Returns the previous
+value.
+::end:: */
+{
+    repv old = rep_make_long_int (rep_max_short_string);
+    if (rep_INTP (val))
+	rep_max_short_string = MAX (0, MIN (rep_INT (val),
+					    rep_MAX_SHORT_STRING));
+    return old;
+}
+
+DEFUN("string-arena-compaction", Fstring_arena_compaction,
+      Sstring_arena_compaction, (repv val), rep_Subr1) /*
+::doc:rep.data#string-arena-compaction::
+string-arena-compaction [NEW-VALUE]
+
+When non-zero, full garbage collections move the contents of small
+strings out of the chunks of the string arena that are less than this
+percentage full, so that the chunks can be reused. Zero (the default)
+means the contents of strings are never moved. Always zero when the
+string arena isn't supported.
+::end:: */
+{
+#ifdef USE_STRING_ARENA
+    repv old = rep_MAKE_INT (string_arena_compaction);
+    if (rep_INTP (val))
+	string_arena_compaction = MAX (0, MIN (rep_INT (val), 100));
+    return old;
+#else
+    return rep_MAKE_INT (0);
+#endif
+}
+
+DEFUN("set-generational-gc", Fset_generational_gc, Sset_generational_gc,
+      (repv status), rep_Subr1) /*
+::doc:rep.data#set-generational-gc::
+set-generational-gc STATUS
+
+When STATUS is true, garbage collections triggered automatically only
+free cons cells allocated since the previous collection, and no other
+types of data, except when `major-garbage-threshold' bytes of storage
+have survived since the last full collection. Calling `garbage-collect'
+always does a full collection. These minor collections still look at
+all the other types of data in use, so they're only much quicker than
+a full collection when most of it is cons cells. Returns the previous
+status.
+::end:: */
+{
+    repv old = rep_gc_generational ? Qt : Qnil;
+    /* counting the blocks may rebuild the remembered set */
+    count_cons_blocks (INT_MAX);
+    rep_gc_generational = (status != Qnil);
+    rep_gc_barrier_active = rep_gc_generational || rep_gc_marking;
+    /* the next collection has to be a full one */
+    remembered_valid = rep_FALSE;
+    return old;
+}
+
+DEFUN("set-gc-huge-pages", Fset_gc_huge_pages, Sset_gc_huge_pages,
+      (repv status), rep_Subr1) /*
+::doc:rep.data#set-gc-huge-pages::
+set-gc-huge-pages STATUS
+
+When STATUS is true, memory mapped for cons cells from now on is backed
+by transparent huge pages, if the system supports them. This may speed
+up programs with very large heaps, but memory is then only returned to
+the system in units of the huge page size. Returns the previous status.
+::end:: */
+{
+    repv old = cons_huge_pages ? Qt : Qnil;
+    cons_huge_pages = (status != Qnil);
+    return old;
+}
+
+DEFUN("gc-heap-statistics", Fgc_heap_statistics, Sgc_heap_statistics,
+      (void), rep_Subr0) /*
+::doc:rep.data#gc-heap-statistics::
+gc-heap-statistics
+
+Returns a list `(ALLOCATED RESIDENT IN-USE ARENAS)' describing the
+memory used for cons cells, which is divided into blocks of 16
+kilobytes. ALLOCATED is the number of blocks of address space reserved,
+RESIDENT the number of those taking up memory, and IN-USE the number
+that contain cells. Blocks are reserved in arenas of two megabytes,
+ARENAS is the number of these.
+::end:: */
+{
+    int allocated, resident, arenas = 0;
+#ifdef USE_CONS_ARENAS
+    cons_arena *a;
+#endif
+    /* empty blocks are only freed once they've been counted */
+    count_cons_blocks (INT_MAX);
+    allocated = resident = n_cons_blocks;
+#ifdef USE_CONS_ARENAS
+    for (a = cons_arenas; a != 0; a = a->next)
+    {
+	if (RETAINS_FREE_BLOCKS (a))
+	    resident += a->n_free;
+    }
+    allocated = n_cons_arenas * CONS_ARENA_BLOCKS;
+    arenas = n_cons_arenas;
+#endif
+    return rep_list_4 (rep_MAKE_INT (allocated), rep_MAKE_INT (resident),
+		       rep_MAKE_INT (n_cons_blocks), rep_MAKE_INT (arenas));
+}
+
+static void
+note_gc_time (struct gc_stats *stats, rep_long_long start, int freed_cons)
+{
+    rep_long_long time = rep_utime () - start;
+    int i;
+    stats->count++;
+    stats->total_time += time;
+    if (time > stats->max_time)
+	stats->max_time = time;
+    stats->freed_cons += freed_cons;
+    for (i = 0; i < N_PAUSE_BUCKETS - 1 && time >= pause_limits[i]; i++)
+	;
+    pause_histogram[i]++;
+}
+
+/* Set rep_gc_threshold from the amount of data the full collection
+   that just finished found to be live: the cons cells, vectors and
+   strings, which are most of it */
+static void
+adapt_gc_threshold (void)
+{
+    double live = ((double) cons_live * sizeof (rep_cons)
+		   + (double) used_vector_slots * sizeof (repv)
+		   + marked_string_bytes);
+    double threshold = live * gc_threshold_growth / 100;
+    if (threshold > max_gc_threshold)
+	threshold = max_gc_threshold;
+    if (threshold < min_gc_threshold)
+	threshold = min_gc_threshold;
+    rep_gc_threshold = (int) threshold;
+}
+
+/* Called as a collection finishes, after the sweep */
+static void
+reset_alloc_stats (void)
+{
+    memset (rep_type_allocs, 0, sizeof (rep_type_allocs));
+    cons_used_after_gc = rep_used_cons;
+    cons_live_after_gc = cons_live;
+}
+
+static repv
+gc_stats_list (repv kind, struct gc_stats *stats)
+{
+    return rep_list_5 (kind, rep_MAKE_INT (stats->count),
+		       rep_make_longlong_int (stats->total_time),
+		       rep_make_longlong_int (stats->max_time),
+		       rep_make_longlong_int (stats->freed_cons));
+}
+
+DEFUN("gc-pause-statistics", Fgc_pause_statistics, Sgc_pause_statistics,
+      (void), rep_Subr0) /*
+::doc:rep.data#gc-pause-statistics::
+gc-pause-statistics
+
+Returns a list `((minor COUNT TOTAL MAX FREED) (major COUNT TOTAL MAX
+FREED) (step COUNT TOTAL MAX 0) (mark-stack PEAK OVERFLOWS) (parallel
+COUNT))'
+describing the garbage collections done so far. TOTAL and MAX are the
+total and longest pause times in microseconds, FREED the number of cons
+cells reclaimed. The `step' entry describes the marking steps of
+incremental collections, whose final step is counted as a major
+collection. PEAK is the largest number of objects the mark stack has
+held, OVERFLOWS the number of objects that couldn't be pushed on it
+since it was full. The `parallel' COUNT is the number of major
+collections that marked using several threads.
+::end:: */
+{
+#ifdef ENABLE_PARALLEL_GC
+    int parallel = parallel_collections;
+#else
+    int parallel = 0;
+#endif
+    return rep_list_5 (gc_stats_list (Qminor, &minor_stats),
+		       gc_stats_list (Qmajor, &major_stats),
+		       gc_stats_list (Qstep, &step_stats),
+		       rep_list_3 (Qmark_stack, rep_MAKE_INT (mark_stack_peak),
+				   rep_MAKE_INT (mark_stack_overflows)),
+		       rep_list_2 (Qparallel, rep_MAKE_INT (parallel)));
+}
+
+DEFUN("gc-statistics", Fgc_statistics, Sgc_statistics, (void), rep_Subr0) /*
+::doc:rep.data#gc-statistics::
+gc-statistics
+
+Returns a list `((collections COUNT TOTAL MAX) (pauses (LIMIT . COUNT)
+...) (types (NAME ALLOCATED BYTES LIVE) ...))' describing the garbage
+collector and the data it manages.
+
+COUNT is the number of minor and major collections done so far, TOTAL
+and MAX the total and longest pause times in microseconds of all
+collections and incremental marking steps. The `pauses' entry is a
+histogram of those pause times: COUNT of them lasted less than LIMIT
+microseconds but no less than the previous LIMIT. The final LIMIT is
+nil, counting the longer pauses.
+
+There is an entry in `types' for each type of object; NAME is the name
+of the type. ALLOCATED is the number of objects of the type allocated
+since the last collection, BYTES the amount of memory they (and any
+growth of existing objects) took. LIVE is the number of objects found
+to be in use by the last full collection, or for cons cells, by the
+last collection of any kind.
+::end:: */
+{
+    repv types = Qnil, pauses = Qnil;
+    rep_long_long total, max;
+    int i;
+    for (i = 0; i < TYPE_HASH_SIZE; i++)
+    {
+	rep_type *t;
+	for (t = data_types[i]; t != 0; t = t->next)
+	{
+	    unsigned long count, bytes, live;
+	    if (t->code == rep_Cons)
+	    {
+		count = MAX (rep_used_cons - cons_used_after_gc, 0);
+		bytes = count * sizeof (rep_cons);
+		live = cons_live_after_gc;
+	    }
+	    else
+	    {
+		count = rep_type_allocs[rep_TYPE_SLOT (t->code)].count;
+		bytes = rep_type_allocs[rep_TYPE_SLOT (t->code)].bytes;
+		live = type_live[rep_TYPE_SLOT (t->code)];
+	    }
+	    types = Fcons (rep_list_4 (rep_string_dup (t->name),
+				       rep_make_long_uint (count),
+				       rep_make_long_uint (bytes),
+				       rep_make_long_uint (live)), types);
+	}
     }
+    for (i = N_PAUSE_BUCKETS - 1; i >= 0; i--)
+    {
+	pauses = Fcons (Fcons (i < N_PAUSE_BUCKETS - 1
+			       ? rep_MAKE_INT (pause_limits[i]) : Qnil,
+			       rep_MAKE_INT (pause_histogram[i])), pauses);
+    }
+    total = minor_stats.total_time + major_stats.total_time
+	    + step_stats.total_time;
+    max = MAX (MAX (minor_stats.max_time, major_stats.max_time),
+	       step_stats.max_time);
+    return rep_list_3 (rep_list_4 (Qcollections,
+				   rep_MAKE_INT (minor_stats.count
+						 + major_stats.count),
+				   rep_make_longlong_int (total),
+				   rep_make_longlong_int (max)),
+		       Fcons (Qpauses, pauses),
+		       Fcons (Qtypes, Fnreverse (types)));
 }
 
-DEFUN("garbage-threshold", Fgarbage_threshold, Sgarbage_threshold, (repv val), rep_Subr1) /*
-::doc:rep.data#garbage-threshold::
-garbage-threshold [NEW-VALUE]
-
-The number of bytes of storage which must be used before a garbage-
-collection is triggered.
-::end:: */
+static inline void
+clear_cons_block_marks (rep_cons_block *cb)
 {
-    return rep_handle_var_int(val, &rep_gc_threshold);
+    memset (cb->h.mark, 0, sizeof (cb->h.mark));
+    memset (cb->h.remembered, 0, sizeof (cb->h.remembered));
 }
 
-DEFUN("idle-garbage-threshold", Fidle_garbage_threshold, Sidle_garbage_threshold, (repv val), rep_Subr1) /*
-::doc:rep.data#idle-garbage-threshold::
-idle-garbage-threshold [NEW-VALUE]
+static void
+cons_marks_cleared (void)
+{
+    cons_clearing = rep_FALSE;
+    cons_uncleared = 0;
+    n_remembered = 0;
+    marked_cons = 0;
+    /* the blocks can't be counted without their marks */
+    cons_uncounted = 0;
+}
 
-The number of bytes of storage which must be used before a garbage-
-collection is triggered when the editor is idle.
-::end:: */
+/* Cons mark bits survive minor collections, a full collection has to
+   start afresh. */
+static void
+clear_cons_marks (void)
 {
-    return rep_handle_var_int(val, &rep_idle_gc_threshold);
+    rep_cons_block *cb;
+    for (cb = rep_cons_block_chain; cb != 0; cb = cb->h.next)
+	clear_cons_block_marks (cb);
+    cons_marks_cleared ();
 }
 
-DEFUN_INT("garbage-collect", Fgarbage_collect, Sgarbage_collect, (repv stats), rep_Subr1, "") /*
-::doc:rep.data#garbage-collect::
-garbage-collect
+/* Clear the cons marks before an incremental collection, a few blocks
+   at a time, returning true once all are clear, or false when the
+   pause that began at START has lasted gc_max_pause microseconds.
+   Blocks made meanwhile are added to the head of the chain, so they
+   start out clear. No minor collections can be done until marking
+   has finished, since the old cells can't be told from the young. */
+static rep_bool
+clear_cons_marks_step (rep_long_long start)
+{
+    int count = 0;
+    if (!cons_clearing)
+    {
+	cons_clearing = rep_TRUE;
+	cons_uncleared = rep_cons_block_chain;
+	remembered_valid = rep_FALSE;
+    }
+    while (cons_uncleared != 0)
+    {
+	clear_cons_block_marks (cons_uncleared);
+	cons_uncleared = cons_uncleared->h.next;
+	if ((++count & 63) == 0 && rep_utime () - start >= gc_max_pause)
+	    return rep_FALSE;
+    }
+    cons_marks_cleared ();
+    return rep_TRUE;
+}
 
-Scans all allocated storage for unusable data, and puts it onto the free-
-list. This is done automatically when the amount of storage used since the
-last garbage-collection is greater than `garbage-threshold'.
-::end:: */
+/* Mark everything that's always reachable */
+static void
+mark_roots (void)
 {
     int i;
     rep_GC_root *rep_gc_root;
     rep_GC_n_roots *rep_gc_n_roots;
     struct rep_Call *lc;
-#ifdef GC_MONITOR_STK
-    int dummy;
-    gc_stack_high_tide = &dummy;
-#endif
-
-    rep_in_gc = rep_TRUE;
 
     rep_macros_before_gc ();
+    rep_verify_before_gc ();
 
     /* mark static objects */
     for(i = 0; i < next_static_root; i++)
@@ -977,6 +3457,7 @@ last garbage-collection is greater than `garbage-threshold'.
 	rep_gc_root != 0; rep_gc_root = rep_gc_root->next)
     {
 	rep_MARKVAL(*rep_gc_root->ptr);
+	rep_pin_string_data(*rep_gc_root->ptr);
     }
     for(rep_gc_n_roots = rep_gc_n_roots_stack; rep_gc_n_roots != 0;
 	rep_gc_n_roots = rep_gc_n_roots->next)
@@ -1015,6 +3496,315 @@ last garbage-collection is greater than `garbage-threshold'.
 	rep_MARKVAL(lc->saved_structure);
 	lc = lc->next;
     }
+}
+
+#ifdef ENABLE_PARALLEL_GC
+
+/* Mark everything reachable from the roots using gc_mark_threads
+   threads */
+static void
+parallel_mark_roots (void)
+{
+    int i, j;
+    start_mark_threads (MIN (gc_mark_threads, MAX_MARK_THREADS) - 1);
+    n_round_workers = n_mark_threads + 1;
+    gc_parallel = rep_TRUE;
+    current_worker = &mark_workers[0];
+    mark_roots ();
+    for (;;)
+    {
+	run_mark_workers ();
+	if (n_deferred_marks == 0)
+	    break;
+	/* the other threads have stopped, and the mark functions
+	   called push on the stack of worker zero */
+	for (i = 0; i < n_deferred_marks; i++)
+	{
+	    repv v = deferred_marks[i];
+	    rep_get_data_type (rep_CELL_TYPE(v))->mark (v);
+	}
+	n_deferred_marks = 0;
+    }
+    gc_parallel = rep_FALSE;
+    current_worker = 0;
+    for (i = 0; i < n_round_workers; i++)
+    {
+	for (j = 0; j < rep_TYPE_SLOTS; j++)
+	{
+	    marked_live[j] += mark_workers[i].live[j];
+	    mark_workers[i].live[j] = 0;
+	}
+	marked_string_bytes += mark_workers[i].live_string_bytes;
+	mark_workers[i].live_string_bytes = 0;
+	marked_cons += mark_workers[i].live_cons;
+	mark_workers[i].live_cons = 0;
+    }
+    parallel_collections++;
+}
+
+#endif
+
+/* Free unreachable cons cells allocated since the last gc. Cells that
+   survived earlier collections are assumed to be live, so marking
+   starts from the roots and the remembered set, stopping at any
+   marked (old) cell. Other types of objects are traversed but not
+   swept. */
+static void
+minor_gc (void)
+{
+    rep_long_long start = rep_utime ();
+    int i, live_before = cons_live, used_before = rep_used_cons;
+    int allocated;
+    rep_guardian *g;
+
+    rep_in_gc = rep_TRUE;
+    gc_minor = rep_TRUE;
+
+    mark_roots ();
+
+    for (i = 0; i < n_remembered; i++)
+    {
+	repv cell = remembered[i];
+	if (REMEMBEREDP(cell))
+	{
+	    rep_MARKVAL(rep_CAR(cell));
+	    rep_MARKVAL(rep_CDR(cell));
+	}
+    }
+
+    /* guarded objects only become inaccessible in full collections */
+    for (g = guardians; g != 0; g = g->next)
+	rep_MARKVAL(g->accessible);
+
+    if (minor_marked_overflowed)
+    {
+	/* some objects weren't marked, so nothing can be freed; a full
+	   collection doesn't need to unmark the others afterwards */
+	for (i = 0; i < n_minor_marked; i++)
+	    rep_GC_CLR_CELL(minor_marked[i]);
+	n_minor_marked = 0;
+	minor_marked_overflowed = rep_FALSE;
+	gc_minor = rep_FALSE;
+	rep_in_gc = rep_FALSE;
+	Fgarbage_collect (Qnil);
+	return;
+    }
+
+    rep_scan_weak_refs_minor ();
+
+    cons_sweep_nursery ();
+    prune_remembered ();
+
+    for (i = 0; i < n_minor_marked; i++)
+	rep_GC_CLR_CELL(minor_marked[i]);
+    n_minor_marked = 0;
+
+    /* promoted cons cells plus everything else allocated */
+    allocated = (used_before - live_before) * sizeof (rep_cons);
+    old_growth += ((cons_live - live_before) * sizeof (rep_cons)
+		   + rep_data_after_gc - allocated);
+
+    rep_data_after_gc = 0;
+    reset_alloc_stats ();
+    gc_minor = rep_FALSE;
+    rep_in_gc = rep_FALSE;
+
+    note_gc_time (&minor_stats, start, used_before - cons_live);
+
+    Fcall_hook (Qafter_gc_hook, Qnil, Qnil);
+}
+
+/* Sweep one block left unswept by the last full collection, returning
+   false if there were none. Cons blocks are only swept if CONSES is
+   true: their marks are in bitmaps that a full collection clears
+   without looking at the cells. The other types have to be swept before
+   their mark bits are set again. */
+static rep_bool
+lazy_sweep_block (rep_bool conses)
+{
+    if (conses && cons_uncounted != 0)
+    {
+	count_cons_blocks (1);
+	return rep_TRUE;
+    }
+    else if (conses && cons_unswept != 0)
+    {
+	rep_cons_block *cb = cons_unswept;
+	cons_unswept = cb->h.alloc_next;
+	if (resweep_cons_block (cb))
+	{
+	    cb->h.alloc_next = cons_free_blocks;
+	    cons_free_blocks = cb;
+	}
+	return rep_TRUE;
+    }
+    else if (string_unswept != NULL)
+    {
+	rep_string_block *cb = string_unswept;
+	string_unswept = cb->next.p;
+	sweep_string_block (cb);
+	return rep_TRUE;
+    }
+    else
+	return rep_sweep_number_block ();
+}
+
+static void
+finish_lazy_sweep (rep_bool conses)
+{
+    while (lazy_sweep_block (conses))
+	;
+}
+
+/* Sweep the blocks left by the last full collection until there are
+   none, returning true, or the pause that began at START has lasted
+   gc_max_pause microseconds. */
+static rep_bool
+lazy_sweep_step (rep_long_long start)
+{
+    int count = 0;
+    while (lazy_sweep_block (rep_TRUE))
+    {
+	if ((++count & 7) == 0 && rep_utime () - start >= gc_max_pause)
+	    return rep_FALSE;
+    }
+    return rep_TRUE;
+}
+
+/* Start an incremental collection: everything is white except the
+   roots, which are marked, and the objects they refer to, which are
+   grey. Allocation doesn't sweep while marking, so everything has
+   to have been swept and the cons marks cleared first (see
+   lazy_sweep_step and clear_cons_marks_step). */
+static void
+start_incremental_gc (void)
+{
+    rep_in_gc = rep_TRUE;
+    finish_lazy_sweep (rep_TRUE);
+    memset (marked_live, 0, sizeof (marked_live));
+    marked_string_bytes = 0;
+    clear_arena_live ();
+    clear_mapped_files_live ();
+    rep_gc_marking = rep_TRUE;
+    rep_gc_barrier_active = rep_TRUE;
+    mark_roots ();
+    rep_in_gc = rep_FALSE;
+}
+
+/* Mark grey objects until there are none left, or the pause that
+   began at START has lasted gc_max_pause microseconds. Returns true
+   if no grey objects remain. */
+static rep_bool
+incremental_mark_step (rep_long_long start)
+{
+    rep_bool done;
+    rep_in_gc = rep_TRUE;
+    mark_depth++;
+    done = mark_grey_objects (rep_TRUE, start);
+    mark_depth--;
+    rep_in_gc = rep_FALSE;
+    return done;
+}
+
+/* The atomic part of finishing an incremental collection: mark from
+   the roots again, then from the objects that may have been changed
+   since they were marked. Objects with write barriers that have been
+   changed are already grey, only the others need scanning again. */
+static void
+finish_incremental_marking (void)
+{
+    int i;
+    rep_gc_marking = rep_FALSE;
+    rep_gc_barrier_active = rep_gc_generational;
+    mark_roots ();
+    mark_depth++;
+    for (i = 0; i < n_rescan; i++)
+	mark_object (rescan[i]);
+    n_rescan = 0;
+    rescan_overflowed = rep_FALSE;
+    drain_mark_stack ();
+    mark_depth--;
+}
+
+/* Called when rep_data_after_gc has passed the threshold, or when
+   idle with an incremental collection in progress */
+void
+rep_auto_gc (void)
+{
+    if (rep_gc_marking)
+    {
+	rep_long_long start = rep_utime ();
+	if (incremental_mark_step (start) || rescan_overflowed)
+	    Fgarbage_collect (Qnil);
+	else
+	{
+	    note_gc_time (&step_stats, start, 0);
+	    rep_data_after_gc = 0;
+	}
+    }
+    else if (rep_gc_generational && old_growth < major_gc_threshold
+	     /* the blocks have to be counted to rebuild the
+		remembered set */
+	     && !count_cons_blocks (INT_MAX) && remembered_valid)
+    {
+	minor_gc ();
+    }
+    else if (gc_max_pause > 0)
+    {
+	rep_long_long start = rep_utime ();
+	if (lazy_sweep_step (start) && clear_cons_marks_step (start))
+	{
+	    start_incremental_gc ();
+	    incremental_mark_step (start);
+	    if (rescan_overflowed)
+	    {
+		Fgarbage_collect (Qnil);
+		return;
+	    }
+	}
+	note_gc_time (&step_stats, start, 0);
+	rep_data_after_gc = 0;
+    }
+    else
+	Fgarbage_collect (Qnil);
+}
+
+DEFUN_INT("garbage-collect", Fgarbage_collect, Sgarbage_collect, (repv stats), rep_Subr1, "") /*
+::doc:rep.data#garbage-collect::
+garbage-collect
+
+Scans all allocated storage for unusable data, and puts it onto the free-
+list. This is done automatically when the amount of storage used since the
+last garbage-collection is greater than `garbage-threshold'.
+::end:: */
+{
+    int i, used_before = rep_used_cons;
+    rep_long_long start = rep_utime ();
+#ifdef GC_MONITOR_STK
+    int dummy;
+    gc_stack_high_tide = &dummy;
+#endif
+
+    rep_in_gc = rep_TRUE;
+
+    if (rep_gc_marking)
+	/* complete the incremental collection in progress */
+	finish_incremental_marking ();
+    else
+    {
+	finish_lazy_sweep (rep_FALSE);
+	clear_cons_marks ();
+	memset (marked_live, 0, sizeof (marked_live));
+	marked_string_bytes = 0;
+	clear_arena_live ();
+	clear_mapped_files_live ();
+#ifdef ENABLE_PARALLEL_GC
+	if (gc_mark_threads > 1 && rep_allocated_cons >= parallel_mark_min_cons)
+	    parallel_mark_roots ();
+	else
+#endif
+	    mark_roots ();
+    }
 
     /* move and mark any guarded objects that became inaccessible */
     run_guardians ();
@@ -1036,9 +3826,17 @@ last garbage-collection is greater than `garbage-threshold'.
 	}
     }
 
+    old_growth = 0;
+
     rep_data_after_gc = 0;
+    memcpy (type_live, marked_live, sizeof (type_live));
+    reset_alloc_stats ();
+    if (gc_threshold_growth > 0)
+	adapt_gc_threshold ();
     rep_in_gc = rep_FALSE;
 
+    note_gc_time (&major_stats, start, used_before - rep_used_cons);
+
 #ifdef GC_MONITOR_STK
     fprintf(stderr, "gc: stack usage = %d\n",
 	    ((int)&dummy) - (int)gc_stack_high_tide);
@@ -1048,6 +3846,8 @@ last garbage-collection is greater than `garbage-threshold'.
 
     if(stats != Qnil)
     {
+	/* the counts are only complete once everything is swept */
+	finish_lazy_sweep (rep_TRUE);
 	return rep_list_5(Fcons(rep_MAKE_INT(rep_used_cons),
 				rep_MAKE_INT(rep_allocated_cons - rep_used_cons)),
 			  Fcons(rep_MAKE_INT(rep_used_tuples),
@@ -1066,6 +3866,120 @@ last garbage-collection is greater than `garbage-threshold'.
 }
 
 
+/* Heap walking (see heap-census.c) */
+
+/* The cons mark bitmaps while the heap is being walked */
+static unsigned long *saved_cons_marks;
+
+/* Collect garbage, then clear all mark bits, so that rep_MARKVAL calls
+   rep_mark_value for every object it's given. The cons marks are saved
+   first, since allocation uses them to find free cells; nothing may be
+   allocated until rep_finish_heap_walk restores them. Returns false if
+   there's no memory to save them. */
+rep_bool
+rep_prepare_heap_walk (void)
+{
+    rep_cons_block *cb;
+    unsigned long *ptr;
+    Fgarbage_collect (Qnil);
+    finish_lazy_sweep (rep_TRUE);
+    saved_cons_marks = rep_alloc (n_cons_blocks * sizeof (cb->h.mark) + 1);
+    if (saved_cons_marks == 0)
+	return rep_FALSE;
+    for (cb = rep_cons_block_chain, ptr = saved_cons_marks;
+	 cb != 0; cb = cb->h.next, ptr += rep_CONSBLK_MAP_WORDS)
+    {
+	memcpy (ptr, cb->h.mark, sizeof (cb->h.mark));
+	memset (cb->h.mark, 0, sizeof (cb->h.mark));
+    }
+    return rep_TRUE;
+}
+
+void
+rep_finish_heap_walk (void)
+{
+    rep_cons_block *cb;
+    unsigned long *ptr;
+    for (cb = rep_cons_block_chain, ptr = saved_cons_marks;
+	 cb != 0; cb = cb->h.next, ptr += rep_CONSBLK_MAP_WORDS)
+    {
+	memcpy (cb->h.mark, ptr, sizeof (cb->h.mark));
+    }
+    rep_free (saved_cons_marks);
+    saved_cons_marks = 0;
+}
+
+/* Call FN with each object that the garbage collector treats as always
+   reachable. Only called between rep_prepare_heap_walk and
+   rep_finish_heap_walk. */
+void
+rep_visit_roots (rep_heap_visitor *fn, void *data)
+{
+    walk_visitor = fn;
+    walk_data = data;
+    mark_roots ();
+    walk_visitor = 0;
+}
+
+/* Call FN with each value that object V refers to, in the order the
+   garbage collector would mark them. FN may be given values that
+   aren't cells. The same conditions as for rep_visit_roots apply. */
+void
+rep_visit_children (repv v, rep_heap_visitor *fn, void *data)
+{
+    rep_type *t;
+    int i;
+
+    if (rep_CELL_CONS_P(v))
+    {
+	fn (rep_CAR(v), data);
+	fn (rep_CDR(v), data);
+	return;
+    }
+    else if (rep_CELL16P(v))
+	t = rep_get_data_type (rep_CELL16_TYPE(v));
+    else
+    {
+	switch (rep_CELL8_TYPE(v))
+	{
+	case rep_Vector:
+	case rep_Compiled:
+	    for (i = 0; i < rep_VECT_LEN(v); i++)
+		fn (rep_VECTI(v, i), data);
+	    return;
+
+	case rep_Symbol:
+	    fn (rep_SYM(v)->name, data);
+	    fn (rep_SYM(v)->next, data);
+	    return;
+
+	case rep_Funarg:
+	    fn (rep_FUNARG(v)->name, data);
+	    fn (rep_FUNARG(v)->env, data);
+	    fn (rep_FUNARG(v)->structure, data);
+	    fn (rep_FUNARG(v)->fun, data);
+	    return;
+
+	case rep_String:
+	case rep_Number:
+	case rep_Subr0: case rep_Subr1: case rep_Subr2: case rep_Subr3:
+	case rep_Subr4: case rep_Subr5: case rep_SubrN: case rep_SF:
+	    return;
+
+	default:
+	    t = rep_get_data_type (rep_CELL8_TYPE(v));
+	}
+    }
+    if (t->mark != 0)
+    {
+	walk_visitor = fn;
+	walk_data = data;
+	t->mark (v);
+	walk_visitor = 0;
+    }
+}
+
+
 void
 rep_pre_values_init(void)
 {
@@ -1077,6 +3991,12 @@ rep_pre_values_init(void)
 		  rep_string_print, string_sweep, 0, 0, 0, 0, 0, 0, 0, 0);
     rep_register_type(rep_Compiled, "bytecode", vector_cmp,
 		  rep_lisp_prin, rep_lisp_prin, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    rep_set_type_size (rep_Cons, cons_size);
+    rep_set_type_size (rep_Vector, vector_size);
+    rep_set_type_size (rep_Compiled, compiled_size);
+    rep_set_type_size (rep_String, string_size);
+    rep_set_write_barrier (rep_Vector);
+    rep_set_write_barrier (rep_Compiled);
     rep_register_type(rep_Void, "void", rep_type_cmp,
 		  rep_lisp_prin, rep_lisp_prin, 0, 0, 0, 0, 0, 0, 0, 0, 0);
     rep_register_type(rep_SF, "special-form", rep_ptr_cmp,
@@ -1100,6 +4020,16 @@ rep_pre_values_init(void)
 					       print_guardian, print_guardian,
 					       sweep_guardians, mark_guardian,
 					       0, 0, 0, 0, 0, 0, 0);
+    rep_set_parallel_mark (rep_guardian_type, mark_guardian);
+
+#ifdef ENABLE_PARALLEL_GC
+    {
+	int i;
+	for (i = 0; i < MAX_MARK_THREADS; i++)
+	    pthread_mutex_init (&mark_workers[i].lock, 0);
+	pthread_atfork (0, 0, mark_threads_after_fork);
+    }
+#endif
 }
 
 void
@@ -1110,23 +4040,60 @@ rep_values_init(void)
     rep_ADD_SUBR(Sgarbage_threshold);
     rep_ADD_SUBR(Sidle_garbage_threshold);
     rep_ADD_SUBR_INT(Sgarbage_collect);
+    rep_ADD_SUBR(Smajor_garbage_threshold);
+    rep_ADD_SUBR(Sgarbage_threshold_growth);
+    rep_ADD_SUBR(Smin_garbage_threshold);
+    rep_ADD_SUBR(Smax_garbage_threshold);
+    rep_ADD_SUBR(Sgc_max_pause);
+    rep_ADD_SUBR(Slarge_string_threshold);
+    rep_ADD_SUBR(Sstring_arena_compaction);
+    rep_ADD_SUBR(Sgc_mark_threads);
+    rep_ADD_SUBR(Sset_generational_gc);
+    rep_ADD_SUBR(Sgc_pause_statistics);
+    rep_ADD_SUBR(Sgc_statistics);
+    rep_ADD_SUBR(Sset_gc_huge_pages);
+    rep_ADD_SUBR(Sgc_heap_statistics);
     rep_ADD_INTERNAL_SUBR(Smake_primitive_guardian);
     rep_ADD_INTERNAL_SUBR(Sprimitive_guardian_push);
     rep_ADD_INTERNAL_SUBR(Sprimitive_guardian_pop);
     rep_INTERN_SPECIAL(after_gc_hook);
+    rep_INTERN(minor);
+    rep_INTERN(major);
+    rep_INTERN(step);
+    rep_INTERN(mark_stack);
+    rep_INTERN(parallel);
+    rep_INTERN(collections);
+    rep_INTERN(pauses);
+    rep_INTERN(types);
     rep_pop_structure (tem);
 }
 
+static void
+free_string_blocks (rep_string_block *s)
+{
+    while(s != NULL)
+    {
+	int i;
+	rep_string_block *nxt = s->next.p;
+	for (i = 0; i < rep_STRINGBLK_SIZE; i++)
+	{
+	    if (!rep_CELL_CONS_P (rep_VAL(s->data + i)))
+		free_string_data (s->data + i);
+	}
+	rep_free(s);
+	s = nxt;
+    }
+}
+
 void
 rep_values_kill(void)
 {
     rep_cons_block *cb = rep_cons_block_chain;
     rep_vector *v = vector_chain;
-    rep_string_block *s = string_block_chain;
     while(cb != NULL)
     {
-	rep_cons_block *nxt = cb->next.p;
-	rep_free(cb);
+	rep_cons_block *nxt = cb->h.next;
+	free_cons_block (cb);
 	cb = nxt;
     }
     while(v != NULL)
@@ -1135,21 +4102,15 @@ rep_values_kill(void)
 	rep_FREE_CELL(v);
 	v = nxt;
     }
-    while(s != NULL)
-    {
-	int i;
-	rep_string_block *nxt = s->next.p;
-	for (i = 0; i < rep_STRINGBLK_SIZE; i++)
-	{
-	    if (!rep_CELL_CONS_P (rep_VAL(s->data + i)))
-		rep_free (s->data[i].data);
-	}
-	rep_free(s);
-	s = nxt;
-    }
+    free_string_blocks (string_block_chain);
+    free_string_blocks (string_unswept);
     rep_cons_block_chain = NULL;
+    n_cons_blocks = 0;
+    rep_cons_freelist = NULL;
+    cons_free_blocks = cons_nursery = cons_unswept = NULL;
+    cons_uncounted = NULL;
     vector_chain = NULL;
-    string_block_chain = NULL;
+    string_block_chain = string_unswept = NULL;
 }
 
 
@@ -0,0 +1,901 @@
+/* verify.c -- checking compiled functions before running them
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
+
+/* The VM trusts the code it runs: it never checks that the stacks
+   stay within the sizes a function asked for, that jumps land on
+   instructions, or that constant and slot indexes are in range. So a
+   compiled function is verified before it first runs, by following
+   every path through its code, tracking the depths of the stack and
+   of the binding stack and which slots have been set at each
+   instruction.
+
+   Functions that verify run as before. Those with a definite fault
+   (from a corrupted .jlc file, or made by hand with
+   make-byte-code-subr) are run in the VM's checked mode instead, which
+   tests each instruction against the same table before executing it.
+   So are those that the verifier can't decide about, being too
+   complex or there being no memory to verify them: only code known to
+   be safe runs unchecked.
+
+   The depth of the lexical environment used by refn and setn depends
+   on the closure being called, so the verifier only works out how many
+   entries the environment a function is entered with needs to have.
+   The VM checks that on entry, running the function checked if the
+   environment is too short. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include "bytecodes.h"
+#include <string.h>
+#include <limits.h>
+
+/* What each opcode does: its length including any argument, how many
+   values it pops and pushes (call also pops its arguments), what it
+   does to the binding stack, and flags */
+typedef struct {
+    unsigned char length;
+    unsigned char pops;
+    unsigned char min_pushes, max_pushes;
+    unsigned char binds;
+    unsigned char flags;
+} insn_info;
+
+enum {
+    BIND_NONE = 0,
+    BIND_TOP,			/* needs a binding frame */
+    BIND_PUSH,
+    BIND_POP,
+    BIND_RESET,		/* back to the initial frame */
+    BIND_CLEAR			/* no frames at all */
+};
+
+#define INSN_VALID	(1 << 0)	/* may appear in code */
+#define INSN_CONST	(1 << 1)	/* arg indexes constants */
+#define INSN_SLOT	(1 << 2)	/* arg indexes slots */
+#define INSN_ENV	(1 << 3)	/* arg indexes environment */
+#define INSN_END	(1 << 4)	/* doesn't fall through */
+
+static insn_info insn_table[256];
+
+/* Instructions with simple effects on the stack, by class */
+
+static const unsigned char unary_insns[] = {
+    OP_REF, OP_FLUID_REF, OP_ENCLOSE, OP_CAR, OP_CDR, OP_LENGTH, OP_NEG,
+    OP_LNOT, OP_NOT, OP_SCM_TEST, OP_INC, OP_DEC, OP_ZEROP, OP_NULL,
+    OP_ATOM, OP_CONSP, OP_LISTP, OP_NUMBERP, OP_STRINGP, OP_VECTORP,
+    OP_BOUNDP, OP_SYMBOLP, OP_REVERSE, OP_NREVERSE, OP_LAST,
+    OP_COPY_SEQUENCE, OP_SEQUENCEP, OP_FUNCTIONP, OP_SPECIAL_FORM_P,
+    OP_SUBRP, OP_MACROP, OP_BYTECODEP, OP_CAAR, OP_CADR, OP_CDAR,
+    OP_CDDR, OP_CADDR, OP_CADDDR, OP_CADDDDR, OP_CADDDDDR, OP_CADDDDDDR,
+    OP_CADDDDDDDR, OP_FLOOR, OP_CEILING, OP_TRUNCATE, OP_ROUND, OP_EXP,
+    OP_LOG, OP_SIN, OP_COS, OP_TAN, OP_SQRT, OP_CLOSUREP, OP_TEST_SCM,
+    OP_TEST_SCM_F, OP_NOT_ZERO_P, OP_KEYWORD_ARG
+};
+
+static const unsigned char binary_insns[] = {
+    OP_CONS, OP_RPLACA, OP_RPLACD, OP_NTH, OP_NTHCDR, OP_AREF, OP_ADD,
+    OP_SUB, OP_MUL, OP_DIV, OP_REM, OP_LOR, OP_LAND, OP_EQUAL, OP_EQ,
+    OP_STRUCT_REF, OP_GT, OP_GE, OP_LT, OP_LE, OP_ASH, OP_THROW, OP_GET,
+    OP_SIGNAL, OP_QUOTIENT, OP_ASSOC, OP_ASSQ, OP_RASSOC, OP_RASSQ,
+    OP_MAPCAR, OP_MAPC, OP_MEMBER, OP_MEMQ, OP_DELETE, OP_DELQ,
+    OP_DELETE_IF, OP_DELETE_IF_NOT, OP_EQL, OP_LXOR, OP_MAX, OP_MIN,
+    OP_FILTER, OP_APPLY, OP_EXPT, OP_MOD, OP_MAKE_CLOSURE, OP_FLUID_SET,
+    OP_MEMQL, OP_NUM_EQ, OP__DEFINE, OP_SET
+};
+
+static const unsigned char push_insns[] = {
+    OP_NIL, OP_T, OP_PUSHI0, OP_PUSHI1, OP_PUSHI2, OP_PUSHIM1,
+    OP_PUSHIM2, OP_PUSHI, OP_PUSHIWN, OP_PUSHIWP, OP_FORBID, OP_PERMIT,
+    OP_REQUIRED_ARG, OP_OPTIONAL_ARG, OP_REST_ARG
+};
+
+static void
+set_insn (int op, int pops, int min_pushes, int max_pushes,
+	  int binds, int flags)
+{
+    insn_info *info = &insn_table[op];
+    info->pops = pops;
+    info->min_pushes = min_pushes;
+    info->max_pushes = max_pushes;
+    info->binds = binds;
+    info->flags = flags | INSN_VALID;
+}
+
+/* Instructions with an argument come in groups of eight, the last two
+   taking the argument from the following one or two bytes */
+static void
+set_arg_insn (int op, int pops, int pushes, int flags)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+	set_insn (op + i, pops, pushes, pushes, BIND_NONE, flags);
+}
+
+void
+rep_verify_init (void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++)
+    {
+	/* everything but the jumps and the immediate pushes is one
+	   byte, excluding any argument */
+	if (i < OP_LAST_WITH_ARGS + 1)
+	    insn_table[i].length = ((i & OP_ARG_MASK) == OP_ARG_1BYTE ? 2
+				    : (i & OP_ARG_MASK) == OP_ARG_2BYTE ? 3 : 1);
+	else if (i > OP_LAST_BEFORE_JMPS
+		 || i == OP_PUSHIWN || i == OP_PUSHIWP)
+	    insn_table[i].length = 3;
+	else if (i == OP_PUSHI)
+	    insn_table[i].length = 2;
+	else
+	    insn_table[i].length = 1;
+    }
+
+    set_arg_insn (OP_SLOT_REF, 0, 1, INSN_SLOT);
+    set_arg_insn (OP_CALL, 1, 1, 0);		/* plus the arguments */
+    set_arg_insn (OP_PUSH, 0, 1, INSN_CONST);
+    set_arg_insn (OP_REFG, 0, 1, INSN_CONST);
+    set_arg_insn (OP_SETG, 1, 0, INSN_CONST);
+    set_arg_insn (OP_SETN, 1, 0, INSN_ENV);
+    set_arg_insn (OP_SLOT_SET, 1, 0, INSN_SLOT);
+    set_arg_insn (OP_REFN, 0, 1, INSN_ENV);
+
+    for (i = 0; i < sizeof (unary_insns); i++)
+	set_insn (unary_insns[i], 1, 1, 1, BIND_NONE, 0);
+    for (i = 0; i < sizeof (binary_insns); i++)
+	set_insn (binary_insns[i], 2, 1, 1, BIND_NONE, 0);
+    for (i = 0; i < sizeof (push_insns); i++)
+	set_insn (push_insns[i], 0, 1, 1, BIND_NONE, 0);
+
+    set_insn (OP__SET, 2, 0, 0, BIND_NONE, 0);
+    set_insn (OP_INIT_BIND, 0, 0, 0, BIND_PUSH, 0);
+    set_insn (OP_UNBIND, 0, 0, 0, BIND_POP, 0);
+    set_insn (OP_DUP, 1, 2, 2, BIND_NONE, 0);
+    set_insn (OP_SWAP, 2, 2, 2, BIND_NONE, 0);
+    set_insn (OP_POP, 1, 0, 0, BIND_NONE, 0);
+    set_insn (OP_ASET, 3, 1, 1, BIND_NONE, 0);
+    set_insn (OP_PUT, 3, 1, 1, BIND_NONE, 0);
+    set_insn (OP_SWAP2, 3, 3, 3, BIND_NONE, 0);
+    set_insn (OP_BIND, 1, 0, 0, BIND_TOP, 0);
+    set_insn (OP_SPEC_BIND, 2, 0, 0, BIND_TOP, 0);
+    set_insn (OP_FLUID_BIND, 2, 0, 0, BIND_TOP, 0);
+    set_insn (OP_UNBINDALL, 0, 0, 0, BIND_RESET, 0);
+    set_insn (OP_UNBINDALL_0, 0, 0, 0, BIND_CLEAR, 0);
+    set_insn (OP_POP_ALL, 0, 0, 0, BIND_NONE, 0);
+    set_insn (OP_RETURN, 0, 0, 0, BIND_NONE, INSN_END);
+
+    /* Leaves the value of a matching throw and nil, or only the
+       throw value if it doesn't match */
+    set_insn (OP_CATCH, 2, 1, 2, BIND_NONE, 0);
+    /* Binds the error data if the handler matches the error */
+    set_insn (OP_ERRORPRO, 2, 1, 1, BIND_PUSH, 0);
+    /* Push the argument and t, or only nil if there isn't one */
+    set_insn (OP_OPTIONAL_ARG_, 0, 1, 2, BIND_NONE, 0);
+    set_insn (OP_KEYWORD_ARG_, 1, 1, 2, BIND_NONE, 0);
+    /* Installs the handler whose address is on the stack */
+    set_insn (OP_BINDERR, 1, 0, 0, BIND_PUSH, 0);
+
+    /* Jumps pop at most one value, jmp and ejmp never fall through */
+    set_insn (OP_JMP, 0, 0, 0, BIND_NONE, INSN_END);
+    set_insn (OP_EJMP, 1, 0, 0, BIND_NONE, INSN_END);
+    set_insn (OP_JN, 1, 0, 0, BIND_NONE, 0);
+    set_insn (OP_JT, 1, 0, 0, BIND_NONE, 0);
+    set_insn (OP_JPN, 1, 0, 1, BIND_NONE, 0);
+    set_insn (OP_JPT, 1, 0, 1, BIND_NONE, 0);
+    set_insn (OP_JNP, 1, 0, 1, BIND_NONE, 0);
+    set_insn (OP_JTP, 1, 0, 1, BIND_NONE, 0);
+
+    /* The quickened instructions (OP_ADD_FIX etc) stay invalid, they
+       only appear in the VM's private copies of verified code */
+}
+
+
+/* Decoding instructions */
+
+DEFSTRING (malformed, "Malformed byte-code");
+DEFSTRING (no_memory, "No memory to verify byte-code");
+DEFSTRING (bad_opcode, "Invalid opcode");
+DEFSTRING (bad_length, "Instruction runs off the end of the code");
+DEFSTRING (bad_target, "Jump to an invalid address");
+DEFSTRING (bad_handler, "Error handler address isn't constant");
+DEFSTRING (no_return, "Execution falls off the end of the code");
+DEFSTRING (underflow, "Stack underflow");
+DEFSTRING (overflow, "Stack overflow");
+DEFSTRING (bind_underflow, "Binding stack underflow");
+DEFSTRING (bind_overflow, "Binding stack overflow");
+DEFSTRING (bad_bind, "Binding without a frame");
+DEFSTRING (bad_frame, "Invalid frame size");
+DEFSTRING (bad_const, "Constant index out of range");
+DEFSTRING (bad_slot, "Slot index out of range");
+DEFSTRING (unset_slot, "Slot read before being set");
+DEFSTRING (bad_env, "Environment index out of range");
+DEFSTRING (unbalanced, "Stacks have different depths on different paths");
+DEFSTRING (too_complex, "Too complex to verify");
+
+/* Decode the argument of the instruction at PC, which must have one */
+static inline int
+insn_arg (unsigned char *pc)
+{
+    switch (pc[0] & OP_ARG_MASK)
+    {
+    case OP_ARG_1BYTE:
+	return pc[1];
+    case OP_ARG_2BYTE:
+	return (pc[1] << ARG_SHIFT) | pc[2];
+    default:
+	return pc[0] & OP_ARG_MASK;
+    }
+}
+
+/* The number of values the instruction at PC pops */
+static inline int
+insn_pops (unsigned char *pc)
+{
+    int pops = insn_table[pc[0]].pops;
+    if ((pc[0] & OP_OP_MASK) == OP_CALL)
+	pops += insn_arg (pc);
+    return pops;
+}
+
+
+/* The verifier */
+
+/* Each path through the code is followed separately, so that the
+   state before an instruction is one of a few exact states. This
+   matters because the compiler relies on things it knows about the
+   values on the stack: e.g. that the error an error handler is entered
+   with is never nil, so the handler's ejmp always rethrows it. */
+
+/* The most different states allowed before a single instruction.
+   Beyond that, states that only differ in what's known about the
+   values on the stack are merged, forgetting it. Code from the
+   compiler has the same stacks before an instruction on every path,
+   so more different stacks than this are taken to be a fault. */
+#define MAX_STATES 16
+
+#define TOP_UNKNOWN -1
+#define TOP_NIL -2
+
+#define WORD_BITS (sizeof (unsigned long) * CHAR_BIT)
+
+/* Which entries of the binding stack are error handlers is tracked in
+   a single word, so code binding more deeply than this isn't verified */
+#define MAX_BINDS WORD_BITS
+
+/* Nor is code binding more lexical variables in a single frame */
+#define MAX_FRAME_LEX UCHAR_MAX
+
+/* Sets of slots are arrays of SLOT_WORDS words */
+#define SLOT_SET_P(set, n) (((set)[(n) / WORD_BITS] >> ((n) % WORD_BITS)) & 1)
+#define SET_SLOT(set, n) ((set)[(n) / WORD_BITS] |= 1UL << ((n) % WORD_BITS))
+
+/* One state of the VM before an instruction: the depths of the stack
+   and the binding stack, which binding stack entries are error
+   handlers, how many lexical variables each of those frames binds and
+   their total, the value on top of the stack if it's nil or a known
+   fixnum (else -1), and the depth at which a thrown value (e.g. the
+   error that entered a handler, never nil) is known to be (else -1).
+   States that only differ in the slots that have been set on every
+   path so far are merged; those slots are kept apart from the states,
+   in the verifier's SLOTS. */
+typedef struct {
+    short depth, binds;
+    short thrown, lex;
+    long top;
+    unsigned long handlers;
+    unsigned char frame_lex[MAX_BINDS];
+    int pc;
+    int next;				/* next state at the same offset */
+    char queued;
+} insn_state;
+
+typedef struct {
+    unsigned char *code;
+    int length;
+    int v_stkreq, b_stkreq, s_stkreq, n_consts;
+    char *starts;			/* instruction starts */
+    int *first;				/* first state at each offset */
+    insn_state *states;
+    int *queue;				/* of states to follow */
+    int n_states, queue_len, size;
+    int slot_words;
+    unsigned long *slots;		/* SLOT_WORDS for each state */
+    unsigned long *in_slots, *out_slots;
+    int env_need;			/* entries needed in the environment */
+    repv error;
+} verifier;
+
+#define STATE_SLOTS(v, i) ((v)->slots + (size_t) (i) * (v)->slot_words)
+
+/* True if states A and B have the same stacks, though perhaps not
+   the same values on them */
+static inline rep_bool
+same_stacks_p (insn_state *a, insn_state *b)
+{
+    return (a->depth == b->depth && a->binds == b->binds
+	    && a->handlers == b->handlers && a->lex == b->lex
+	    && memcmp (a->frame_lex, b->frame_lex, a->binds) == 0);
+}
+
+/* Merge STATE and SLOTS into the I'th state, which has the same
+   stacks, following it again if that loses anything */
+static void
+merge_state (verifier *v, int i, insn_state *state, unsigned long *slots)
+{
+    insn_state *s = &v->states[i];
+    unsigned long *set = STATE_SLOTS (v, i);
+    rep_bool changed = rep_FALSE;
+    int w;
+
+    for (w = 0; w < v->slot_words; w++)
+    {
+	if ((set[w] & slots[w]) != set[w])
+	{
+	    set[w] &= slots[w];
+	    changed = rep_TRUE;
+	}
+    }
+    if (s->top != state->top && s->top != TOP_UNKNOWN)
+    {
+	s->top = TOP_UNKNOWN;
+	changed = rep_TRUE;
+    }
+    if (s->thrown != state->thrown && s->thrown != -1)
+    {
+	s->thrown = -1;
+	changed = rep_TRUE;
+    }
+    if (changed && !s->queued)
+    {
+	s->queued = 1;
+	v->queue[v->queue_len++] = i;
+    }
+}
+
+/* Add STATE, with the set of slots SLOTS (not one of the states'), to
+   those the instruction at PC may be entered with, queueing it to be
+   followed from there if it's a new one. ERROR is the problem if PC
+   isn't the start of an instruction. */
+static rep_bool
+flow_to (verifier *v, int pc, insn_state *state, unsigned long *slots,
+	 repv error)
+{
+    int i, count = 0;
+
+    if (pc < 0 || pc >= v->length || !v->starts[pc])
+	return (v->error = error, rep_FALSE);
+
+    for (i = v->first[pc]; i >= 0; i = v->states[i].next, count++)
+    {
+	insn_state *s = &v->states[i];
+	if (same_stacks_p (s, state)
+	    && s->thrown == state->thrown && s->top == state->top)
+	{
+	    /* perhaps fewer slots are set */
+	    merge_state (v, i, state, slots);
+	    return rep_TRUE;
+	}
+    }
+    if (count >= MAX_STATES)
+    {
+	for (i = v->first[pc]; i >= 0; i = v->states[i].next)
+	{
+	    if (same_stacks_p (&v->states[i], state))
+	    {
+		merge_state (v, i, state, slots);
+		return rep_TRUE;
+	    }
+	}
+	return (v->error = rep_VAL (&unbalanced), rep_FALSE);
+    }
+
+    if (v->n_states == v->size)
+    {
+	/* each state is queued at most once, so the queue needs no
+	   more room than the states */
+	int size = v->size * 2;
+	insn_state *states;
+	int *queue;
+	unsigned long *sets;
+
+	states = rep_realloc (v->states, sizeof (insn_state) * size);
+	if (states == 0)
+	    return (v->error = rep_VAL (&no_memory), rep_FALSE);
+	v->states = states;
+	queue = rep_realloc (v->queue, sizeof (int) * size);
+	if (queue == 0)
+	    return (v->error = rep_VAL (&no_memory), rep_FALSE);
+	v->queue = queue;
+	sets = rep_realloc (v->slots, (sizeof (unsigned long)
+				       * v->slot_words * size));
+	if (sets == 0)
+	    return (v->error = rep_VAL (&no_memory), rep_FALSE);
+	v->slots = sets;
+	v->size = size;
+    }
+
+    i = v->n_states++;
+    v->states[i] = *state;
+    v->states[i].pc = pc;
+    v->states[i].queued = 1;
+    v->states[i].next = v->first[pc];
+    v->first[pc] = i;
+    memcpy (STATE_SLOTS (v, i), slots, sizeof (unsigned long) * v->slot_words);
+    v->queue[v->queue_len++] = i;
+    return rep_TRUE;
+}
+
+/* Follow the instruction at PC when entered with state IN, whose
+   slots have been copied to the verifier's IN_SLOTS */
+static rep_bool
+verify_insn (verifier *v, int pc, insn_state in)
+{
+    unsigned char *insn = v->code + pc;
+    int op = insn[0];
+    insn_info *info = &insn_table[op];
+    int pops, arg = 0;
+    rep_bool falls_through = !(info->flags & INSN_END);
+    insn_state out, alt;
+    int target;
+
+    if (!(info->flags & INSN_VALID))
+	return (v->error = rep_VAL (&bad_opcode), rep_FALSE);
+    if (pc + info->length > v->length)
+	return (v->error = rep_VAL (&bad_length), rep_FALSE);
+
+    if (op <= OP_LAST_WITH_ARGS)
+	arg = insn_arg (insn);
+    if ((info->flags & INSN_CONST) && arg >= v->n_consts)
+	return (v->error = rep_VAL (&bad_const), rep_FALSE);
+    if ((info->flags & INSN_SLOT) && arg >= v->s_stkreq)
+	return (v->error = rep_VAL (&bad_slot), rep_FALSE);
+    if ((op & OP_OP_MASK) == OP_SLOT_REF && !SLOT_SET_P (v->in_slots, arg))
+	return (v->error = rep_VAL (&unset_slot), rep_FALSE);
+    if ((info->flags & INSN_ENV) && arg + 1 - in.lex > v->env_need)
+	v->env_need = arg + 1 - in.lex;
+
+    /* The stack */
+    pops = insn_pops (insn);
+    if (in.depth < pops)
+	return (v->error = rep_VAL (&underflow), rep_FALSE);
+    if (in.depth - pops + info->max_pushes > v->v_stkreq)
+	return (v->error = rep_VAL (&overflow), rep_FALSE);
+    out = in;
+    out.depth = in.depth - pops + info->min_pushes;
+    memcpy (v->out_slots, v->in_slots, sizeof (unsigned long) * v->slot_words);
+    if ((op & OP_OP_MASK) == OP_SLOT_SET)
+	SET_SLOT (v->out_slots, arg);
+    if (op == OP_POP_ALL)
+	out.depth = 0;
+    if (out.thrown >= in.depth - pops || op == OP_POP_ALL)
+	out.thrown = -1;
+
+    /* Remember nil and fixnums pushed, for the jumps that test them
+       and the handler addresses binderr takes */
+    switch (op)
+    {
+    case OP_NIL: out.top = TOP_NIL; break;
+    case OP_PUSHI0: out.top = 0; break;
+    case OP_PUSHI1: out.top = 1; break;
+    case OP_PUSHI2: out.top = 2; break;
+    case OP_PUSHI: out.top = insn[1] < 128 ? insn[1] : TOP_UNKNOWN; break;
+    case OP_PUSHIWP: out.top = (insn[1] << ARG_SHIFT) | insn[2]; break;
+    default: out.top = TOP_UNKNOWN;
+    }
+
+    /* The binding stack, which starts with a single frame. Bindings
+       are added to the frame on top, which mustn't be an error
+       handler, only binderr pushes those. Unbinding a frame removes
+       its lexical bindings from the environment. */
+    switch (info->binds)
+    {
+    case BIND_TOP:
+    case BIND_POP:
+	if (in.binds < 1)
+	    return (v->error = rep_VAL (&bind_underflow), rep_FALSE);
+	if (info->binds == BIND_TOP && (in.handlers >> (in.binds - 1)) & 1)
+	    return (v->error = rep_VAL (&bad_bind), rep_FALSE);
+	if (info->binds == BIND_POP)
+	{
+	    out.binds--;
+	    out.handlers &= ~(1UL << out.binds);
+	    out.lex -= in.frame_lex[out.binds];
+	}
+	else if (op == OP_BIND)
+	{
+	    if (in.frame_lex[in.binds - 1] == MAX_FRAME_LEX)
+		return (v->error = rep_VAL (&too_complex), rep_FALSE);
+	    out.frame_lex[in.binds - 1]++;
+	    out.lex++;
+	}
+	break;
+
+    case BIND_PUSH:
+	if (in.binds + 1 > v->b_stkreq + 1)
+	    return (v->error = rep_VAL (&bind_overflow), rep_FALSE);
+	if (in.binds >= MAX_BINDS)
+	    return (v->error = rep_VAL (&too_complex), rep_FALSE);
+	if (op == OP_BINDERR)
+	    out.handlers |= 1UL << in.binds;
+	out.frame_lex[in.binds] = 0;
+	out.binds++;
+	break;
+
+    case BIND_RESET:
+	/* the initial frame must still be there */
+	if (in.binds < 1)
+	    return (v->error = rep_VAL (&bind_underflow), rep_FALSE);
+	out.binds = 1;
+	out.handlers = 0;
+	out.lex = in.frame_lex[0];
+	break;
+
+    case BIND_CLEAR:
+	out.binds = 0;
+	out.handlers = 0;
+	out.lex = 0;
+	break;
+    }
+
+    switch (op)
+    {
+    case OP_BINDERR:
+	/* When the handler is entered, the error replaces its address
+	   on the stack, and the binding stack is as it was before the
+	   handler was installed */
+	if (in.top < 0)
+	    return (v->error = rep_VAL (&bad_handler), rep_FALSE);
+	alt = in;
+	alt.top = TOP_UNKNOWN;
+	alt.thrown = in.depth - 1;
+	if (!flow_to (v, in.top, &alt, v->in_slots, rep_VAL (&bad_handler)))
+	    return rep_FALSE;
+	break;
+
+    case OP_ERRORPRO:
+	/* Either the error matched, its data is bound and nil is left
+	   on the stack, or the error is left as it was */
+	alt = out;
+	alt.binds--;
+	alt.thrown = (in.thrown == in.depth - 2) ? in.thrown : -1;
+	out.top = TOP_NIL;
+	out.frame_lex[in.binds] = 1;
+	out.lex++;
+	if (!flow_to (v, pc + 1, &alt, v->out_slots, rep_VAL (&no_return)))
+	    return rep_FALSE;
+	break;
+
+    case OP_CATCH:
+	/* Either the throw matched, and its value and nil are left,
+	   or the thrown value is left as it was */
+	alt = out;
+	alt.thrown = (in.thrown == in.depth - 2) ? in.thrown : -1;
+	if (!flow_to (v, pc + 1, &alt, v->out_slots, rep_VAL (&no_return)))
+	    return rep_FALSE;
+	out.depth++;
+	out.top = TOP_NIL;
+	break;
+
+    case OP_OPTIONAL_ARG_:
+    case OP_KEYWORD_ARG_:
+	/* Push the argument and t, or only nil */
+	if (!flow_to (v, pc + 1, &out, v->out_slots, rep_VAL (&no_return)))
+	    return rep_FALSE;
+	out.depth++;
+	break;
+
+    case OP_EJMP: case OP_JMP: case OP_JN: case OP_JT:
+    case OP_JPN: case OP_JPT: case OP_JNP: case OP_JTP:
+	/* Only follow the paths that the value on top of the stack
+	   allows, if it's known to be nil or not. jnp and jtp keep
+	   their argument when they jump and pop it when they don't,
+	   jpn and jpt do the opposite. */
+	target = (insn[1] << ARG_SHIFT) | insn[2];
+	alt = out;
+	if (op == OP_JNP || op == OP_JTP)
+	    alt.depth = in.depth, alt.thrown = in.thrown, alt.top = in.top;
+	if (op == OP_JPN || op == OP_JPT)
+	    out.depth = in.depth, out.thrown = in.thrown, out.top = in.top;
+	if (op != OP_JMP)
+	{
+	    rep_bool if_nil = (op == OP_EJMP || op == OP_JN
+			       || op == OP_JNP || op == OP_JPN);
+	    rep_bool nil = (in.top == TOP_NIL);
+	    rep_bool non_nil = (in.top >= 0 || in.thrown == in.depth - 1);
+	    if (if_nil ? non_nil : nil)
+		break;			/* never jumps */
+	    if (if_nil ? nil : non_nil)
+		falls_through = rep_FALSE;
+	}
+	if (!flow_to (v, target, &alt, v->out_slots, rep_VAL (&bad_target)))
+	    return rep_FALSE;
+	break;
+    }
+
+    if (!falls_through)
+	return rep_TRUE;
+
+    return flow_to (v, pc + info->length, &out, v->out_slots,
+		    rep_VAL (&no_return));
+}
+
+/* Verify that CODE (a string) and CONSTS (a vector) make up a function
+   that can be run in a frame of the given sizes without any checks.
+   Returns one if so, storing the number of entries the environment
+   must have when it's entered in ENV_NEED, minus one if not, or zero
+   if it couldn't be decided (the code is too complex, or there's no
+   memory). Unless it returns one and if WHY is non-null, stores a
+   description of the problem found in WHY, and its offset in the code
+   in WHERE. */
+int
+rep_verify_bytecode (repv code, repv consts, int v_stkreq, int b_stkreq,
+		     int s_stkreq, int *env_need, repv *why, int *where)
+{
+    verifier v;
+    insn_state initial;
+    rep_bool ok = rep_FALSE;
+    int i, pc = 0;
+
+    if (!rep_STRINGP (code) || !rep_VECTORP (consts)
+	|| rep_STRING_LEN (code) == 0)
+    {
+	if (why != 0)
+	    *why = rep_VAL (&malformed), *where = 0;
+	return -1;
+    }
+    if (s_stkreq < 0 || s_stkreq > BYTECODE_MAX_SLOTS)
+    {
+	if (why != 0)
+	    *why = rep_VAL (&bad_frame), *where = 0;
+	return -1;
+    }
+
+    v.code = (unsigned char *) rep_STR (code);
+    v.length = rep_STRING_LEN (code);
+    v.v_stkreq = v_stkreq;
+    v.b_stkreq = b_stkreq;
+    v.s_stkreq = s_stkreq;
+    v.n_consts = rep_VECT_LEN (consts);
+    v.n_states = v.queue_len = 0;
+    v.size = v.length;
+    v.slot_words = s_stkreq / WORD_BITS + 1;
+    v.env_need = 0;
+    v.error = rep_VAL (&no_memory);
+    v.starts = rep_alloc (v.length);
+    v.first = rep_alloc (sizeof (int) * v.length);
+    v.states = rep_alloc (sizeof (insn_state) * v.size);
+    v.queue = rep_alloc (sizeof (int) * v.size);
+    v.slots = rep_alloc (sizeof (unsigned long) * v.slot_words * v.size);
+    v.in_slots = rep_alloc (sizeof (unsigned long) * v.slot_words * 2);
+    v.out_slots = v.in_slots + v.slot_words;
+    if (v.starts == 0 || v.first == 0 || v.states == 0 || v.queue == 0
+	|| v.slots == 0 || v.in_slots == 0)
+	goto out;
+
+    /* Where each instruction starts, reading from the beginning */
+    memset (v.starts, 0, v.length);
+    for (i = 0; i < v.length; i += insn_table[v.code[i]].length)
+	v.starts[i] = 1;
+    for (i = 0; i < v.length; i++)
+	v.first[i] = -1;
+
+    initial.depth = 0;
+    initial.binds = 1;
+    initial.handlers = 0;
+    initial.thrown = -1;
+    initial.lex = 0;
+    memset (initial.frame_lex, 0, sizeof (initial.frame_lex));
+    initial.top = TOP_UNKNOWN;
+    memset (v.in_slots, 0, sizeof (unsigned long) * v.slot_words);
+    ok = flow_to (&v, 0, &initial, v.in_slots, rep_VAL (&no_return));
+
+    while (ok && v.queue_len > 0)
+    {
+	i = v.queue[--v.queue_len];
+	v.states[i].queued = 0;
+	pc = v.states[i].pc;
+	memcpy (v.in_slots, STATE_SLOTS (&v, i),
+		sizeof (unsigned long) * v.slot_words);
+	ok = verify_insn (&v, pc, v.states[i]);
+    }
+
+out:
+    if (!ok && why != 0)
+	*why = v.error, *where = pc;
+    if (v.starts != 0)
+	rep_free (v.starts);
+    if (v.first != 0)
+	rep_free (v.first);
+    if (v.states != 0)
+	rep_free (v.states);
+    if (v.queue != 0)
+	rep_free (v.queue);
+    if (v.slots != 0)
+	rep_free (v.slots);
+    if (v.in_slots != 0)
+	rep_free (v.in_slots);
+    if (ok)
+	return (*env_need = v.env_need, 1);
+    else if (v.error == rep_VAL (&too_complex)
+	     || v.error == rep_VAL (&no_memory))
+	return 0;
+    else
+	return -1;
+}
+
+/* True if the current lexical environment has at least N entries */
+static inline rep_bool
+env_has_entries (int n)
+{
+    repv ptr = rep_env;
+    while (n-- > 0 && rep_CONSP (ptr))
+	ptr = rep_CDR (ptr);
+    return n < 0;
+}
+
+/* Verify the compiled function FUN unless that's already been done,
+   returning false if it has a fault or couldn't be verified, or needs
+   a deeper environment than the current one, so must be run with
+   checks */
+rep_bool
+rep_verify_compiled (repv fun)
+{
+    rep_inline_caches *caches = rep_COMPILED_CACHES (fun);
+    if (caches->verified == 0)
+    {
+	repv stkreq = rep_COMPILED_STACK (fun);
+	int env_need = 0;
+	int ok = (!rep_INTP (stkreq) ? -1
+		  : rep_verify_bytecode (rep_COMPILED_CODE (fun),
+					 rep_COMPILED_CONSTANTS (fun),
+					 rep_INT (stkreq) & 0x3ff,
+					 (rep_INT (stkreq) >> 10) & 0x3ff,
+					 rep_INT (stkreq) >> 20,
+					 &env_need, 0, 0));
+	caches->verified = (ok > 0) ? 1 + env_need : -1;
+    }
+    return (caches->verified > 0
+	    && env_has_entries (caches->verified - 1));
+}
+
+/* The results for code run by run-byte-code, which has no compiled
+   function to keep them in. Cleared before each GC, after which the
+   code may have been freed and its address reused. */
+#define TOP_LEVEL_CACHE_SIZE 16
+
+static struct {
+    repv code, consts;
+    int v_stkreq, b_stkreq, s_stkreq;
+    int verified;
+} top_level_cache[TOP_LEVEL_CACHE_SIZE];
+
+/* Like rep_verify_compiled, for code that isn't part of a compiled
+   function */
+rep_bool
+rep_verify_top_level (repv code, repv consts, int v_stkreq, int b_stkreq,
+		      int s_stkreq)
+{
+    int i = (code / rep_CELL_ALIGNMENT) % TOP_LEVEL_CACHE_SIZE;
+    if (top_level_cache[i].code != code
+	|| top_level_cache[i].consts != consts
+	|| top_level_cache[i].v_stkreq != v_stkreq
+	|| top_level_cache[i].b_stkreq != b_stkreq
+	|| top_level_cache[i].s_stkreq != s_stkreq)
+    {
+	int env_need = 0;
+	int ok = rep_verify_bytecode (code, consts, v_stkreq, b_stkreq,
+				      s_stkreq, &env_need, 0, 0);
+	top_level_cache[i].code = code;
+	top_level_cache[i].consts = consts;
+	top_level_cache[i].v_stkreq = v_stkreq;
+	top_level_cache[i].b_stkreq = b_stkreq;
+	top_level_cache[i].s_stkreq = s_stkreq;
+	top_level_cache[i].verified = (ok > 0) ? 1 + env_need : -1;
+    }
+    return (top_level_cache[i].verified > 0
+	    && env_has_entries (top_level_cache[i].verified - 1));
+}
+
+void
+rep_verify_before_gc (void)
+{
+    memset (top_level_cache, 0, sizeof (top_level_cache));
+}
+
+
+/* Checking single instructions, for the VM's checked mode */
+
+/* Returns rep_NULL if the instruction at offset PC of CODE can be
+   run in the VM state described by the other arguments, otherwise a
+   string describing why not. SLOTS are the function's slots, unset
+   ones are zero. TOP is the value on top of the stack and BIND_TOP
+   the entry on top of the binding stack, when they aren't empty.
+
+   Jumps, and binderr, are only allowed to addresses inside the code,
+   so that the VM never fetches an instruction from outside it before
+   checking it. */
+repv
+rep_check_insn (repv code, repv consts, unsigned int pc,
+		int stk_use, int bind_use, repv top, repv bind_top,
+		repv *slots, int v_stkreq, int b_stkreq, int s_stkreq)
+{
+    unsigned char *insn = (unsigned char *) rep_STR (code) + pc;
+    insn_info *info;
+    int pops, arg = 0;
+
+    if (pc >= rep_STRING_LEN (code))
+	return rep_VAL (&no_return);
+    info = &insn_table[insn[0]];
+    if (!(info->flags & INSN_VALID))
+	return rep_VAL (&bad_opcode);
+    if (pc + info->length > rep_STRING_LEN (code))
+	return rep_VAL (&bad_length);
+
+    if (insn[0] <= OP_LAST_WITH_ARGS)
+    {
+	arg = insn_arg (insn);
+	if ((info->flags & INSN_CONST) && arg >= rep_VECT_LEN (consts))
+	    return rep_VAL (&bad_const);
+	if (info->flags & INSN_SLOT)
+	{
+	    if (arg >= s_stkreq)
+		return rep_VAL (&bad_slot);
+	    if ((insn[0] & OP_OP_MASK) == OP_SLOT_REF && slots[arg] == 0)
+		return rep_VAL (&unset_slot);
+	}
+	if ((info->flags & INSN_ENV) && rep_list_length (rep_env) <= arg)
+	    return rep_VAL (&bad_env);
+    }
+
+    pops = insn_pops (insn);
+    if (stk_use < pops)
+	return rep_VAL (&underflow);
+    if (stk_use - pops + info->max_pushes > v_stkreq)
+	return rep_VAL (&overflow);
+
+    if (insn[0] > OP_LAST_BEFORE_JMPS
+	&& ((insn[1] << ARG_SHIFT) | insn[2]) >= rep_STRING_LEN (code))
+	return rep_VAL (&bad_target);
+    if (insn[0] == OP_BINDERR
+	&& !(rep_INTP (top) && rep_INT (top) >= 0
+	     && rep_INT (top) < rep_STRING_LEN (code)))
+	return rep_VAL (&bad_handler);
+
+    switch (info->binds)
+    {
+    case BIND_TOP:
+    case BIND_POP:
+    case BIND_RESET:
+	if (bind_use < 1)
+	    return rep_VAL (&bind_underflow);
+	if (info->binds == BIND_TOP && !rep_INTP (bind_top))
+	    return rep_VAL (&bad_bind);
+	break;
+
+    case BIND_PUSH:
+	if (bind_use + 1 > b_stkreq + 1)
+	    return rep_VAL (&bind_overflow);
+	break;
+    }
+
+    return rep_NULL;
+}
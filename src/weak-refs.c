@@ -83,6 +83,23 @@ rep_scan_weak_refs (void)
     }
 }
 
+/* Called after a minor collection. Only cons cells allocated since the
+   previous collection can have been freed, and weak refs not reached by
+   the collector are still live (so leave the list alone) */
+void
+rep_scan_weak_refs_minor (void)
+{
+    repv ref;
+    for (ref = weak_refs; ref != rep_NULL; ref = WEAK_NEXT (ref))
+    {
+	if (rep_CONSP (WEAK_REF (ref))
+	    && !rep_GC_CONS_MARKEDP (WEAK_REF (ref)))
+	{
+	    WEAK_REF (ref) = Qnil;
+	}
+    }
+}
+
 static void
 weak_ref_print (repv stream, repv arg)
 {